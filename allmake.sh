@@ -6,6 +6,11 @@ BOOST_INC_PATH=/usr/local/include
 export BOOST_INC_PATH
 `rm -f client_with_asio/client_with_asio 2>/dev/null ;\
     rm -f server/server 2>/dev/null ;\
+    rm -f packet_capture_decoder/packet_capture_decoder 2>/dev/null ;\
+    rm -f kcp_trace_to_chrome/kcp_trace_to_chrome 2>/dev/null ;\
+    rm -f udp_impair_proxy/udp_impair_proxy 2>/dev/null ;\
+    rm -f conn_bench/conn_bench 2>/dev/null ;\
+    rm -f echo_bench/echo_bench 2>/dev/null ;\
     rm -f server_lib/asio_kcp_server.a 2>/dev/null;\
     rm -f asio_kcp_utest/asio_kcp_utest 2>/dev/null;\
     rm -f asio_kcp_client_utest/asio_kcp_client_utest 2>/dev/null;\
@@ -19,8 +24,18 @@ echo "" && echo "" && echo "[-------------------------------]" && echo "   serve
     cd ../server_lib/ && make && \
 echo "" && echo "" && echo "[-------------------------------]" && echo "   server" && echo "[-------------------------------]" && \
     cd ../server/ && make && \
+echo "" && echo "" && echo "[-------------------------------]" && echo "   packet_capture_decoder" && echo "[-------------------------------]" && \
+    cd ../packet_capture_decoder/ && make && \
+echo "" && echo "" && echo "[-------------------------------]" && echo "   kcp_trace_to_chrome" && echo "[-------------------------------]" && \
+    cd ../kcp_trace_to_chrome/ && make && \
+echo "" && echo "" && echo "[-------------------------------]" && echo "   udp_impair_proxy" && echo "[-------------------------------]" && \
+    cd ../udp_impair_proxy/ && make && \
+echo "" && echo "" && echo "[-------------------------------]" && echo "   conn_bench" && echo "[-------------------------------]" && \
+    cd ../conn_bench/ && make && \
 echo "" && echo "" && echo "[-------------------------------]" && echo "   client_with_asio" && echo "[-------------------------------]" && \
     cd ../client_with_asio/ && make && \
+echo "" && echo "" && echo "[-------------------------------]" && echo "   echo_bench" && echo "[-------------------------------]" && \
+    cd ../echo_bench/ && make && \
 echo "" && echo "" && echo "[-------------------------------]" && echo "   asio_kcp_utest" && echo "[-------------------------------]" && \
     cd ../asio_kcp_utest/ && make && \
 echo "" && echo "" && echo "[-------------------------------]" && echo "   kcp_client_utest" && echo "[-------------------------------]" && \
@@ -0,0 +1,62 @@
+#include "gtest_util.hpp"
+#include <vector>
+
+#include "../client_lib/kcp_client_trace.h"
+
+using namespace asio_kcp;
+
+class TraceSinkCounter
+{
+public:
+    TraceSinkCounter() : count_(0), last_event_(eCountOfTraceEvent) {}
+    static void sink(const trace_record& rec, void* var)
+    {
+        TraceSinkCounter* p = (TraceSinkCounter*)var;
+        p->count_++;
+        p->last_event_ = (eTraceEvent)rec.event;
+    }
+
+    size_t count_;
+    eTraceEvent last_event_;
+};
+
+TEST(ClientTraceTest, RuntimeLevel) {
+    const int old_level = get_trace_level();
+    TraceSinkCounter counter;
+    set_trace_sink(&TraceSinkCounter::sink, &counter);
+
+    set_trace_level(AK_TRACE_LEVEL_ERROR);
+    AK_CLIENT_TRACE_WARNING(eTraceSendUdpPartial, 1001, 10, 20);
+    EXPECT_EQ(counter.count_, 0u);
+    AK_CLIENT_TRACE_ERROR(eTraceSendUdpError, 1001, 11, 20);
+    EXPECT_EQ(counter.count_, 1u);
+    EXPECT_EQ(counter.last_event_, eTraceSendUdpError);
+
+    set_trace_sink(NULL, NULL);
+    set_trace_level(old_level);
+}
+
+TEST(ClientTraceTest, Snapshot) {
+    const int old_level = get_trace_level();
+    set_trace_level(AK_TRACE_LEVEL_INFO);
+    for (int i = 0; i < 10; ++i)
+        AK_CLIENT_TRACE_INFO(eTraceRecvKcpMsg, 1002, i, 0);
+
+    std::vector<trace_record> records(5);
+    size_t n = trace_snapshot(&records[0], records.size());
+    EXPECT_EQ(n, 5u);
+    EXPECT_EQ(records[4].arg0, 9);
+    EXPECT_EQ(records[0].arg0, 5);
+    EXPECT_EQ(records[0].conv, 1002u);
+    EXPECT_LT(records[0].seq, records[4].seq);
+
+    // ring keeps only the newest ASIO_KCP_TRACE_RING_SIZE records.
+    for (int i = 0; i < ASIO_KCP_TRACE_RING_SIZE + 10; ++i)
+        AK_CLIENT_TRACE_INFO(eTraceRecvKcpMsg, 1002, i, 0);
+    records.resize(ASIO_KCP_TRACE_RING_SIZE * 2);
+    n = trace_snapshot(&records[0], records.size());
+    EXPECT_EQ(n, size_t(ASIO_KCP_TRACE_RING_SIZE));
+    EXPECT_EQ(records[n - 1].arg0, ASIO_KCP_TRACE_RING_SIZE + 9);
+
+    set_trace_level(old_level);
+}
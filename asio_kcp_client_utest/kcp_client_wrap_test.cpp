@@ -1,8 +1,10 @@
 #include "gtest_util.hpp"
 #include <functional>
+#include <poll.h>
 
 #include "../util/ikcp.h"
 #include "../client_lib/kcp_client_util.h"
+#include "../util/msg_buffer.hpp"
 
 #define private public
 #define protected public
@@ -147,3 +149,201 @@ TEST(ClientKcpNetTest, ConnectAsyncWithoutCallback_Succeed) {
     }
 }
 
+
+
+// kcp_client测试竞速连接 - 第一个服务器无应答
+TEST(ClientKcpNetTest, RaceServer) {
+    asio_kcp::kcp_client_wrap net;
+    EXPECT_EQ(net.add_race_server("127.0.0.1.1", 32323), KCP_ERR_ADDRESS_INVALID);
+    EXPECT_EQ(net.add_race_server("127.0.0.1", 32323), 0);
+    int ret = net.connect(0, "127.0.0.1", 11113);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(net.kcp_client_.servaddr_.sin_port, htons(32323));
+}
+
+static void update_kcp_client_for(asio_kcp::kcp_client& c, uint64_t milliseconds)
+{
+    uint64_t end_clock = iclock64() + milliseconds;
+    while (iclock64() < end_clock)
+    {
+        c.update();
+        millisecond_sleep(KCP_UPDATE_INTERVAL);
+    }
+}
+
+// kcp_client测试0-RTT恢复连接 - 保持conv, 恢复前发送的消息可以收到回显
+TEST(ClientKcpNetTest, Resume) {
+    asio_kcp::kcp_client c;
+    Client client;
+    c.set_event_callback(Client::client_event_callback, (void*)(&client));
+    EXPECT_EQ(c.resume_async(), KCP_ERR_CAN_NOT_RESUME);
+
+    int ret = c.connect_async(0, "127.0.0.1", 32323);
+    EXPECT_EQ(ret, 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_EQ(client.last_event_type_, eConnect);
+    EXPECT_NE(c.get_resume_token(), 0u);
+    const kcp_conv_t conv = c.p_kcp_->conv;
+
+    c.send_msg(std::string("1234567890"));
+    EXPECT_EQ(c.resume_async(), 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_FALSE(c.in_resume_stage_);
+    EXPECT_EQ(client.last_conv_, conv);
+    EXPECT_EQ(client.last_event_type_, eRcvMsg);
+    EXPECT_EQ(client.last_msg_, std::string("1234567890"));
+}
+
+// the udp socket, recording the biggest packet sent.
+class max_size_transport : public udp_socket_transport
+{
+public:
+    max_size_transport() : max_sent_(0) {}
+    virtual ssize_t send(const char* buf, size_t len)
+    {
+        max_sent_ = std::max(max_sent_, len);
+        return udp_socket_transport::send(buf, len);
+    }
+
+    size_t max_sent_;
+};
+
+// kcp_client测试恢复连接时不超过mtu - 恢复包单独发送, 不加在满mtu的kcp包前面
+TEST(ClientKcpNetTest, ResumeWithinMtu) {
+    asio_kcp::kcp_client c;
+    max_size_transport transport;
+    Client client;
+    c.set_transport(&transport);
+    c.set_event_callback(Client::client_event_callback, (void*)(&client));
+
+    int ret = c.connect_async(0, "127.0.0.1", 32323);
+    EXPECT_EQ(ret, 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_EQ(client.last_event_type_, eConnect);
+
+    const std::string msg(3000, 'a'); // full mtu kcp packets
+    transport.max_sent_ = 0;
+    c.send_msg(msg);
+    EXPECT_EQ(c.resume_async(), 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_FALSE(c.in_resume_stage_);
+    EXPECT_EQ(client.last_event_type_, eRcvMsg);
+    EXPECT_EQ(client.last_msg_, msg);
+    EXPECT_EQ(transport.max_sent_, (size_t)c.p_kcp_->mtu);
+}
+
+class MsgClient
+{
+public:
+    MsgClient() : msg_count_(0) {}
+    static void client_msg_callback(kcp_conv_t conv, const char* msg, size_t len, void* var)
+    {
+        MsgClient* p = (MsgClient*)var;
+        p->msg_count_++;
+        p->last_msg_ = make_msg_buffer(msg, len);
+    }
+
+    size_t msg_count_;
+    msg_buffer_ref last_msg_;
+};
+
+// kcp_client测试零拷贝收消息 - 消息大于MAX_MSG_SIZE也可以收到
+TEST(ClientKcpNetTest, SendRecvZeroCopy) {
+    asio_kcp::kcp_client c;
+    Client client;
+    MsgClient msg_client;
+    c.set_event_callback(Client::client_event_callback, (void*)(&client));
+    c.set_msg_callback(MsgClient::client_msg_callback, (void*)(&msg_client));
+
+    int ret = c.connect_async(0, "127.0.0.1", 32323);
+    EXPECT_EQ(ret, 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_EQ(client.last_event_type_, eConnect);
+
+    const std::string big_msg(MAX_MSG_SIZE + 5000, 'x');
+    c.send_msg(std::string("1234567890"));
+    c.send_msg(big_msg);
+    update_kcp_client_for(c, 500);
+    EXPECT_EQ(client.last_event_type_, eConnect); // eRcvMsg is not given to event callback.
+    EXPECT_EQ(msg_client.msg_count_, 2u);
+    EXPECT_EQ(std::string(msg_client.last_msg_.data(), msg_client.last_msg_.size()), big_msg);
+}
+
+// kcp_client测试微秒时钟 - 服务器仍然使用毫秒时钟
+TEST(ClientKcpNetTest, MicrosecondKcpClock) {
+    const uint64_t clock_ms = iclock64();
+    const uint64_t clock_us = iclock64_us();
+    EXPECT_LE(clock_us / 1000 - clock_ms, 1u);
+
+    asio_kcp::kcp_client c;
+    Client client;
+    c.set_event_callback(Client::client_event_callback, (void*)(&client));
+    c.set_kcp_clock_in_microsecond(true);
+    int ret = c.connect_async(0, "127.0.0.1", 32323);
+    EXPECT_EQ(ret, 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_EQ(client.last_event_type_, eConnect);
+    EXPECT_EQ(c.p_kcp_->clock_unit, 1000u);
+    EXPECT_EQ(c.p_kcp_->rx_minrto, 30 * 1000);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        c.send_msg(std::string("1234567890"));
+        update_kcp_client_for(c, 50);
+    }
+    EXPECT_EQ(client.last_event_type_, eRcvMsg);
+    EXPECT_EQ(client.last_msg_, std::string("1234567890"));
+    EXPECT_GT(c.p_kcp_->rx_srtt, 0);
+    EXPECT_LT(c.p_kcp_->rx_srtt, 100 * 1000);
+}
+
+static void count_udp_output(const char* buf, size_t len, void* var)
+{
+    (*(size_t*)var)++;
+}
+
+static void* send_msg_in_other_thread(void* c)
+{
+    ((asio_kcp::kcp_client*)c)->send_msg(std::string("abcdefg"));
+    return NULL;
+}
+
+// kcp_client测试send-through模式 - 网络线程中send_msg立即发出, 其他线程send_msg唤醒notify fd
+TEST(ClientKcpNetTest, SendThrough) {
+    asio_kcp::kcp_client c;
+    Client client;
+    size_t udp_output_count = 0;
+    c.set_event_callback(Client::client_event_callback, (void*)(&client));
+    c.set_udp_output_hook(count_udp_output, (void*)(&udp_output_count));
+    EXPECT_EQ(c.get_send_notify_fd(), -1);
+    EXPECT_EQ(c.enable_send_through(), 0);
+    EXPECT_NE(c.get_send_notify_fd(), -1);
+
+    int ret = c.connect_async(0, "127.0.0.1", 32323);
+    EXPECT_EQ(ret, 0);
+    update_kcp_client_for(c, 200);
+    EXPECT_EQ(client.last_event_type_, eConnect);
+
+    // in the thread calling update().
+    const size_t output_count_before = udp_output_count;
+    c.send_msg(std::string("1234567890"));
+    EXPECT_EQ(udp_output_count, output_count_before + 1);
+    update_kcp_client_for(c, 100);
+    EXPECT_EQ(client.last_msg_, std::string("1234567890"));
+
+    // in other thread.
+    pthread_t thread;
+    pthread_create(&thread, NULL, send_msg_in_other_thread, (void*)(&c));
+    pthread_join(thread, NULL);
+    struct pollfd notify_pollfd;
+    notify_pollfd.fd = c.get_send_notify_fd();
+    notify_pollfd.events = POLLIN;
+    notify_pollfd.revents = 0;
+    EXPECT_EQ(poll(&notify_pollfd, 1, 0), 1);
+    const size_t output_count_before_flush = udp_output_count;
+    c.flush_send_msg();
+    EXPECT_EQ(udp_output_count, output_count_before_flush + 1);
+    EXPECT_EQ(poll(&notify_pollfd, 1, 0), 0);
+    update_kcp_client_for(c, 100);
+    EXPECT_EQ(client.last_msg_, std::string("abcdefg"));
+}
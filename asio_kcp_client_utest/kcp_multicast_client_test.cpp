@@ -0,0 +1,422 @@
+#include "gtest_util.hpp"
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <functional>
+
+#define private public
+#include "../client_lib/kcp_multicast_client.hpp"
+#undef private
+#include "../util/multicast_packet.hpp"
+
+using namespace asio_kcp;
+
+// 不走socket, 直接把组播包喂给kcp_multicast_client
+class MulticastFeeder
+{
+public:
+    MulticastFeeder(eMulticastDeliveryMode mode = eMcDeliverInOrder)
+    {
+        memset(&addr_, 0, sizeof(addr_));
+        client_.groups_[1] = kcp_multicast_client::GroupInfo();
+        client_.set_delivery_mode(1, mode);
+    }
+
+    void feed(const std::string& packet)
+    {
+        std::vector<std::string> msgs;
+        client_.handle_packet(client_.groups_[1], packet.c_str(), packet.size(), addr_, &msgs);
+        for (size_t i = 0; i < msgs.size(); ++i)
+            recved_ += msgs[i] + ",";
+    }
+
+    void reliable(uint32_t seq)
+    {
+        const std::string msg = std::to_string(seq);
+        feed(making_mc_reliable_packet(seq, msg.c_str(), msg.size()));
+    }
+
+    // kcp收到的补齐回复
+    void catch_up(const std::string& packet)
+    {
+        std::vector<std::string> msgs;
+        client_.handle_catch_up(client_.groups_[1], packet.c_str(), packet.size(), &msgs);
+        for (size_t i = 0; i < msgs.size(); ++i)
+            recved_ += msgs[i] + ",";
+    }
+
+    void catch_up_msg(uint32_t seq)
+    {
+        const std::string msg = std::to_string(seq);
+        catch_up(making_mc_catch_up_packet(1, seq, msg.c_str(), msg.size()));
+    }
+
+    // [first_seq, first_seq + count) 的校验包
+    void fec(uint32_t first_seq, uint8_t count)
+    {
+        mc_fec_block block;
+        block.first_seq = first_seq;
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            const std::string msg = std::to_string(first_seq + i);
+            block.add(msg.c_str(), msg.size());
+        }
+        feed(making_mc_fec_packet(block));
+    }
+
+    multicast_group_stats stats(void)
+    {
+        multicast_group_stats s;
+        client_.get_group_stats(1, &s);
+        return s;
+    }
+
+    kcp_multicast_client client_;
+    struct sockaddr_in addr_;
+    std::string recved_;
+};
+
+TEST(MulticastClientTest, InOrderReorderAndDedupe) {
+    MulticastFeeder feeder;
+    feeder.reliable(0);
+    feeder.reliable(2);
+    EXPECT_EQ(feeder.recved_, "0,");
+    EXPECT_EQ(feeder.stats().missing_count, 1u);
+    EXPECT_EQ(feeder.stats().buffered_count, 1u);
+
+    feeder.reliable(2);
+    feeder.reliable(1);
+    feeder.reliable(1);
+    feeder.reliable(3);
+    EXPECT_EQ(feeder.recved_, "0,1,2,3,");
+    EXPECT_EQ(feeder.stats().duplicate_count, 2u);
+    EXPECT_EQ(feeder.stats().missing_count, 0u);
+    EXPECT_EQ(feeder.stats().buffered_count, 0u);
+    EXPECT_EQ(feeder.stats().next_deliver_seq, 4u);
+}
+
+TEST(MulticastClientTest, HeartbeatAndTooOld) {
+    MulticastFeeder feeder;
+    feeder.reliable(10);
+    feeder.reliable(13);
+    feeder.feed(making_mc_heartbeat_packet(15));
+    EXPECT_EQ(feeder.stats().missing_count, 3u); // 11 12 14
+
+    // 发送者已经不能重传12之前的消息
+    feeder.feed(making_mc_too_old_packet(12));
+    EXPECT_EQ(feeder.stats().lost_count, 1u);
+    EXPECT_EQ(feeder.recved_, "10,");
+
+    feeder.reliable(12);
+    feeder.reliable(14);
+    EXPECT_EQ(feeder.recved_, "10,12,13,14,");
+    EXPECT_EQ(feeder.stats().missing_count, 0u);
+}
+
+TEST(MulticastClientTest, ReorderWindowOverflow) {
+    MulticastFeeder feeder;
+    feeder.reliable(0);
+    feeder.reliable(ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW + 5);
+    EXPECT_EQ(feeder.stats().lost_count, 5u);
+    EXPECT_EQ(feeder.stats().next_deliver_seq, 6u);
+    EXPECT_EQ(feeder.stats().missing_count, ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW - 1u);
+}
+
+TEST(MulticastClientTest, LatestOnly) {
+    MulticastFeeder feeder(eMcDeliverLatestOnly);
+    feeder.reliable(0);
+    feeder.reliable(2);
+    feeder.reliable(1);
+    feeder.reliable(2);
+    EXPECT_EQ(feeder.recved_, "0,2,");
+    EXPECT_EQ(feeder.stats().lost_count, 1u);
+    EXPECT_EQ(feeder.stats().duplicate_count, 2u);
+    EXPECT_EQ(feeder.stats().missing_count, 0u); // 不NACK
+}
+
+TEST(MulticastClientTest, Feedback) {
+    MulticastFeeder feeder;
+
+    // 用本地socket接收反馈
+    int sender_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sender_addr;
+    memset(&sender_addr, 0, sizeof(sender_addr));
+    sender_addr.sin_family = AF_INET;
+    sender_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(sender_fd, (struct sockaddr*)&sender_addr, sizeof(sender_addr)), 0);
+    socklen_t addr_len = sizeof(sender_addr);
+    getsockname(sender_fd, (struct sockaddr*)&sender_addr, &addr_len);
+    feeder.addr_ = sender_addr;
+    feeder.client_.groups_[1].socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    feeder.reliable(5);
+    feeder.reliable(7);
+    feeder.reliable(9);
+    feeder.client_.send_feedback(1);
+
+    char buf[1500];
+    const ssize_t len = recv(sender_fd, buf, sizeof(buf), 0);
+    uint32_t ack_seq = 0;
+    std::vector<uint8_t> bitmap;
+    ASSERT_TRUE(grab_feedback_from_mc_packet(buf, len, &ack_seq, &bitmap));
+    EXPECT_EQ(ack_seq, 6u);
+    ASSERT_EQ(bitmap.size(), 1u);
+    EXPECT_EQ(bitmap[0], 0x05); // 7 9
+    EXPECT_FALSE(feeder.client_.groups_[1].feedback_dirty);
+
+    close(feeder.client_.groups_[1].socket_fd);
+    close(sender_fd);
+}
+
+TEST(MulticastClientTest, FecRecovery) {
+    MulticastFeeder feeder;
+    // 收到第一个校验包之后才保留已交付的消息
+    feeder.reliable(7);
+    feeder.fec(7, 1);
+    feeder.reliable(8);
+    feeder.reliable(9);
+    feeder.reliable(11);
+    feeder.fec(8, 4);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,11,");
+    EXPECT_EQ(feeder.stats().fec_recovered_count, 1u);
+    EXPECT_EQ(feeder.stats().missing_count, 0u);
+
+    // 末尾丢失, 校验包先于心跳到达
+    feeder.reliable(12);
+    feeder.reliable(13);
+    feeder.fec(12, 3);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,11,12,13,14,");
+
+    // 丢了两个, 只能等重传
+    feeder.reliable(15);
+    feeder.reliable(18);
+    feeder.fec(15, 4);
+    EXPECT_EQ(feeder.stats().fec_recovered_count, 2u);
+    EXPECT_EQ(feeder.stats().missing_count, 2u);
+    feeder.reliable(16);
+    feeder.fec(15, 4);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,11,12,13,14,15,16,17,18,");
+    EXPECT_EQ(feeder.stats().fec_recovered_count, 3u);
+
+    // 已经交付的块
+    feeder.fec(8, 4);
+    EXPECT_EQ(feeder.stats().duplicate_count, 0u);
+    EXPECT_EQ(feeder.stats().delivered_count, 12u);
+}
+
+TEST(MulticastClientTest, Batch) {
+    MulticastFeeder feeder;
+    std::string batch = making_mc_batch_packet();
+    char head[ASIO_KCP_MC_RELIABLE_HEADER_SIZE];
+    for (uint32_t seq = 0; seq < 3; ++seq)
+    {
+        const std::string msg = std::to_string(seq);
+        const size_t head_len = making_mc_reliable_header(seq, head);
+        append_frame_to_mc_batch_packet(&batch, head, head_len, msg.c_str(), msg.size());
+    }
+    const size_t head_len = making_mc_raw_header(head);
+    append_frame_to_mc_batch_packet(&batch, head, head_len, "raw", 3);
+
+    // 嵌套的batch被忽略
+    const std::string inner = making_mc_batch_packet();
+    append_frame_to_mc_batch_packet(&batch, inner.c_str(), inner.size(), "", 0);
+
+    feeder.feed(batch);
+    EXPECT_EQ(feeder.recved_, "0,1,2,raw,");
+    EXPECT_EQ(feeder.stats().next_deliver_seq, 3u);
+}
+
+TEST(MulticastClientTest, FeedbackLoss) {
+    MulticastFeeder feeder;
+    feeder.client_.groups_[1].socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    feeder.addr_.sin_family = AF_INET;
+    feeder.addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    feeder.addr_.sin_port = htons(9); // discard
+
+    // 每10个丢1个, 即使被FEC恢复也算丢包
+    feeder.fec(0, 1);
+    for (uint32_t block = 0; block < 50; ++block)
+    {
+        for (uint32_t seq = block * 10; seq < block * 10 + 9; ++seq)
+            feeder.reliable(seq);
+        feeder.fec(block * 10, 10);
+        feeder.client_.send_feedback(1);
+    }
+    EXPECT_EQ(feeder.stats().fec_recovered_count, 50u);
+    EXPECT_GE(feeder.stats().loss_permille, 90);
+    EXPECT_LE(feeder.stats().loss_permille, 100);
+    close(feeder.client_.groups_[1].socket_fd);
+}
+
+class MulticastCounter
+{
+public:
+    MulticastCounter() : count_(0) {}
+    void on_msg(uint32_t group_id, const std::string& msg) {count_++;}
+    std::atomic<size_t> count_;
+};
+
+// 在本机组播上测试epoll和recvmmsg的接收循环
+TEST(MulticastClientTest, CatchUp) {
+    MulticastFeeder feeder;
+    std::string request;
+    ASSERT_EQ(feeder.client_.begin_catch_up(1, &request), 0);
+    EXPECT_EQ(get_mc_packet_type(request.c_str(), request.size()), eMcPacketCatchUpRequest);
+    EXPECT_EQ(grab_group_id_from_mc_packet(request.c_str(), request.size()), 1u);
+    EXPECT_EQ(feeder.client_.begin_catch_up(1, &request), -2);
+    EXPECT_EQ(feeder.client_.begin_catch_up(2, &request), -1);
+
+    // 补齐期间的组播包先暂存
+    feeder.reliable(12);
+    feeder.reliable(10);
+    EXPECT_EQ(feeder.recved_, "");
+    EXPECT_TRUE(feeder.stats().catching_up);
+
+    // 7 8 9 走kcp, 从10开始走组播
+    feeder.catch_up(making_mc_catch_up_begin_packet(1, 7, 10));
+    feeder.catch_up_msg(7);
+    feeder.catch_up_msg(8);
+    EXPECT_EQ(feeder.recved_, "7,8,");
+    feeder.catch_up_msg(9);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,");
+    EXPECT_FALSE(feeder.stats().catching_up);
+    EXPECT_EQ(feeder.stats().caught_up_count, 3u);
+    EXPECT_EQ(feeder.stats().missing_count, 1u); // 11
+
+    feeder.reliable(11);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,11,12,");
+    EXPECT_EQ(feeder.stats().lost_count, 0u);
+
+    // 补齐之后不再接受
+    feeder.catch_up_msg(9);
+    EXPECT_EQ(feeder.recved_, "7,8,9,10,11,12,");
+    EXPECT_FALSE(feeder.client_.handle_catch_up_packet(request.c_str(), request.size()));
+}
+
+TEST(MulticastClientTest, CatchUpTimeout) {
+    MulticastFeeder feeder;
+    std::string request;
+    ASSERT_EQ(feeder.client_.begin_catch_up(1, &request), 0);
+    feeder.reliable(5);
+    feeder.reliable(6);
+
+    // 服务端一直没有回复, 从暂存的组播消息开始
+    feeder.client_.groups_[1].catch_up_deadline = 0;
+    kcp_multicast_client::delivery_list_t deliveries;
+    feeder.client_.handle_catch_up_packets(&deliveries);
+    ASSERT_EQ(deliveries.size(), 2u);
+    EXPECT_EQ(deliveries[0].second, "5");
+    EXPECT_EQ(deliveries[1].second, "6");
+    EXPECT_FALSE(feeder.stats().catching_up);
+    EXPECT_EQ(feeder.stats().next_deliver_seq, 7u);
+}
+
+TEST(MulticastClientTest, EpollReceive) {
+    const char* mc_addr = "239.255.77.1";
+    const uint16_t mc_port = 34571;
+
+    kcp_multicast_client client;
+    MulticastCounter counter;
+    client.set_message_callback(std::bind(&MulticastCounter::on_msg, &counter, std::placeholders::_1, std::placeholders::_2));
+    ASSERT_EQ(client.join_group(mc_addr, mc_port, 1), 0);
+    ASSERT_EQ(client.join_group(mc_addr, mc_port + 1, 2), 0);
+    ASSERT_TRUE(client.start());
+
+    int sender_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to_addr;
+    memset(&to_addr, 0, sizeof(to_addr));
+    to_addr.sin_family = AF_INET;
+    to_addr.sin_addr.s_addr = inet_addr(mc_addr);
+    to_addr.sin_port = htons(mc_port);
+
+    // 一次发一堆, 让recvmmsg批量读
+    for (uint32_t seq = 0; seq < 200; ++seq)
+    {
+        const std::string packet = making_mc_reliable_packet(seq, "1234567890", 10);
+        sendto(sender_fd, packet.c_str(), packet.size(), 0, (struct sockaddr*)&to_addr, sizeof(to_addr));
+    }
+    for (int i = 0; i < 100 && counter.count_ < 200; ++i)
+        usleep(10000);
+    EXPECT_EQ(counter.count_, 200u);
+
+    multicast_group_stats stats;
+    ASSERT_EQ(client.get_group_stats(1, &stats), 0);
+    EXPECT_EQ(stats.delivered_count, 200u);
+    EXPECT_EQ(stats.next_deliver_seq, 200u);
+
+    // 离开之后收不到了
+    EXPECT_EQ(client.leave_group(1), 0);
+    const std::string packet = making_mc_raw_packet("1234567890", 10);
+    sendto(sender_fd, packet.c_str(), packet.size(), 0, (struct sockaddr*)&to_addr, sizeof(to_addr));
+    usleep(50000);
+    EXPECT_EQ(counter.count_, 200u);
+
+    close(sender_fd);
+    client.stop();
+}
+
+class MulticastGroupCounter
+{
+public:
+    void on_msg(uint32_t group_id, const std::string& msg)
+    {
+        MutexLockGuard lock(mutex_);
+        counts_[group_id]++;
+    }
+    size_t count(uint32_t group_id)
+    {
+        MutexLockGuard lock(mutex_);
+        return counts_[group_id];
+    }
+    MutexLock mutex_;
+    std::map<uint32_t, size_t> counts_;
+};
+
+// 多个组共用一个套接字, 按目的地址区分
+TEST(MulticastClientTest, SharedSocket) {
+    const char* mc_addrs[2] = {"239.255.77.2", "239.255.77.3"};
+    const uint16_t mc_port = 34580;
+
+    kcp_multicast_client client;
+    MulticastGroupCounter counter;
+    client.set_message_callback(std::bind(&MulticastGroupCounter::on_msg, &counter, std::placeholders::_1, std::placeholders::_2));
+    ASSERT_EQ(client.use_shared_socket(mc_port), 0);
+    ASSERT_EQ(client.join_group(mc_addrs[0], mc_port, 11), 0);
+    ASSERT_EQ(client.join_group(mc_addrs[1], mc_port, 12), 0);
+    EXPECT_LT(client.join_group("239.255.77.4", mc_port + 1, 13), 0); // 端口不同
+    EXPECT_LT(client.join_group(mc_addrs[0], mc_port, 14), 0);        // 地址重复
+    EXPECT_EQ(client.groups_[11].socket_fd, client.groups_[12].socket_fd);
+    ASSERT_TRUE(client.start());
+
+    int sender_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    for (int g = 0; g < 2; ++g)
+    {
+        struct sockaddr_in to_addr;
+        memset(&to_addr, 0, sizeof(to_addr));
+        to_addr.sin_family = AF_INET;
+        to_addr.sin_addr.s_addr = inet_addr(mc_addrs[g]);
+        to_addr.sin_port = htons(mc_port);
+        for (uint32_t seq = 0; seq < 50u * (g + 1); ++seq)
+        {
+            const std::string packet = making_mc_reliable_packet(seq, "1234567890", 10);
+            sendto(sender_fd, packet.c_str(), packet.size(), 0, (struct sockaddr*)&to_addr, sizeof(to_addr));
+        }
+    }
+    for (int i = 0; i < 100 && counter.count(11) + counter.count(12) < 150; ++i)
+        usleep(10000);
+    EXPECT_EQ(counter.count(11), 50u);
+    EXPECT_EQ(counter.count(12), 100u);
+
+    // 离开一个组不影响另一个组
+    EXPECT_EQ(client.leave_group(11), 0);
+    multicast_group_stats stats;
+    EXPECT_EQ(client.get_group_stats(12, &stats), 0);
+    EXPECT_EQ(stats.delivered_count, 100u);
+
+    close(sender_fd);
+    client.stop();
+}
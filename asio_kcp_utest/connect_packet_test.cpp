@@ -17,3 +17,33 @@ TEST(ConnectSendBackConvTest, Normal) {
     ASSERT_TRUE(grab_conv_from_send_back_conv_packet(packet.c_str(), packet.size()) == 232);
     EXPECT_CMP_PRED2(232, grab_conv_from_send_back_conv_packet, packet.c_str(), packet.size());
 }
+
+TEST(ConnectSendBackConvTest, ResumeToken) {
+    std::string packet = making_send_back_conv_packet(1232, 0x1234abcd5678ef90ull);
+    EXPECT_PRED2(is_send_back_conv_packet, packet.c_str(), packet.size()) << "packet: " << packet;
+    EXPECT_CMP_PRED2(1232, grab_conv_from_send_back_conv_packet, packet.c_str(), packet.size());
+    EXPECT_EQ(grab_resume_token_from_send_back_conv_packet(packet.c_str(), packet.size()), 0x1234abcd5678ef90ull);
+
+    // old server does not send token.
+    std::string old_packet = making_send_back_conv_packet(1232);
+    EXPECT_EQ(grab_resume_token_from_send_back_conv_packet(old_packet.c_str(), old_packet.size()), 0u);
+}
+
+TEST(ResumePacketTest, Normal) {
+    std::string packet = making_resume_packet(1232, 0x1234abcd5678ef90ull);
+    EXPECT_EQ(packet.size(), ASIO_KCP_RESUME_PACKET_HEADER_SIZE);
+    EXPECT_PRED2(is_resume_packet, packet.c_str(), packet.size());
+    EXPECT_FALSE(is_connect_packet(packet.c_str(), packet.size()));
+
+    // kcp data appended after header.
+    packet += "kcp data";
+    uint32_t conv = 0;
+    uint64_t token = 0;
+    EXPECT_TRUE(grab_conv_and_token_from_resume_packet(packet.c_str(), packet.size(), &conv, &token));
+    EXPECT_EQ(conv, 1232u);
+    EXPECT_EQ(token, 0x1234abcd5678ef90ull);
+
+    std::string back_packet = making_resume_back_packet(1232);
+    EXPECT_PRED2(is_resume_back_packet, back_packet.c_str(), back_packet.size());
+    EXPECT_FALSE(is_resume_packet(back_packet.c_str(), back_packet.size()));
+}
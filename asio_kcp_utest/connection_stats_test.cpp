@@ -0,0 +1,136 @@
+#include "gtest_util.hpp"
+#include "../server_lib/connection_stats.hpp"
+#include "../util/ikcp.h"
+#include <string>
+#include <vector>
+
+using namespace kcp_svr;
+using asio_kcp::hdr_histogram;
+
+// sender -> receiver. The packets in drop_ are lost.
+struct KcpPair
+{
+    KcpPair() : counters(1, 0), packet_index(0)
+    {
+        sender = ikcp_create(1, this);
+        receiver = ikcp_create(1, this);
+        sender->output = &KcpPair::sender_output;
+        receiver->output = &KcpPair::receiver_output;
+        ikcp_nodelay(sender, 1, 10, 1, 1);
+        ikcp_nodelay(receiver, 1, 10, 1, 1);
+    }
+
+    ~KcpPair()
+    {
+        ikcp_release(sender);
+        ikcp_release(receiver);
+    }
+
+    static int sender_output(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        KcpPair* pair = (KcpPair*)user;
+        pair->counters.on_output(buf, len);
+        if (pair->packet_index++ != pair->drop_index)
+            pair->to_receiver.push_back(std::string(buf, len));
+        return 0;
+    }
+
+    static int receiver_output(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        ((KcpPair*)user)->to_sender.push_back(std::string(buf, len));
+        return 0;
+    }
+
+    void run(uint32_t from, uint32_t to, hdr_histogram* rtt_us = NULL)
+    {
+        for (uint32_t clock = from; clock < to; clock += 5)
+        {
+            ikcp_update(sender, clock);
+            counters.publish_kcp(sender);
+            for (size_t i = 0; i < to_receiver.size(); ++i)
+                ikcp_input(receiver, to_receiver[i].data(), to_receiver[i].size());
+            to_receiver.clear();
+            ikcp_update(receiver, clock);
+            for (size_t i = 0; i < to_sender.size(); ++i)
+            {
+                counters.on_input(to_sender[i].size(), clock);
+                if (rtt_us)
+                    connection_stats_counters::record_ack_rtts(to_sender[i].data(), to_sender[i].size(), sender->current, rtt_us);
+                ikcp_input(sender, to_sender[i].data(), to_sender[i].size());
+            }
+            to_sender.clear();
+            counters.publish_kcp(sender);
+        }
+    }
+
+    ikcpcb* sender;
+    ikcpcb* receiver;
+    connection_stats_counters counters;
+    size_t packet_index;
+    size_t drop_index;
+    std::vector<std::string> to_receiver;
+    std::vector<std::string> to_sender;
+};
+
+TEST(ConnectionStatsTest, CountPushSegments) {
+    KcpPair pair;
+    pair.drop_index = (size_t)-1;
+    const std::string msg(3000, 'a'); // 3 segments with mtu 1400
+    ikcp_send(pair.sender, msg.data(), msg.size());
+    ikcp_update(pair.sender, 0);
+    ASSERT_EQ(pair.to_receiver.size(), 3u);
+    EXPECT_EQ(connection_stats_counters::count_push_segments(pair.to_receiver[0].data(), pair.to_receiver[0].size()), 1u);
+
+    // a truncated header is not counted
+    EXPECT_EQ(connection_stats_counters::count_push_segments(pair.to_receiver[0].data(), 23), 0u);
+}
+
+TEST(ConnectionStatsTest, RetransmitAndQueues) {
+    KcpPair pair;
+    pair.drop_index = 1;
+    const std::string msg(1000, 'a'); // one segment in one packet
+    for (int i = 0; i < 4; ++i)
+        ikcp_send(pair.sender, msg.data(), msg.size());
+
+    pair.run(0, 1000);
+
+    connection_stats stats;
+    pair.counters.snapshot(1500, &stats);
+    EXPECT_EQ(stats.conv, 1u);
+    EXPECT_EQ(stats.segments_sent, 5u);
+    EXPECT_EQ(stats.retransmit_count, 1u);
+    EXPECT_NEAR(stats.retransmit_ratio, 0.2, 1e-9);
+    EXPECT_EQ(stats.in_flight, 0u);
+    EXPECT_EQ(stats.send_queue, 0u);
+    EXPECT_GT(stats.packets_out, 0u);
+    EXPECT_GT(stats.bytes_out, stats.packets_out * 24);
+    EXPECT_GT(stats.packets_in, 0u);
+    EXPECT_GT(stats.rto_us, 0u);
+    EXPECT_GE(stats.last_recv_age_ms, 500u);
+}
+
+TEST(ConnectionStatsTest, RecordAckRtts) {
+    KcpPair pair;
+    pair.drop_index = (size_t)-1;
+    const std::string msg(1000, 'a');
+    for (int i = 0; i < 4; ++i)
+        ikcp_send(pair.sender, msg.data(), msg.size());
+
+    // the acks come back in the same clock, rtt 0. One ack for every segment.
+    hdr_histogram rtt_us;
+    pair.run(0, 100, &rtt_us);
+    EXPECT_EQ(rtt_us.count(), 4u);
+    EXPECT_EQ(rtt_us.max(), 0u);
+
+    // an ack of the segment sent 30 milliseconds ago
+    ikcp_send(pair.sender, msg.data(), msg.size());
+    ikcp_update(pair.sender, 100);
+    ASSERT_EQ(pair.to_receiver.size(), 1u);
+    ikcp_input(pair.receiver, pair.to_receiver[0].data(), pair.to_receiver[0].size());
+    ikcp_update(pair.receiver, 100);
+    ASSERT_EQ(pair.to_sender.size(), 1u);
+    ikcp_update(pair.sender, 130);
+    connection_stats_counters::record_ack_rtts(pair.to_sender[0].data(), pair.to_sender[0].size(), pair.sender->current, &rtt_us);
+    EXPECT_EQ(rtt_us.count(), 5u);
+    EXPECT_EQ(rtt_us.max(), 30000u);
+}
@@ -0,0 +1,95 @@
+#include "gtest_util.hpp"
+#include "../util/hdr_histogram.hpp"
+#include <thread>
+#include <vector>
+
+using namespace asio_kcp;
+
+TEST(HdrHistogramTest, BucketIndex) {
+    // exact below 256
+    EXPECT_EQ(hdr_histogram::bucket_index(0), 0u);
+    EXPECT_EQ(hdr_histogram::bucket_index(255), 255u);
+    EXPECT_EQ(hdr_histogram::highest_equivalent_value(255), 255u);
+
+    // 256 and 257 share a bucket of width 2
+    EXPECT_EQ(hdr_histogram::bucket_index(256), 256u);
+    EXPECT_EQ(hdr_histogram::bucket_index(257), 256u);
+    EXPECT_EQ(hdr_histogram::highest_equivalent_value(256), 257u);
+
+    // relative error < 1%
+    for (uint64_t v = 1; v < HDR_HISTOGRAM_HIGHEST_TRACKABLE; v = v * 3 + 1)
+    {
+        const uint64_t highest = hdr_histogram::highest_equivalent_value(hdr_histogram::bucket_index(v));
+        EXPECT_GE(highest, v);
+        EXPECT_LE(highest - v, v / 100);
+    }
+
+    // clamped
+    EXPECT_EQ(hdr_histogram::bucket_index(HDR_HISTOGRAM_HIGHEST_TRACKABLE * 4),
+            hdr_histogram::bucket_index(HDR_HISTOGRAM_HIGHEST_TRACKABLE - 1));
+}
+
+TEST(HdrHistogramTest, Percentiles) {
+    hdr_histogram histogram;
+    EXPECT_EQ(histogram.value_at_percentile(99.0), 0u);
+    EXPECT_EQ(histogram.min(), 0u);
+
+    for (uint64_t v = 1; v <= 1000; ++v)
+        histogram.record(v);
+
+    latency_summary summary;
+    histogram.summarize(&summary);
+    EXPECT_EQ(summary.count, 1000u);
+    EXPECT_EQ(summary.min, 1u);
+    EXPECT_EQ(summary.max, 1000u);
+    EXPECT_NEAR(summary.mean, 500.5, 1e-9);
+    EXPECT_NEAR((double)summary.p50, 500, 5);
+    EXPECT_NEAR((double)summary.p90, 900, 9);
+    EXPECT_NEAR((double)summary.p99, 990, 10);
+    EXPECT_EQ(summary.p999, 999u);
+    EXPECT_EQ(histogram.value_at_percentile(0.0), 1u);
+    EXPECT_EQ(histogram.value_at_percentile(100.0), 1000u);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.count(), 0u);
+    EXPECT_EQ(histogram.value_at_percentile(50.0), 0u);
+}
+
+TEST(HdrHistogramTest, MergeShards) {
+    hdr_histogram shards[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.push_back(std::thread([&shards, i]() {
+            for (uint64_t v = 0; v < 10000; ++v)
+                shards[i].record(v * (i + 1));
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    hdr_histogram merged;
+    for (int i = 0; i < 4; ++i)
+        merged.merge(shards[i]);
+    EXPECT_EQ(merged.count(), 40000u);
+    EXPECT_EQ(merged.min(), 0u);
+    EXPECT_EQ(merged.max(), 39996u);
+}
+
+TEST(HdrHistogramTest, ConcurrentRecord) {
+    hdr_histogram histogram;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.push_back(std::thread([&histogram]() {
+            for (uint64_t v = 0; v < 100000; ++v)
+                histogram.record(v % 1000);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    EXPECT_EQ(histogram.count(), 400000u);
+    EXPECT_EQ(histogram.max(), 999u);
+    EXPECT_EQ(histogram.value_at_percentile(100.0), 999u);
+}
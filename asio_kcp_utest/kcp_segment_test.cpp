@@ -0,0 +1,59 @@
+#include "gtest_util.hpp"
+#include "../util/ikcp.h"
+#include "../util/kcp_segment.hpp"
+#include <string>
+#include <vector>
+
+using namespace asio_kcp;
+
+static int collect_output(const char* buf, int len, ikcpcb* kcp, void* user)
+{
+    ((std::vector<std::string>*)user)->push_back(std::string(buf, len));
+    return 0;
+}
+
+TEST(KcpSegmentTest, ReadIkcpOutput) {
+    std::vector<std::string> packets;
+    ikcpcb* kcp = ikcp_create(1001, &packets);
+    kcp->output = &collect_output;
+    ikcp_nodelay(kcp, 1, 10, 1, 1);
+
+    ikcp_send(kcp, std::string(100, 'a').c_str(), 100);
+    ikcp_send(kcp, std::string(10, 'b').c_str(), 10);
+    ikcp_update(kcp, 1000);
+    ASSERT_EQ(packets.size(), 1u);
+
+    // two push segments in one packet
+    size_t offset = 0;
+    kcp_segment_header seg;
+    ASSERT_TRUE(next_kcp_segment(packets[0].data(), packets[0].size(), &offset, &seg));
+    EXPECT_EQ(seg.conv, 1001u);
+    EXPECT_EQ(seg.cmd, KCP_CMD_PUSH);
+    EXPECT_EQ(seg.frg, 0u);
+    EXPECT_EQ(seg.wnd, kcp->rcv_wnd);
+    EXPECT_EQ(seg.ts, 1000u);
+    EXPECT_EQ(seg.sn, 0u);
+    EXPECT_EQ(seg.una, 0u);
+    EXPECT_EQ(seg.len, 100u);
+    EXPECT_EQ(offset, (size_t)KCP_SEGMENT_HEADER_SIZE + 100);
+
+    ASSERT_TRUE(next_kcp_segment(packets[0].data(), packets[0].size(), &offset, &seg));
+    EXPECT_EQ(seg.sn, 1u);
+    EXPECT_EQ(seg.len, 10u);
+    EXPECT_EQ(offset, packets[0].size());
+    EXPECT_FALSE(next_kcp_segment(packets[0].data(), packets[0].size(), &offset, &seg));
+
+    ikcp_release(kcp);
+}
+
+TEST(KcpSegmentTest, ShortPacket) {
+    const std::string header(KCP_SEGMENT_HEADER_SIZE, '\0');
+    size_t offset = 0;
+    kcp_segment_header seg;
+    EXPECT_FALSE(next_kcp_segment(header.data(), header.size() - 1, &offset, &seg));
+    EXPECT_EQ(offset, 0u);
+    EXPECT_TRUE(next_kcp_segment(header.data(), header.size(), &offset, &seg));
+
+    EXPECT_EQ(read_uint32_le("\x01\x02\x03\x04"), 0x04030201u);
+    EXPECT_EQ(read_uint16_le("\xff\x01"), 0x01ffu);
+}
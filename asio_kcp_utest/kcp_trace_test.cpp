@@ -0,0 +1,205 @@
+#include "gtest_util.hpp"
+#include "../util/kcp_trace.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace asio_kcp;
+
+// two kcp talking through memory. The first transmit of sn drop_sn from a to b is lost.
+struct kcp_pair
+{
+    ikcpcb* a;
+    ikcpcb* b;
+    std::vector<std::string> a_to_b;
+    std::vector<std::string> b_to_a;
+    int drop_sn;
+    bool dropped;
+
+    kcp_pair(void) : drop_sn(-1), dropped(false)
+    {
+        a = ikcp_create(1001, this);
+        b = ikcp_create(1001, this);
+        a->output = &kcp_pair::output_a;
+        b->output = &kcp_pair::output_b;
+        ikcp_nodelay(a, 1, 5, 1, 1);
+        ikcp_nodelay(b, 1, 5, 1, 1);
+    }
+
+    ~kcp_pair(void)
+    {
+        ikcp_release(a);
+        ikcp_release(b);
+    }
+
+    static int output_a(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        kcp_pair* pair = (kcp_pair*)user;
+        std::string packet;
+        for (int pos = 0; pos + 24 <= len; )
+        {
+            uint32_t sn = 0, seg_len = 0;
+            memcpy(&sn, buf + pos + 12, 4);
+            memcpy(&seg_len, buf + pos + 20, 4);
+            if (buf[pos + 4] == 81 && (int)sn == pair->drop_sn && !pair->dropped)
+                pair->dropped = true;
+            else
+                packet.append(buf + pos, 24 + seg_len);
+            pos += 24 + seg_len;
+        }
+        if (!packet.empty())
+            pair->a_to_b.push_back(packet);
+        return 0;
+    }
+
+    static int output_b(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        ((kcp_pair*)user)->b_to_a.push_back(std::string(buf, len));
+        return 0;
+    }
+
+    void run(uint32_t from_clock, uint32_t to_clock, std::vector<std::string>* recved)
+    {
+        char buf[4096];
+        for (uint32_t clock = from_clock; clock < to_clock; clock += 5)
+        {
+            ikcp_update(a, clock);
+            ikcp_update(b, clock);
+            for (size_t i = 0; i < a_to_b.size(); ++i)
+                ikcp_input(b, a_to_b[i].data(), a_to_b[i].size());
+            a_to_b.clear();
+            for (size_t i = 0; i < b_to_a.size(); ++i)
+                ikcp_input(a, b_to_a[i].data(), b_to_a[i].size());
+            b_to_a.clear();
+            int len = 0;
+            while ((len = ikcp_recv(b, buf, sizeof(buf))) > 0)
+                recved->push_back(std::string(buf, len));
+        }
+    }
+};
+
+static std::vector<uint32_t> events_of_sn(const std::vector<kcp_trace_record>& records, uint32_t sn)
+{
+    std::vector<uint32_t> events;
+    for (size_t i = 0; i < records.size(); ++i)
+        if (records[i].sn == sn)
+            events.push_back(records[i].event);
+    return events;
+}
+
+TEST(KcpTraceTest, SegmentLifecycle) {
+    kcp_pair pair;
+    pair.drop_sn = 1;
+    kcp_trace_ring send_ring;
+    kcp_trace_ring recv_ring;
+    send_ring.attach(pair.a);
+    recv_ring.attach(pair.b);
+
+    ikcp_send(pair.a, "msg0", 4);
+    ikcp_send(pair.a, "msg1", 4);
+    ikcp_send(pair.a, "msg2", 4);
+    std::vector<std::string> recved;
+    pair.run(0, 1000, &recved);
+    ASSERT_EQ(recved.size(), 3u);
+    ASSERT_TRUE(pair.dropped);
+
+    std::vector<kcp_trace_record> records;
+    send_ring.snapshot(&records);
+    EXPECT_EQ(records[0].conv, 1001u);
+
+    std::vector<uint32_t> sn0 = events_of_sn(records, 0);
+    ASSERT_EQ(sn0.size(), 4u);
+    EXPECT_EQ(sn0[0], (uint32_t)IKCP_TRACE_SEND);
+    EXPECT_EQ(sn0[1], (uint32_t)IKCP_TRACE_SNDBUF);
+    EXPECT_EQ(sn0[2], (uint32_t)IKCP_TRACE_XMIT);
+    EXPECT_EQ(sn0[3], (uint32_t)IKCP_TRACE_ACKED);
+
+    // lost once, then resent by fastack (sn 2 acked first) or rto
+    std::vector<uint32_t> sn1 = events_of_sn(records, 1);
+    ASSERT_EQ(sn1.size(), 5u);
+    EXPECT_TRUE(sn1[3] == (uint32_t)IKCP_TRACE_FAST_RESEND || sn1[3] == (uint32_t)IKCP_TRACE_RTO_RESEND);
+    EXPECT_EQ(sn1[4], (uint32_t)IKCP_TRACE_ACKED);
+
+    // sn 2 waits in rcv_buf for the lost sn 1
+    recv_ring.snapshot(&records);
+    std::vector<uint32_t> sn2 = events_of_sn(records, 2);
+    ASSERT_EQ(sn2.size(), 3u);
+    EXPECT_EQ(sn2[0], (uint32_t)IKCP_TRACE_INPUT);
+    EXPECT_EQ(sn2[1], (uint32_t)IKCP_TRACE_RCVQUEUE);
+    EXPECT_EQ(sn2[2], (uint32_t)IKCP_TRACE_RECV);
+    uint64_t sn1_rcvqueue_time = 0, sn2_input_time = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        if (records[i].sn == 1 && records[i].event == IKCP_TRACE_RCVQUEUE)
+            sn1_rcvqueue_time = records[i].time_us;
+        if (records[i].sn == 2 && records[i].event == IKCP_TRACE_INPUT)
+            sn2_input_time = records[i].time_us;
+    }
+    EXPECT_LE(sn2_input_time, sn1_rcvqueue_time);
+
+    // detached: nothing more recorded
+    kcp_trace_ring::detach(pair.a);
+    send_ring.snapshot(&records);
+    const size_t count = records.size();
+    ikcp_send(pair.a, "msg3", 4);
+    pair.run(1000, 1100, &recved);
+    send_ring.snapshot(&records);
+    EXPECT_EQ(records.size(), count);
+}
+
+TEST(KcpTraceTest, RingWrapAround) {
+    kcp_trace_ring ring;
+    const uint32_t total = ASIO_KCP_KCP_TRACE_RING_SIZE + 10;
+    for (uint32_t sn = 0; sn < total; ++sn)
+        ring.record(1001, IKCP_TRACE_SEND, sn, 0);
+
+    std::vector<kcp_trace_record> records;
+    ring.snapshot(&records);
+    ASSERT_EQ(records.size(), (size_t)ASIO_KCP_KCP_TRACE_RING_SIZE);
+    EXPECT_EQ(records.front().sn, 10u);
+    EXPECT_EQ(records.back().sn, total - 1);
+}
+
+TEST(KcpTraceTest, FileAndChromeJson) {
+    kcp_trace_ring ring;
+    ring.record(1001, IKCP_TRACE_SEND, 7, 100);
+    ring.record(1001, IKCP_TRACE_SNDBUF, 7, 32);
+    ring.record(1001, IKCP_TRACE_XMIT, 7, 200);
+    ring.record(1001, IKCP_TRACE_RTO_RESEND, 7, 2);
+    ring.record(1001, IKCP_TRACE_ACKED, 7, 2);
+    ring.record(1001, IKCP_TRACE_ACKED, 8, 1); // begin not in the ring
+    std::vector<kcp_trace_record> records;
+    ring.snapshot(&records);
+
+    char path[] = "/tmp/asio_kcp_kcp_trace_test_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    EXPECT_TRUE(write_kcp_trace_file(path, records));
+    std::vector<kcp_trace_record> read_records;
+    EXPECT_TRUE(read_kcp_trace_file(path, &read_records));
+    unlink(path);
+    ASSERT_EQ(read_records.size(), records.size());
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        EXPECT_EQ(read_records[i].time_us, records[i].time_us);
+        EXPECT_EQ(read_records[i].conv, records[i].conv);
+        EXPECT_EQ(read_records[i].event, records[i].event);
+        EXPECT_EQ(read_records[i].sn, records[i].sn);
+        EXPECT_EQ(read_records[i].arg, records[i].arg);
+    }
+    EXPECT_FALSE(read_kcp_trace_file("/nonexistent/asio_kcp.kcptrace", &read_records));
+
+    std::vector<std::vector<kcp_trace_record> > record_sets(1, records);
+    const std::string json = kcp_trace_to_chrome_json(record_sets, std::vector<std::string>(1, "ser\"ver"));
+    EXPECT_NE(json.find("\"name\":\"ser\\\"ver\""), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"snd_queue\",\"cat\":\"kcp_send\",\"ph\":\"b\""), std::string::npos) << json;
+    EXPECT_NE(json.find("{\"name\":\"snd_queue\",\"cat\":\"kcp_send\",\"ph\":\"e\""), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"in_flight\",\"cat\":\"kcp_send\",\"ph\":\"b\""), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"in_flight\",\"cat\":\"kcp_send\",\"ph\":\"e\""), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"rto_resend\",\"cat\":\"kcp_send\",\"ph\":\"n\""), std::string::npos);
+    EXPECT_NE(json.find("\"id\":\"1001_7\""), std::string::npos);
+    EXPECT_EQ(json.find("\"id\":\"1001_8\""), std::string::npos); // no end without begin
+}
@@ -0,0 +1,78 @@
+#include "gtest_util.hpp"
+#include "../server_lib/metrics.hpp"
+#include <string>
+#include <vector>
+
+using namespace kcp_svr;
+
+static bool contains_line(const std::string& text, const std::string& line)
+{
+    return text.find(line + "\n") != std::string::npos;
+}
+
+TEST(MetricsTest, CounterAndGauge) {
+    metrics_counter counter;
+    metrics_gauge gauge;
+    metrics_registry registry;
+    registry.add("test_packets_total", "Packets.", &counter);
+    registry.add("test_connections", "Connections.", &gauge);
+
+    counter.inc();
+    counter.inc(41);
+    gauge.set(10);
+    gauge.dec(3);
+
+    const std::string text = registry.render();
+    EXPECT_TRUE(contains_line(text, "# HELP test_packets_total Packets."));
+    EXPECT_TRUE(contains_line(text, "# TYPE test_packets_total counter"));
+    EXPECT_TRUE(contains_line(text, "test_packets_total 42"));
+    EXPECT_TRUE(contains_line(text, "# TYPE test_connections gauge"));
+    EXPECT_TRUE(contains_line(text, "test_connections 7"));
+
+    // keep the order of registering
+    EXPECT_LT(text.find("test_packets_total"), text.find("test_connections"));
+}
+
+TEST(MetricsTest, Histogram) {
+    std::vector<uint64_t> bounds;
+    bounds.push_back(10);
+    bounds.push_back(100);
+    metrics_histogram histogram(bounds);
+    metrics_registry registry;
+    registry.add("test_size_bytes", "Size.", &histogram);
+
+    histogram.observe(5);
+    histogram.observe(10); // le is inclusive
+    histogram.observe(50);
+    histogram.observe(1000);
+    EXPECT_EQ(histogram.bucket_count(0), 2u);
+    EXPECT_EQ(histogram.bucket_count(1), 1u);
+    EXPECT_EQ(histogram.bucket_count(2), 1u);
+
+    const std::string text = registry.render();
+    EXPECT_TRUE(contains_line(text, "# TYPE test_size_bytes histogram"));
+    EXPECT_TRUE(contains_line(text, "test_size_bytes_bucket{le=\"10\"} 2"));
+    EXPECT_TRUE(contains_line(text, "test_size_bytes_bucket{le=\"100\"} 3"));
+    EXPECT_TRUE(contains_line(text, "test_size_bytes_bucket{le=\"+Inf\"} 4"));
+    EXPECT_TRUE(contains_line(text, "test_size_bytes_sum 1065"));
+    EXPECT_TRUE(contains_line(text, "test_size_bytes_count 4"));
+}
+
+TEST(MetricsTest, Callback) {
+    metrics_registry registry;
+    int calls = 0;
+    registry.add_callback("test_groups", "Groups.", eMetricsGauge, [&calls]() { return (double)++calls; });
+
+    EXPECT_TRUE(contains_line(registry.render(), "test_groups 1"));
+    EXPECT_TRUE(contains_line(registry.render(), "test_groups 2"));
+}
+
+TEST(MetricsTest, CallbackLargeValue) {
+    metrics_registry registry;
+    registry.add_callback("test_bytes_total", "Bytes.", eMetricsCounter, []() { return 1234567891.0; });
+    registry.add_callback("test_ratio", "Ratio.", eMetricsGauge, []() { return 0.25; });
+
+    const std::string text = registry.render();
+    EXPECT_TRUE(contains_line(text, "test_bytes_total 1234567891"));
+    EXPECT_TRUE(contains_line(text, "test_ratio 0.25"));
+}
@@ -0,0 +1,40 @@
+#include "gtest_util.hpp"
+#include "../util/msg_buffer.hpp"
+#include <string>
+
+using namespace asio_kcp;
+
+TEST(MsgBufferTest, Normal) {
+    msg_buffer_ref empty_ref;
+    EXPECT_TRUE(empty_ref.empty());
+    EXPECT_EQ(empty_ref.size(), 0u);
+
+    msg_buffer_ref ref = make_msg_buffer("1234567890", 10);
+    EXPECT_EQ(std::string(ref.data(), ref.size()), "1234567890");
+
+    msg_buffer_ref ref_copy(ref);
+    ref.reset();
+    EXPECT_TRUE(ref.empty());
+    EXPECT_EQ(std::string(ref_copy.data(), ref_copy.size()), "1234567890");
+
+    empty_ref = ref_copy;
+    ref_copy = ref_copy;
+    EXPECT_EQ(empty_ref.data(), ref_copy.data());
+}
+
+TEST(MsgBufferTest, ReuseFromPool) {
+    const char* data = NULL;
+    size_t free_count = 0;
+    {
+        msg_buffer_ref ref = make_msg_buffer("1234567890", 10);
+        data = ref.data();
+        free_count = msg_buffer_pool_free_count();
+    }
+    EXPECT_EQ(msg_buffer_pool_free_count(), free_count + 1);
+
+    // the smaller msg reuse the buffer released.
+    msg_buffer_ref ref = make_msg_buffer("abc", 3);
+    EXPECT_EQ(ref.data(), data);
+    EXPECT_EQ(std::string(ref.data(), ref.size()), "abc");
+    EXPECT_EQ(msg_buffer_pool_free_count(), free_count);
+}
@@ -0,0 +1,193 @@
+#include "gtest_util.hpp"
+#include "../util/multicast_packet.hpp"
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace asio_kcp;
+
+TEST(MulticastPacketTest, Reliable) {
+    std::string packet = making_mc_reliable_packet(0x12345678, "hello", 5);
+    EXPECT_EQ(packet.size(), ASIO_KCP_MC_RELIABLE_HEADER_SIZE + 5u);
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), packet.size()), eMcPacketReliable);
+    EXPECT_EQ(grab_seq_from_mc_packet(packet.c_str(), packet.size()), 0x12345678u);
+    EXPECT_EQ(packet.substr(ASIO_KCP_MC_RELIABLE_HEADER_SIZE), "hello");
+
+    std::string raw_packet = making_mc_raw_packet("hello", 5);
+    EXPECT_EQ(get_mc_packet_type(raw_packet.c_str(), raw_packet.size()), eMcPacketRaw);
+    EXPECT_EQ(raw_packet.substr(ASIO_KCP_MC_HEADER_SIZE), "hello");
+
+    // 只写包头, 和消息分开发送
+    char head[ASIO_KCP_MC_RELIABLE_HEADER_SIZE];
+    size_t head_len = making_mc_reliable_header(0x12345678, head);
+    EXPECT_EQ(std::string(head, head_len), packet.substr(0, ASIO_KCP_MC_RELIABLE_HEADER_SIZE));
+    head_len = making_mc_raw_header(head);
+    EXPECT_EQ(std::string(head, head_len), raw_packet.substr(0, ASIO_KCP_MC_HEADER_SIZE));
+}
+
+TEST(MulticastPacketTest, HeartbeatAndTooOld) {
+    std::string heartbeat = making_mc_heartbeat_packet(1000);
+    EXPECT_EQ(get_mc_packet_type(heartbeat.c_str(), heartbeat.size()), eMcPacketHeartbeat);
+    EXPECT_EQ(grab_seq_from_mc_packet(heartbeat.c_str(), heartbeat.size()), 1000u);
+
+    std::string too_old = making_mc_too_old_packet(24);
+    EXPECT_EQ(get_mc_packet_type(too_old.c_str(), too_old.size()), eMcPacketTooOld);
+    EXPECT_EQ(grab_seq_from_mc_packet(too_old.c_str(), too_old.size()), 24u);
+
+    // 截断的包
+    EXPECT_EQ(get_mc_packet_type(too_old.c_str(), too_old.size() - 1), eMcPacketUnknown);
+}
+
+TEST(MulticastPacketTest, Nack) {
+    std::vector<mc_nack_range> ranges(2);
+    ranges[0].first_seq = 3;
+    ranges[0].count = 1;
+    ranges[1].first_seq = 0xFFFFFFFE;
+    ranges[1].count = 4;
+    std::string packet = making_mc_nack_packet(ranges);
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), packet.size()), eMcPacketNack);
+
+    std::vector<mc_nack_range> grabbed;
+    ASSERT_TRUE(grab_ranges_from_mc_nack_packet(packet.c_str(), packet.size(), &grabbed));
+    ASSERT_EQ(grabbed.size(), 2u);
+    EXPECT_EQ(grabbed[0].first_seq, 3u);
+    EXPECT_EQ(grabbed[0].count, 1u);
+    EXPECT_EQ(grabbed[1].first_seq, 0xFFFFFFFEu);
+    EXPECT_EQ(grabbed[1].count, 4u);
+
+    // 截断的包
+    EXPECT_FALSE(grab_ranges_from_mc_nack_packet(packet.c_str(), packet.size() - 1, &grabbed));
+
+    // 超过的range被忽略
+    ranges.resize(ASIO_KCP_MC_NACK_MAX_RANGES + 10, ranges[0]);
+    packet = making_mc_nack_packet(ranges);
+    ASSERT_TRUE(grab_ranges_from_mc_nack_packet(packet.c_str(), packet.size(), &grabbed));
+    EXPECT_EQ(grabbed.size(), (size_t)ASIO_KCP_MC_NACK_MAX_RANGES);
+}
+
+TEST(MulticastPacketTest, SeqWrapAround) {
+    EXPECT_GT(mc_seq_diff(1, 0xFFFFFFFF), 0);
+    EXPECT_LT(mc_seq_diff(0xFFFFFFFF, 1), 0);
+    EXPECT_EQ(mc_seq_diff(7, 7), 0);
+
+    // 不是组播包
+    EXPECT_EQ(get_mc_packet_type("ACK:1", 5), eMcPacketUnknown);
+}
+
+TEST(MulticastPacketTest, Feedback) {
+    std::vector<uint8_t> bitmap(2);
+    bitmap[0] = 0x05;
+    bitmap[1] = 0x80;
+    std::string packet = making_mc_feedback_packet(100, bitmap);
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), packet.size()), eMcPacketFeedback);
+
+    uint32_t ack_seq = 0;
+    std::vector<uint8_t> grabbed;
+    ASSERT_TRUE(grab_feedback_from_mc_packet(packet.c_str(), packet.size(), &ack_seq, &grabbed));
+    EXPECT_EQ(ack_seq, 100u);
+    EXPECT_EQ(grabbed, bitmap);
+
+    // 截断的包
+    EXPECT_FALSE(grab_feedback_from_mc_packet(packet.c_str(), packet.size() - 3, &ack_seq, &grabbed));
+
+    // 没有bitmap
+    packet = making_mc_feedback_packet(7, std::vector<uint8_t>());
+    ASSERT_TRUE(grab_feedback_from_mc_packet(packet.c_str(), packet.size(), &ack_seq, &grabbed));
+    EXPECT_EQ(ack_seq, 7u);
+    EXPECT_TRUE(grabbed.empty());
+}
+
+TEST(MulticastPacketTest, Fec) {
+    const char* msgs[3] = {"hello", "fec", "multicast"};
+    mc_fec_block block;
+    block.first_seq = 0xFFFFFFFF;
+    for (int i = 0; i < 3; ++i)
+        block.add(msgs[i], strlen(msgs[i]));
+    std::string packet = making_mc_fec_packet(block);
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), packet.size()), eMcPacketFec);
+
+    mc_fec_block grabbed;
+    ASSERT_TRUE(grab_fec_block_from_mc_packet(packet.c_str(), packet.size(), &grabbed));
+    EXPECT_EQ(grabbed.first_seq, 0xFFFFFFFFu);
+    EXPECT_EQ(grabbed.count, 3);
+
+    // 丢了第一个, 用另外两个恢复
+    grabbed.add(msgs[1], strlen(msgs[1]));
+    grabbed.add(msgs[2], strlen(msgs[2]));
+    std::string msg;
+    ASSERT_TRUE(grabbed.rebuild(&msg));
+    EXPECT_EQ(msg, "hello");
+
+    // 截断的包
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), ASIO_KCP_MC_FEC_HEADER_SIZE - 1), eMcPacketUnknown);
+}
+
+TEST(MulticastPacketTest, FeedbackLossAndFecBlockSize) {
+    std::string packet = making_mc_feedback_packet(7, std::vector<uint8_t>(1, 0x01), 25);
+    uint32_t ack_seq = 0;
+    std::vector<uint8_t> bitmap;
+    uint16_t loss_permille = 0;
+    ASSERT_TRUE(grab_feedback_from_mc_packet(packet.c_str(), packet.size(), &ack_seq, &bitmap, &loss_permille));
+    EXPECT_EQ(loss_permille, 25);
+
+    // 没有丢包率的旧反馈
+    ASSERT_TRUE(grab_feedback_from_mc_packet(packet.c_str(), packet.size() - 2, &ack_seq, &bitmap, &loss_permille));
+    EXPECT_EQ(loss_permille, 0);
+    EXPECT_EQ(bitmap.size(), 1u);
+
+    EXPECT_EQ(mc_fec_block_size_for_loss(0), 0);
+    EXPECT_EQ(mc_fec_block_size_for_loss(ASIO_KCP_MC_FEC_MIN_LOSS_PERMILLE), 60);
+    EXPECT_EQ(mc_fec_block_size_for_loss(20), 15);
+    EXPECT_EQ(mc_fec_block_size_for_loss(500), ASIO_KCP_MC_FEC_MIN_BLOCK);
+}
+
+TEST(MulticastPacketTest, Batch) {
+    std::string batch = making_mc_batch_packet();
+    char head[ASIO_KCP_MC_RELIABLE_HEADER_SIZE];
+    size_t head_len = making_mc_reliable_header(9, head);
+    append_frame_to_mc_batch_packet(&batch, head, head_len, "abc", 3);
+    head_len = making_mc_raw_header(head);
+    append_frame_to_mc_batch_packet(&batch, head, head_len, "", 0);
+    EXPECT_EQ(get_mc_packet_type(batch.c_str(), batch.size()), eMcPacketBatch);
+
+    size_t offset = ASIO_KCP_MC_HEADER_SIZE;
+    const char* frame = NULL;
+    size_t frame_len = 0;
+    ASSERT_TRUE(grab_next_frame_from_mc_batch_packet(batch.c_str(), batch.size(), &offset, &frame, &frame_len));
+    EXPECT_EQ(get_mc_packet_type(frame, frame_len), eMcPacketReliable);
+    EXPECT_EQ(grab_seq_from_mc_packet(frame, frame_len), 9u);
+    EXPECT_EQ(std::string(frame + ASIO_KCP_MC_RELIABLE_HEADER_SIZE, frame_len - ASIO_KCP_MC_RELIABLE_HEADER_SIZE), "abc");
+    ASSERT_TRUE(grab_next_frame_from_mc_batch_packet(batch.c_str(), batch.size(), &offset, &frame, &frame_len));
+    EXPECT_EQ(get_mc_packet_type(frame, frame_len), eMcPacketRaw);
+    EXPECT_EQ(frame_len, (size_t)ASIO_KCP_MC_HEADER_SIZE);
+    EXPECT_FALSE(grab_next_frame_from_mc_batch_packet(batch.c_str(), batch.size(), &offset, &frame, &frame_len));
+
+    // 截断的帧
+    offset = ASIO_KCP_MC_HEADER_SIZE;
+    EXPECT_FALSE(grab_next_frame_from_mc_batch_packet(batch.c_str(), ASIO_KCP_MC_HEADER_SIZE + 5, &offset, &frame, &frame_len));
+}
+
+TEST(MulticastPacketTest, CatchUp) {
+    const std::string request = making_mc_catch_up_request_packet(7);
+    EXPECT_EQ(get_mc_packet_type(request.c_str(), request.size()), eMcPacketCatchUpRequest);
+    EXPECT_EQ(grab_group_id_from_mc_packet(request.c_str(), request.size()), 7u);
+
+    const std::string begin = making_mc_catch_up_begin_packet(7, 0xFFFFFFFE, 3);
+    uint32_t group_id = 0, first_seq = 0, live_seq = 0;
+    ASSERT_TRUE(grab_catch_up_begin_from_mc_packet(begin.c_str(), begin.size(), &group_id, &first_seq, &live_seq));
+    EXPECT_EQ(group_id, 7u);
+    EXPECT_EQ(first_seq, 0xFFFFFFFEu);
+    EXPECT_EQ(live_seq, 3u);
+    EXPECT_FALSE(grab_catch_up_begin_from_mc_packet(begin.c_str(), begin.size() - 1, &group_id, &first_seq, &live_seq));
+
+    // live_seq在first_seq之前
+    const std::string bad_begin = making_mc_catch_up_begin_packet(7, 3, 2);
+    EXPECT_FALSE(grab_catch_up_begin_from_mc_packet(bad_begin.c_str(), bad_begin.size(), &group_id, &first_seq, &live_seq));
+
+    const std::string packet = making_mc_catch_up_packet(7, 42, "abc", 3);
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), packet.size()), eMcPacketCatchUp);
+    EXPECT_EQ(grab_group_id_from_mc_packet(packet.c_str(), packet.size()), 7u);
+    EXPECT_EQ(grab_seq_from_mc_catch_up_packet(packet.c_str(), packet.size()), 42u);
+    EXPECT_EQ(packet.substr(ASIO_KCP_MC_CATCH_UP_HEADER_SIZE), "abc");
+    EXPECT_EQ(get_mc_packet_type(packet.c_str(), ASIO_KCP_MC_CATCH_UP_HEADER_SIZE - 1), eMcPacketUnknown);
+}
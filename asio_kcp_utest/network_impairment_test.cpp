@@ -0,0 +1,201 @@
+#include "gtest_util.hpp"
+#include "../server_lib/network_impairment.hpp"
+#include <string>
+#include <vector>
+
+using namespace kcp_svr;
+
+TEST(NetworkImpairmentTest, ParseProfile) {
+    impairment_profile profile;
+    std::string err;
+    ASSERT_TRUE(parse_impairment_profile(
+                "# a comment\n"
+                "name = test\n"
+                "delay_ms = 30   # one way\n"
+                "\n"
+                "delay_distribution = pareto\n"
+                "loss = 0.05\n"
+                "rate_kbps = 1000\n", &profile, &err));
+    EXPECT_EQ(profile.name, "test");
+    EXPECT_EQ(profile.delay_ms, 30u);
+    EXPECT_EQ(profile.delay_distribution, eDelayPareto);
+    EXPECT_DOUBLE_EQ(profile.loss, 0.05);
+    EXPECT_EQ(profile.rate_kbps, 1000u);
+    EXPECT_EQ(profile.jitter_ms, 0u);
+
+    // round trip
+    impairment_profile parsed;
+    ASSERT_TRUE(parse_impairment_profile(impairment_profile_str(profile), &parsed, &err));
+    EXPECT_EQ(impairment_profile_str(parsed), impairment_profile_str(profile));
+
+    EXPECT_FALSE(parse_impairment_profile("delay = 30\n", &profile, &err));
+    EXPECT_EQ(err, "line 1: bad key or value: delay = 30");
+    EXPECT_FALSE(parse_impairment_profile("loss = 1.5\n", &profile, &err));
+    EXPECT_FALSE(parse_impairment_profile("delay_ms = -1\n", &profile, &err));
+    EXPECT_FALSE(parse_impairment_profile("delay_distribution = gauss\n", &profile, &err));
+    EXPECT_FALSE(parse_impairment_profile("\nloss\n", &profile, &err));
+    EXPECT_EQ(err, "line 2: bad line: loss");
+}
+
+TEST(NetworkImpairmentTest, BuiltinProfiles) {
+    const char* bench_mark_profiles[] = {"network_lag", "network_very_lag", "china_mobile_3g", "china_union_3g"};
+    for (size_t i = 0; i < sizeof(bench_mark_profiles) / sizeof(bench_mark_profiles[0]); ++i)
+    {
+        impairment_profile profile;
+        EXPECT_TRUE(load_impairment_profile(bench_mark_profiles[i], &profile, NULL)) << bench_mark_profiles[i];
+        EXPECT_EQ(profile.name, bench_mark_profiles[i]);
+        EXPECT_GT(profile.delay_ms, 0u);
+        EXPECT_GT(profile.loss, 0);
+    }
+    EXPECT_EQ(builtin_impairment_profile_names().size(), 5u);
+
+    std::string err;
+    impairment_profile profile;
+    EXPECT_FALSE(load_impairment_profile("no_such_profile", &profile, &err));
+    EXPECT_EQ(err, "no builtin profile or file named no_such_profile");
+}
+
+TEST(NetworkImpairmentTest, PerfectLink) {
+    impaired_link link(impairment_profile(), 1);
+    std::vector<uint64_t> deliver_times_us;
+    for (uint64_t now_us = 1000; now_us < 100000; now_us += 1000)
+    {
+        link.send(now_us, 500, &deliver_times_us);
+        ASSERT_EQ(deliver_times_us.size(), 1u);
+        EXPECT_EQ(deliver_times_us[0], now_us);
+    }
+    EXPECT_EQ(link.stats().packets, 99u);
+    EXPECT_EQ(link.stats().lost, 0u);
+}
+
+// runs n packets sent every 1ms, returns the deliver time of every packet, 0 for lost.
+static std::vector<uint64_t> run_link(const impairment_profile& profile, uint32_t seed, int n)
+{
+    impaired_link link(profile, seed);
+    std::vector<uint64_t> ret;
+    std::vector<uint64_t> deliver_times_us;
+    for (int i = 0; i < n; ++i)
+    {
+        link.send((uint64_t)(i + 1) * 1000, 500, &deliver_times_us);
+        ret.push_back(deliver_times_us.empty() ? 0 : deliver_times_us[0]);
+    }
+    return ret;
+}
+
+TEST(NetworkImpairmentTest, SameSeedSameFate) {
+    impairment_profile profile;
+    get_builtin_impairment_profile("network_very_lag", &profile);
+    EXPECT_EQ(run_link(profile, 7, 10000), run_link(profile, 7, 10000));
+    EXPECT_NE(run_link(profile, 7, 10000), run_link(profile, 8, 10000));
+
+    // changing the loss does not change the delays. Every packet reordered by 0ms to turn off the order keeping.
+    profile.reorder = 1;
+    const std::vector<uint64_t>& lossy = run_link(profile, 7, 10000);
+    profile.loss = 0;
+    profile.burst_loss = 0;
+    const std::vector<uint64_t>& lossless = run_link(profile, 7, 10000);
+    int lost = 0;
+    for (size_t i = 0; i < lossy.size(); ++i)
+    {
+        if (lossy[i] == 0)
+            lost++;
+        else
+            EXPECT_EQ(lossless[i], lossy[i]);
+    }
+    EXPECT_GT(lost, 0);
+}
+
+TEST(NetworkImpairmentTest, BernoulliLoss) {
+    impairment_profile profile;
+    profile.loss = 0.1;
+    impaired_link link(profile, 1);
+    std::vector<uint64_t> deliver_times_us;
+    for (int i = 0; i < 100000; ++i)
+        link.send(i, 100, &deliver_times_us);
+    EXPECT_GT(link.stats().lost, 9000u);
+    EXPECT_LT(link.stats().lost, 11000u);
+}
+
+TEST(NetworkImpairmentTest, BurstLoss) {
+    impairment_profile profile;
+    profile.burst_enter = 0.01;
+    profile.burst_exit = 0.1;
+    profile.burst_loss = 1;
+    const std::vector<uint64_t>& deliver_times = run_link(profile, 1, 100000);
+
+    int bursts = 0;
+    int lost = 0;
+    for (size_t i = 0; i < deliver_times.size(); ++i)
+    {
+        if (deliver_times[i] == 0)
+        {
+            lost++;
+            if (i == 0 || deliver_times[i - 1] != 0)
+                bursts++;
+        }
+    }
+    // mean burst of 1 / burst_exit packets
+    ASSERT_GT(bursts, 0);
+    EXPECT_GT(lost / bursts, 7);
+    EXPECT_LT(lost / bursts, 13);
+}
+
+TEST(NetworkImpairmentTest, JitterKeepsOrder) {
+    impairment_profile profile;
+    profile.delay_ms = 50;
+    profile.jitter_ms = 20;
+    profile.delay_distribution = eDelayNormal;
+    const std::vector<uint64_t>& deliver_times = run_link(profile, 1, 10000);
+    for (size_t i = 1; i < deliver_times.size(); ++i)
+        EXPECT_GE(deliver_times[i], deliver_times[i - 1]);
+
+    profile.reorder = 0.1;
+    profile.reorder_ms = 10;
+    const std::vector<uint64_t>& reordered = run_link(profile, 1, 10000);
+    int overtaken = 0;
+    for (size_t i = 1; i < reordered.size(); ++i)
+        if (reordered[i] < reordered[i - 1])
+            overtaken++;
+    EXPECT_GT(overtaken, 500);
+}
+
+TEST(NetworkImpairmentTest, Duplicate) {
+    impairment_profile profile;
+    profile.duplicate = 1;
+    impaired_link link(profile, 1);
+    std::vector<uint64_t> deliver_times_us;
+    link.send(1000, 100, &deliver_times_us);
+    ASSERT_EQ(deliver_times_us.size(), 2u);
+    EXPECT_EQ(deliver_times_us[0], 1000u);
+    EXPECT_EQ(deliver_times_us[1], 1000u);
+    EXPECT_EQ(link.stats().duplicated, 1u);
+}
+
+TEST(NetworkImpairmentTest, RateCap) {
+    impairment_profile profile;
+    profile.rate_kbps = 1000; // 125 bytes a ms
+    profile.queue_ms = 5;
+    impaired_link link(profile, 1);
+    std::vector<uint64_t> deliver_times_us;
+
+    // a burst at once: every packet waits for the ones before it, until the queue is full.
+    for (int i = 0; i < 10; ++i)
+    {
+        link.send(0, 125, &deliver_times_us);
+        if (i <= 5)
+        {
+            ASSERT_EQ(deliver_times_us.size(), 1u);
+            EXPECT_EQ(deliver_times_us[0], (uint64_t)(i + 1) * 1000);
+        }
+        else
+        {
+            EXPECT_TRUE(deliver_times_us.empty());
+        }
+    }
+    EXPECT_EQ(link.stats().queue_dropped, 4u);
+
+    // drained
+    link.send(100000, 125, &deliver_times_us);
+    ASSERT_EQ(deliver_times_us.size(), 1u);
+    EXPECT_EQ(deliver_times_us[0], 101000u);
+}
@@ -0,0 +1,127 @@
+#include "gtest_util.hpp"
+#include "../server_lib/packet_capture.hpp"
+#include "../util/connect_packet.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace kcp_svr;
+using boost::asio::ip::udp;
+
+static void append_uint32_le(std::string& buf, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        buf.push_back((char)((value >> (i * 8)) & 0xff));
+}
+
+// a push segment of kcp with len bytes payload.
+static std::string making_kcp_push(uint32_t conv, uint32_t sn, uint32_t una, uint32_t len)
+{
+    std::string buf;
+    append_uint32_le(buf, conv);
+    buf.push_back((char)81); // IKCP_CMD_PUSH
+    buf.push_back((char)0);  // frg
+    buf.push_back((char)128); buf.push_back((char)0); // wnd
+    append_uint32_le(buf, 1000); // ts
+    append_uint32_le(buf, sn);
+    append_uint32_le(buf, una);
+    append_uint32_le(buf, len);
+    buf.append(len, 'x');
+    return buf;
+}
+
+TEST(PacketCaptureTest, GrabConv) {
+    const std::string push = making_kcp_push(1001, 0, 0, 10);
+    EXPECT_EQ(packet_capture_ring::grab_conv(push.c_str(), push.size()), 1001u);
+
+    const std::string connect = asio_kcp::making_connect_packet();
+    EXPECT_EQ(packet_capture_ring::grab_conv(connect.c_str(), connect.size()), 0u);
+
+    const std::string send_back = asio_kcp::making_send_back_conv_packet(1002, 0x1234);
+    EXPECT_EQ(packet_capture_ring::grab_conv(send_back.c_str(), send_back.size()), 1002u);
+
+    const std::string resume = asio_kcp::making_resume_packet(1003, 0x1234);
+    EXPECT_EQ(packet_capture_ring::grab_conv(resume.c_str(), resume.size()), 1003u);
+
+    EXPECT_EQ(packet_capture_ring::grab_conv("ab", 2), 0u);
+}
+
+TEST(PacketCaptureTest, RingWrapAround) {
+    packet_capture_ring ring;
+    const udp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 39836);
+
+    std::vector<packet_capture_record> records;
+    ring.snapshot(&records);
+    EXPECT_TRUE(records.empty());
+
+    const uint32_t total = ASIO_KCP_PACKET_CAPTURE_SIZE + 10;
+    for (uint32_t sn = 0; sn < total; ++sn)
+    {
+        const std::string push = making_kcp_push(1001, sn, 0, 500);
+        ring.record(sn % 2 == 0 ? ePacketIn : ePacketOut, endpoint, push.c_str(), push.size());
+    }
+
+    ring.snapshot(&records);
+    ASSERT_EQ(records.size(), (size_t)ASIO_KCP_PACKET_CAPTURE_SIZE);
+
+    // oldest first, the first 10 are overwritten
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        uint32_t sn = 0;
+        memcpy(&sn, records[i].data + 12, 4);
+        EXPECT_EQ(sn, (uint32_t)(i + 10));
+    }
+    EXPECT_EQ(records[0].size, 524u);
+    EXPECT_EQ(records[0].captured_len, (uint8_t)ASIO_KCP_PACKET_CAPTURE_SNAP_LEN);
+    EXPECT_EQ(records[0].conv, 1001u);
+    EXPECT_EQ(records[0].remote_port, 39836);
+    EXPECT_EQ(records[0].remote_addr, 0x7f000001u);
+}
+
+TEST(PacketCaptureTest, PcapngRoundTrip) {
+    packet_capture_ring ring;
+    const udp::endpoint client(boost::asio::ip::address::from_string("10.0.0.2"), 40000);
+    const udp::endpoint local(boost::asio::ip::address::from_string("10.0.0.1"), 12345);
+
+    const std::string connect = asio_kcp::making_connect_packet();
+    const std::string send_back = asio_kcp::making_send_back_conv_packet(1001, 0x1234);
+    const std::string push = making_kcp_push(1001, 3, 2, 500);
+    ring.record(ePacketIn, client, connect.c_str(), connect.size());
+    ring.record(ePacketOut, client, send_back.c_str(), send_back.size());
+    ring.record(ePacketIn, client, push.c_str(), push.size());
+
+    std::vector<packet_capture_record> records;
+    ring.snapshot(&records);
+    ASSERT_EQ(records.size(), 3u);
+
+    char path[] = "/tmp/asio_kcp_packet_capture_test_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    EXPECT_TRUE(write_pcapng_file(path, records, local));
+    std::vector<packet_capture_record> read_records;
+    EXPECT_TRUE(read_pcapng_file(path, &read_records));
+    unlink(path);
+
+    ASSERT_EQ(read_records.size(), records.size());
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        EXPECT_EQ(read_records[i].time_us, records[i].time_us);
+        EXPECT_EQ(read_records[i].remote_addr, records[i].remote_addr);
+        EXPECT_EQ(read_records[i].remote_port, records[i].remote_port);
+        EXPECT_EQ(read_records[i].direction, records[i].direction);
+        EXPECT_EQ(read_records[i].size, records[i].size);
+        EXPECT_EQ(read_records[i].conv, records[i].conv);
+        ASSERT_EQ(read_records[i].captured_len, records[i].captured_len);
+        EXPECT_EQ(memcmp(read_records[i].data, records[i].data, records[i].captured_len), 0);
+    }
+
+    const std::string line = packet_capture_record_str(read_records[2]);
+    EXPECT_NE(line.find(" in  10.0.0.2:40000 conv:1001 size:524"), std::string::npos) << line;
+    EXPECT_NE(line.find("push sn:3 una:2"), std::string::npos) << line;
+
+    EXPECT_FALSE(read_pcapng_file("/nonexistent/asio_kcp.pcapng", &read_records));
+}
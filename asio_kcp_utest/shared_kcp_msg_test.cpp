@@ -0,0 +1,94 @@
+#include "gtest_util.hpp"
+#include "../server_lib/connection.hpp"
+#include "../util/ikcp.h"
+#include <string>
+#include <vector>
+
+using namespace kcp_svr;
+
+namespace {
+
+// a sender kcp and its receiver, packets delivered at once.
+struct KcpLink
+{
+    KcpLink()
+    {
+        sender = ikcp_create(1, this);
+        receiver = ikcp_create(1, this);
+        sender->output = &KcpLink::sender_output;
+        receiver->output = &KcpLink::receiver_output;
+        ikcp_nodelay(sender, 1, 10, 1, 1);
+        ikcp_nodelay(receiver, 1, 10, 1, 1);
+        ikcp_setref(sender, &shared_kcp_msg::retain, &shared_kcp_msg::release);
+    }
+
+    ~KcpLink()
+    {
+        ikcp_release(sender);
+        ikcp_release(receiver);
+    }
+
+    static int sender_output(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        ikcp_input(((KcpLink*)user)->receiver, buf, len);
+        return 0;
+    }
+
+    static int receiver_output(const char* buf, int len, ikcpcb* kcp, void* user)
+    {
+        ikcp_input(((KcpLink*)user)->sender, buf, len);
+        return 0;
+    }
+
+    std::string recv(void)
+    {
+        std::vector<char> buf(64 * 1024);
+        const int len = ikcp_recv(receiver, buf.data(), buf.size());
+        return (len < 0 ? std::string() : std::string(buf.data(), len));
+    }
+
+    ikcpcb* sender;
+    ikcpcb* receiver;
+};
+
+} // namespace
+
+TEST(SharedKcpMsgTest, ReleasedAfterAllAcked) {
+    std::shared_ptr<std::string> msg = std::make_shared<std::string>(3000, 'a'); // 3 segments
+    (*msg)[2999] = 'z';
+    std::weak_ptr<std::string> weak_msg = msg;
+
+    KcpLink links[3];
+    shared_kcp_msg* shared_msg = shared_kcp_msg::create(msg);
+    for (size_t i = 0; i < 3; ++i)
+        EXPECT_EQ(ikcp_send_ref(links[i].sender, shared_msg->msg().data(), shared_msg->msg().size(), shared_msg), 0);
+    shared_kcp_msg::release(shared_msg);
+    msg.reset();
+    EXPECT_FALSE(weak_msg.expired()); // held by the segments
+
+    // the first link acks all, the msg is still in the others
+    ikcp_update(links[0].sender, 100);
+    ikcp_update(links[0].receiver, 100);
+    EXPECT_EQ(links[0].recv(), std::string(2999, 'a') + "z");
+    EXPECT_EQ(ikcp_waitsnd(links[0].sender), 0);
+    EXPECT_FALSE(weak_msg.expired());
+
+    ikcp_update(links[1].sender, 100);
+    ikcp_update(links[1].receiver, 100);
+    EXPECT_EQ(links[1].recv(), std::string(2999, 'a') + "z");
+    EXPECT_FALSE(weak_msg.expired());
+
+    // the last link is released before any ack
+    ikcp_release(links[2].sender);
+    links[2].sender = ikcp_create(1, &links[2]);
+    EXPECT_TRUE(weak_msg.expired());
+}
+
+TEST(SharedKcpMsgTest, NoRefHooks) {
+    KcpLink link;
+    ikcp_setref(link.sender, NULL, NULL);
+    shared_kcp_msg* shared_msg = shared_kcp_msg::create(std::make_shared<std::string>("abc"));
+    EXPECT_EQ(ikcp_send_ref(link.sender, shared_msg->msg().data(), shared_msg->msg().size(), shared_msg), -3);
+    EXPECT_EQ(ikcp_waitsnd(link.sender), 0);
+    shared_kcp_msg::release(shared_msg);
+}
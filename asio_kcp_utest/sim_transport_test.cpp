@@ -0,0 +1,283 @@
+#include "gtest_util.hpp"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "../client_lib/kcp_client.hpp"
+#include "../server_lib/connection_manager.hpp"
+#include "../server_lib/network_impairment.hpp"
+#include "../util/kcp_clock.hpp"
+
+using namespace kcp_svr;
+
+namespace {
+
+// Discrete event simulation of one server and many clients in one thread.
+// Every udp packet goes through an impaired_link and is delivered at its deliver time of the virtual clock.
+// Nothing depends on the real time, so a run is reproduced exactly by the seed.
+class kcp_sim
+{
+public:
+    struct result
+    {
+        size_t connected;
+        size_t echoes;
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t last_echo_us;
+        std::vector<uint64_t> echo_us;  // the times of all echoes, in order
+    };
+
+    kcp_sim(size_t client_count, const impairment_profile& profile, uint32_t seed) :
+        packet_seq_(0)
+    {
+        server_endpoint_ = udp::endpoint(boost::asio::ip::address_v4::from_string("10.0.0.1"), 4000);
+        server_transport_ = std::make_shared<memory_server_transport>(server_endpoint_,
+                std::bind(&kcp_sim::server_output, this, std::placeholders::_1, std::placeholders::_2,
+                    std::placeholders::_4));
+        server_ = std::make_shared<connection_manager>(io_service_, server_transport_, &clock_);
+        server_->set_callback(std::bind(&kcp_sim::server_event, this,
+                    std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+        for (size_t i = 0; i < client_count; ++i)
+        {
+            struct sockaddr_in addr;
+            bzero(&addr, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl((10u << 24) + (1u << 16) + i + 1);
+            addr.sin_port = htons(5000);
+
+            std::unique_ptr<client_node> node(new client_node(this, addr, profile, seed + 2 * i));
+            node->client.set_transport(&node->transport);
+            node->client.set_clock(&clock_);
+            node->client.set_event_callback(kcp_sim::client_event, node.get());
+            clients_.push_back(std::move(node));
+        }
+    }
+
+    ~kcp_sim(void)
+    {
+        server_->stop_all();
+    }
+
+    // connect all the clients, send msg_count msgs from every client after connected, and run until end_us.
+    result run(size_t msg_count, uint64_t end_us)
+    {
+        msg_count_ = msg_count;
+        for (size_t i = 0; i < clients_.size(); ++i)
+            EXPECT_EQ(clients_[i]->client.connect_async(0, "10.0.0.1", 4000), 0);
+
+        for (uint64_t tick_us = 0; tick_us <= end_us; tick_us += KCP_UPDATE_INTERVAL * 1000)
+        {
+            while (!packets_.empty() && packets_.top().deliver_us <= tick_us)
+            {
+                const sim_packet& p = packets_.top();
+                clock_.set_us(p.deliver_us);
+                if (p.to_client < 0)
+                    server_transport_->deliver(p.data.data(), p.data.size(), p.from);
+                else
+                    clients_[p.to_client]->transport.deliver(p.data.data(), p.data.size(), to_sockaddr(p.from));
+                packets_.pop();
+            }
+            clock_.set_us(tick_us);
+            server_->update();
+            for (size_t i = 0; i < clients_.size(); ++i)
+                clients_[i]->client.update();
+        }
+
+        result r = result();
+        for (size_t i = 0; i < clients_.size(); ++i)
+        {
+            const client_node& node = *clients_[i];
+            r.connected += (node.connected ? 1 : 0);
+            r.echoes += node.echoes;
+            r.packets += node.up.stats().packets + node.down.stats().packets;
+            r.lost += node.up.stats().lost + node.down.stats().lost;
+        }
+        r.echo_us = echo_us_;
+        r.last_echo_us = (echo_us_.empty() ? 0 : echo_us_.back());
+        return r;
+    }
+
+    void get_server_latency_stats(latency_stats* stats) const
+    {
+        server_->get_latency_stats(stats);
+    }
+
+private:
+    struct client_node
+    {
+        client_node(kcp_sim* s, const struct sockaddr_in& addr, const impairment_profile& profile, uint32_t seed) :
+            sim(s), transport(addr, &kcp_sim::client_output, this), up(profile, seed), down(profile, seed + 1),
+            connected(false), echoes(0) {}
+
+        kcp_sim* sim;
+        asio_kcp::memory_client_transport transport;
+        asio_kcp::kcp_client client;
+        impaired_link up;
+        impaired_link down;
+        bool connected;
+        size_t echoes;
+    };
+
+    struct sim_packet
+    {
+        uint64_t deliver_us;
+        uint64_t seq;
+        int to_client;  // -1: to server
+        udp::endpoint from;
+        std::string data;
+
+        bool operator<(const sim_packet& other) const
+        {
+            // priority_queue pops the greatest. The earliest first, FIFO if the same time.
+            if (deliver_us != other.deliver_us)
+                return deliver_us > other.deliver_us;
+            return seq > other.seq;
+        }
+    };
+
+    static udp::endpoint to_endpoint(const struct sockaddr_in& addr)
+    {
+        return udp::endpoint(boost::asio::ip::address_v4(ntohl(addr.sin_addr.s_addr)), ntohs(addr.sin_port));
+    }
+
+    static struct sockaddr_in to_sockaddr(const udp::endpoint& ep)
+    {
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(ep.address().to_v4().to_ulong());
+        addr.sin_port = htons(ep.port());
+        return addr;
+    }
+
+    void schedule(impaired_link& link, int to_client, const udp::endpoint& from, const char* data, size_t len)
+    {
+        deliver_times_.clear();
+        link.send(clock_.now_us(), len, &deliver_times_);
+        for (size_t i = 0; i < deliver_times_.size(); ++i)
+        {
+            sim_packet p;
+            p.deliver_us = deliver_times_[i];
+            p.seq = packet_seq_++;
+            p.to_client = to_client;
+            p.from = from;
+            p.data.assign(data, len);
+            packets_.push(p);
+        }
+    }
+
+    static void client_output(const char* buf, size_t len, const struct sockaddr_in& from_addr,
+            const struct sockaddr_in& /*to_addr*/, void* var)
+    {
+        client_node* node = static_cast<client_node*>(var);
+        node->sim->schedule(node->up, -1, to_endpoint(from_addr), buf, len);
+    }
+
+    void server_output(const char* data, size_t len, const udp::endpoint& to)
+    {
+        const size_t index = (to.address().to_v4().to_ulong() & 0xffff) - 1;
+        ASSERT_LT(index, clients_.size());
+        schedule(clients_[index]->down, (int)index, server_endpoint_, data, len);
+    }
+
+    void server_event(kcp_conv_t conv, eEventType event_type, std::shared_ptr<std::string> msg)
+    {
+        if (event_type == kcp_svr::eRcvMsg)
+            server_->send_msg(conv, msg);
+    }
+
+    static void client_event(kcp_conv_t /*conv*/, asio_kcp::eEventType event_type, const std::string& /*msg*/, void* var)
+    {
+        client_node* node = static_cast<client_node*>(var);
+        if (event_type == asio_kcp::eConnect)
+        {
+            node->connected = true;
+            for (size_t i = 0; i < node->sim->msg_count_; ++i)
+                node->client.send_msg(std::string(100, 'a' + i % 26));
+        }
+        else if (event_type == asio_kcp::eRcvMsg)
+        {
+            node->echoes++;
+            node->sim->echo_us_.push_back(node->sim->clock_.now_us());
+        }
+    }
+
+    asio_kcp::virtual_kcp_clock clock_;
+    boost::asio::io_service io_service_;
+    udp::endpoint server_endpoint_;
+    std::shared_ptr<memory_server_transport> server_transport_;
+    connection_manager::shared_ptr server_;
+    std::vector<std::unique_ptr<client_node> > clients_;
+    std::priority_queue<sim_packet> packets_;
+    uint64_t packet_seq_;
+    std::vector<uint64_t> deliver_times_;
+    size_t msg_count_;
+    std::vector<uint64_t> echo_us_;
+};
+
+} // namespace
+
+TEST(SimTransportTest, ManyClientsPerfectLink) {
+    impairment_profile profile;
+    profile.delay_ms = 10;
+
+    kcp_sim sim(200, profile, 1);
+    const kcp_sim::result r = sim.run(5, 2 * 1000 * 1000);
+    EXPECT_EQ(r.connected, 200u);
+    EXPECT_EQ(r.echoes, 200u * 5);
+    EXPECT_EQ(r.lost, 0u);
+    // connect and echo: 2 RTTs of 20ms and some kcp update intervals.
+    EXPECT_LT(r.last_echo_us, 200 * 1000u);
+}
+
+TEST(SimTransportTest, ServerRttBetweenTicks) {
+    impairment_profile profile;
+    profile.delay_ms = 1;
+
+    kcp_sim sim(10, profile, 3);
+    const kcp_sim::result r = sim.run(5, 1000 * 1000);
+    EXPECT_EQ(r.echoes, 10u * 5);
+
+    // the echo is sent at a tick of the server, and acked at the next tick of the client: 1 + 5 milliseconds later.
+    // The ack arrives between two ticks of the server, one millisecond after its last tick.
+    latency_stats stats;
+    sim.get_server_latency_stats(&stats);
+    EXPECT_GT(stats.rtt_us.count, 0u);
+    EXPECT_GE(stats.rtt_us.min, 6 * 1000u);
+    EXPECT_LT(stats.rtt_us.max, 7 * 1000u);
+}
+
+TEST(SimTransportTest, ManyClientsLossyLink) {
+    impairment_profile profile;
+    ASSERT_TRUE(get_builtin_impairment_profile("network_very_lag", &profile));
+
+    kcp_sim sim(1000, profile, 7);
+    const kcp_sim::result r = sim.run(10, 20 * 1000 * 1000);
+    EXPECT_EQ(r.connected, 1000u);
+    EXPECT_EQ(r.echoes, 1000u * 10);
+    EXPECT_GT(r.lost, 0u);
+}
+
+TEST(SimTransportTest, SameSeedSameRun) {
+    impairment_profile profile;
+    ASSERT_TRUE(get_builtin_impairment_profile("china_union_3g", &profile));
+
+    kcp_sim sim1(50, profile, 11);
+    const kcp_sim::result r1 = sim1.run(10, 10 * 1000 * 1000);
+    kcp_sim sim2(50, profile, 11);
+    const kcp_sim::result r2 = sim2.run(10, 10 * 1000 * 1000);
+    EXPECT_EQ(r1.echoes, 50u * 10);
+    EXPECT_EQ(r1.packets, r2.packets);
+    EXPECT_EQ(r1.lost, r2.lost);
+    EXPECT_EQ(r1.echo_us, r2.echo_us);
+
+    kcp_sim sim3(50, profile, 12);
+    const kcp_sim::result r3 = sim3.run(10, 10 * 1000 * 1000);
+    EXPECT_EQ(r3.echoes, 50u * 10);
+    EXPECT_NE(r1.echo_us, r3.echo_us);
+}
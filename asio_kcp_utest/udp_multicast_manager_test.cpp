@@ -0,0 +1,165 @@
+#include "gtest_util.hpp"
+#include "../server_lib/udp_multicast_manager.hpp"
+#include "../util/multicast_packet.hpp"
+#include <dirent.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kcp_svr;
+using boost::asio::ip::udp;
+
+namespace {
+
+// A manager running in its own io_service thread. The groups send to a udp socket on 127.0.0.1 instead of a multicast address.
+class UdpMulticastManagerTest : public ::testing::Test
+{
+protected:
+    UdpMulticastManagerTest() :
+        work_(new boost::asio::io_service::work(io_service_)),
+        manager_(io_service_),
+        receiver_(io_service_, udp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0))
+    {
+        thread_ = std::thread([this]() { io_service_.run(); });
+    }
+
+    ~UdpMulticastManagerTest()
+    {
+        manager_.stop();
+        work_.reset();
+        io_service_.stop();
+        thread_.join();
+    }
+
+    uint32_t create_group(void)
+    {
+        return manager_.create_group("127.0.0.1", receiver_.local_endpoint().port());
+    }
+
+    // the packets received by the receiver in timeout_ms, at most count. *sender is the socket of the group.
+    std::vector<std::string> recv_packets(size_t count, int timeout_ms, udp::endpoint* sender = NULL)
+    {
+        std::vector<std::string> packets;
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (packets.size() < count && std::chrono::steady_clock::now() < deadline)
+        {
+            if (receiver_.available() == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            char buf[1500];
+            udp::endpoint from;
+            const size_t len = receiver_.receive_from(boost::asio::buffer(buf), from);
+            packets.push_back(std::string(buf, len));
+            if (sender)
+                *sender = from;
+        }
+        return packets;
+    }
+
+    boost::asio::io_service io_service_;
+    std::unique_ptr<boost::asio::io_service::work> work_;
+    UdpMulticastManager manager_;
+    udp::socket receiver_;
+    std::thread thread_;
+};
+
+} // namespace
+
+TEST_F(UdpMulticastManagerTest, LowPacingRateDrains) {
+    const uint32_t group_id = create_group();
+    ASSERT_NE(group_id, 0u);
+
+    // 100 bytes at 100 B/s. The burst of the rate is less than one byte.
+    ASSERT_TRUE(manager_.set_pacing_rate(group_id, 100));
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i)
+        manager_.send_to_group(group_id, std::string(10 - ASIO_KCP_MC_HEADER_SIZE, 'a' + i));
+
+    const std::vector<std::string> packets = recv_packets(10, 5000);
+    const int64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(packets.size(), 10u);
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_EQ(asio_kcp::get_mc_packet_type(packets[i].data(), packets[i].size()), asio_kcp::eMcPacketRaw);
+        EXPECT_EQ(packets[i].substr(ASIO_KCP_MC_HEADER_SIZE), std::string(10 - ASIO_KCP_MC_HEADER_SIZE, 'a' + i));
+    }
+    EXPECT_GE(elapsed_ms, 500); // paced, not sent at once
+    EXPECT_NE(manager_.get_group_info(group_id).find("Send Queue: 0\n"), std::string::npos);
+}
+
+// the seqs of the reliable packets, skipping heartbeats.
+static std::vector<uint32_t> reliable_seqs(const std::vector<std::string>& packets)
+{
+    std::vector<uint32_t> seqs;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        if (asio_kcp::get_mc_packet_type(packets[i].data(), packets[i].size()) == asio_kcp::eMcPacketReliable)
+            seqs.push_back(asio_kcp::grab_seq_from_mc_packet(packets[i].data(), packets[i].size()));
+    }
+    return seqs;
+}
+
+TEST_F(UdpMulticastManagerTest, NackOnlyFromKnownReceiver) {
+    const uint32_t group_id = create_group();
+    ASSERT_NE(group_id, 0u);
+    for (int i = 0; i < 3; ++i)
+        EXPECT_EQ(manager_.send_reliable_to_group(group_id, std::string(10, 'a' + i)), 0);
+
+    udp::endpoint group_socket;
+    EXPECT_EQ(reliable_seqs(recv_packets(3, 1000, &group_socket)).size(), 3u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ASIO_KCP_MULTICAST_RETRANSMIT_HOLDOFF + 10));
+
+    std::vector<asio_kcp::mc_nack_range> ranges(1);
+    ranges[0].first_seq = 1;
+    ranges[0].count = 1;
+    const std::string nack = asio_kcp::making_mc_nack_packet(ranges);
+
+    // never fed back: ignored
+    receiver_.send_to(boost::asio::buffer(nack), group_socket);
+    EXPECT_TRUE(reliable_seqs(recv_packets(100, 200)).empty());
+    EXPECT_NE(manager_.get_group_info(group_id).find("Nack Unknown: 1\n"), std::string::npos);
+
+    // known after a feedback
+    receiver_.send_to(boost::asio::buffer(asio_kcp::making_mc_feedback_packet(1, std::vector<uint8_t>())), group_socket);
+    receiver_.send_to(boost::asio::buffer(nack), group_socket);
+    std::vector<uint32_t> seqs = reliable_seqs(recv_packets(100, 200));
+    ASSERT_EQ(seqs.size(), 1u);
+    EXPECT_EQ(seqs[0], 1u);
+    EXPECT_NE(manager_.get_group_info(group_id).find("Retransmitted: 1\n"), std::string::npos);
+}
+
+static size_t open_fd_count(void)
+{
+    size_t count = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL)
+        return 0;
+    while (readdir(dir) != NULL)
+        count++;
+    closedir(dir);
+    return count;
+}
+
+TEST_F(UdpMulticastManagerTest, DeleteGroupWhileSending) {
+    const size_t fd_count = open_fd_count();
+    for (int i = 0; i < 200; ++i)
+    {
+        const uint32_t group_id = create_group();
+        ASSERT_NE(group_id, 0u);
+        for (int k = 0; k < 20; ++k)
+        {
+            manager_.send_to_group(group_id, std::string(100, 'a'));
+            manager_.send_reliable_to_group(group_id, std::string(100, 'b'));
+        }
+        EXPECT_TRUE(manager_.delete_group(group_id));
+        EXPECT_FALSE(manager_.delete_group(group_id));
+    }
+
+    // the sockets are closed after the sends and receives in flight.
+    recv_packets(200 * 40, 500);
+    EXPECT_EQ(open_fd_count(), fd_count);
+}
@@ -0,0 +1,3 @@
+// ikcp built with the flags of the bench (-O2 -DNDEBUG).
+// client_lib and server_lib build util/ with -g3 and no optimization, their archives are not for measuring.
+#include "../util/ikcp.c"
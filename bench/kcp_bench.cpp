@@ -0,0 +1,299 @@
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../util/ikcp.h"
+
+/*
+ * Microbenchmarks of util/ikcp.c. No socket, the packets are passed in memory.
+ *
+ * Every kcp uses the settings of asio_kcp: ikcp_nodelay(kcp, 1, interval, 1, 1), with windows big enough
+ *   for the largest case. So the numbers show the cost of the kcp engine itself, not of the flow control.
+ * The results are written to kcp_bench.json by default (--benchmark_out to change it).
+ *   Compare two runs on the same machine by tools/compare.py of google benchmark:
+ *     compare.py benchmarks before.json after.json
+ */
+
+#define BENCH_CONV 1001
+#define BENCH_WND 2048
+#define BENCH_INTERVAL 10
+
+// the packets output by a kcp. Reused without allocation in steady state.
+struct packet_sink
+{
+    std::vector<char> data;
+    std::vector<size_t> ends;
+
+    size_t count(void) const {return ends.size();}
+    const char* packet(size_t i) const {return &data[i == 0 ? 0 : ends[i - 1]];}
+    long packet_size(size_t i) const {return (long)(ends[i] - (i == 0 ? 0 : ends[i - 1]));}
+    void clear(void) {data.clear(); ends.clear();}
+
+    void input_all_to(ikcpcb* kcp)
+    {
+        for (size_t i = 0; i < count(); ++i)
+            ikcp_input(kcp, packet(i), packet_size(i));
+        clear();
+    }
+};
+
+static int sink_output(const char* buf, int len, ikcpcb* kcp, void* user)
+{
+    packet_sink* sink = (packet_sink*)user;
+    sink->data.insert(sink->data.end(), buf, buf + len);
+    sink->ends.push_back(sink->data.size());
+    return 0;
+}
+
+static int drop_output(const char* buf, int len, ikcpcb* kcp, void* user)
+{
+    return 0;
+}
+
+static ikcpcb* create_bench_kcp(packet_sink* sink)
+{
+    ikcpcb* kcp = ikcp_create(BENCH_CONV, sink);
+    kcp->output = (sink ? &sink_output : &drop_output);
+    ikcp_nodelay(kcp, 1, BENCH_INTERVAL, 1, 1);
+    ikcp_wndsize(kcp, BENCH_WND, BENCH_WND);
+    kcp->rmt_wnd = BENCH_WND; // as if the peer had told its window
+    ikcp_update(kcp, 0);
+    return kcp;
+}
+
+static int get_default_mss(void)
+{
+    ikcpcb* kcp = ikcp_create(BENCH_CONV, NULL);
+    const int mss = (int)kcp->mss;
+    ikcp_release(kcp);
+    return mss;
+}
+
+static int fragment_count(int msg_size)
+{
+    static const int mss = get_default_mss();
+    return msg_size <= mss ? 1 : (msg_size + mss - 1) / mss;
+}
+
+// the packets of msg_count msgs, one packet for every flush.
+static void make_push_packets(int msg_size, int msg_count, packet_sink* out)
+{
+    ikcpcb* sender = create_bench_kcp(out);
+    const std::string msg(msg_size, 'x');
+    for (int i = 0; i < msg_count; ++i)
+    {
+        ikcp_send(sender, msg.data(), (int)msg.size());
+        ikcp_flush(sender);
+    }
+    ikcp_release(sender);
+}
+
+// ikcp_send of one msg, fragmenting into snd_queue.
+static void BM_Send(benchmark::State& state)
+{
+    const int msg_size = (int)state.range(0);
+    const int batch = std::max(1, BENCH_WND / 2 / fragment_count(msg_size));
+    const std::string msg(msg_size, 'x');
+
+    ikcpcb* kcp = create_bench_kcp(NULL);
+    int sent = 0;
+    for (auto _ : state)
+    {
+        if (sent == batch)
+        {
+            state.PauseTiming();
+            ikcp_release(kcp);
+            kcp = create_bench_kcp(NULL);
+            sent = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(ikcp_send(kcp, msg.data(), msg_size));
+        sent++;
+    }
+    ikcp_release(kcp);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * msg_size);
+}
+BENCHMARK(BM_Send)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+// ikcp_recv of one msg, merging the fragments in rcv_queue.
+static void BM_Recv(benchmark::State& state)
+{
+    const int msg_size = (int)state.range(0);
+    const int batch = std::max(1, BENCH_WND / 2 / fragment_count(msg_size));
+    packet_sink packets;
+    make_push_packets(msg_size, batch, &packets);
+    std::vector<char> buf(msg_size);
+
+    ikcpcb* kcp = NULL;
+    int recved = batch;
+    for (auto _ : state)
+    {
+        if (recved == batch)
+        {
+            state.PauseTiming();
+            if (kcp)
+                ikcp_release(kcp);
+            kcp = create_bench_kcp(NULL);
+            for (size_t i = 0; i < packets.count(); ++i)
+                ikcp_input(kcp, packets.packet(i), packets.packet_size(i));
+            recved = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(ikcp_recv(kcp, &buf[0], msg_size));
+        recved++;
+    }
+    ikcp_release(kcp);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * msg_size);
+}
+BENCHMARK(BM_Recv)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+// a msg from one kcp to another in memory: send, flush, input, recv, and the ack back.
+static void BM_SendRecv(benchmark::State& state)
+{
+    const int msg_size = (int)state.range(0);
+    const std::string msg(msg_size, 'x');
+    std::vector<char> buf(msg_size);
+    packet_sink a_to_b;
+    packet_sink b_to_a;
+    ikcpcb* a = create_bench_kcp(&a_to_b);
+    ikcpcb* b = create_bench_kcp(&b_to_a);
+
+    for (auto _ : state)
+    {
+        ikcp_send(a, msg.data(), msg_size);
+        ikcp_flush(a);
+        a_to_b.input_all_to(b);
+        benchmark::DoNotOptimize(ikcp_recv(b, &buf[0], msg_size));
+        ikcp_flush(b);
+        b_to_a.input_all_to(a);
+    }
+    ikcp_release(a);
+    ikcp_release(b);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * msg_size);
+}
+BENCHMARK(BM_SendRecv)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+enum eInputOrder
+{
+    eInputInOrder = 0,
+    eInputOutOfOrder = 1,  // shuffled. Segments wait in rcv_buf.
+    eInputDuplicate = 2,   // in order, every packet twice. As resent by a spurious rto.
+};
+
+// ikcp_input of 512 push segments of 64 bytes into a new kcp. One iteration is the whole batch.
+static void BM_Input(benchmark::State& state)
+{
+    const eInputOrder order = (eInputOrder)state.range(0);
+    const int segment_count = 512;
+    packet_sink packets;
+    make_push_packets(64, segment_count, &packets);
+
+    std::vector<size_t> input_order;
+    for (size_t i = 0; i < packets.count(); ++i)
+    {
+        input_order.push_back(i);
+        if (order == eInputDuplicate)
+            input_order.push_back(i);
+    }
+    if (order == eInputOutOfOrder)
+        std::shuffle(input_order.begin(), input_order.end(), std::mt19937(1));
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        ikcpcb* kcp = create_bench_kcp(NULL);
+        state.ResumeTiming();
+
+        for (size_t i = 0; i < input_order.size(); ++i)
+            ikcp_input(kcp, packets.packet(input_order[i]), packets.packet_size(input_order[i]));
+
+        state.PauseTiming();
+        ikcp_release(kcp);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * input_order.size());
+    state.SetLabel(order == eInputInOrder ? "in_order" : (order == eInputOutOfOrder ? "out_of_order" : "duplicate"));
+}
+BENCHMARK(BM_Input)->Arg(eInputInOrder)->Arg(eInputOutOfOrder)->Arg(eInputDuplicate);
+
+// ikcp_flush with N segments in flight (in snd_buf, sent and waiting for ack). No one needs resending.
+static void BM_Flush(benchmark::State& state)
+{
+    const int in_flight = (int)state.range(0);
+    ikcpcb* kcp = create_bench_kcp(NULL);
+    const std::string msg(64, 'x');
+    for (int i = 0; i < in_flight; ++i)
+        ikcp_send(kcp, msg.data(), (int)msg.size());
+    ikcp_flush(kcp); // the first transmit of all
+
+    for (auto _ : state)
+        ikcp_flush(kcp);
+
+    state.counters["snd_buf"] = kcp->nsnd_buf;
+    ikcp_release(kcp);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Flush)->Arg(0)->Arg(16)->Arg(128)->Arg(512)->Arg(BENCH_WND);
+
+// ikcp_update of N connections for one interval, as update_all_kcp of the server.
+//   range(1): 0 for idle connections, 1 for connections with an unacked segment (resent by rto as time goes).
+static void BM_Update(benchmark::State& state)
+{
+    const int conn_count = (int)state.range(0);
+    const bool with_unacked = (state.range(1) != 0);
+    std::vector<ikcpcb*> kcps;
+    for (int i = 0; i < conn_count; ++i)
+    {
+        ikcpcb* kcp = create_bench_kcp(NULL);
+        kcp->dead_link = 0xffffffff; // keep resending, never dead
+        if (with_unacked)
+            ikcp_send(kcp, "ping", 4);
+        kcps.push_back(kcp);
+    }
+
+    IUINT32 clock = 0;
+    for (auto _ : state)
+    {
+        clock += BENCH_INTERVAL;
+        for (size_t i = 0; i < kcps.size(); ++i)
+            ikcp_update(kcps[i], clock);
+    }
+
+    for (size_t i = 0; i < kcps.size(); ++i)
+        ikcp_release(kcps[i]);
+    state.SetItemsProcessed(state.iterations() * conn_count);
+}
+BENCHMARK(BM_Update)->ArgsProduct({{1, 100, 1000, 10000}, {0, 1}});
+
+int main(int argc, char** argv)
+{
+    // json output by default
+    std::vector<char*> args(argv, argv + argc);
+    bool has_out = false;
+    for (int i = 1; i < argc; ++i)
+        if (strncmp(argv[i], "--benchmark_out=", strlen("--benchmark_out=")) == 0)
+            has_out = true;
+    static char out_arg[] = "--benchmark_out=kcp_bench.json";
+    static char out_format_arg[] = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(out_arg);
+        args.push_back(out_format_arg);
+    }
+    args.push_back(NULL);
+
+    int args_count = (int)args.size() - 1;
+    benchmark::Initialize(&args_count, &args[0]);
+    if (benchmark::ReportUnrecognizedArguments(args_count, &args[0]))
+        return 1;
+    benchmark::AddCustomContext("ikcp_mss", std::to_string(get_default_mss()));
+    benchmark::AddCustomContext("ikcp_wnd", std::to_string(BENCH_WND));
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
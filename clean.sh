@@ -1,7 +1,12 @@
 OLD_PWD="$( pwd )"
 
 cd ./client_with_asio/ && make clean && \
+    cd ../echo_bench/ && make clean && \
     cd ../server/ && make clean && \
+    cd ../packet_capture_decoder/ && make clean && \
+    cd ../kcp_trace_to_chrome/ && make clean && \
+    cd ../udp_impair_proxy/ && make clean && \
+    cd ../conn_bench/ && make clean && \
     cd ../server_lib/ && make clean && \
     cd ../asio_kcp_utest/ && make clean && \
     cd ../essential/ && make clean
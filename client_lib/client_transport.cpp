@@ -0,0 +1,207 @@
+#include "client_transport.hpp"
+#include <iostream>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#include "kcp_client.hpp"
+
+namespace asio_kcp {
+
+udp_socket_transport::udp_socket_transport(void) :
+    udp_socket_(-1)
+{
+}
+
+udp_socket_transport::~udp_socket_transport(void)
+{
+    close();
+}
+
+int udp_socket_transport::open(int udp_port_bind)
+{
+    // create udp_socket_
+    {
+        udp_socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (udp_socket_ < 0)
+        {
+            std::cerr << "socket error return with errno: " << errno << " " << strerror(errno) << std::endl;
+            return KCP_ERR_CREATE_SOCKET_FAIL;
+        }
+    }
+
+    // set socket non-blocking
+    {
+        int flags = fcntl(udp_socket_, F_GETFL, 0);
+        if (flags == -1)
+        {
+            std::cerr << "get socket non-blocking: fcntl error return with errno: " << errno << " " << strerror(errno) << std::endl;
+            return KCP_ERR_SET_NON_BLOCK_FAIL;
+        }
+        int ret = fcntl(udp_socket_, F_SETFL, flags | O_NONBLOCK);
+        if (ret == -1)
+        {
+            std::cerr << "set socket non-blocking: fcntl error return with errno: " << errno << " " << strerror(errno) << std::endl;
+            return KCP_ERR_SET_NON_BLOCK_FAIL;
+        }
+    }
+
+    // bind
+    if (udp_port_bind != 0)
+    {
+        struct sockaddr_in bind_addr;
+        bind_addr.sin_family = AF_INET;
+        bind_addr.sin_port = htons(udp_port_bind);
+        bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        int ret_bind = ::bind(udp_socket_, (const struct sockaddr*)(&bind_addr), sizeof(bind_addr));
+        if (ret_bind < 0)
+            std::cerr << "setsockopt error return with errno: " << errno << " " << strerror(errno) << std::endl;
+    }
+
+    return 0;
+}
+
+void udp_socket_transport::close(void)
+{
+    if (udp_socket_ != -1)
+    {
+        ::close(udp_socket_);
+        udp_socket_ = -1;
+    }
+}
+
+int udp_socket_transport::connect(const struct sockaddr_in& servaddr)
+{
+    int ret = ::connect(udp_socket_, (const struct sockaddr*)(&servaddr), sizeof(servaddr));
+    if (ret < 0)
+    {
+        std::cerr << "connect error return with errno: " << errno << " " << strerror(errno) << std::endl;
+        return KCP_ERR_CONNECT_FUNC_FAIL;
+    }
+    return 0;
+}
+
+ssize_t udp_socket_transport::send(const char* buf, size_t len)
+{
+    return ::send(udp_socket_, buf, len, 0);
+}
+
+ssize_t udp_socket_transport::send_to(const char* buf, size_t len, const struct sockaddr_in& addr)
+{
+    return ::sendto(udp_socket_, buf, len, 0, (const struct sockaddr*)(&addr), sizeof(addr));
+}
+
+ssize_t udp_socket_transport::recv(char* buf, size_t len)
+{
+    return ::recv(udp_socket_, buf, len, 0);
+}
+
+ssize_t udp_socket_transport::recv_from(char* buf, size_t len, struct sockaddr_in* from_addr)
+{
+    socklen_t from_addr_len = sizeof(*from_addr);
+    return ::recvfrom(udp_socket_, buf, len, 0, (struct sockaddr*)from_addr, &from_addr_len);
+}
+
+
+static bool same_addr(const struct sockaddr_in& lhs, const struct sockaddr_in& rhs)
+{
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+
+memory_client_transport::memory_client_transport(const struct sockaddr_in& local_addr,
+        memory_transport_output_t* output_func, void* var) :
+    local_addr_(local_addr),
+    output_func_(output_func),
+    output_var_(var),
+    is_open_(false),
+    connected_(false)
+{
+    bzero(&connected_addr_, sizeof(connected_addr_));
+}
+
+int memory_client_transport::open(int udp_port_bind)
+{
+    if (udp_port_bind != 0)
+        local_addr_.sin_port = htons(udp_port_bind);
+    is_open_ = true;
+    connected_ = false;
+    packets_.clear();
+    return 0;
+}
+
+void memory_client_transport::close(void)
+{
+    is_open_ = false;
+    connected_ = false;
+    packets_.clear();
+}
+
+int memory_client_transport::connect(const struct sockaddr_in& servaddr)
+{
+    connected_ = true;
+    connected_addr_ = servaddr;
+    return 0;
+}
+
+ssize_t memory_client_transport::send(const char* buf, size_t len)
+{
+    if (!connected_)
+    {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    return send_to(buf, len, connected_addr_);
+}
+
+ssize_t memory_client_transport::send_to(const char* buf, size_t len, const struct sockaddr_in& addr)
+{
+    if (!is_open_)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    (*output_func_)(buf, len, local_addr_, addr, output_var_);
+    return (ssize_t)len;
+}
+
+ssize_t memory_client_transport::recv(char* buf, size_t len)
+{
+    struct sockaddr_in from_addr;
+    return recv_from(buf, len, &from_addr);
+}
+
+ssize_t memory_client_transport::recv_from(char* buf, size_t len, struct sockaddr_in* from_addr)
+{
+    if (!is_open_)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (packets_.empty())
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // truncated as a udp socket does.
+    const packet& front = packets_.front();
+    const size_t copy_len = (front.data.size() < len ? front.data.size() : len);
+    memcpy(buf, front.data.data(), copy_len);
+    *from_addr = front.from_addr;
+    packets_.pop_front();
+    return (ssize_t)copy_len;
+}
+
+void memory_client_transport::deliver(const char* buf, size_t len, const struct sockaddr_in& from_addr)
+{
+    if (!is_open_ || (connected_ && !same_addr(from_addr, connected_addr_)))
+        return;
+    packets_.push_back(packet());
+    packets_.back().from_addr = from_addr;
+    packets_.back().data.assign(buf, len);
+}
+
+} // namespace asio_kcp
@@ -0,0 +1,108 @@
+#ifndef _ASIO_KCP_CLIENT_TRANSPORT_
+#define _ASIO_KCP_CLIENT_TRANSPORT_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+namespace asio_kcp {
+
+/*
+ * The udp socket under kcp_client. Replace it by kcp_client::set_transport, e.g. memory_client_transport for
+ * running many clients in one process in simulated time.
+ *
+ * The calls are the ones of a non-blocking udp socket: send and recv return < 0 with errno set on error,
+ *   errno EAGAIN when nothing to recv.
+ * All calls are made in the thread calling kcp_client::update(), or the thread calling send_msg in send-through mode.
+ */
+class client_transport
+{
+public:
+    virtual ~client_transport(void) {}
+
+    // return 0, or KCP_ERR_XXX of kcp_client.hpp. udp_port_bind == 0 for any port.
+    virtual int open(int udp_port_bind) = 0;
+    virtual void close(void) = 0;
+    virtual bool is_open(void) const = 0;
+
+    // send and recv talk with servaddr only after connect. return KCP_ERR_XXX if failed.
+    virtual int connect(const struct sockaddr_in& servaddr) = 0;
+
+    virtual ssize_t send(const char* buf, size_t len) = 0;
+    virtual ssize_t send_to(const char* buf, size_t len, const struct sockaddr_in& addr) = 0;
+    virtual ssize_t recv(char* buf, size_t len) = 0;
+    virtual ssize_t recv_from(char* buf, size_t len, struct sockaddr_in* from_addr) = 0;
+};
+
+// the default one. A non-blocking udp socket of the system.
+class udp_socket_transport : public client_transport
+{
+public:
+    udp_socket_transport(void);
+    virtual ~udp_socket_transport(void);
+
+    virtual int open(int udp_port_bind);
+    virtual void close(void);
+    virtual bool is_open(void) const {return udp_socket_ != -1;}
+    virtual int connect(const struct sockaddr_in& servaddr);
+
+    virtual ssize_t send(const char* buf, size_t len);
+    virtual ssize_t send_to(const char* buf, size_t len, const struct sockaddr_in& addr);
+    virtual ssize_t recv(char* buf, size_t len);
+    virtual ssize_t recv_from(char* buf, size_t len, struct sockaddr_in* from_addr);
+
+private:
+    udp_socket_transport(const udp_socket_transport&);
+    udp_socket_transport& operator=(const udp_socket_transport&);
+
+    int udp_socket_;
+};
+
+// called for every packet sent by a memory_client_transport. from_addr is the address of the transport.
+typedef void(memory_transport_output_t)(const char* /*buf*/, size_t /*len*/, const struct sockaddr_in& /*from_addr*/,
+        const struct sockaddr_in& /*to_addr*/, void* /*var*/);
+
+// No socket. The packets sent go to the output func, and the simulator delivers the packets to recv by deliver().
+class memory_client_transport : public client_transport
+{
+public:
+    // local_addr is the address seen by the server.
+    memory_client_transport(const struct sockaddr_in& local_addr, memory_transport_output_t* output_func, void* var);
+
+    virtual int open(int udp_port_bind);
+    virtual void close(void);
+    virtual bool is_open(void) const {return is_open_;}
+    virtual int connect(const struct sockaddr_in& servaddr);
+
+    virtual ssize_t send(const char* buf, size_t len);
+    virtual ssize_t send_to(const char* buf, size_t len, const struct sockaddr_in& addr);
+    virtual ssize_t recv(char* buf, size_t len);
+    virtual ssize_t recv_from(char* buf, size_t len, struct sockaddr_in* from_addr);
+
+    // a packet arrived. Dropped if closed, or not from the connected address, as a udp socket does.
+    void deliver(const char* buf, size_t len, const struct sockaddr_in& from_addr);
+
+    const struct sockaddr_in& get_local_addr(void) const {return local_addr_;}
+
+private:
+    struct packet
+    {
+        struct sockaddr_in from_addr;
+        std::string data;
+    };
+
+    struct sockaddr_in local_addr_;
+    memory_transport_output_t* output_func_;
+    void* output_var_;
+    bool is_open_;
+    bool connected_;
+    struct sockaddr_in connected_addr_;
+    std::deque<packet> packets_;
+};
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_CLIENT_TRANSPORT_
@@ -8,31 +8,58 @@
 #include <sstream>
 #include <fcntl.h>
 #include <string.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "../util/ikcp.h"
 #include "../util/connect_packet.hpp"
 #include "kcp_client_util.h"
+#include "kcp_client_trace.h"
+#include "../util/kcp_trace.hpp"
+#include "../util/kcp_clock.hpp"
 
 namespace asio_kcp {
 
 kcp_client::kcp_client(void) :
     in_connect_stage_(false),
     connect_start_time_(0),
-    last_send_connect_msg_time_(0),
+    next_send_connect_msg_time_(0),
+    send_connect_msg_count_(0),
     connect_succeed_(false),
+    in_resume_stage_(false),
+    resume_token_(0),
+    kcp_clock_in_us_(false),
     pevent_func_(NULL),
     event_callback_var_(NULL),
+    pmsg_func_(NULL),
+    msg_callback_var_(NULL),
+    send_through_(false),
+    send_notify_pending_(0),
+    update_thread_known_(false),
+    pudp_output_hook_(NULL),
+    udp_output_hook_var_(NULL),
     udp_port_bind_(0),
     server_port_(0),
-    udp_socket_(-1),
-    p_kcp_(NULL)
+    transport_(&udp_socket_transport_),
+    clock_(NULL),
+    kcp_recv_buf_(MAX_MSG_SIZE),
+    p_kcp_(NULL),
+    kcp_trace_ring_(NULL)
 {
     bzero(&servaddr_, sizeof(servaddr_));
+    send_notify_fd_[0] = -1;
+    send_notify_fd_[1] = -1;
 }
 
 kcp_client::~kcp_client(void)
 {
     clean();
+    delete kcp_trace_ring_;
+    if (send_notify_fd_[0] != -1)
+        ::close(send_notify_fd_[0]);
+    if (send_notify_fd_[1] != -1 && send_notify_fd_[1] != send_notify_fd_[0])
+        ::close(send_notify_fd_[1]);
 }
 
 void kcp_client::clean(void)
@@ -50,6 +77,49 @@ void kcp_client::set_event_callback(const client_event_callback_t& event_callbac
     event_callback_var_ = var;
 }
 
+void kcp_client::set_msg_callback(const client_msg_callback_t& msg_callback_func, void* var)
+{
+    pmsg_func_ = &msg_callback_func;
+    msg_callback_var_ = var;
+}
+
+void kcp_client::set_udp_output_hook(const client_udp_output_hook_t& hook_func, void* var)
+{
+    pudp_output_hook_ = &hook_func;
+    udp_output_hook_var_ = var;
+}
+
+int kcp_client::enable_send_through(void)
+{
+    if (send_through_)
+        return 0;
+
+#ifdef __linux__
+    send_notify_fd_[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (send_notify_fd_[0] < 0)
+    {
+        std::cerr << "eventfd error return with errno: " << errno << " " << strerror(errno) << std::endl;
+        return KCP_ERR_CREATE_NOTIFY_FD_FAIL;
+    }
+    send_notify_fd_[1] = send_notify_fd_[0];
+#else
+    if (pipe(send_notify_fd_) < 0)
+    {
+        std::cerr << "pipe error return with errno: " << errno << " " << strerror(errno) << std::endl;
+        send_notify_fd_[0] = send_notify_fd_[1] = -1;
+        return KCP_ERR_CREATE_NOTIFY_FD_FAIL;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        int flags = fcntl(send_notify_fd_[i], F_GETFL, 0);
+        fcntl(send_notify_fd_[i], F_SETFL, flags | O_NONBLOCK);
+    }
+#endif
+
+    send_through_ = true;
+    return 0;
+}
+
 void kcp_client::stop()
 {
 /*    set stopped_
@@ -64,6 +134,10 @@ void kcp_client::init_kcp(kcp_conv_t conv)
 {
     p_kcp_ = ikcp_create(conv, (void*)this);
     p_kcp_->output = &kcp_client::udp_output;
+    if (kcp_trace_ring_)
+        kcp_trace_ring_->attach(p_kcp_);
+    if (kcp_clock_in_us_)
+        ikcp_clockunit(p_kcp_, 1000);
 
     // 启动快速模式
     // 第二个参数 nodelay-启用以后若干常规加速将启动
@@ -74,9 +148,24 @@ void kcp_client::init_kcp(kcp_conv_t conv)
     ikcp_nodelay(p_kcp_, 1, 2, 1, 1); // 设置成1次ACK跨越直接重传, 这样反应速度会更快. 内部时钟5毫秒.
 }
 
+void kcp_client::enable_kcp_trace(void)
+{
+    if (kcp_trace_ring_ == NULL)
+        kcp_trace_ring_ = new kcp_trace_ring();
+}
+
+bool kcp_client::dump_kcp_trace(const std::string& path) const
+{
+    if (kcp_trace_ring_ == NULL)
+        return false;
+    std::vector<kcp_trace_record> records;
+    kcp_trace_ring_->snapshot(&records);
+    return write_kcp_trace_file(path, records);
+}
+
 int kcp_client::connect_async(int udp_port_bind, const std::string& server_ip, const int server_port)
 {
-    if (udp_socket_ != -1)
+    if (transport_->is_open())
         return KCP_ERR_ALREADY_CONNECTED;
 
     udp_port_bind_ = udp_port_bind;
@@ -93,16 +182,64 @@ int kcp_client::connect_async(int udp_port_bind, const std::string& server_ip, c
     // do asio_kcp connect
     {
         in_connect_stage_ = true;
-        connect_start_time_ = iclock64();
+        connect_start_time_ = clock_ms();
+        next_send_connect_msg_time_ = connect_start_time_;
+        send_connect_msg_count_ = 0;
     }
 
 
     return 0;
 }
 
+int kcp_client::add_race_server(const std::string& server_ip, const int server_port)
+{
+    struct sockaddr_in servaddr;
+    bzero(&servaddr, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(server_port);
+    int ret = inet_pton(AF_INET, server_ip.c_str(), &servaddr.sin_addr);
+    if (ret <= 0)
+        return KCP_ERR_ADDRESS_INVALID;
+
+    race_servaddrs_.push_back(servaddr);
+    return 0;
+}
+
+int kcp_client::resume_async(void)
+{
+    if (p_kcp_ == NULL || resume_token_ == 0)
+        return KCP_ERR_CAN_NOT_RESUME;
+
+    // reopen the udp socket. The old one maybe broken by changing network.
+    transport_->close();
+    {
+        int ret = transport_->open(udp_port_bind_);
+        if (ret < 0)
+            return ret;
+        ret = transport_->connect(servaddr_);
+        if (ret < 0)
+            return ret;
+    }
+
+    // keep connect_succeed_ and p_kcp_. msg can be sent before server answered.
+    in_resume_stage_ = true;
+    connect_succeed_ = true;
+    connect_start_time_ = clock_ms();
+    next_send_connect_msg_time_ = connect_start_time_;
+    send_connect_msg_count_ = 0;
+    return 0;
+}
+
 void kcp_client::update()
 {
-    uint64_t cur_clock = iclock64();
+    if (!update_thread_known_)
+    {
+        update_thread_ = pthread_self();
+        __sync_synchronize();
+        update_thread_known_ = true;
+    }
+
+    uint64_t cur_clock = clock_ms();
     if (in_connect_stage_)
     {
         do_asio_kcp_connect(cur_clock);
@@ -114,12 +251,16 @@ void kcp_client::update()
         // send the msg in SendMsgQueue
         do_send_msg_in_queue();
 
+        // resend the resume packet until server answer.
+        if (in_resume_stage_)
+            do_asio_kcp_resume(cur_clock);
+
         // recv the udp packet.
         do_recv_udp_packet_in_loop();
 
         // ikcp_update
         //
-        ikcp_update(p_kcp_, cur_clock);
+        ikcp_update(p_kcp_, kcp_clock());
     }
 }
 
@@ -127,6 +268,7 @@ void kcp_client::do_asio_kcp_connect(uint64_t cur_clock)
 {
     if (connect_timeout(cur_clock))
     {
+        AK_CLIENT_TRACE_WARNING(eTraceConnectTimeout, 0, cur_clock - connect_start_time_, 0);
         (*pevent_func_)(0, eConnectFailed, KCP_CONNECT_TIMEOUT_MSG, event_callback_var_);
         in_connect_stage_ = false;
         return;
@@ -137,9 +279,49 @@ void kcp_client::do_asio_kcp_connect(uint64_t cur_clock)
     try_recv_connect_back_packet();
 }
 
+void kcp_client::do_asio_kcp_resume(uint64_t cur_clock)
+{
+    if (connect_timeout(cur_clock))
+    {
+        in_resume_stage_ = false;
+        AK_CLIENT_TRACE_WARNING(eTraceConnectTimeout, p_kcp_->conv, cur_clock - connect_start_time_, 0);
+        if (pevent_func_ != NULL)
+            (*pevent_func_)(p_kcp_->conv, eDisconnect, KCP_RESUME_TIMEOUT_MSG, event_callback_var_);
+        return;
+    }
+    if (!need_send_connect_packet(cur_clock))
+        return;
+    schedule_next_connect_packet(cur_clock);
+
+    send_resume_packet();
+}
+
+void kcp_client::send_resume_packet(void)
+{
+    // sent alone, just before the kcp packets of this update(). A kcp packet can be a whole mtu, no room for the header.
+    // server takes the kcp packets from the new address by conv, so they need not wait the answer.
+    const std::string resume_packet = asio_kcp::making_resume_packet(p_kcp_->conv, resume_token_);
+    const ssize_t send_ret = transport_->send(resume_packet.c_str(), resume_packet.size());
+    AK_CLIENT_TRACE_INFO(eTraceSendConnectPacket, p_kcp_->conv, send_ret, 0);
+    if (send_ret < 0)
+    {
+        AK_CLIENT_TRACE_ERROR(eTraceSendUdpError, p_kcp_->conv, errno, resume_packet.size());
+    }
+}
+
 bool kcp_client::need_send_connect_packet(uint64_t cur_clock) const
 {
-    return (cur_clock - last_send_connect_msg_time_ > KCP_RESEND_CONNECT_MSG_INTERVAL);
+    return (cur_clock >= next_send_connect_msg_time_);
+}
+
+void kcp_client::schedule_next_connect_packet(uint64_t cur_clock)
+{
+    // exponential backoff. one lost packet only costs KCP_RESEND_CONNECT_MSG_FIRST_INTERVAL.
+    uint64_t interval = KCP_RESEND_CONNECT_MSG_MAX_INTERVAL;
+    if (send_connect_msg_count_ < 16)
+        interval = std::min<uint64_t>(KCP_RESEND_CONNECT_MSG_FIRST_INTERVAL << send_connect_msg_count_, KCP_RESEND_CONNECT_MSG_MAX_INTERVAL);
+    send_connect_msg_count_++;
+    next_send_connect_msg_time_ = cur_clock + interval;
 }
 
 bool kcp_client::connect_timeout(uint64_t cur_clock) const
@@ -149,38 +331,64 @@ bool kcp_client::connect_timeout(uint64_t cur_clock) const
 
 void kcp_client::do_send_connect_packet(uint64_t cur_clock)
 {
-    last_send_connect_msg_time_ = cur_clock;
+    schedule_next_connect_packet(cur_clock);
 
-    // send a connect cmd.
+    // send a connect cmd to every server in race. the socket is not connected in connect stage.
     std::string connect_msg = asio_kcp::making_connect_packet();
-    std::cerr << "send connect packet" << std::endl;
-    const ssize_t send_ret = send(udp_socket_, connect_msg.c_str(), connect_msg.size(), 0);
-    if (send_ret < 0)
+    for (size_t i = 0; i <= race_servaddrs_.size(); ++i)
     {
-        std::cerr << "do_asio_kcp_connect send error return with errno: " << errno << " " << strerror(errno) << std::endl;
+        const struct sockaddr_in& servaddr = (i == 0 ? servaddr_ : race_servaddrs_[i - 1]);
+        const ssize_t send_ret = transport_->send_to(connect_msg.c_str(), connect_msg.size(), servaddr);
+        AK_CLIENT_TRACE_INFO(eTraceSendConnectPacket, 0, send_ret, i);
+        if (send_ret < 0)
+        {
+            AK_CLIENT_TRACE_ERROR(eTraceSendUdpError, 0, errno, connect_msg.size());
+        }
     }
 }
 
 void kcp_client::try_recv_connect_back_packet(void)
 {
     char recv_buf[1400] = ""; // connect udp packet will not bigger than 1400.
-    const ssize_t ret_recv = recv(udp_socket_, recv_buf, sizeof(recv_buf), 0); // recv timeout is 2 milliseconds. - SO_RCVTIMEO
+    struct sockaddr_in from_addr;
+    const ssize_t ret_recv = transport_->recv_from(recv_buf, sizeof(recv_buf), &from_addr);
     if (ret_recv < 0)
     {
         int err = errno;
         if (err == EAGAIN)
             return;
-        std::cerr << "try_recv_connect_back_packet recv error return with errno: " << err << " " << strerror(err) << std::endl;
+        AK_CLIENT_TRACE_ERROR(eTraceRecvUdpError, 0, err, 0);
     }
     if (ret_recv > 0 && asio_kcp::is_send_back_conv_packet(recv_buf, ret_recv))
     {
+        // only the server in race can win.
+        bool from_race_server = false;
+        for (size_t i = 0; i <= race_servaddrs_.size(); ++i)
+        {
+            const struct sockaddr_in& servaddr = (i == 0 ? servaddr_ : race_servaddrs_[i - 1]);
+            if (servaddr.sin_addr.s_addr == from_addr.sin_addr.s_addr && servaddr.sin_port == from_addr.sin_port)
+            {
+                from_race_server = true;
+                servaddr_ = servaddr;
+                break;
+            }
+        }
+        if (!from_race_server)
+            return;
+
+        if (transport_->connect(servaddr_) < 0)
+        {
+            (*pevent_func_)(0, eConnectFailed, "udp connect failed", event_callback_var_);
+            in_connect_stage_ = false;
+            return;
+        }
+
         // connect ok.
 
         kcp_conv_t conv = asio_kcp::grab_conv_from_send_back_conv_packet(recv_buf, ret_recv);
+        resume_token_ = asio_kcp::grab_resume_token_from_send_back_conv_packet(recv_buf, ret_recv);
 
-        std::cerr << "connect succeed in " << iclock64() - connect_start_time_ << " milliseconds"
-            << " conv:" << conv
-            << std::endl;
+        AK_CLIENT_TRACE_INFO(eTraceConnectSucceed, conv, clock_ms() - connect_start_time_, send_connect_msg_count_);
         init_kcp(conv);
         in_connect_stage_ = false;
         connect_succeed_ = true;
@@ -252,84 +460,22 @@ int kcp_client::init_udp_connect(void)
         }
     }
 
-    // create udp_socket_
-    {
-        udp_socket_ = socket(AF_INET, SOCK_DGRAM, 0);
-        if (udp_socket_ < 0)
-        {
-            std::cerr << "socket error return with errno: " << errno << " " << strerror(errno) << std::endl;
-            return KCP_ERR_CREATE_SOCKET_FAIL;
-        }
-    }
-
-    // set socket recv timeout
-    /*{
-        struct timeval recv_timeo;
-        recv_timeo.tv_sec = 0;
-        recv_timeo.tv_usec = 2 * 1000; // 2 milliseconds
-        int ret = setsockopt(udp_socket_, SOL_SOCKET, SO_RCVTIMEO, &recv_timeo, sizeof(recv_timeo));
-        if (ret < 0)
-        {
-            std::cerr << "setsockopt error return with errno: " << errno << " " << strerror(errno) << std::endl;
-        }
-    }*/
-
-    // set socket non-blocking
-    {
-        int flags = fcntl(udp_socket_, F_GETFL, 0);
-        if (flags == -1)
-        {
-            std::cerr << "get socket non-blocking: fcntl error return with errno: " << errno << " " << strerror(errno) << std::endl;
-            return KCP_ERR_SET_NON_BLOCK_FAIL;
-        }
-        int ret = fcntl(udp_socket_, F_SETFL, flags | O_NONBLOCK);
-        if (ret == -1)
-        {
-            std::cerr << "set socket non-blocking: fcntl error return with errno: " << errno << " " << strerror(errno) << std::endl;
-            return KCP_ERR_SET_NON_BLOCK_FAIL;
-        }
-    }
-
-    // set recv buf bigger
-
-    // bind
-    if (udp_port_bind_ != 0)
-    {
-        struct sockaddr_in bind_addr;
-        bind_addr.sin_family = AF_INET;
-        bind_addr.sin_port = htons(udp_port_bind_);
-        bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        int ret_bind = ::bind(udp_socket_, (const struct sockaddr*)(&bind_addr), sizeof(bind_addr));
-        if (ret_bind < 0)
-            std::cerr << "setsockopt error return with errno: " << errno << " " << strerror(errno) << std::endl;
-    }
-
-    // udp connect
-    {
-        int ret = ::connect(udp_socket_, (const struct sockaddr*)(&servaddr_), sizeof(servaddr_));
-        if (ret < 0)
-        {
-            std::cerr << "connect error return with errno: " << errno << " " << strerror(errno) << std::endl;
-            return KCP_ERR_CONNECT_FUNC_FAIL;
-        }
-    }
-
-    return 0;
+    // udp connect will be done when the connect back packet recved. Because we may race some servers.
+    return transport_->open(udp_port_bind_);
 }
 
 void kcp_client::do_recv_udp_packet_in_loop(void)
 {
-    char recv_buf[MAX_MSG_SIZE * 2] = ""; // udp packet will not twice bigger than kcp msg size.
-    const ssize_t ret_recv = recv(udp_socket_, recv_buf, sizeof(recv_buf), 0);
+    const ssize_t ret_recv = transport_->recv(udp_data_, sizeof(udp_data_));
     if (ret_recv < 0)
     {
         int err = errno;
         if (err == EAGAIN)
             return;
+        AK_CLIENT_TRACE_ERROR(eTraceRecvUdpError, p_kcp_->conv, err, 0);
         std::ostringstream ostrm;
-        std::string err_detail = ostrm.str();
         ostrm << "do_asio_kcp_connect recv error return with errno: " << err << " " << strerror(err);
-        std::cerr << err_detail << std::endl;
+        const std::string err_detail = ostrm.str();
         (*pevent_func_)(p_kcp_->conv, eDisconnect, err_detail, event_callback_var_);
         return;
     }
@@ -338,7 +484,8 @@ void kcp_client::do_recv_udp_packet_in_loop(void)
         return; // do nothing.   ignore the zero size packet.
 
     // ret_recv > 0
-    handle_udp_packet(std::string(recv_buf, ret_recv));
+    AK_CLIENT_TRACE_DEBUG(eTraceRecvUdpPacket, p_kcp_->conv, ret_recv, 0);
+    handle_udp_packet(udp_data_, ret_recv);
     return;
 }
 
@@ -350,15 +497,20 @@ int kcp_client::udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 
 void kcp_client::send_udp_package(const char *buf, int len)
 {
-    std::cerr << "send_udp_package" << std::endl;
-    const ssize_t send_ret = send(udp_socket_, buf, len, 0);
+    const ssize_t send_ret = transport_->send(buf, len);
+    if (pudp_output_hook_ != NULL && send_ret > 0)
+        (*pudp_output_hook_)(buf, send_ret, udp_output_hook_var_);
     if (send_ret < 0)
     {
-        std::cerr << "send_udp_package error with errno: " << errno << " " << strerror(errno) << std::endl;
+        AK_CLIENT_TRACE_ERROR(eTraceSendUdpError, p_kcp_->conv, errno, len);
     }
     else if (send_ret != len)
     {
-        std::cerr << "send_udp_package error: not all packet send. " << send_ret << " in " << len << std::endl;
+        AK_CLIENT_TRACE_WARNING(eTraceSendUdpPartial, p_kcp_->conv, send_ret, len);
+    }
+    else
+    {
+        AK_CLIENT_TRACE_DEBUG(eTraceSendUdpPacket, p_kcp_->conv, len, 0);
     }
 }
 
@@ -366,69 +518,162 @@ void kcp_client::send_msg(const std::string& msg)
 {
     // todo: check msg size < MAX_MSG_SIZE
 
+    if (send_through_ && in_update_thread() && connect_succeed_)
+    {
+        // the msgs queued by other threads go first.
+        do_send_msg_in_queue();
+        do_send_kcp_msg(msg);
+        flush_kcp_now();
+        return;
+    }
+
     send_msg_queue_.push(msg);
+    if (send_through_)
+        notify_send_msg();
+}
+
+void kcp_client::flush_send_msg(void)
+{
+    if (!connect_succeed_)
+        return;
+    do_send_msg_in_queue();
+    flush_kcp_now();
+}
+
+bool kcp_client::in_update_thread(void) const
+{
+    return update_thread_known_ && pthread_equal(pthread_self(), update_thread_);
+}
+
+uint32_t kcp_client::kcp_clock(void) const
+{
+    return kcp_clock_in_us_ ? (uint32_t)clock_us() : (uint32_t)clock_ms();
+}
+
+uint64_t kcp_client::clock_ms(void) const
+{
+    return clock_ ? clock_->now_ms() : iclock64();
+}
+
+uint64_t kcp_client::clock_us(void) const
+{
+    return clock_ ? clock_->now_us() : iclock64_us();
+}
+
+void kcp_client::flush_kcp_now(void)
+{
+    // ikcp_flush stamps the segments with kcp->current. Using now instead of the time of last update().
+    p_kcp_->current = kcp_clock();
+    ikcp_flush(p_kcp_);
+}
+
+void kcp_client::notify_send_msg(void)
+{
+    // only the first msg after draining writes the fd.
+    if (__sync_lock_test_and_set(&send_notify_pending_, 1) != 0)
+        return;
+    const uint64_t one = 1;
+    const ssize_t write_ret = write(send_notify_fd_[1], &one, sizeof(one));
+    (void)write_ret; // fd is full means it is readable already.
+}
+
+void kcp_client::drain_send_notify_fd(void)
+{
+    if (send_notify_pending_ == 0)
+        return;
+
+    // drain before clearing the pending flag, or a notify between them will be lost.
+    char buf[64];
+    while (read(send_notify_fd_[0], buf, sizeof(buf)) > 0)
+        ;
+    __sync_lock_release(&send_notify_pending_);
 }
 
 void kcp_client::do_send_msg_in_queue(void)
 {
+    if (send_through_)
+        drain_send_notify_fd();
+
     std::queue<std::string> msgs = send_msg_queue_.grab_all();
 
     while (msgs.size() > 0)
     {
-        std::string msg = msgs.front();
-        int send_ret = ikcp_send(p_kcp_, msg.c_str(), msg.size());
-        if (send_ret < 0)
-        {
-            std::cerr << "send_ret<0: " << send_ret << std::endl;
-        }
+        do_send_kcp_msg(msgs.front());
         msgs.pop();
     }
 }
 
-void kcp_client::handle_udp_packet(const std::string& udp_packet)
+void kcp_client::do_send_kcp_msg(const std::string& msg)
 {
-    if (is_disconnect_packet(udp_packet.c_str(), udp_packet.size()))
+    int send_ret = ikcp_send(p_kcp_, msg.c_str(), msg.size());
+    if (send_ret < 0)
     {
+        AK_CLIENT_TRACE_WARNING(eTraceKcpSendError, p_kcp_->conv, send_ret, msg.size());
+    }
+}
+
+void kcp_client::handle_udp_packet(const char* udp_data, size_t bytes_recvd)
+{
+    if (is_resume_back_packet(udp_data, bytes_recvd))
+    {
+        AK_CLIENT_TRACE_INFO(eTraceConnectSucceed, p_kcp_->conv, clock_ms() - connect_start_time_, send_connect_msg_count_);
+        in_resume_stage_ = false;
+        return;
+    }
+
+    // the answer of a resent connect packet, or the loser in race.
+    if (is_send_back_conv_packet(udp_data, bytes_recvd))
+        return;
+
+    if (is_disconnect_packet(udp_data, bytes_recvd))
+    {
+        AK_CLIENT_TRACE_INFO(eTraceRecvDisconnect, p_kcp_->conv, bytes_recvd, 0);
+        in_resume_stage_ = false;
         if (pevent_func_ != NULL)
         {
-            std::string msg(udp_packet);
+            std::string msg(udp_data, bytes_recvd);
             (*pevent_func_)(p_kcp_->conv, eDisconnect, msg, event_callback_var_);
         }
         return;
     }
 
 
-    ikcp_input(p_kcp_, udp_packet.c_str(), udp_packet.size());
+    // ikcp_input takes rtt sample by kcp->current. Using now instead of the time of last update().
+    // Or the rtt is always 0 when the ack arrives before next update(). It matters in microsecond clock.
+    p_kcp_->current = kcp_clock();
+    ikcp_input(p_kcp_, udp_data, bytes_recvd);
 
     while (true)
     {
-        const std::string& msg = recv_udp_package_from_kcp();
-        if (msg.size() > 0)
-        {
-            // recved good msg.
-            std::cerr << "recv good kcp msg: " << msg << std::endl;
-            if (pevent_func_ != NULL)
-            {
-                (*pevent_func_)(p_kcp_->conv, eRcvMsg, msg, event_callback_var_);
-            }
+        const int msg_size = recv_udp_package_from_kcp();
+        if (msg_size < 0)
+            break;
+        if (msg_size == 0)
             continue;
+
+        // recved good msg.
+        AK_CLIENT_TRACE_DEBUG(eTraceRecvKcpMsg, p_kcp_->conv, msg_size, 0);
+        if (pmsg_func_ != NULL)
+        {
+            (*pmsg_func_)(p_kcp_->conv, &kcp_recv_buf_[0], msg_size, msg_callback_var_);
+        }
+        else if (pevent_func_ != NULL)
+        {
+            const std::string msg(&kcp_recv_buf_[0], msg_size);
+            (*pevent_func_)(p_kcp_->conv, eRcvMsg, msg, event_callback_var_);
         }
-        break;
     }
 }
 
-std::string kcp_client::recv_udp_package_from_kcp(void)
+int kcp_client::recv_udp_package_from_kcp(void)
 {
-    char kcp_buf[MAX_MSG_SIZE] = "";
-    int kcp_recvd_bytes = ikcp_recv(p_kcp_, kcp_buf, sizeof(kcp_buf));
-    if (kcp_recvd_bytes < 0)
-    {
-        //std::cerr << "kcp_recvd_bytes<0: " << kcp_recvd_bytes << std::endl;
-        return "";
-    }
+    const int peek_size = ikcp_peeksize(p_kcp_);
+    if (peek_size < 0)
+        return peek_size;
+    if (kcp_recv_buf_.size() < (size_t)peek_size)
+        kcp_recv_buf_.resize(peek_size);
 
-    const std::string result(kcp_buf, kcp_recvd_bytes);
-    return result;
+    return ikcp_recv(p_kcp_, &kcp_recv_buf_[0], kcp_recv_buf_.size());
 }
 
 
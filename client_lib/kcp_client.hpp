@@ -6,9 +6,11 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <vector>
 
 
 #include "threadsafe_queue_mutex.hpp"
+#include "client_transport.hpp"
 
 struct IKCPCB;
 typedef struct IKCPCB ikcpcb;
@@ -18,21 +20,28 @@ typedef uint32_t kcp_conv_t;
 
 #define MAX_MSG_SIZE 1024 * 10
 #define KCP_UPDATE_INTERVAL 5 // milliseconds
-#define KCP_RESEND_CONNECT_MSG_INTERVAL 500 // milliseconds
+#define KCP_RESEND_CONNECT_MSG_FIRST_INTERVAL 50 // milliseconds. resend at 0, 50, 150, 350, 750 ... doubling the interval every time.
+#define KCP_RESEND_CONNECT_MSG_MAX_INTERVAL 1000 // milliseconds
 #define KCP_CONNECT_TIMEOUT_TIME 5000 // milliseconds
 
 #define KCP_ERR_ALREADY_CONNECTED       -2001
 #define KCP_ERR_ADDRESS_INVALID         -2002
 #define KCP_ERR_CREATE_SOCKET_FAIL      -2003
 #define KCP_ERR_SET_NON_BLOCK_FAIL      -2004
+#define KCP_ERR_CREATE_NOTIFY_FD_FAIL   -2005
 
 #define KCP_ERR_CONNECT_FUNC_FAIL       -2010
 #define KCP_ERR_KCP_CONNECT_TIMEOUT     -2011
+#define KCP_ERR_CAN_NOT_RESUME          -2012
 
 #define KCP_CONNECT_TIMEOUT_MSG "connect timeout"
+#define KCP_RESUME_TIMEOUT_MSG "resume timeout"
 
 namespace asio_kcp {
 
+class kcp_trace_ring;
+class kcp_clock;
+
 enum eEventType
 {
     eNotSet = -1,
@@ -45,6 +54,13 @@ enum eEventType
 };
 typedef void(client_event_callback_t)(kcp_conv_t /*conv*/, eEventType /*event_type*/, const std::string& /*msg*/, void* /*var*/);
 
+// msg points into the recv buffer of kcp_client. It is valid only before the callback return.
+// Using asio_kcp::make_msg_buffer(msg, len) in util/msg_buffer.hpp if you want to keep it.
+typedef void(client_msg_callback_t)(kcp_conv_t /*conv*/, const char* /*msg*/, size_t /*len*/, void* /*var*/);
+
+// called after every udp packet sent. buf is the kcp packet.
+typedef void(client_udp_output_hook_t)(const char* /*buf*/, size_t /*len*/, void* /*var*/);
+
 
 /*
  * using asio_kcp_client in a event-driven framework. You should hook a timer for calling the kcp_client.update()
@@ -94,17 +110,72 @@ public:
     // event_callback_func will be called in the thread which you call update()
     void set_event_callback(const client_event_callback_t& event_callback_func, void* var);
 
+    // Zero copy recving. eRcvMsg will be given to msg_callback_func instead of event_callback_func if you set it.
+    // msg_callback_func will be called in the thread which you call update()
+    void set_msg_callback(const client_msg_callback_t& msg_callback_func, void* var);
+
     // we use system giving local port from system if udp_port_bind == 0
     // return KCP_ERR_XXX if some error happen.
     // kcp_client will call event_callback_func when connect succeed or failed.
     int connect_async(int udp_port_bind, const std::string& server_ip, const int server_port);
 
+    // Racing more server addresses. Call it before connect_async.
+    // connect packet will be sent to server_ip of connect_async and all the race servers. The first one answered wins.
+    // return KCP_ERR_ADDRESS_INVALID if server_ip is wrong.
+    int add_race_server(const std::string& server_ip, const int server_port);
+
+    // 0-RTT resume. Using it when the network of device changed (wifi to 3G, .etc) and the old udp socket is broken.
+    // kcp_client will reopen the udp socket, and keep the conv and all kcp state (msg not acked will be resent).
+    // The resume packet goes just before the kcp packets. So the msg you send_msg before or after resume_async will not wait a RTT.
+    // Server answer nothing within KCP_CONNECT_TIMEOUT_TIME: eDisconnect with KCP_RESUME_TIMEOUT_MSG.
+    // Server do not known the conv any more: eDisconnect.
+    // return KCP_ERR_CAN_NOT_RESUME if never connected or server do not support resume.
+    int resume_async(void);
+
+    // Using microsecond timestamps in kcp. RTT and RTO will be accurate in LAN (RTT < 1 millisecond).
+    // Call it before connect_async. Server need not to support it: kcp ts is echoed back by peer.
+    void set_kcp_clock_in_microsecond(bool enable) {kcp_clock_in_us_ = enable;}
+
+    // The token server given when connect succeed. 0 means server do not support resume.
+    uint64_t get_resume_token(void) const {return resume_token_;}
+
     void update();
 
     // user level send msg.
     // this func is multithread safe.
     void send_msg(const std::string& msg);
 
+    // Send-through mode. The msg do not wait the next update() before sending:
+    //   send_msg called in the thread calling update(): ikcp_send and ikcp_flush at once. The msg is on the wire when send_msg return.
+    //   send_msg called in other thread: the msg is queued and get_send_notify_fd() becomes readable.
+    //     Poll the fd in your event loop and call flush_send_msg() in the thread calling update() when it is readable.
+    // Call it before connect_async. return KCP_ERR_CREATE_NOTIFY_FD_FAIL if creating the notify fd failed.
+    int enable_send_through(void);
+
+    // return -1 if send-through mode is not enabled.
+    int get_send_notify_fd(void) const {return send_notify_fd_[0];}
+
+    // send the queued msgs at once. Call it in the thread calling update().
+    void flush_send_msg(void);
+
+    // For measuring. hook_func will be called in the thread sending the udp packet.
+    void set_udp_output_hook(const client_udp_output_hook_t& hook_func, void* var);
+
+    // Record the lifecycle of the kcp segments into a ring: snd_queue, waiting for cwnd, xmit, resend, acked,
+    //   rcv_buf, recv. See util/kcp_trace.hpp. Call it before connect_async.
+    void enable_kcp_trace(void);
+
+    // write the kcp trace to a file for the kcp_trace_to_chrome tool. return false if not enabled.
+    // this func is multithread safe.
+    bool dump_kcp_trace(const std::string& path) const;
+
+    // Replace the udp socket, e.g. by a memory_client_transport for simulation. Not owned, must outlive the client.
+    // Call it before connect_async.
+    void set_transport(client_transport* transport) {transport_ = transport;}
+
+    // Replace the system clock, e.g. by a virtual_kcp_clock for simulation. Not owned. Call it before connect_async.
+    void set_clock(const asio_kcp::kcp_clock* clock) {clock_ = clock;}
+
     // Stop connections.
     // this func is multithread safe.
     void stop();
@@ -120,9 +191,13 @@ private:
     // return < 0 (KCP_ERR_XXX) when some error happen.
     int init_udp_connect(void);
 
+
     bool connect_timeout(uint64_t cur_clock) const;
     bool need_send_connect_packet(uint64_t cur_clock) const;
+    void schedule_next_connect_packet(uint64_t cur_clock);
     void do_asio_kcp_connect(uint64_t cur_clock);
+    void do_asio_kcp_resume(uint64_t cur_clock);
+    void send_resume_packet(void);
 
 
     static int udp_output(const char *buf, int len, ikcpcb *kcp, void *user);
@@ -132,29 +207,60 @@ private:
 
     void do_recv_udp_packet_in_loop(void);
     void do_send_msg_in_queue(void);
-    void handle_udp_packet(const std::string& udp_packet);
+    void do_send_kcp_msg(const std::string& msg);
+    void flush_kcp_now(void);
+    void notify_send_msg(void);
+    void drain_send_notify_fd(void);
+    bool in_update_thread(void) const;
+    uint32_t kcp_clock(void) const;
+    uint64_t clock_ms(void) const;
+    uint64_t clock_us(void) const;
+    void handle_udp_packet(const char* udp_data, size_t bytes_recvd);
     void try_recv_connect_back_packet(void);
 
-    std::string recv_udp_package_from_kcp(void);
+    // return the size of msg in kcp_recv_buf_. return < 0 if no msg.
+    int recv_udp_package_from_kcp(void);
 
     bool in_connect_stage_;
     uint64_t connect_start_time_;
-    uint64_t last_send_connect_msg_time_;
+    uint64_t next_send_connect_msg_time_;
+    size_t send_connect_msg_count_;
     bool connect_succeed_;
 
+    bool in_resume_stage_;
+    uint64_t resume_token_;
+
+    bool kcp_clock_in_us_;
+
     client_event_callback_t* pevent_func_;
     void* event_callback_var_;
+    client_msg_callback_t* pmsg_func_;
+    void* msg_callback_var_;
 
     threadsafe_queue_mutex<std::string> send_msg_queue_;
 
+    bool send_through_;
+    int send_notify_fd_[2]; // [0] for reading, [1] for writing. The same eventfd on linux.
+    volatile int send_notify_pending_;
+    pthread_t update_thread_;
+    volatile bool update_thread_known_;
+
+    client_udp_output_hook_t* pudp_output_hook_;
+    void* udp_output_hook_var_;
+
     int udp_port_bind_;
     std::string server_ip_;
     int server_port_;
-    int udp_socket_;
+    udp_socket_transport udp_socket_transport_;
+    client_transport* transport_; // udp_socket_transport_ if not set.
+    const asio_kcp::kcp_clock* clock_; // NULL for iclock64. Qualified: kcp_clock() is a member function.
     struct sockaddr_in servaddr_;
-    char udp_data_[1024 * 4];
+    std::vector<struct sockaddr_in> race_servaddrs_;
+    char udp_data_[MAX_MSG_SIZE * 2]; // udp packet will not twice bigger than kcp msg size.
+    std::vector<char> kcp_recv_buf_; // reused for every msg. grows if a msg is bigger than MAX_MSG_SIZE.
 
     ikcpcb* p_kcp_; // --own
+    kcp_trace_ring* kcp_trace_ring_; // --own. NULL if not traced.
 };
 
 } // namespace asio_kcp
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "kcp_client_trace.h"
+#include "kcp_client_util.h"
+
+namespace asio_kcp {
+
+volatile int g_trace_runtime_level = AK_TRACE_LEVEL_WARNING;
+
+static trace_record s_trace_ring[ASIO_KCP_TRACE_RING_SIZE];
+static volatile uint64_t s_trace_next_seq = 0;
+
+static trace_sink_t* volatile s_trace_sink = NULL;
+static void* volatile s_trace_sink_var = NULL;
+
+void set_trace_level(int level)
+{
+    g_trace_runtime_level = level;
+}
+
+int get_trace_level(void)
+{
+    return g_trace_runtime_level;
+}
+
+void set_trace_sink(trace_sink_t* sink, void* var)
+{
+    s_trace_sink_var = var;
+    s_trace_sink = sink;
+}
+
+void trace_write(int level, eTraceEvent event, uint32_t conv, int64_t arg0, int64_t arg1)
+{
+    // claim a slot. seq start from 1 because 0 means empty slot.
+    const uint64_t seq = __sync_add_and_fetch(&s_trace_next_seq, 1);
+    trace_record& rec = s_trace_ring[(seq - 1) & (ASIO_KCP_TRACE_RING_SIZE - 1)];
+
+    // mark the slot is being written. reader will skip it.
+    rec.seq = 0;
+    __sync_synchronize();
+    rec.clock = iclock64();
+    rec.conv = conv;
+    rec.level = (uint16_t)level;
+    rec.event = (uint16_t)event;
+    rec.arg0 = arg0;
+    rec.arg1 = arg1;
+    __sync_synchronize();
+    rec.seq = seq;
+
+    trace_sink_t* sink = s_trace_sink;
+    if (sink != NULL)
+        (*sink)(rec, s_trace_sink_var);
+}
+
+size_t trace_snapshot(trace_record* out, size_t max_count)
+{
+    const uint64_t last_seq = s_trace_next_seq;
+    uint64_t first_seq = 1;
+    if (last_seq > ASIO_KCP_TRACE_RING_SIZE)
+        first_seq = last_seq - ASIO_KCP_TRACE_RING_SIZE + 1;
+    if (last_seq - first_seq + 1 > max_count)
+        first_seq = last_seq - max_count + 1;
+
+    size_t count = 0;
+    for (uint64_t seq = first_seq; seq <= last_seq && count < max_count; ++seq)
+    {
+        const trace_record& rec = s_trace_ring[(seq - 1) & (ASIO_KCP_TRACE_RING_SIZE - 1)];
+        if (rec.seq != seq)
+            continue; // being written, or overwritten by a newer one.
+        __sync_synchronize();
+        memcpy(&out[count], &rec, sizeof(trace_record));
+        __sync_synchronize();
+        if (rec.seq != seq)
+            continue; // overwritten when copying.
+        count++;
+    }
+    return count;
+}
+
+const char* trace_event_str(eTraceEvent event)
+{
+    switch (event)
+    {
+        case eTraceSendConnectPacket: return "send_connect_packet";
+        case eTraceConnectSucceed: return "connect_succeed";
+        case eTraceConnectTimeout: return "connect_timeout";
+        case eTraceSendUdpPacket: return "send_udp_packet";
+        case eTraceSendUdpError: return "send_udp_error";
+        case eTraceSendUdpPartial: return "send_udp_partial";
+        case eTraceRecvUdpPacket: return "recv_udp_packet";
+        case eTraceRecvUdpError: return "recv_udp_error";
+        case eTraceRecvKcpMsg: return "recv_kcp_msg";
+        case eTraceKcpSendError: return "kcp_send_error";
+        case eTraceRecvDisconnect: return "recv_disconnect";
+        case eTraceClientEvent: return "client_event";
+        default: return "unknown";
+    }
+}
+
+const char* trace_level_str(int level)
+{
+    switch (level)
+    {
+        case AK_TRACE_LEVEL_DEBUG: return "DEBUG";
+        case AK_TRACE_LEVEL_INFO: return "INFO";
+        case AK_TRACE_LEVEL_WARNING: return "WARNING";
+        case AK_TRACE_LEVEL_ERROR: return "ERROR";
+        default: return "unknown";
+    }
+}
+
+} // namespace asio_kcp
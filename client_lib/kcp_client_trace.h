@@ -0,0 +1,121 @@
+#ifndef _ASIO_KCP_CLIENT_TRACE_
+#define _ASIO_KCP_CLIENT_TRACE_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Trace facility of client_lib.
+ *   Never use iostream in the packet path. A trace is a fixed size binary record pushed into a process wide ring buffer.
+ *   The ring keeps the last ASIO_KCP_TRACE_RING_SIZE records. You can grab them by trace_snapshot() when something goes wrong.
+ *
+ * Level is checked twice:
+ *   compile time: AK_CLIENT_TRACE_COMPILE_LEVEL. The trace macro of a lower level is defined to nothing.
+ *                 set it in Makefile by ASIO_KCP_DEFINE = -D AK_CLIENT_TRACE_COMPILE_LEVEL=0  if you want the debug trace.
+ *   runtime:      set_trace_level(). default is AK_TRACE_LEVEL_WARNING.
+ *
+ * You can set a sink callback if you want to see the traces in your own log system.
+ *   the sink will be called in the thread which write the trace. So keep it fast and multithread safe.
+ */
+
+#define AK_TRACE_LEVEL_DEBUG    0
+#define AK_TRACE_LEVEL_INFO     1
+#define AK_TRACE_LEVEL_WARNING  2
+#define AK_TRACE_LEVEL_ERROR    3
+#define AK_TRACE_LEVEL_OFF      4
+
+#ifndef AK_CLIENT_TRACE_COMPILE_LEVEL
+#define AK_CLIENT_TRACE_COMPILE_LEVEL AK_TRACE_LEVEL_INFO
+#endif
+
+#define ASIO_KCP_TRACE_RING_SIZE 4096 // must be power of 2
+
+namespace asio_kcp {
+
+enum eTraceEvent
+{
+    eTraceSendConnectPacket = 0,    // arg0: send return
+    eTraceConnectSucceed,           // arg0: milliseconds used
+    eTraceConnectTimeout,           // arg0: milliseconds used
+    eTraceSendUdpPacket,            // arg0: packet size
+    eTraceSendUdpError,             // arg0: errno
+    eTraceSendUdpPartial,           // arg0: sent size  arg1: packet size
+    eTraceRecvUdpPacket,            // arg0: packet size
+    eTraceRecvUdpError,             // arg0: errno
+    eTraceRecvKcpMsg,               // arg0: msg size
+    eTraceKcpSendError,             // arg0: ikcp_send return  arg1: msg size
+    eTraceRecvDisconnect,           // arg0: packet size
+    eTraceClientEvent,              // arg0: eEventType  arg1: msg size
+
+    eCountOfTraceEvent
+};
+
+struct trace_record
+{
+    uint64_t seq;       // 0 means this slot never be written.
+    uint64_t clock;     // iclock64()
+    uint32_t conv;
+    uint16_t level;
+    uint16_t event;     // eTraceEvent
+    int64_t arg0;
+    int64_t arg1;
+};
+
+typedef void(trace_sink_t)(const trace_record& /*record*/, void* /*var*/);
+
+// runtime level. traces whose level lower than this will be dropped.
+extern volatile int g_trace_runtime_level;
+
+void set_trace_level(int level);
+int get_trace_level(void);
+
+// set NULL to remove sink.
+void set_trace_sink(trace_sink_t* sink, void* var);
+
+// do not call directly. using the AK_CLIENT_TRACE_XXX macro below.
+void trace_write(int level, eTraceEvent event, uint32_t conv, int64_t arg0, int64_t arg1);
+
+// copy the records in ring to out. oldest first.
+// return the count copied.
+// this func is multithread safe. A record being written when copying will be skipped.
+size_t trace_snapshot(trace_record* out, size_t max_count);
+
+const char* trace_event_str(eTraceEvent event);
+const char* trace_level_str(int level);
+
+} // namespace asio_kcp
+
+
+#define AK_CLIENT_TRACE_(level, event, conv, arg0, arg1) \
+    do { \
+        if ((level) >= asio_kcp::g_trace_runtime_level) \
+            asio_kcp::trace_write((level), (event), (conv), (int64_t)(arg0), (int64_t)(arg1)); \
+    } while (0)
+
+#define AK_CLIENT_TRACE_NOTHING_(event, conv, arg0, arg1) do {} while (0)
+
+#if AK_CLIENT_TRACE_COMPILE_LEVEL <= AK_TRACE_LEVEL_DEBUG
+    #define AK_CLIENT_TRACE_DEBUG(event, conv, arg0, arg1) AK_CLIENT_TRACE_(AK_TRACE_LEVEL_DEBUG, event, conv, arg0, arg1)
+#else
+    #define AK_CLIENT_TRACE_DEBUG AK_CLIENT_TRACE_NOTHING_
+#endif
+
+#if AK_CLIENT_TRACE_COMPILE_LEVEL <= AK_TRACE_LEVEL_INFO
+    #define AK_CLIENT_TRACE_INFO(event, conv, arg0, arg1) AK_CLIENT_TRACE_(AK_TRACE_LEVEL_INFO, event, conv, arg0, arg1)
+#else
+    #define AK_CLIENT_TRACE_INFO AK_CLIENT_TRACE_NOTHING_
+#endif
+
+#if AK_CLIENT_TRACE_COMPILE_LEVEL <= AK_TRACE_LEVEL_WARNING
+    #define AK_CLIENT_TRACE_WARNING(event, conv, arg0, arg1) AK_CLIENT_TRACE_(AK_TRACE_LEVEL_WARNING, event, conv, arg0, arg1)
+#else
+    #define AK_CLIENT_TRACE_WARNING AK_CLIENT_TRACE_NOTHING_
+#endif
+
+#if AK_CLIENT_TRACE_COMPILE_LEVEL <= AK_TRACE_LEVEL_ERROR
+    #define AK_CLIENT_TRACE_ERROR(event, conv, arg0, arg1) AK_CLIENT_TRACE_(AK_TRACE_LEVEL_ERROR, event, conv, arg0, arg1)
+#else
+    #define AK_CLIENT_TRACE_ERROR AK_CLIENT_TRACE_NOTHING_
+#endif
+
+#endif // _ASIO_KCP_CLIENT_TRACE_
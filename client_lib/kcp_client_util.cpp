@@ -39,14 +39,32 @@ void itimeofday(long *sec, long *usec)
 	if (usec) *usec = time.tv_usec;
 }
 
+static volatile int s_clock_id = CLOCK_MONOTONIC;
+
+void set_clock_source(eClockSource source)
+{
+    s_clock_id = (source == eClockMonotonicCoarse ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC);
+}
+
+eClockSource get_clock_source(void)
+{
+    return (s_clock_id == CLOCK_MONOTONIC_COARSE ? eClockMonotonicCoarse : eClockMonotonic);
+}
+
 /* get clock in millisecond 64 */
 uint64_t iclock64(void)
 {
-    long s, u;
-    uint64_t value;
-    itimeofday(&s, &u);
-    value = ((uint64_t)s) * 1000 + (u / 1000);
-    return value;
+    struct timespec ts;
+    clock_gettime(s_clock_id, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000 + (ts.tv_nsec / (1000 * 1000));
+}
+
+/* get clock in microsecond 64 */
+uint64_t iclock64_us(void)
+{
+    struct timespec ts;
+    clock_gettime(s_clock_id, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000 * 1000 + (ts.tv_nsec / 1000);
 }
 
 
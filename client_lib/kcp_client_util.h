@@ -11,9 +11,23 @@ void millisecond_sleep(size_t n_millisecond);
 /* get system time */
 void itimeofday(long *sec, long *usec);
 
+// The clock of iclock64 and iclock64_us. They do not jump when the system time changed (NTP, .etc).
+enum eClockSource
+{
+    eClockMonotonic = 0,    // CLOCK_MONOTONIC. default. microsecond resolution by vDSO.
+    eClockMonotonicCoarse,  // CLOCK_MONOTONIC_COARSE. cheaper, but only 1 ~ 4 milliseconds resolution.
+
+    eCountOfClockSource
+};
+void set_clock_source(eClockSource source);
+eClockSource get_clock_source(void);
+
 /* get clock in millisecond 64 */
 uint64_t iclock64(void);
 
+/* get clock in microsecond 64 */
+uint64_t iclock64_us(void);
+
 uint32_t iclock();
 
 } // end of asio_kcp
@@ -1,7 +1,9 @@
 #include <iostream>
+#include <poll.h>
 
 #include "kcp_client_wrap.hpp"
 #include "kcp_client_util.h"
+#include "kcp_client_trace.h"
 #include "../essential/check_function.h"
 
 namespace asio_kcp {
@@ -30,6 +32,11 @@ void kcp_client_wrap::set_event_callback(const client_event_callback_t& event_ca
     event_func_var_ = var;
 }
 
+void kcp_client_wrap::set_msg_callback(const client_msg_callback_t& msg_callback_func, void* var)
+{
+    kcp_client_.set_msg_callback(msg_callback_func, var);
+}
+
 void kcp_client_wrap::client_event_callback_func(kcp_conv_t conv, eEventType event_type, const std::string& msg, void* var)
 {
     ((kcp_client_wrap*)var)->handle_client_event_callback(conv, event_type, msg);
@@ -37,7 +44,7 @@ void kcp_client_wrap::client_event_callback_func(kcp_conv_t conv, eEventType eve
 
 void kcp_client_wrap::handle_client_event_callback(kcp_conv_t conv, eEventType event_type, const std::string& msg)
 {
-    std::cout << "kcp_client_wrap::handle_client_event_callback event_type: " << event_type << std::endl;
+    AK_CLIENT_TRACE_DEBUG(eTraceClientEvent, conv, event_type, msg.size());
     switch (event_type)
     {
         case eConnect:
@@ -97,6 +104,11 @@ int kcp_client_wrap::connect_async(int udp_port_bind, const std::string& server_
     return 0;
 }
 
+int kcp_client_wrap::add_race_server(const std::string& server_ip, const int server_port)
+{
+    return kcp_client_.add_race_server(server_ip, server_port);
+}
+
 void kcp_client_wrap::start_workthread(void)
 {
     if (workthread_start_)
@@ -140,6 +152,16 @@ void kcp_client_wrap::do_workthread_loop(void)
             kcp_last_update_clock_ = cur_clock;
             kcp_client_.update();
         }
+        else if (kcp_client_.get_send_notify_fd() != -1)
+        {
+            // send-through mode: waked up by send_msg at once.
+            struct pollfd notify_pollfd;
+            notify_pollfd.fd = kcp_client_.get_send_notify_fd();
+            notify_pollfd.events = POLLIN;
+            notify_pollfd.revents = 0;
+            if (poll(&notify_pollfd, 1, 1) > 0)
+                kcp_client_.flush_send_msg();
+        }
         else
         {
             millisecond_sleep(1);
@@ -62,6 +62,10 @@ public:
 
     void set_event_callback(const client_event_callback_t& event_callback_func, void* var);
 
+    // Zero copy recving. see kcp_client::set_msg_callback
+    // kcp_client_wrap will call msg_callback_func in another thread. msg is valid only before msg_callback_func return.
+    void set_msg_callback(const client_msg_callback_t& msg_callback_func, void* var);
+
     // Sync connect. This function will block until connect succeed or failed.
     // we use system giving local port from system if udp_port_bind == 0
     // return 0 if connect succeed.
@@ -81,6 +85,12 @@ public:
     // 0: connect succeed,  1: need waiting connect end,   <0: connect fail, and it's error code.
     int connect_result(void) const {return connect_result_;}
 
+    // Racing more server addresses. Call it before connect or connect_async. see kcp_client::add_race_server
+    int add_race_server(const std::string& server_ip, const int server_port);
+
+    // Call it before connect or connect_async. see kcp_client::set_kcp_clock_in_microsecond
+    void set_kcp_clock_in_microsecond(bool enable) {kcp_client_.set_kcp_clock_in_microsecond(enable);}
+
     //
     // end of Async connect
 
@@ -88,6 +98,10 @@ public:
     // user level send msg.
     void send_msg(const std::string& msg);
 
+    // Call it before connect or connect_async. see kcp_client::enable_send_through
+    // The work thread will be woken up by send_msg, instead of sending the msg in next update.
+    int enable_send_through(void) {return kcp_client_.enable_send_through();}
+
     void stop();
 
 private:
@@ -7,31 +7,62 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include "kcp_client_util.h"
+#include "../util/multicast_packet.hpp"
 
 namespace asio_kcp {
 
+// epoll_event.data: group_id in high 32 bits, socket_fd in low 32 bits. So the receive thread need not lock to find the socket.
+static uint64_t make_epoll_data(uint32_t group_id, int socket_fd)
+{
+    return ((uint64_t)group_id << 32) | (uint32_t)socket_fd;
+}
+
 kcp_multicast_client::kcp_multicast_client()
-    : running_(false), thread_running_(false)
+    : running_(false), thread_running_(false), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+    shared_socket_fd_(-1), shared_port_(0), wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
 {
+    if (epoll_fd_ < 0)
+    {
+        std::cerr << "Failed to create epoll: " << strerror(errno) << std::endl;
+    }
+    if (wakeup_fd_ < 0)
+    {
+        std::cerr << "Failed to create eventfd: " << strerror(errno) << std::endl;
+    }
+    else
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = make_epoll_data(0, wakeup_fd_);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+    }
 }
 
 kcp_multicast_client::~kcp_multicast_client()
 {
     stop();
+    if (shared_socket_fd_ >= 0)
+    {
+        close(shared_socket_fd_);
+    }
+    if (wakeup_fd_ >= 0)
+    {
+        close(wakeup_fd_);
+    }
+    if (epoll_fd_ >= 0)
+    {
+        close(epoll_fd_);
+    }
 }
 
-int kcp_multicast_client::join_group(const std::string& multicast_addr, uint16_t port, uint32_t group_id)
+// 创建绑定到port的非阻塞UDP套接字. 成功返回套接字, 失败返回负数错误码.
+static int open_multicast_socket(uint16_t port)
 {
-    asio_kcp::lock_guard lock(mutex_);
-    
-    // 检查是否已经加入该组
-    if (groups_.find(group_id) != groups_.end())
-    {
-        std::cerr << "Already joined group " << group_id << std::endl;
-        return -1;
-    }
-    
     // 创建UDP套接字
     int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock_fd < 0)
@@ -72,23 +103,129 @@ int kcp_multicast_client::join_group(const std::string& multicast_addr, uint16_t
         return -5;
     }
     
+    return sock_fd;
+}
+
+static int add_to_epoll(int epoll_fd, int sock_fd, uint32_t group_id)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = make_epoll_data(group_id, sock_fd);
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0)
+    {
+        std::cerr << "Failed to add socket to epoll: " << strerror(errno) << std::endl;
+        return -7;
+    }
+    return 0;
+}
+
+int kcp_multicast_client::use_shared_socket(uint16_t port)
+{
+    MutexLockGuard lock(mutex_);
+    
+    if (running_ || !groups_.empty() || shared_socket_fd_ >= 0)
+    {
+        std::cerr << "use_shared_socket must be called before join_group and start" << std::endl;
+        return -1;
+    }
+    
+    int sock_fd = open_multicast_socket(port);
+    if (sock_fd < 0)
+    {
+        return sock_fd;
+    }
+    
+    // 收包时带上目的地址, 用来区分组
+    int on = 1;
+    if (setsockopt(sock_fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0)
+    {
+        std::cerr << "Failed to set IP_PKTINFO: " << strerror(errno) << std::endl;
+        close(sock_fd);
+        return -3;
+    }
+    
+    int ret = add_to_epoll(epoll_fd_, sock_fd, 0);
+    if (ret < 0)
+    {
+        close(sock_fd);
+        return ret;
+    }
+    
+    shared_socket_fd_ = sock_fd;
+    shared_port_ = port;
+    return 0;
+}
+
+int kcp_multicast_client::join_group(const std::string& multicast_addr, uint16_t port, uint32_t group_id)
+{
+    MutexLockGuard lock(mutex_);
+    
+    // 检查是否已经加入该组
+    if (groups_.find(group_id) != groups_.end())
+    {
+        std::cerr << "Already joined group " << group_id << std::endl;
+        return -1;
+    }
+    
+    const in_addr_t mc_addr = inet_addr(multicast_addr.c_str());
+    const bool shared = (shared_socket_fd_ >= 0);
+    int sock_fd = -1;
+    if (shared)
+    {
+        // 共用套接字时按目的地址区分组
+        if (port != shared_port_ || shared_groups_.find(mc_addr) != shared_groups_.end())
+        {
+            std::cerr << "Shared socket needs port " << shared_port_ << " and a distinct multicast address" << std::endl;
+            return -8;
+        }
+        sock_fd = shared_socket_fd_;
+    }
+    else
+    {
+        sock_fd = open_multicast_socket(port);
+        if (sock_fd < 0)
+        {
+            return sock_fd;
+        }
+    }
+    
     // 加入组播组
     struct ip_mreq mreq;
-    mreq.imr_multiaddr.s_addr = inet_addr(multicast_addr.c_str());
+    mreq.imr_multiaddr.s_addr = mc_addr;
     mreq.imr_interface.s_addr = htonl(INADDR_ANY);
     
     if (setsockopt(sock_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
     {
         std::cerr << "Failed to join multicast group: " << strerror(errno) << std::endl;
-        close(sock_fd);
+        if (!shared)
+        {
+            close(sock_fd);
+        }
         return -6;
     }
     
+    if (shared)
+    {
+        shared_groups_[mc_addr] = group_id;
+    }
+    else
+    {
+        // 注册到epoll, 直到离开组播组
+        int ret = add_to_epoll(epoll_fd_, sock_fd, group_id);
+        if (ret < 0)
+        {
+            close(sock_fd);
+            return ret;
+        }
+    }
+    
     // 保存组信息
     GroupInfo group_info;
     group_info.multicast_addr = multicast_addr;
     group_info.port = port;
     group_info.socket_fd = sock_fd;
+    group_info.shared_socket = shared;
     group_info.last_seq = 0;
     
     groups_[group_id] = group_info;
@@ -100,7 +237,7 @@ int kcp_multicast_client::join_group(const std::string& multicast_addr, uint16_t
 
 int kcp_multicast_client::leave_group(uint32_t group_id)
 {
-    asio_kcp::lock_guard lock(mutex_);
+    MutexLockGuard lock(mutex_);
     
     auto it = groups_.find(group_id);
     if (it == groups_.end())
@@ -120,8 +257,8 @@ int kcp_multicast_client::leave_group(uint32_t group_id)
         // 继续执行，关闭套接字
     }
     
-    // 关闭套接字
-    close(it->second.socket_fd);
+    // 关闭套接字. 共用的套接字留给其它组.
+    close_group_socket(it->second);
     
     // 移除组信息
     groups_.erase(it);
@@ -131,15 +268,29 @@ int kcp_multicast_client::leave_group(uint32_t group_id)
     return 0;
 }
 
+void kcp_multicast_client::close_group_socket(GroupInfo& group)
+{
+    if (group.shared_socket)
+    {
+        shared_groups_.erase(inet_addr(group.multicast_addr.c_str()));
+    }
+    else
+    {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, group.socket_fd, NULL);
+        close(group.socket_fd);
+    }
+    group.socket_fd = -1;
+}
+
 void kcp_multicast_client::set_message_callback(const multicast_message_callback_t& cb)
 {
-    asio_kcp::lock_guard lock(mutex_);
+    MutexLockGuard lock(mutex_);
     msg_callback_ = cb;
 }
 
 bool kcp_multicast_client::start()
 {
-    asio_kcp::lock_guard lock(mutex_);
+    MutexLockGuard lock(mutex_);
     
     if (running_)
     {
@@ -171,7 +322,7 @@ bool kcp_multicast_client::start()
 void kcp_multicast_client::stop()
 {
     {
-        asio_kcp::lock_guard lock(mutex_);
+        MutexLockGuard lock(mutex_);
         if (!running_)
         {
             return;
@@ -180,14 +331,11 @@ void kcp_multicast_client::stop()
         running_ = false;
     }
     
-    // 等待接收线程结束
-    if (thread_running_)
-    {
-        pthread_join(receive_thread_, nullptr);
-    }
+    // 等待接收线程结束. 线程可能还没来得及设置thread_running_, running_为true时线程一定已创建.
+    pthread_join(receive_thread_, nullptr);
     
     // 离开所有组播组
-    asio_kcp::lock_guard lock(mutex_);
+    MutexLockGuard lock(mutex_);
     for (auto it = groups_.begin(); it != groups_.end(); )
     {
         // 离开组播组
@@ -198,7 +346,7 @@ void kcp_multicast_client::stop()
         setsockopt(it->second.socket_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
         
         // 关闭套接字
-        close(it->second.socket_fd);
+        close_group_socket(it->second);
         
         // 移除组信息
         it = groups_.erase(it);
@@ -207,185 +355,842 @@ void kcp_multicast_client::stop()
     std::cout << "Multicast client stopped" << std::endl;
 }
 
-void kcp_multicast_client::send_ack(uint32_t group_id, uint32_t seq)
+void kcp_multicast_client::send_feedback(uint32_t group_id)
 {
-    asio_kcp::lock_guard lock(mutex_);
+    MutexLockGuard lock(mutex_);
     
     auto it = groups_.find(group_id);
     if (it == groups_.end())
     {
-        std::cerr << "Not in group " << group_id << " when sending ACK" << std::endl;
+        std::cerr << "Not in group " << group_id << " when sending feedback" << std::endl;
         return;
     }
     
-    // 创建ACK消息
-    // 格式: "ACK:[SEQ]"
-    std::string ack_msg = "ACK:" + std::to_string(seq);
-    
-    // 创建目标地址
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(it->second.multicast_addr.c_str());
-    addr.sin_port = htons(it->second.port);
-    
-    // 发送ACK
-    sendto(it->second.socket_fd, ack_msg.c_str(), ack_msg.size(), 0,
-           (struct sockaddr*)&addr, sizeof(addr));
-    
-    std::cout << "Sent ACK for seq " << seq << " to group " << group_id << std::endl;
+    send_feedback_to_sender(it->second);
 }
 
 void kcp_multicast_client::receive_thread_func()
 {
     thread_running_ = true;
     
-    constexpr size_t MAX_BUFFER_SIZE = 65536;
-    char buffer[MAX_BUFFER_SIZE];
+    // recvmmsg一次读多个包
+    std::vector<char> buffer(ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH * ASIO_KCP_MULTICAST_CLIENT_RECV_BUFFER_SIZE);
+    struct mmsghdr msgs[ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH];
+    struct iovec iovecs[ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH];
+    struct sockaddr_in src_addrs[ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH];
+    char controls[ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
     
-    // 创建pollfd数组
-    std::vector<pollfd> poll_fds;
-    std::vector<uint32_t> group_ids;
+    struct epoll_event events[ASIO_KCP_MULTICAST_CLIENT_EPOLL_EVENTS];
+    delivery_list_t deliveries;
+    bool has_missing = false;
     
     while (running_)
     {
-        // 更新poll_fds
+        // 等待数据. 有丢包时缩短超时, 及时发NACK.
+        int ret = epoll_wait(epoll_fd_, events, ASIO_KCP_MULTICAST_CLIENT_EPOLL_EVENTS,
+                has_missing ? ASIO_KCP_MULTICAST_CLIENT_NACK_DELAY : 100);
+        
+        if (ret < 0)
         {
-            asio_kcp::lock_guard lock(mutex_);
+            if (errno == EINTR)
+            {
+                continue; // 被信号中断，重试
+            }
+            
+            std::cerr << "Epoll wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        
+        // 检查每个有数据的套接字
+        for (int i = 0; i < ret; ++i)
+        {
+            const uint32_t group_id = (uint32_t)(events[i].data.u64 >> 32);
+            const int sock_fd = (int)(uint32_t)events[i].data.u64;
             
-            poll_fds.clear();
-            group_ids.clear();
+            if (sock_fd == wakeup_fd_)
+            {
+                uint64_t value = 0;
+                (void)read(wakeup_fd_, &value, sizeof(value));
+                continue; // 补齐回复在下面处理
+            }
             
-            for (const auto& entry : groups_)
+            // 读空这个套接字. 最多读几轮, 不让一个组饿死其它组, epoll下次还会通知.
+            for (int round = 0; round < ASIO_KCP_MULTICAST_CLIENT_MAX_RECV_ROUNDS; ++round)
             {
-                pollfd pfd;
-                pfd.fd = entry.second.socket_fd;
-                pfd.events = POLLIN;
-                pfd.revents = 0;
+                for (int k = 0; k < ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH; ++k)
+                {
+                    iovecs[k].iov_base = &buffer[k * ASIO_KCP_MULTICAST_CLIENT_RECV_BUFFER_SIZE];
+                    iovecs[k].iov_len = ASIO_KCP_MULTICAST_CLIENT_RECV_BUFFER_SIZE;
+                    memset(&msgs[k], 0, sizeof(msgs[k]));
+                    msgs[k].msg_hdr.msg_iov = &iovecs[k];
+                    msgs[k].msg_hdr.msg_iovlen = 1;
+                    msgs[k].msg_hdr.msg_name = &src_addrs[k];
+                    msgs[k].msg_hdr.msg_namelen = sizeof(src_addrs[k]);
+                    msgs[k].msg_hdr.msg_control = controls[k];
+                    msgs[k].msg_hdr.msg_controllen = sizeof(controls[k]);
+                }
+                
+                const int count = recvmmsg(sock_fd, msgs, ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH, MSG_DONTWAIT, NULL);
+                if (count <= 0)
+                {
+                    if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        std::cerr << "Recvmmsg failed: " << strerror(errno) << std::endl;
+                    }
+                    break;
+                }
                 
-                poll_fds.push_back(pfd);
-                group_ids.push_back(entry.first);
+                handle_packets(sock_fd, group_id, msgs, count, &deliveries);
+                
+                if (count < ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH)
+                {
+                    break; // 读空了
+                }
             }
         }
         
-        if (poll_fds.empty())
+        handle_catch_up_packets(&deliveries);
+        has_missing = send_nacks();
+        send_feedbacks();
+    }
+    
+    thread_running_ = false;
+}
+
+// 共用套接字收到的包的目的地址. 没有IP_PKTINFO时返回INADDR_NONE.
+static in_addr_t grab_dest_addr(const struct msghdr& msg_hdr)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr*)&msg_hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
         {
-            // 没有组播组，等待一段时间
-            usleep(100000); // 100ms
-            continue;
+            struct in_pktinfo pktinfo;
+            memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+            return pktinfo.ipi_addr.s_addr;
         }
-        
-        // 等待数据
-        int ret = poll(poll_fds.data(), poll_fds.size(), 100); // 超时100ms
-        
-        if (ret < 0)
+    }
+    return INADDR_NONE;
+}
+
+uint32_t kcp_multicast_client::find_shared_group(const struct msghdr& msg_hdr, const struct sockaddr_in& src_addr, GroupInfo** group)
+{
+    // 组播包按目的地址找组
+    auto shared_it = shared_groups_.find(grab_dest_addr(msg_hdr));
+    if (shared_it != shared_groups_.end())
+    {
+        auto it = groups_.find(shared_it->second);
+        if (it != groups_.end())
         {
-            if (errno == EINTR)
-            {
-                continue; // 被信号中断，重试
-            }
-            
-            std::cerr << "Poll failed: " << strerror(errno) << std::endl;
-            break;
+            *group = &it->second;
+            return it->first;
         }
-        
-        if (ret == 0)
+    }
+    
+    // 发送者单播过来的too_old按发送者地址找组. 每个组的发送套接字不同.
+    for (auto it = groups_.begin(); it != groups_.end(); ++it)
+    {
+        const GroupInfo& info = it->second;
+        if (info.shared_socket && info.has_sender_addr &&
+            info.sender_addr.sin_addr.s_addr == src_addr.sin_addr.s_addr && info.sender_addr.sin_port == src_addr.sin_port)
         {
-            continue; // 超时，继续循环
+            *group = &it->second;
+            return it->first;
+        }
+    }
+    
+    *group = NULL;
+    return 0;
+}
+
+// 把一个组可以交付的消息移到deliveries
+static void append_deliveries(uint32_t group_id, std::vector<std::string>& group_msgs,
+        std::vector<std::pair<uint32_t, std::string> >* deliveries)
+{
+    for (size_t i = 0; i < group_msgs.size(); ++i)
+    {
+        deliveries->push_back(std::make_pair(group_id, std::string()));
+        deliveries->back().second.swap(group_msgs[i]);
+    }
+}
+
+void kcp_multicast_client::handle_packets(int sock_fd, uint32_t group_id, struct mmsghdr* msgs, int count, delivery_list_t* deliveries)
+{
+    multicast_message_callback_t cb;
+    std::vector<std::string> group_msgs;
+    deliveries->clear();
+    
+    // 一批包只加一次锁
+    {
+        MutexLockGuard lock(mutex_);
+        const bool shared = (sock_fd == shared_socket_fd_);
+        GroupInfo* group = NULL;
+        if (!shared)
+        {
+            auto it = groups_.find(group_id);
+            if (it == groups_.end())
+            {
+                return; // 已经离开了
+            }
+            group = &it->second;
         }
         
-        // 检查每个套接字
-        for (size_t i = 0; i < poll_fds.size(); ++i)
+        for (int k = 0; k < count; ++k)
         {
-            if (!(poll_fds[i].revents & POLLIN))
+            if (msgs[k].msg_hdr.msg_flags & MSG_TRUNC)
             {
-                continue; // 没有数据可读
+                continue; // 太大的包被截断了
             }
             
-            uint32_t group_id = group_ids[i];
-            int sock_fd = poll_fds[i].fd;
-            
-            // 接收数据
-            struct sockaddr_in src_addr;
-            socklen_t addr_len = sizeof(src_addr);
-            
-            ssize_t recv_len = recvfrom(sock_fd, buffer, MAX_BUFFER_SIZE, 0,
-                                        (struct sockaddr*)&src_addr, &addr_len);
-            
-            if (recv_len < 0)
+            const struct sockaddr_in& src_addr = *(const struct sockaddr_in*)msgs[k].msg_hdr.msg_name;
+            if (shared)
             {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                group_id = find_shared_group(msgs[k].msg_hdr, src_addr, &group);
+                if (group == NULL)
                 {
-                    continue; // 没有数据，继续
+                    continue; // 不是我们加入的组
                 }
-                
-                std::cerr << "Recvfrom failed: " << strerror(errno) << std::endl;
-                continue;
             }
             
-            // 检查是否是ACK消息回复（我们不处理）
-            if (recv_len >= 4 && memcmp(buffer, "ACK:", 4) == 0)
+            group_msgs.clear();
+            handle_packet(*group, (const char*)msgs[k].msg_hdr.msg_iov->iov_base, msgs[k].msg_len, src_addr, &group_msgs);
+            append_deliveries(group_id, group_msgs, deliveries);
+        }
+        
+        if (!deliveries->empty())
+        {
+            cb = msg_callback_;
+        }
+    }
+    
+    // 不持有锁调用回调
+    if (cb)
+    {
+        for (size_t i = 0; i < deliveries->size(); ++i)
+        {
+            cb((*deliveries)[i].first, (*deliveries)[i].second);
+        }
+    }
+}
+
+void kcp_multicast_client::handle_packet(GroupInfo& group, const char* data, size_t len,
+        const struct sockaddr_in& src_addr, std::vector<std::string>* deliver_msgs)
+{
+    if (group.catching_up)
+    {
+        // 补齐之后再处理
+        if (group.catch_up_stash.size() >= ASIO_KCP_MULTICAST_CLIENT_CATCH_UP_STASH)
+        {
+            group.catch_up_stash.pop_front();
+        }
+        group.catch_up_stash.push_back(std::make_pair(src_addr, std::string(data, len)));
+        return;
+    }
+
+    switch (get_mc_packet_type(data, len))
+    {
+        case eMcPacketRaw:
+            // 普通组播消息
+            deliver_msgs->push_back(std::string(data + ASIO_KCP_MC_HEADER_SIZE, len - ASIO_KCP_MC_HEADER_SIZE));
+            break;
+        case eMcPacketReliable:
+            handle_reliable_message(group, data, len, src_addr, deliver_msgs);
+            break;
+        case eMcPacketHeartbeat:
+            handle_heartbeat(group, grab_seq_from_mc_packet(data, len), src_addr, deliver_msgs);
+            break;
+        case eMcPacketTooOld:
+            handle_too_old(group, grab_seq_from_mc_packet(data, len), deliver_msgs);
+            break;
+        case eMcPacketFec:
+            handle_fec(group, data, len, src_addr, deliver_msgs);
+            break;
+        case eMcPacketBatch:
+        {
+            // 打包的小包逐个处理
+            size_t offset = ASIO_KCP_MC_HEADER_SIZE;
+            const char* frame = NULL;
+            size_t frame_len = 0;
+            while (grab_next_frame_from_mc_batch_packet(data, len, &offset, &frame, &frame_len))
             {
-                continue;
+                if (get_mc_packet_type(frame, frame_len) != eMcPacketBatch)
+                    handle_packet(group, frame, frame_len, src_addr, deliver_msgs);
             }
-            
-            // 检查是否是带序列号的可靠消息
-            if (recv_len >= 4)
+            break;
+        }
+        default:
+            break; // 不认识的包
+    }
+}
+
+void kcp_multicast_client::handle_reliable_message(GroupInfo& group, const char* data, size_t len,
+        const struct sockaddr_in& src_addr, std::vector<std::string>* msgs)
+{
+    const uint32_t seq = grab_seq_from_mc_packet(data, len);
+    const char* msg = data + ASIO_KCP_MC_RELIABLE_HEADER_SIZE;
+    const size_t msg_len = len - ASIO_KCP_MC_RELIABLE_HEADER_SIZE;
+
+    group.sender_addr = src_addr;
+    group.has_sender_addr = true;
+    group.feedback_dirty = true;
+    group.last_seq = seq;
+
+    if (!group.seq_inited)
+    {
+        // 中途加入的从第一条收到的消息开始
+        group.seq_inited = true;
+        group.next_deliver_seq = seq;
+        group.next_expected_seq = seq;
+    }
+
+    if (mc_seq_diff(seq, group.next_deliver_seq) < 0)
+    {
+        // 已经交付过或者已经放弃的消息
+        group.duplicate_count++;
+        return;
+    }
+
+    if (group.delivery_mode == eMcDeliverLatestOnly)
+    {
+        group.lost_count += mc_seq_diff(seq, group.next_deliver_seq);
+        group.next_deliver_seq = seq + 1;
+        group.next_expected_seq = seq + 1;
+        group.delivered_count++;
+        msgs->push_back(std::string(msg, msg_len));
+        return;
+    }
+
+    // 超出重排窗口, 放弃最老的缺口
+    if (mc_seq_diff(seq, group.next_deliver_seq) >= ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW)
+    {
+        advance_deliver_seq(group, seq - ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW + 1, msgs);
+    }
+
+    ReorderSlot& slot = group.reorder_ring[seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW];
+    if (slot.filled && slot.seq == seq)
+    {
+        group.duplicate_count++;
+        return;
+    }
+
+    if (!slot.filled)
+    {
+        group.buffered_count++;
+    }
+    slot.filled = true;
+    slot.kept = false;
+    slot.seq = seq;
+    slot.msg.assign(msg, msg_len);
+
+    // 重传来的消息
+    group.missing_seqs.erase(seq);
+
+    if (mc_seq_diff(seq, group.next_expected_seq) >= 0)
+    {
+        group.loss_expected_count += mc_seq_diff(seq, group.next_expected_seq) + 1;
+        mark_missing_seqs(group, group.next_expected_seq, seq, iclock64());
+        group.next_expected_seq = seq + 1;
+    }
+    collect_in_order_msgs(group, msgs);
+}
+
+void kcp_multicast_client::handle_heartbeat(GroupInfo& group, uint32_t next_seq,
+        const struct sockaddr_in& src_addr, std::vector<std::string>* msgs)
+{
+    group.sender_addr = src_addr;
+    group.has_sender_addr = true;
+    group.feedback_dirty = true;
+
+    if (!group.seq_inited)
+    {
+        group.seq_inited = true;
+        group.next_deliver_seq = next_seq;
+        group.next_expected_seq = next_seq;
+        return;
+    }
+
+    if (group.delivery_mode == eMcDeliverLatestOnly)
+    {
+        // 末尾丢失的消息不再等待
+        if (mc_seq_diff(next_seq, group.next_deliver_seq) > 0)
+        {
+            group.lost_count += mc_seq_diff(next_seq, group.next_deliver_seq);
+            group.next_deliver_seq = next_seq;
+            group.next_expected_seq = next_seq;
+        }
+        return;
+    }
+
+    if (mc_seq_diff(next_seq, group.next_deliver_seq) > ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW)
+    {
+        advance_deliver_seq(group, next_seq - ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW, msgs);
+    }
+    if (mc_seq_diff(next_seq, group.next_expected_seq) > 0)
+    {
+        group.loss_expected_count += mc_seq_diff(next_seq, group.next_expected_seq);
+        mark_missing_seqs(group, group.next_expected_seq, next_seq, iclock64());
+        group.next_expected_seq = next_seq;
+    }
+}
+
+void kcp_multicast_client::handle_fec(GroupInfo& group, const char* data, size_t len,
+        const struct sockaddr_in& src_addr, std::vector<std::string>* msgs)
+{
+    mc_fec_block block;
+    if (group.delivery_mode != eMcDeliverInOrder || !grab_fec_block_from_mc_packet(data, len, &block))
+    {
+        return;
+    }
+    group.fec_seen = true;
+
+    if (!group.seq_inited || mc_seq_diff(block.first_seq + block.count, group.next_deliver_seq) <= 0)
+    {
+        return; // 整块都已经交付或放弃
+    }
+
+    // 把收到的消息从校验中消去, 剩下的就是唯一丢失的消息
+    const uint8_t count = block.count;
+    int lost_index = -1;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        const uint32_t seq = block.first_seq + i;
+        const ReorderSlot& slot = group.reorder_ring[seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW];
+        if (slot.seq == seq && (slot.filled || slot.kept))
+        {
+            block.add(slot.msg.data(), slot.msg.size());
+        }
+        else if (lost_index < 0)
+        {
+            lost_index = i;
+        }
+        else
+        {
+            return; // 丢了不止一个, 等重传
+        }
+    }
+
+    const uint32_t lost_seq = block.first_seq + lost_index;
+    std::string msg;
+    if (lost_index < 0 || mc_seq_diff(lost_seq, group.next_deliver_seq) < 0 || !block.rebuild(&msg))
+    {
+        return;
+    }
+
+    // 末尾丢失的消息还没被发现
+    if (mc_seq_diff(lost_seq, group.next_expected_seq) >= 0)
+    {
+        group.loss_missing_count++;
+    }
+    group.fec_recovered_count++;
+    const std::string packet = making_mc_reliable_packet(lost_seq, msg.data(), msg.size());
+    handle_reliable_message(group, packet.data(), packet.size(), src_addr, msgs);
+}
+
+void kcp_multicast_client::handle_too_old(GroupInfo& group, uint32_t window_base_seq, std::vector<std::string>* msgs)
+{
+    if (group.seq_inited && mc_seq_diff(window_base_seq, group.next_deliver_seq) > 0)
+    {
+        advance_deliver_seq(group, window_base_seq, msgs);
+    }
+}
+
+int kcp_multicast_client::begin_catch_up(uint32_t group_id, std::string* request)
+{
+    MutexLockGuard lock(mutex_);
+    auto it = groups_.find(group_id);
+    if (it == groups_.end())
+    {
+        return -1;
+    }
+
+    GroupInfo& group = it->second;
+    if (group.seq_inited || group.catching_up)
+    {
+        return -2;
+    }
+
+    group.catching_up = true;
+    group.catch_up_begun = false;
+    group.catch_up_deadline = iclock64() + ASIO_KCP_MULTICAST_CLIENT_CATCH_UP_TIMEOUT;
+    *request = making_mc_catch_up_request_packet(group_id);
+    return 0;
+}
+
+bool kcp_multicast_client::handle_catch_up_packet(const char* data, size_t len)
+{
+    const eMulticastPacketType type = get_mc_packet_type(data, len);
+    if (type != eMcPacketCatchUpBegin && type != eMcPacketCatchUp)
+    {
+        return false;
+    }
+
+    {
+        MutexLockGuard lock(mutex_);
+        catch_up_packets_.push_back(std::string(data, len));
+    }
+
+    // 回调只在接收线程中调用, 保证和组播消息的交付顺序
+    const uint64_t one = 1;
+    (void)write(wakeup_fd_, &one, sizeof(one));
+    return true;
+}
+
+void kcp_multicast_client::handle_catch_up_packets(delivery_list_t* deliveries)
+{
+    multicast_message_callback_t cb;
+    std::vector<std::string> group_msgs;
+    deliveries->clear();
+
+    {
+        MutexLockGuard lock(mutex_);
+        std::vector<std::string> packets;
+        packets.swap(catch_up_packets_);
+        for (size_t i = 0; i < packets.size(); ++i)
+        {
+            const uint32_t group_id = grab_group_id_from_mc_packet(packets[i].data(), packets[i].size());
+            auto it = groups_.find(group_id);
+            if (it == groups_.end())
             {
-                uint32_t net_seq;
-                memcpy(&net_seq, buffer, 4);
-                uint32_t seq = ntohl(net_seq);
-                
-                // 处理可靠消息
-                handle_reliable_message(group_id, buffer + 4, recv_len - 4);
-                
-                // 发送ACK确认
-                send_ack(group_id, seq);
+                continue; // 已经离开了
             }
-            else
+
+            group_msgs.clear();
+            handle_catch_up(it->second, packets[i].data(), packets[i].size(), &group_msgs);
+            append_deliveries(group_id, group_msgs, deliveries);
+        }
+
+        const uint64_t now = iclock64();
+        for (auto& entry : groups_)
+        {
+            GroupInfo& group = entry.second;
+            if (group.catching_up && group.catch_up_deadline <= now)
             {
-                // 普通组播消息
-                std::string msg(buffer, recv_len);
-                handle_multicast_message(group_id, msg);
+                std::cerr << "Catching up group " << entry.first << " timeout" << std::endl;
+                group_msgs.clear();
+                finish_catch_up(group, &group_msgs);
+                append_deliveries(entry.first, group_msgs, deliveries);
             }
         }
+
+        if (!deliveries->empty())
+        {
+            cb = msg_callback_;
+        }
+    }
+
+    if (cb)
+    {
+        for (size_t i = 0; i < deliveries->size(); ++i)
+        {
+            cb((*deliveries)[i].first, (*deliveries)[i].second);
+        }
     }
-    
-    thread_running_ = false;
 }
 
-void kcp_multicast_client::handle_multicast_message(uint32_t group_id, const std::string& msg)
+void kcp_multicast_client::handle_catch_up(GroupInfo& group, const char* data, size_t len, std::vector<std::string>* msgs)
 {
-    multicast_message_callback_t cb;
-    
+    if (!group.catching_up)
     {
-        asio_kcp::lock_guard lock(mutex_);
-        cb = msg_callback_;
+        return; // 已经超时放弃了
     }
-    
-    if (cb)
+
+    switch (get_mc_packet_type(data, len))
     {
-        cb(group_id, msg);
+        case eMcPacketCatchUpBegin:
+        {
+            uint32_t group_id = 0;
+            uint32_t first_seq = 0;
+            uint32_t live_seq = 0;
+            if (group.catch_up_begun || !grab_catch_up_begin_from_mc_packet(data, len, &group_id, &first_seq, &live_seq))
+            {
+                return;
+            }
+
+            // 从服务端保留的最早的消息开始交付
+            group.catch_up_begun = true;
+            group.catch_up_live_seq = live_seq;
+            group.seq_inited = true;
+            group.next_deliver_seq = first_seq;
+            group.next_expected_seq = first_seq;
+            break;
+        }
+        case eMcPacketCatchUp:
+        {
+            const uint32_t seq = grab_seq_from_mc_catch_up_packet(data, len);
+            if (!group.catch_up_begun || mc_seq_diff(seq, group.next_deliver_seq) < 0 || mc_seq_diff(seq, group.catch_up_live_seq) >= 0)
+            {
+                group.duplicate_count++;
+                return;
+            }
+
+            // kcp保证顺序, 补发的消息可以直接交付
+            group.lost_count += mc_seq_diff(seq, group.next_deliver_seq);
+            group.next_deliver_seq = seq + 1;
+            group.next_expected_seq = seq + 1;
+            group.delivered_count++;
+            group.caught_up_count++;
+            msgs->push_back(std::string(data + ASIO_KCP_MC_CATCH_UP_HEADER_SIZE, len - ASIO_KCP_MC_CATCH_UP_HEADER_SIZE));
+            break;
+        }
+        default:
+            return;
+    }
+
+    if (group.next_deliver_seq == group.catch_up_live_seq)
+    {
+        finish_catch_up(group, msgs);
     }
 }
 
-void kcp_multicast_client::handle_reliable_message(uint32_t group_id, const char* data, size_t len)
+void kcp_multicast_client::finish_catch_up(GroupInfo& group, std::vector<std::string>* msgs)
 {
-    std::string msg(data, len);
-    
-    // 更新最后收到的序列号
+    // 超时, 还没补发的放弃
+    if (group.catch_up_begun && mc_seq_diff(group.catch_up_live_seq, group.next_deliver_seq) > 0)
     {
-        asio_kcp::lock_guard lock(mutex_);
-        auto it = groups_.find(group_id);
-        if (it != groups_.end())
+        group.lost_count += mc_seq_diff(group.catch_up_live_seq, group.next_deliver_seq);
+        group.next_deliver_seq = group.catch_up_live_seq;
+        group.next_expected_seq = group.catch_up_live_seq;
+    }
+    group.catching_up = false;
+    group.catch_up_begun = false;
+
+    // live_seq之前的是重复的, 之后丢失的照常NACK
+    std::deque<std::pair<struct sockaddr_in, std::string> > stash;
+    stash.swap(group.catch_up_stash);
+    for (size_t i = 0; i < stash.size(); ++i)
+    {
+        handle_packet(group, stash[i].second.data(), stash[i].second.size(), stash[i].first, msgs);
+    }
+}
+
+void kcp_multicast_client::mark_missing_seqs(GroupInfo& group, uint32_t from, uint32_t to, uint64_t now)
+{
+    // [from, to) 总在重排窗口中, 所以missing_seqs不会超过ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW
+    for (uint32_t seq = from; mc_seq_diff(to, seq) > 0; ++seq)
+    {
+        group.missing_seqs[seq] = now + ASIO_KCP_MULTICAST_CLIENT_NACK_DELAY;
+        group.loss_missing_count++;
+    }
+}
+
+void kcp_multicast_client::collect_in_order_msgs(GroupInfo& group, std::vector<std::string>* msgs)
+{
+    for (;;)
+    {
+        ReorderSlot& slot = group.reorder_ring[group.next_deliver_seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW];
+        if (!slot.filled || slot.seq != group.next_deliver_seq)
         {
-            // 这里可以添加序列号检查逻辑，丢弃重复的消息
-            // ...
+            break;
         }
+
+        deliver_slot(group, slot, msgs);
+        group.next_deliver_seq++;
     }
-    
-    // 调用回调
-    handle_multicast_message(group_id, msg);
 }
 
-} // namespace asio_kcp 
\ No newline at end of file
+void kcp_multicast_client::deliver_slot(GroupInfo& group, ReorderSlot& slot, std::vector<std::string>* msgs)
+{
+    if (group.fec_seen)
+    {
+        msgs->push_back(slot.msg);
+        slot.kept = true;
+    }
+    else
+    {
+        msgs->push_back(std::string());
+        msgs->back().swap(slot.msg);
+    }
+    slot.filled = false;
+    group.buffered_count--;
+    group.delivered_count++;
+}
+
+void kcp_multicast_client::advance_deliver_seq(GroupInfo& group, uint32_t to, std::vector<std::string>* msgs)
+{
+    // 窗口里已收到的照常交付, 没收到的放弃
+    for (uint32_t i = 0; i < ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW && mc_seq_diff(to, group.next_deliver_seq) > 0; ++i)
+    {
+        ReorderSlot& slot = group.reorder_ring[group.next_deliver_seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW];
+        if (slot.filled && slot.seq == group.next_deliver_seq)
+        {
+            deliver_slot(group, slot, msgs);
+        }
+        else
+        {
+            group.missing_seqs.erase(group.next_deliver_seq);
+            group.lost_count++;
+        }
+        group.next_deliver_seq++;
+    }
+
+    // 比窗口还大的缺口
+    if (mc_seq_diff(to, group.next_deliver_seq) > 0)
+    {
+        group.lost_count += mc_seq_diff(to, group.next_deliver_seq);
+        group.next_deliver_seq = to;
+    }
+    if (mc_seq_diff(to, group.next_expected_seq) > 0)
+    {
+        group.next_expected_seq = to;
+    }
+
+    collect_in_order_msgs(group, msgs);
+}
+
+int kcp_multicast_client::set_delivery_mode(uint32_t group_id, eMulticastDeliveryMode mode)
+{
+    MutexLockGuard lock(mutex_);
+    auto it = groups_.find(group_id);
+    if (it == groups_.end())
+    {
+        return -1;
+    }
+
+    it->second.delivery_mode = mode;
+    if (mode == eMcDeliverLatestOnly)
+    {
+        it->second.missing_seqs.clear();
+    }
+    return 0;
+}
+
+int kcp_multicast_client::get_group_stats(uint32_t group_id, multicast_group_stats* stats)
+{
+    MutexLockGuard lock(mutex_);
+    auto it = groups_.find(group_id);
+    if (it == groups_.end())
+    {
+        return -1;
+    }
+
+    const GroupInfo& group = it->second;
+    stats->next_deliver_seq = group.next_deliver_seq;
+    stats->delivered_count = group.delivered_count;
+    stats->duplicate_count = group.duplicate_count;
+    stats->lost_count = group.lost_count;
+    stats->nack_sent_count = group.nack_sent_count;
+    stats->fec_recovered_count = group.fec_recovered_count;
+    stats->caught_up_count = group.caught_up_count;
+    stats->catching_up = group.catching_up;
+    stats->loss_permille = (uint16_t)(group.loss_permille_x8 / 8);
+    stats->missing_count = group.missing_seqs.size();
+    stats->buffered_count = group.buffered_count;
+    return 0;
+}
+
+bool kcp_multicast_client::send_nacks(void)
+{
+    MutexLockGuard lock(mutex_);
+
+    bool has_missing = false;
+    const uint64_t now = iclock64();
+    std::vector<mc_nack_range> ranges;
+    for (auto& entry : groups_)
+    {
+        GroupInfo& group = entry.second;
+        if (group.missing_seqs.empty())
+        {
+            continue;
+        }
+        has_missing = true;
+        if (!group.has_sender_addr)
+        {
+            continue;
+        }
+
+        // 把到期的连续序列号合并成一个range
+        ranges.clear();
+        for (auto& miss : group.missing_seqs)
+        {
+            if (miss.second > now)
+            {
+                continue;
+            }
+            miss.second = now + ASIO_KCP_MULTICAST_CLIENT_NACK_INTERVAL;
+
+            if (!ranges.empty() && ranges.back().first_seq + ranges.back().count == miss.first && ranges.back().count < 0xFFFF)
+            {
+                ranges.back().count++;
+            }
+            else if (ranges.size() < ASIO_KCP_MC_NACK_MAX_RANGES)
+            {
+                mc_nack_range range;
+                range.first_seq = miss.first;
+                range.count = 1;
+                ranges.push_back(range);
+            }
+            else
+            {
+                miss.second = now; // 放不下了, 下一轮再发
+            }
+        }
+
+        if (ranges.empty())
+        {
+            continue;
+        }
+
+        const std::string nack = making_mc_nack_packet(ranges);
+        sendto(group.socket_fd, nack.data(), nack.size(), 0,
+               (const struct sockaddr*)&group.sender_addr, sizeof(group.sender_addr));
+        group.nack_sent_count++;
+    }
+    return has_missing;
+}
+
+void kcp_multicast_client::send_feedbacks(void)
+{
+    MutexLockGuard lock(mutex_);
+
+    const uint64_t now = iclock64();
+    for (auto& entry : groups_)
+    {
+        GroupInfo& group = entry.second;
+        if (group.feedback_dirty && group.next_feedback_clock <= now)
+        {
+            send_feedback_to_sender(group);
+            group.next_feedback_clock = now + ASIO_KCP_MULTICAST_CLIENT_FEEDBACK_INTERVAL;
+        }
+    }
+}
+
+void kcp_multicast_client::send_feedback_to_sender(GroupInfo& group)
+{
+    if (!group.has_sender_addr || !group.seq_inited)
+    {
+        return;
+    }
+
+    // bit i: next_deliver_seq + 1 + i 已收到
+    std::vector<uint8_t> bitmap;
+    if (group.delivery_mode == eMcDeliverInOrder)
+    {
+        const uint32_t bits = std::min<uint32_t>(mc_seq_diff(group.next_expected_seq, group.next_deliver_seq),
+                ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES * 8);
+        for (uint32_t i = 0; i < bits; ++i)
+        {
+            const uint32_t seq = group.next_deliver_seq + 1 + i;
+            const ReorderSlot& slot = group.reorder_ring[seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW];
+            if (slot.filled && slot.seq == seq)
+            {
+                bitmap.resize(i / 8 + 1, 0);
+                bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+        }
+    }
+
+    // 丢包率 = 7/8 旧值 + 1/8 这次反馈间隔内的值
+    if (group.loss_expected_count > 0)
+    {
+        const uint64_t loss = (uint64_t)std::min(group.loss_missing_count, group.loss_expected_count) * 1000 / group.loss_expected_count;
+        group.loss_permille_x8 = group.loss_permille_x8 - group.loss_permille_x8 / 8 + (uint32_t)loss;
+        group.loss_expected_count = 0;
+        group.loss_missing_count = 0;
+    }
+
+    const std::string feedback = making_mc_feedback_packet(group.next_deliver_seq, bitmap, (uint16_t)(group.loss_permille_x8 / 8));
+    sendto(group.socket_fd, feedback.data(), feedback.size(), 0,
+           (const struct sockaddr*)&group.sender_addr, sizeof(group.sender_addr));
+    group.feedback_dirty = false;
+}
+
+} // namespace asio_kcp
@@ -10,13 +10,69 @@
 #include <memory>
 #include <atomic>
 #include <functional>
+#include <vector>
+#include <deque>
+#include <netinet/in.h>
 #include "mutex.h"
 
+// 第一次发现丢包后等待多久再发NACK, 容忍网络乱序 (毫秒)
+#define ASIO_KCP_MULTICAST_CLIENT_NACK_DELAY 3
+
+// NACK之后还没收到重传, 隔多久再NACK一次 (毫秒)
+#define ASIO_KCP_MULTICAST_CLIENT_NACK_INTERVAL 50
+
+// 有新消息时, 隔多久向发送者反馈一次接收状态 (毫秒)
+#define ASIO_KCP_MULTICAST_CLIENT_FEEDBACK_INTERVAL 100
+
+// epoll_wait一次最多返回多少个套接字
+#define ASIO_KCP_MULTICAST_CLIENT_EPOLL_EVENTS 64
+
+// recvmmsg一次最多读多少个包, 以及每个包的缓冲区大小
+#define ASIO_KCP_MULTICAST_CLIENT_RECV_BATCH 16
+#define ASIO_KCP_MULTICAST_CLIENT_RECV_BUFFER_SIZE 65536
+
+// 一个套接字每次最多连续读几批. 避免一个繁忙的组饿死其它组.
+#define ASIO_KCP_MULTICAST_CLIENT_MAX_RECV_ROUNDS 4
+
+// 按序交付时最多缓存多少个序列号的消息. 等不到重传的缺口超出这个窗口时放弃, 计入丢失.
+#define ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW 1024
+
+// 补齐期间最多暂存多少个组播包. 更早的被丢弃, 补齐之后再NACK.
+#define ASIO_KCP_MULTICAST_CLIENT_CATCH_UP_STASH 4096
+
+// 补齐超过这个时间还没完成时放弃, 直接从收到的组播消息开始 (毫秒)
+#define ASIO_KCP_MULTICAST_CLIENT_CATCH_UP_TIMEOUT 10000
+
+struct mmsghdr;
+struct msghdr;
+
 namespace asio_kcp {
 
 // 组播消息回调函数类型
 typedef std::function<void(uint32_t /*group_id*/, const std::string& /*msg*/)> multicast_message_callback_t;
 
+// 可靠组播消息的交付方式
+enum eMulticastDeliveryMode
+{
+    eMcDeliverInOrder,      // 默认. 按序列号顺序, 每条消息恰好交付一次. 有缺口时等重传补齐后再交付后面的消息.
+    eMcDeliverLatestOnly,   // 只交付比已交付的更新的消息, 不NACK也不等重传. 适合实时状态流.
+};
+
+struct multicast_group_stats
+{
+    uint32_t next_deliver_seq;    // 下一个要交付的序列号
+    uint64_t delivered_count;     // 已交付的可靠消息数量
+    uint64_t duplicate_count;     // 丢弃的重复消息数量
+    uint64_t lost_count;          // 放弃等待的消息数量
+    uint64_t nack_sent_count;     // 发出的NACK包数量
+    uint64_t fec_recovered_count; // 用FEC校验包恢复的消息数量
+    uint64_t caught_up_count;     // 通过kcp补齐交付的消息数量
+    bool catching_up;             // 正在补齐
+    uint16_t loss_permille;       // 修复之前的丢包率(千分比), 反馈给发送者调整FEC
+    size_t missing_count;         // 正在等待重传的消息数量
+    size_t buffered_count;        // 等待前面缺口补齐的消息数量
+};
+
 // 组播客户端类，用于接收组播消息
 class kcp_multicast_client
 {
@@ -38,35 +94,155 @@ public:
     // 设置消息回调，当收到组播消息时调用
     void set_message_callback(const multicast_message_callback_t& cb);
 
+    // 所有组共用一个绑定在port的套接字接收, 减少套接字, 内核缓冲区和唤醒次数. 适合加入很多组的客户端.
+    // 按IP_PKTINFO给出的目的地址区分组, 所以各组的组播地址不能相同, 端口必须都是port.
+    // 请在join_group和start之前调用.
+    // 返回值: 成功返回0，失败返回负数错误码
+    int use_shared_socket(uint16_t port);
+
     // 启动接收线程
     bool start();
 
     // 停止接收
     void stop();
 
-    // 发送ACK确认消息（用于可靠组播）
-    void send_ack(uint32_t group_id, uint32_t seq);
+    // 立即向发送者单播反馈接收状态（用于可靠组播）: 连续收到的位置和之后的接收bitmap.
+    // 接收线程有新消息时每ASIO_KCP_MULTICAST_CLIENT_FEEDBACK_INTERVAL毫秒自动反馈一次, 一般不需要调用.
+    void send_feedback(uint32_t group_id);
+
+    // 设置可靠消息的交付方式, 默认eMcDeliverInOrder. 请在join_group之后, start之前设置.
+    // 返回值: 成功返回0，不在组中返回-1
+    int set_delivery_mode(uint32_t group_id, eMulticastDeliveryMode mode);
+
+    // 中途加入时补齐加入之前的可靠消息. 请在join_group之后, 收到这个组的消息之前调用, 然后把request通过kcp连接发给服务端
+    // (kcp_svr::server::handle_multicast_catch_up_request). 补齐完成之前收到的组播包先暂存, 交付从服务端保留的最早的消息开始.
+    // 返回值: 成功返回0，不在组中返回-1, 已经开始收消息或正在补齐返回-2
+    int begin_catch_up(uint32_t group_id, std::string* request);
+
+    // kcp连接收到的每个消息先交给它. 是补齐的回复时返回true, 消息在接收线程中交付; 否则返回false, 请照常处理.
+    bool handle_catch_up_packet(const char* data, size_t len);
+
+    // 返回值: 成功返回0，不在组中返回-1
+    int get_group_stats(uint32_t group_id, multicast_group_stats* stats);
 
 private:
+    // 重排窗口中的一条消息
+    struct ReorderSlot
+    {
+        bool filled;
+        bool kept;                    // 已交付, 但为FEC恢复保留了msg
+        uint32_t seq;
+        std::string msg;
+
+        ReorderSlot() : filled(false), kept(false), seq(0) {}
+    };
+
     // 组播组信息
     struct GroupInfo
     {
         std::string multicast_addr;   // 组播地址
         uint16_t port;                // 组播端口
         int socket_fd;                // 套接字描述符
+        bool shared_socket;           // socket_fd是所有组共用的套接字
         uint32_t last_seq;            // 最后收到的序列号
-        
-        GroupInfo() : port(0), socket_fd(-1), last_seq(0) {}
+
+        eMulticastDeliveryMode delivery_mode;
+        bool seq_inited;              // 收到第一个可靠消息或心跳后才知道从哪个序列号开始
+        uint32_t next_deliver_seq;    // 下一个要交付的序列号
+        uint32_t next_expected_seq;   // 收到过的最大序列号 + 1
+        std::vector<ReorderSlot> reorder_ring; // [next_deliver_seq, next_expected_seq) 中已收到的消息, 按 seq % ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW 索引
+        size_t buffered_count;
+        std::map<uint32_t, uint64_t> missing_seqs; // 丢失的序列号 -> 下次发NACK的时间
+        bool has_sender_addr;
+        struct sockaddr_in sender_addr; // 发送者地址, NACK和反馈单播到这里
+        bool feedback_dirty;          // 上次反馈之后收到过可靠消息或心跳
+        uint64_t next_feedback_clock;
+        bool fec_seen;                // 发送者在发FEC, 交付后的消息要保留在重排窗口里
+        uint32_t loss_expected_count; // 上次反馈之后新出现的序列号数量
+        uint32_t loss_missing_count;  // 其中丢失的数量 (不管后来有没有恢复)
+        uint32_t loss_permille_x8;    // 平滑之后的丢包率 * 8
+
+        uint64_t delivered_count;
+        uint64_t duplicate_count;
+        uint64_t nack_sent_count;
+        uint64_t lost_count;
+        uint64_t fec_recovered_count;
+
+        bool catching_up;             // 在等待服务端通过kcp补发
+        bool catch_up_begun;          // 收到了catch_up_begin, 补发的消息从next_deliver_seq开始
+        uint32_t catch_up_live_seq;   // 从这个序列号开始走组播
+        uint64_t catch_up_deadline;
+        std::deque<std::pair<struct sockaddr_in, std::string> > catch_up_stash; // 补齐期间收到的组播包
+        uint64_t caught_up_count;
+
+        GroupInfo() : port(0), socket_fd(-1), shared_socket(false), last_seq(0), delivery_mode(eMcDeliverInOrder), seq_inited(false),
+            next_deliver_seq(0), next_expected_seq(0), reorder_ring(ASIO_KCP_MULTICAST_CLIENT_REORDER_WINDOW), buffered_count(0),
+            has_sender_addr(false), feedback_dirty(false), next_feedback_clock(0), fec_seen(false), loss_expected_count(0), loss_missing_count(0),
+            loss_permille_x8(0), delivered_count(0), duplicate_count(0), nack_sent_count(0), lost_count(0), fec_recovered_count(0),
+            catching_up(false), catch_up_begun(false), catch_up_live_seq(0), catch_up_deadline(0), caught_up_count(0) {}
     };
 
-    // 接收线程函数
+    // 接收线程函数. 套接字在join_group/leave_group时注册到epoll, 每个有数据的套接字用recvmmsg批量读取.
     void receive_thread_func();
 
-    // 处理收到的组播消息
-    void handle_multicast_message(uint32_t group_id, const std::string& msg);
+    // 离开组播组时关闭套接字, 共用的套接字只是不再对应这个组. 需要持有mutex_.
+    void close_group_socket(GroupInfo& group);
+
+    // (组ID, 消息)
+    typedef std::vector<std::pair<uint32_t, std::string> > delivery_list_t;
+
+    // 处理recvmmsg读到的一批包. 只加一次锁, 不持有锁调用回调.
+    // sock_fd是共用套接字时, 每个包按目的地址找组, 否则都属于group_id.
+    void handle_packets(int sock_fd, uint32_t group_id, struct mmsghdr* msgs, int count, delivery_list_t* deliveries);
+
+    // 需要持有mutex_. 找不到时*group为NULL.
+    uint32_t find_shared_group(const struct msghdr& msg_hdr, const struct sockaddr_in& src_addr, GroupInfo** group);
+
+    // 以下函数需要持有mutex_. 可以交付的消息按顺序放入msgs.
+    void handle_packet(GroupInfo& group, const char* data, size_t len, const struct sockaddr_in& src_addr, std::vector<std::string>* msgs);
+
+    // 处理可靠组播消息. 检查序列号缺口和重复.
+    void handle_reliable_message(GroupInfo& group, const char* data, size_t len, const struct sockaddr_in& src_addr, std::vector<std::string>* msgs);
+
+    // 处理心跳, 发现末尾丢失的消息
+    void handle_heartbeat(GroupInfo& group, uint32_t next_seq, const struct sockaddr_in& src_addr, std::vector<std::string>* msgs);
+
+    // 块内只丢了一个消息时用校验包恢复它
+    void handle_fec(GroupInfo& group, const char* data, size_t len, const struct sockaddr_in& src_addr, std::vector<std::string>* msgs);
+
+    // 处理kcp收到的补齐回复
+    void handle_catch_up(GroupInfo& group, const char* data, size_t len, std::vector<std::string>* msgs);
+
+    // 补齐完成或超时, 处理暂存的组播包
+    void finish_catch_up(GroupInfo& group, std::vector<std::string>* msgs);
+
+    // 接收线程处理handle_catch_up_packet收下的回复和超时的补齐
+    void handle_catch_up_packets(delivery_list_t* deliveries);
+
+    // 发送者已经不能重传window_base_seq之前的消息
+    void handle_too_old(GroupInfo& group, uint32_t window_base_seq, std::vector<std::string>* msgs);
+
+    // 把[from, to)标记为丢失
+    void mark_missing_seqs(GroupInfo& group, uint32_t from, uint32_t to, uint64_t now);
+
+    // 从重排窗口取出可以按序交付的消息
+    void collect_in_order_msgs(GroupInfo& group, std::vector<std::string>* msgs);
+
+    // 交付next_deliver_seq的消息
+    void deliver_slot(GroupInfo& group, ReorderSlot& slot, std::vector<std::string>* msgs);
+
+    // 放弃等待to之前的缺口, 把next_deliver_seq推进到to
+    void advance_deliver_seq(GroupInfo& group, uint32_t to, std::vector<std::string>* msgs);
+
+
+    // 发送到期的NACK. 返回是否还有丢失的消息.
+    bool send_nacks(void);
+
+    // 发送到期的反馈
+    void send_feedbacks(void);
 
-    // 处理可靠组播消息
-    void handle_reliable_message(uint32_t group_id, const char* data, size_t len);
+    // 需要持有mutex_
+    void send_feedback_to_sender(GroupInfo& group);
 
 private:
     std::map<uint32_t, GroupInfo> groups_;    // 组播组信息映射表
@@ -74,7 +250,13 @@ private:
     std::atomic<bool> thread_running_;        // 线程运行标志
     pthread_t receive_thread_;                // 接收线程
     multicast_message_callback_t msg_callback_; // 消息回调函数
-    asio_kcp::mutex mutex_;                   // 互斥锁
+    MutexLock mutex_;                         // 互斥锁
+    int epoll_fd_;                            // 所有组播套接字都注册在这里
+    int shared_socket_fd_;                    // use_shared_socket创建的套接字, 没有时为-1
+    uint16_t shared_port_;
+    std::map<in_addr_t, uint32_t> shared_groups_; // 共用套接字的组播地址 -> 组ID
+    int wakeup_fd_;                           // eventfd, 有补齐回复时唤醒接收线程
+    std::vector<std::string> catch_up_packets_; // handle_catch_up_packet收下, 等接收线程处理的回复
 };
 
 } // namespace asio_kcp
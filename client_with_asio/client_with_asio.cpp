@@ -14,35 +14,14 @@
 #include "../util/ikcp.h"
 #include "test_util.h"
 #include "../util/connect_packet.hpp"
+#include "../client_lib/kcp_client_util.h"
 
 #define PACKAGE_LOSE_RATIO 0
 #define PACKAGE_CONTENT_DAMAGE_RATIO 0
 #define SEND_TEST_MSG_INTERVAL 1000
 
-/* get system time */
-static inline void itimeofday(long *sec, long *usec)
-{
-	struct timeval time;
-	gettimeofday(&time, NULL);
-	if (sec) *sec = time.tv_sec;
-	if (usec) *usec = time.tv_usec;
-}
-
-/* get clock in millisecond 64 */
-static inline IINT64 iclock64(void)
-{
-    long s, u;
-    IINT64 value;
-    itimeofday(&s, &u);
-    value = ((IINT64)s) * 1000 + (u / 1000);
-    return value;
-}
-
-
-static inline IUINT32 iclock()
-{
-    return (IUINT32)(iclock64() & 0xfffffffful);
-}
+using asio_kcp::iclock64;
+using asio_kcp::iclock64_us;
 
 std::string get_milly_sec_time_str(void)
 {
@@ -50,12 +29,13 @@ std::string get_milly_sec_time_str(void)
     return boost::posix_time::to_iso_extended_string(ptime);
 }
 
+// the clock in test msg is iclock64_us()
 #define CLOCK_START_STR "!ha"
 #define CLOCK_INTERVAL_STR "_ha"
 std::string make_test_str(size_t test_str_size)
 {
     std::ostringstream ostr;
-    ostr << CLOCK_START_STR << iclock64();
+    ostr << CLOCK_START_STR << iclock64_us();
     std::string msg_str = ostr.str();
     msg_str += test_str(CLOCK_INTERVAL_STR, test_str_size - msg_str.size());
     return msg_str;
@@ -103,6 +83,17 @@ uint64_t search_time_from_kcp_str(const std::string& kcp_str)
     return ret;
 }
 
+// p50:123us p90:456us p99:789us p999:1000us max:1200us
+std::string latency_str(const asio_kcp::hdr_histogram& histogram)
+{
+    asio_kcp::latency_summary summary;
+    histogram.summarize(&summary);
+    std::ostringstream ostr;
+    ostr << "p50:" << summary.p50 << "us p90:" << summary.p90 << "us p99:" << summary.p99
+        << "us p999:" << summary.p999 << "us max:" << summary.max << "us";
+    return ostr.str();
+}
+
 size_t g_count_send_udp_packet = 0;
 size_t g_count_send_kcp_packet = 0;
 
@@ -113,13 +104,17 @@ using namespace boost::asio::ip;
 using namespace asio_kcp;
 
 client_with_asio::client_with_asio(boost::asio::io_service& io_service, int udp_port_bind,
-        const std::string& server_ip, const int server_port, const size_t test_str_size) :
+        const std::string& server_ip, const int server_port, const size_t test_str_size, bool send_through) :
     stopped_(false),
+    send_through_(send_through),
     test_str_size_(test_str_size),
     client_timer_(io_service),
     client_timer_send_msg_(io_service)
 {
     kcp_client_.set_event_callback(client_event_callback_func, (void*)this);
+    kcp_client_.set_udp_output_hook(udp_output_hook_func, (void*)this);
+    if (send_through_)
+        kcp_client_.enable_send_through();
     hook_client_timer();
     kcp_client_.connect_async(udp_port_bind, server_ip, server_port);
     hook_timer_send_msg();
@@ -132,7 +127,40 @@ void client_with_asio::stop_all()
 
 void client_with_asio::send_test_msg(void)
 {
-    kcp_client_.send_msg(make_test_str(test_str_size_));
+    const std::string& msg = make_test_str(test_str_size_);
+    g_count_send_kcp_packet++;
+    g_count_send_kcp_size += msg.size();
+    kcp_client_.send_msg(msg);
+}
+
+void client_with_asio::udp_output_hook_func(const char* buf, size_t len, void* var)
+{
+    ((client_with_asio*)var)->handle_udp_output(buf, len);
+}
+
+void client_with_asio::handle_udp_output(const char* buf, size_t len)
+{
+    g_count_send_udp_packet++;
+    g_count_send_udp_size += len;
+
+    uint64_t send_time = search_time_from_kcp_str(std::string(buf, len));
+    if (send_time == 0)
+        return;
+    if (g_package_send_counter[send_time]++ > 0)
+        return; // resent.
+
+    // input-to-wire latency: from send_msg called to the first udp packet carrying the msg sent.
+    print_input_to_wire_log(iclock64_us() - send_time);
+}
+
+void client_with_asio::print_input_to_wire_log(uint64_t latency_us)
+{
+    input_to_wire_us_.record(latency_us);
+    if (input_to_wire_us_.count() % 10 != 0)
+        return;
+
+    std::cout << "input_to_wire(" << (send_through_ ? "send_through" : "queued") << ") "
+        << latency_str(input_to_wire_us_) << std::endl;
 }
 
 void client_with_asio::print_recv_log(const std::string& msg)
@@ -143,7 +171,8 @@ void client_with_asio::print_recv_log(const std::string& msg)
     static_recved_bytes += msg.size();
     uint64_t cur_time = iclock64();
     uint64_t send_time = get_time_from_msg(msg);
-    uint64_t interval = cur_time - send_time;
+    uint64_t interval_us = iclock64_us() - send_time;
+    uint64_t interval = interval_us / 1000;
 
     if (static_good_recv_count == 0)
     {
@@ -152,26 +181,13 @@ void client_with_asio::print_recv_log(const std::string& msg)
     }
 
     static_good_recv_count++;
-    recv_package_interval_.push_back(interval);
-    recv_package_interval10_.push_back(interval);
-    recv_package_interval100_.push_back(interval);
+    echo_latency_us_.record(interval_us);
+    echo_latency100_us_.record(interval_us);
 
     //std::cout << interval << ":" << send_time << ":" << g_package_send_counter[send_time] << "\t";
     std::cout << interval << ":" << g_package_send_counter[send_time] << "\t";
     g_package_send_counter.erase(send_time);
 
-    if (static_good_recv_count % 10 == 0)
-    {
-        int average10 = 0;
-        for (int x : recv_package_interval10_)
-            average10 += x;
-        average10 = (average10 / 10);
-
-        std::cout << "max:" << *std::max_element( recv_package_interval10_.begin(), recv_package_interval10_.end() ) <<
-            " avrg10:" << average10;
-        recv_package_interval10_.clear();
-    }
-
     if (cur_time - static_last_refresh_time > 10 * 1000 && static_good_recv_count % 100 == 30 && static_good_recv_count != 30)
     {
         std::cout << " " << static_cast<double>(static_recved_bytes * 10 / (cur_time - static_last_refresh_time)) / 10 << "KB/s(in)";
@@ -181,20 +197,9 @@ void client_with_asio::print_recv_log(const std::string& msg)
 
     if (static_good_recv_count % 100 == 0 && static_good_recv_count != 0)
     {
-        int average100 = 0;
-        for (int x : recv_package_interval100_)
-            average100 += x;
-        average100 = (average100 / 100);
-
-        int average_total = 0;
-        for (int x: recv_package_interval_)
-            average_total += x;
-        average_total = average_total / recv_package_interval_.size();
-
-        std::cout << " max100:" << *std::max_element( recv_package_interval100_.begin(), recv_package_interval100_.end() ) <<
-            " avrg100:" << average100 <<
-            " avrgall:" << average_total;
-        recv_package_interval100_.clear();
+        std::cout << std::endl << "echo latency last100: " << latency_str(echo_latency100_us_)
+            << std::endl << "echo latency all:     " << latency_str(echo_latency_us_);
+        echo_latency100_us_.reset();
     }
 
     if (static_good_recv_count % 100 == 10 && static_good_recv_count != 10)
@@ -4,13 +4,14 @@
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 #include "../client_lib/kcp_client.hpp"
+#include "../util/hdr_histogram.hpp"
 
 class client_with_asio
   : private boost::noncopyable
 {
 public:
     client_with_asio(boost::asio::io_service& io_service, int udp_port_bind,
-            const std::string& server_ip, const int server_port, const size_t test_str_size);
+            const std::string& server_ip, const int server_port, const size_t test_str_size, bool send_through);
 
     /// Stop all connections.
     void stop_all();
@@ -19,6 +20,7 @@ private:
 
 private:
     bool stopped_;
+    bool send_through_;
 
     void print_recv_log(const std::string& msg);
     void handle_client_time(void);
@@ -28,6 +30,10 @@ private:
     void hook_timer_send_msg(void);
     void send_test_msg(void);
 
+    static void udp_output_hook_func(const char* buf, size_t len, void* var);
+    void handle_udp_output(const char* buf, size_t len);
+    void print_input_to_wire_log(uint64_t latency_us);
+
     static void client_event_callback_func(kcp_conv_t conv, asio_kcp::eEventType event_type, const std::string& msg, void* var);
     void handle_client_event_callback(kcp_conv_t conv, asio_kcp::eEventType event_type, const std::string& msg);
 
@@ -37,9 +43,9 @@ private:
     boost::asio::deadline_timer client_timer_;
     boost::asio::deadline_timer client_timer_send_msg_;
 
-    std::vector<uint64_t> recv_package_interval_;
-    std::vector<uint64_t> recv_package_interval10_;
-    std::vector<uint64_t> recv_package_interval100_;
+    asio_kcp::hdr_histogram echo_latency_us_;    // all msgs
+    asio_kcp::hdr_histogram echo_latency100_us_; // the last 100 msgs
+    asio_kcp::hdr_histogram input_to_wire_us_;
 };
 
 #endif // _BS_CLIENT_WITH_ASIO_HPP_
@@ -12,9 +12,10 @@ using boost::asio::ip::tcp;
 
 enum { max_length = 1024 };
 
-void test_kcp(boost::asio::io_service &io_service, const int port_bind_to, const char* ip, const int port, size_t test_msg_size)
+void test_kcp(boost::asio::io_service &io_service, const int port_bind_to, const char* ip, const int port, size_t test_msg_size,
+        bool send_through)
 {
-    client_with_asio client(io_service, port_bind_to, std::string(ip), port, test_msg_size);
+    client_with_asio client(io_service, port_bind_to, std::string(ip), port, test_msg_size, send_through);
     io_service.run();
 }
 
@@ -24,15 +25,17 @@ int main(int argc, char* argv[])
 {
     try
     {
-        if (argc != 5)
+        if (argc != 5 && argc != 6)
         {
-            std::cerr << "Usage: asio_kcp_client <port_bind_to> <connect_to_host> <connect_to_port> <test_msg_lenth>\n";
+            std::cerr << "Usage: asio_kcp_client <port_bind_to> <connect_to_host> <connect_to_port> <test_msg_lenth> [send_through]\n";
             std::cerr << "asio_kcp_client 22222 232.23.223.1 12345 500\n";
+            std::cerr << "asio_kcp_client 22222 232.23.223.1 12345 500 1   # measuring input_to_wire latency of send-through mode\n";
             return 1;
         }
 
         boost::asio::io_service io_service;
-        test_kcp(io_service, std::atoi(argv[1]), argv[2], std::atoi(argv[3]), std::atoi(argv[4]));
+        const bool send_through = (argc == 6 && std::atoi(argv[5]) != 0);
+        test_kcp(io_service, std::atoi(argv[1]), argv[2], std::atoi(argv[3]), std::atoi(argv[4]), send_through);
     }
     catch (std::exception& e)
     {
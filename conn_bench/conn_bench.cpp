@@ -0,0 +1,251 @@
+#include "conn_bench.hpp"
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "connection_container.hpp"
+#include "asio_kcp_log.hpp"
+#include "../util/connect_packet.hpp"
+#include "../util/kcp_segment.hpp"
+
+#define CONN_BENCH_TICK_MS 5 // the kcp timer of connection_manager
+#define CONN_BENCH_PAYLOAD_SIZE 64
+#define CONN_BENCH_KCP_WND 128
+#define CONN_BENCH_FIND_ROUNDS 4
+
+static uint64_t steady_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+// malloced and not freed, including the big blocks by mmap.
+static size_t heap_in_use(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static char* encode32u(char* p, uint32_t v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)((v >> 24) & 0xff);
+    return p + 4;
+}
+
+static kcp_svr::udp::endpoint client_endpoint(size_t index)
+{
+    return kcp_svr::udp::endpoint(boost::asio::ip::address_v4((10u << 24) + (uint32_t)index + 1), 5000);
+}
+
+// the logs of every new and cleaned connection of server_lib. Too many for 500k connections.
+class scoped_silence
+{
+public:
+    scoped_silence(void) :
+        cout_buf_(std::cout.rdbuf(&null_buf_)),
+        cerr_buf_(std::cerr.rdbuf(&null_buf_)) {}
+    ~scoped_silence(void)
+    {
+        std::cout.rdbuf(cout_buf_);
+        std::cerr.rdbuf(cerr_buf_);
+    }
+
+private:
+    nullbuf_t null_buf_;
+    std::streambuf* cout_buf_;
+    std::streambuf* cerr_buf_;
+};
+
+static double percentile_us(const std::vector<uint64_t>& sorted_ns, double p)
+{
+    if (sorted_ns.empty())
+        return 0;
+    const size_t i = std::min(sorted_ns.size() - 1, (size_t)(p * sorted_ns.size()));
+    return sorted_ns[i] / 1000.0;
+}
+
+const char* conn_bench_csv_header(void)
+{
+    return "label,connections,mix,msgs_per_sec,ticks,tick_avg_us,tick_p50_us,tick_p99_us,tick_max_us,"
+        "bytes_per_conn,recv_packets,recv_ns_per_packet,find_ns";
+}
+
+std::string conn_bench_csv_line(const std::string& label, const conn_bench_result& r)
+{
+    std::ostringstream os;
+    os.setf(std::ios::fixed);
+    os.precision(1);
+    os << label << ',' << r.connections << ',' << r.mix << ',' << r.msgs_per_sec << ',' << r.ticks << ','
+        << r.tick_avg_us << ',' << r.tick_p50_us << ',' << r.tick_p99_us << ',' << r.tick_max_us << ','
+        << r.bytes_per_conn << ',' << r.recv_packets << ',' << r.recv_ns_per_packet << ',' << r.find_ns;
+    return os.str();
+}
+
+bool get_traffic_mix(const std::string& name, double* msgs_per_sec)
+{
+    if (name == "idle")
+        *msgs_per_sec = 0;
+    else if (name == "light")
+        *msgs_per_sec = 1;
+    else if (name == "heavy")
+        *msgs_per_sec = 30;
+    else
+        return false;
+    return true;
+}
+
+
+conn_bench::conn_bench(size_t connections, const std::string& mix, double msgs_per_sec) :
+    connections_(connections),
+    mix_(mix),
+    msgs_per_sec_(msgs_per_sec),
+    clock_(1000 * 1000), // not 0: the connections created at clock 0 never timeout.
+    last_conv_back_(0),
+    msgs_recved_(0),
+    payload_(CONN_BENCH_PAYLOAD_SIZE, 'x'),
+    packet_(KCP_SEGMENT_HEADER_SIZE + CONN_BENCH_PAYLOAD_SIZE)
+{
+    transport_ = std::make_shared<kcp_svr::memory_server_transport>(
+            kcp_svr::udp::endpoint(boost::asio::ip::address_v4::from_string("10.0.0.1"), 4000),
+            std::bind(&conn_bench::server_output, this, std::placeholders::_1, std::placeholders::_2));
+    manager_ = std::make_shared<kcp_svr::connection_manager>(io_service_, transport_, &clock_);
+    manager_->set_callback([](kcp_conv_t, kcp_svr::eEventType, std::shared_ptr<std::string>) {});
+    manager_->set_msg_callback([this](kcp_conv_t, const char*, size_t) {msgs_recved_++;});
+}
+
+conn_bench::~conn_bench(void)
+{
+    if (manager_)
+    {
+        scoped_silence silence;
+        manager_->stop_all();
+        manager_.reset();
+    }
+}
+
+void conn_bench::server_output(const char* data, size_t len)
+{
+    if (asio_kcp::is_send_back_conv_packet(data, len))
+        last_conv_back_ = asio_kcp::grab_conv_from_send_back_conv_packet(data, len);
+}
+
+// the handshake, and the first kcp packet which turns the connection from handshaking to connected.
+void conn_bench::connect_all(void)
+{
+    const std::string connect_packet = asio_kcp::making_connect_packet();
+    convs_.reserve(connections_);
+    sns_.assign(connections_, 0);
+    for (size_t i = 0; i < connections_; ++i)
+    {
+        last_conv_back_ = 0;
+        transport_->deliver(connect_packet.data(), connect_packet.size(), client_endpoint(i));
+        convs_.push_back(last_conv_back_);
+        send_push_packet(i);
+    }
+}
+
+void conn_bench::send_push_packet(size_t index)
+{
+    char* p = &packet_[0];
+    p = encode32u(p, convs_[index]);
+    *p++ = (char)KCP_CMD_PUSH;
+    *p++ = 0; // frg
+    *p++ = (char)(CONN_BENCH_KCP_WND & 0xff);
+    *p++ = (char)(CONN_BENCH_KCP_WND >> 8);
+    p = encode32u(p, (uint32_t)clock_.now_ms());
+    p = encode32u(p, sns_[index]++);
+    p = encode32u(p, 0); // una: the server sends no msg
+    p = encode32u(p, (uint32_t)payload_.size());
+    memcpy(p, payload_.data(), payload_.size());
+    transport_->deliver(&packet_[0], packet_.size(), client_endpoint(index));
+}
+
+void conn_bench::run(size_t ticks, conn_bench_result* result)
+{
+    *result = conn_bench_result();
+    result->mix = mix_;
+    result->msgs_per_sec = msgs_per_sec_;
+    result->connections = connections_;
+    result->ticks = ticks;
+
+    scoped_silence silence;
+
+    // memory
+    {
+        const size_t heap_before = heap_in_use();
+        connect_all();
+        manager_->update();
+        result->bytes_per_conn = (double)(heap_in_use() - heap_before) / connections_;
+    }
+
+    // ticks. The msgs of every tick are spread over the connections round robin.
+    {
+        std::vector<uint64_t> tick_ns;
+        tick_ns.reserve(ticks);
+        const double msgs_per_tick = connections_ * msgs_per_sec_ * CONN_BENCH_TICK_MS / 1000.0;
+        double msgs_due = 0;
+        msgs_recved_ = 0;
+        size_t next_index = 0;
+        uint64_t recv_ns = 0;
+        for (size_t t = 0; t < ticks; ++t)
+        {
+            clock_.advance_ms(CONN_BENCH_TICK_MS);
+
+            msgs_due += msgs_per_tick;
+            const size_t msgs = (size_t)msgs_due;
+            msgs_due -= msgs;
+            const uint64_t recv_begin = steady_clock_ns();
+            for (size_t i = 0; i < msgs; ++i)
+            {
+                send_push_packet(next_index);
+                next_index = (next_index + 1 < connections_ ? next_index + 1 : 0);
+            }
+            const uint64_t tick_begin = steady_clock_ns();
+            recv_ns += tick_begin - recv_begin;
+            result->recv_packets += msgs;
+
+            manager_->update();
+            tick_ns.push_back(steady_clock_ns() - tick_begin);
+        }
+
+        uint64_t tick_ns_sum = 0;
+        for (size_t i = 0; i < tick_ns.size(); ++i)
+            tick_ns_sum += tick_ns[i];
+        std::sort(tick_ns.begin(), tick_ns.end());
+        result->tick_avg_us = (ticks > 0 ? tick_ns_sum / 1000.0 / ticks : 0);
+        result->tick_p50_us = percentile_us(tick_ns, 0.5);
+        result->tick_p99_us = percentile_us(tick_ns, 0.99);
+        result->tick_max_us = (tick_ns.empty() ? 0 : tick_ns.back() / 1000.0);
+        result->recv_msgs = msgs_recved_;
+        result->recv_ns_per_packet = (result->recv_packets > 0 ? (double)recv_ns / result->recv_packets : 0);
+    }
+
+    manager_->stop_all();
+    manager_.reset();
+
+    // find_by_conv of a container as big, without the manager. The convs in random order: no cache help.
+    {
+        kcp_svr::connection_container container;
+        for (size_t i = 0; i < connections_; ++i)
+            container.add_new_connection(std::weak_ptr<kcp_svr::connection_manager>(), convs_[i], client_endpoint(i));
+
+        std::vector<kcp_conv_t> convs(convs_);
+        std::mt19937 rand(1);
+        std::shuffle(convs.begin(), convs.end(), rand);
+        size_t found = 0;
+        const uint64_t find_begin = steady_clock_ns();
+        for (size_t round = 0; round < CONN_BENCH_FIND_ROUNDS; ++round)
+            for (size_t i = 0; i < convs.size(); ++i)
+                found += (container.find_by_conv(convs[i]) ? 1 : 0);
+        const uint64_t find_ns = steady_clock_ns() - find_begin;
+        result->find_ns = (found > 0 ? (double)find_ns / found : 0);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef _CONN_BENCH_HPP_
+#define _CONN_BENCH_HPP_
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include "connection_manager.hpp"
+#include "../util/kcp_clock.hpp"
+
+// one line of the csv.
+struct conn_bench_result
+{
+    std::string mix;
+    double msgs_per_sec;
+    size_t connections;
+    size_t ticks;
+
+    // connection_manager::update(): kcp update and timeout check of all connections.
+    double tick_avg_us;
+    double tick_p50_us;
+    double tick_p99_us;
+    double tick_max_us;
+
+    // heap held by the connection_manager per connection.
+    double bytes_per_conn;
+
+    // a kcp packet from the transport to the msg callback: find_by_conv, ikcp_input, ikcp_recv.
+    uint64_t recv_packets;
+    uint64_t recv_msgs;     // given to the msg callback. Should be recv_packets.
+    double recv_ns_per_packet;
+
+    // connection_container::find_by_conv alone, the convs in random order.
+    double find_ns;
+};
+
+const char* conn_bench_csv_header(void);
+std::string conn_bench_csv_line(const std::string& label, const conn_bench_result& result);
+
+// msgs per second of every connection. false if the name is unknown.
+bool get_traffic_mix(const std::string& name, double* msgs_per_sec);
+
+// A connection_manager on a memory_server_transport and a virtual clock. No socket, no real client:
+// the clients are a conv and a sn each, writing kcp push packets by hand. Time is moved 5ms a tick,
+// so only the cpu time of the server is measured.
+class conn_bench
+  : private boost::noncopyable
+{
+public:
+    conn_bench(size_t connections, const std::string& mix, double msgs_per_sec);
+    ~conn_bench(void);
+
+    void run(size_t ticks, conn_bench_result* result);
+
+private:
+    void connect_all(void);
+    void send_push_packet(size_t index);
+    void server_output(const char* data, size_t len);
+
+    size_t connections_;
+    std::string mix_;
+    double msgs_per_sec_;
+
+    asio_kcp::virtual_kcp_clock clock_;
+    boost::asio::io_service io_service_;
+    std::shared_ptr<kcp_svr::memory_server_transport> transport_;
+    kcp_svr::connection_manager::shared_ptr manager_;
+
+    std::vector<kcp_conv_t> convs_;
+    std::vector<uint32_t> sns_;
+    kcp_conv_t last_conv_back_;
+    uint64_t msgs_recved_;
+    std::string payload_;
+    std::vector<char> packet_;
+};
+
+#endif // _CONN_BENCH_HPP_
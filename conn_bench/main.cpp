@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "conn_bench.hpp"
+
+#define DEFAULT_CONNECTIONS "1000,10000,100000,500000"
+#define DEFAULT_MIXES "idle,light,heavy"
+#define DEFAULT_TICKS 200 // 1 second of the 5ms timer
+#define DEFAULT_CSV_PATH "conn_bench.csv"
+
+static std::vector<std::string> split_list(const std::string& text)
+{
+    std::vector<std::string> items;
+    std::istringstream is(text);
+    std::string item;
+    while (std::getline(is, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static void usage(void)
+{
+    std::cerr << "Usage: conn_bench [-n connections] [-m mixes] [-t ticks] [-o csv_path] [-l label]\n";
+    std::cerr << "  -n  connection counts, default " DEFAULT_CONNECTIONS "\n";
+    std::cerr << "  -m  traffic mixes, default " DEFAULT_MIXES ". idle: no msg, light: 1 msg/s, heavy: 30 msg/s a connection\n";
+    std::cerr << "  -t  5ms ticks of every case, default " << DEFAULT_TICKS << "\n";
+    std::cerr << "  -o  csv appended to, default " DEFAULT_CSV_PATH ". The header is written if the file is empty.\n";
+    std::cerr << "  -l  label of the lines, e.g. the commit: -l $(git rev-parse --short HEAD)\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::string connections_text = DEFAULT_CONNECTIONS;
+    std::string mixes_text = DEFAULT_MIXES;
+    size_t ticks = DEFAULT_TICKS;
+    std::string csv_path = DEFAULT_CSV_PATH;
+    std::string label = "-";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:t:o:l:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': connections_text = optarg; break;
+            case 'm': mixes_text = optarg; break;
+            case 't': ticks = strtoul(optarg, NULL, 10); break;
+            case 'o': csv_path = optarg; break;
+            case 'l': label = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+
+    const std::vector<std::string> connections_list = split_list(connections_text);
+    const std::vector<std::string> mixes = split_list(mixes_text);
+    for (size_t i = 0; i < mixes.size(); ++i)
+    {
+        double msgs_per_sec = 0;
+        if (!get_traffic_mix(mixes[i], &msgs_per_sec))
+        {
+            std::cerr << "unknown traffic mix: " << mixes[i] << std::endl;
+            usage();
+            return 1;
+        }
+    }
+
+    std::ofstream csv(csv_path.c_str(), std::ios::app);
+    if (!csv)
+    {
+        std::cerr << "open failed: " << csv_path << std::endl;
+        return 1;
+    }
+    if (csv.tellp() == 0)
+        csv << conn_bench_csv_header() << std::endl;
+    std::cout << conn_bench_csv_header() << std::endl;
+
+    for (size_t i = 0; i < connections_list.size(); ++i)
+    {
+        const size_t connections = strtoul(connections_list[i].c_str(), NULL, 10);
+        if (connections == 0)
+            continue;
+        for (size_t j = 0; j < mixes.size(); ++j)
+        {
+            double msgs_per_sec = 0;
+            get_traffic_mix(mixes[j], &msgs_per_sec);
+
+            conn_bench_result result;
+            {
+                conn_bench bench(connections, mixes[j], msgs_per_sec);
+                bench.run(ticks, &result);
+            }
+            if (result.recv_msgs != result.recv_packets)
+                std::cerr << "warning: " << result.recv_packets << " packets sent but " << result.recv_msgs
+                    << " msgs recved. The recv path is not measured right." << std::endl;
+            const std::string line = conn_bench_csv_line(label, result);
+            csv << line << std::endl;
+            std::cout << line << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,507 @@
+#include "echo_bench.hpp"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "../client_lib/kcp_client.hpp"
+#include "../client_lib/kcp_client_util.h"
+#include "../util/connect_packet.hpp"
+#include "../util/kcp_segment.hpp"
+
+#define ECHO_BENCH_MSG_HEADER_SIZE 12 // send time in microseconds and seq
+#define ECHO_BENCH_POLL_INTERVAL_US 1000
+#define ECHO_BENCH_DRAIN_TIME_MS 3000
+#define ECHO_BENCH_COMPARE_NOISE 0.05 // changes smaller than 5% are not marked better or worse
+#define ECHO_BENCH_NAME_WIDTH 22
+#define ECHO_BENCH_VALUE_WIDTH 24
+
+using asio_kcp::iclock64_us;
+using asio_kcp::read_uint32_le;
+
+static uint64_t read_uint64_le(const char* data)
+{
+    return (uint64_t)read_uint32_le(data) | ((uint64_t)read_uint32_le(data + 4) << 32);
+}
+
+static void write_uint32_le(char* data, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        data[i] = (char)((v >> (8 * i)) & 0xff);
+}
+
+static void write_uint64_le(char* data, uint64_t v)
+{
+    write_uint32_le(data, (uint32_t)(v & 0xffffffffu));
+    write_uint32_le(data + 4, (uint32_t)(v >> 32));
+}
+
+namespace {
+
+struct wire_counters
+{
+    uint64_t packets_out;
+    uint64_t bytes_out;
+    uint64_t packets_in;
+    uint64_t bytes_in;
+    uint64_t push_segments_out;
+    uint64_t retransmits_out;
+
+    wire_counters(void) : packets_out(0), bytes_out(0), packets_in(0), bytes_in(0), push_segments_out(0), retransmits_out(0) {}
+};
+
+// the udp socket of a client, counting what goes on the wire.
+// A push segment with a sn sent before is a retransmit: kcp sends the new segments in sn order.
+class counting_transport : public asio_kcp::client_transport
+{
+public:
+    explicit counting_transport(wire_counters* counters) :
+        counters_(counters), next_new_sn_(0) {}
+
+    virtual int open(int udp_port_bind) {return socket_.open(udp_port_bind);}
+    virtual void close(void) {socket_.close();}
+    virtual bool is_open(void) const {return socket_.is_open();}
+    virtual int connect(const struct sockaddr_in& servaddr) {return socket_.connect(servaddr);}
+
+    virtual ssize_t send(const char* buf, size_t len)
+    {
+        const ssize_t ret = socket_.send(buf, len);
+        if (ret >= 0)
+            count_out(buf, len);
+        return ret;
+    }
+
+    virtual ssize_t send_to(const char* buf, size_t len, const struct sockaddr_in& addr)
+    {
+        const ssize_t ret = socket_.send_to(buf, len, addr);
+        if (ret >= 0)
+            count_out(buf, len);
+        return ret;
+    }
+
+    virtual ssize_t recv(char* buf, size_t len)
+    {
+        return count_in(socket_.recv(buf, len));
+    }
+
+    virtual ssize_t recv_from(char* buf, size_t len, struct sockaddr_in* from_addr)
+    {
+        return count_in(socket_.recv_from(buf, len, from_addr));
+    }
+
+private:
+    ssize_t count_in(ssize_t ret)
+    {
+        if (ret > 0)
+        {
+            counters_->packets_in++;
+            counters_->bytes_in += ret;
+        }
+        return ret;
+    }
+
+    void count_out(const char* buf, size_t len)
+    {
+        counters_->packets_out++;
+        counters_->bytes_out += len;
+        if (asio_kcp::is_connect_packet(buf, len) || asio_kcp::is_resume_packet(buf, len))
+            return;
+
+        size_t offset = 0;
+        asio_kcp::kcp_segment_header seg;
+        while (asio_kcp::next_kcp_segment(buf, len, &offset, &seg))
+        {
+            if (seg.cmd != KCP_CMD_PUSH)
+                continue;
+            counters_->push_segments_out++;
+            if ((int32_t)(seg.sn - next_new_sn_) < 0)
+                counters_->retransmits_out++;
+            else
+                next_new_sn_ = seg.sn + 1;
+        }
+    }
+
+    asio_kcp::udp_socket_transport socket_;
+    wire_counters* counters_;
+    uint32_t next_new_sn_;
+};
+
+class echo_bench_run;
+
+struct bench_client
+{
+    bench_client(echo_bench_run* r, wire_counters* counters) :
+        run(r), transport(counters), connected(false), failed(false), next_send_us(0), seq(0)
+    {
+        client.set_transport(&transport);
+    }
+
+    echo_bench_run* run;
+    counting_transport transport;
+    asio_kcp::kcp_client client;
+    bool connected;
+    bool failed;
+    uint64_t next_send_us;
+    uint32_t seq;
+};
+
+class echo_bench_run
+{
+public:
+    explicit echo_bench_run(const echo_bench_config& config) :
+        config_(config),
+        measure_begin_us_(0),
+        measure_end_us_(0),
+        msgs_sent_(0),
+        msgs_echoed_(0)
+    {
+        for (size_t i = 0; i < config_.clients; ++i)
+        {
+            clients_.push_back(new bench_client(this, &counters_));
+            clients_.back()->client.set_event_callback(echo_bench_run::client_event, clients_.back());
+            clients_.back()->client.set_msg_callback(echo_bench_run::client_msg, clients_.back());
+        }
+    }
+
+    ~echo_bench_run(void)
+    {
+        for (size_t i = 0; i < clients_.size(); ++i)
+        {
+            clients_[i]->client.stop();
+            delete clients_[i];
+        }
+    }
+
+    int run(echo_bench_result* result)
+    {
+        *result = echo_bench_result();
+
+        // connect
+        size_t connected = 0;
+        {
+            for (size_t i = 0; i < clients_.size(); ++i)
+            {
+                const int ret = clients_[i]->client.connect_async(0, config_.server_host, config_.server_port);
+                if (ret < 0)
+                    return ret;
+            }
+            const uint64_t connect_end_us = iclock64_us() + (KCP_CONNECT_TIMEOUT_TIME + 1000) * 1000;
+            size_t answered = 0;
+            while (answered < clients_.size() && iclock64_us() < connect_end_us)
+            {
+                update_all();
+                answered = 0;
+                connected = 0;
+                for (size_t i = 0; i < clients_.size(); ++i)
+                {
+                    answered += (clients_[i]->connected || clients_[i]->failed ? 1 : 0);
+                    connected += (clients_[i]->connected ? 1 : 0);
+                }
+                usleep(ECHO_BENCH_POLL_INTERVAL_US);
+            }
+            if (connected == 0)
+                return KCP_ERR_KCP_CONNECT_TIMEOUT;
+        }
+
+        // send. The clients are spread over the send interval.
+        const uint64_t interval_us = (uint64_t)(1000 * 1000 / config_.msgs_per_sec);
+        const uint64_t begin_us = iclock64_us();
+        measure_begin_us_ = begin_us + (uint64_t)(config_.warmup_sec * 1000 * 1000);
+        measure_end_us_ = measure_begin_us_ + (uint64_t)(config_.duration_sec * 1000 * 1000);
+        for (size_t i = 0; i < clients_.size(); ++i)
+            clients_[i]->next_send_us = begin_us + interval_us * i / clients_.size();
+
+        wire_counters counters_begin;
+        bool measuring = false;
+        for (uint64_t now = begin_us; now < measure_end_us_; now = iclock64_us())
+        {
+            if (!measuring && now >= measure_begin_us_)
+            {
+                measuring = true;
+                counters_begin = counters_;
+            }
+            for (size_t i = 0; i < clients_.size(); ++i)
+            {
+                bench_client& c = *clients_[i];
+                while (c.connected && now >= c.next_send_us)
+                {
+                    send_msg(c, now);
+                    c.next_send_us += interval_us;
+                }
+            }
+            update_all();
+            usleep(ECHO_BENCH_POLL_INTERVAL_US);
+        }
+
+        // drain the echoes of the last msgs
+        const uint64_t drain_end_us = iclock64_us() + ECHO_BENCH_DRAIN_TIME_MS * 1000;
+        while (msgs_echoed_ < msgs_sent_ && iclock64_us() < drain_end_us)
+        {
+            update_all();
+            usleep(ECHO_BENCH_POLL_INTERVAL_US);
+        }
+
+        fill_result(connected, counters_begin, result);
+        return 0;
+    }
+
+private:
+    void update_all(void)
+    {
+        for (size_t i = 0; i < clients_.size(); ++i)
+            if (!clients_[i]->failed)
+                clients_[i]->client.update();
+    }
+
+    void send_msg(bench_client& c, uint64_t now_us)
+    {
+        std::string msg(config_.msg_size, 'x');
+        write_uint64_le(&msg[0], now_us);
+        write_uint32_le(&msg[8], c.seq++);
+        if (now_us >= measure_begin_us_)
+            msgs_sent_++;
+        c.client.send_msg(msg);
+    }
+
+    void fill_result(size_t connected, const wire_counters& counters_begin, echo_bench_result* result)
+    {
+        result->clients_connected = connected;
+        result->msgs_sent = msgs_sent_;
+        result->msgs_echoed = msgs_echoed_;
+        result->msgs_lost = (msgs_sent_ > msgs_echoed_ ? msgs_sent_ - msgs_echoed_ : 0);
+        latency_us_.summarize(&result->latency_us);
+        result->goodput_kbps = (double)msgs_echoed_ * config_.msg_size * 8 / 1000 / config_.duration_sec;
+
+        result->packets_out = counters_.packets_out - counters_begin.packets_out;
+        result->bytes_out = counters_.bytes_out - counters_begin.bytes_out;
+        result->packets_in = counters_.packets_in - counters_begin.packets_in;
+        result->bytes_in = counters_.bytes_in - counters_begin.bytes_in;
+        result->push_segments_out = counters_.push_segments_out - counters_begin.push_segments_out;
+        result->retransmits_out = counters_.retransmits_out - counters_begin.retransmits_out;
+
+        const double payload_out = (double)msgs_sent_ * config_.msg_size;
+        const double payload_in = (double)msgs_echoed_ * config_.msg_size;
+        result->packets_out_per_msg = (msgs_sent_ > 0 ? (double)result->packets_out / msgs_sent_ : 0);
+        result->packets_in_per_msg = (msgs_echoed_ > 0 ? (double)result->packets_in / msgs_echoed_ : 0);
+        result->byte_overhead_out = (payload_out > 0 ? (result->bytes_out - payload_out) / payload_out : 0);
+        result->byte_overhead_in = (payload_in > 0 ? (result->bytes_in - payload_in) / payload_in : 0);
+        result->retransmit_share = (result->push_segments_out > 0 ?
+                (double)result->retransmits_out / result->push_segments_out : 0);
+    }
+
+    static void client_event(kcp_conv_t /*conv*/, asio_kcp::eEventType event_type, const std::string& /*msg*/, void* var)
+    {
+        bench_client* c = (bench_client*)var;
+        if (event_type == asio_kcp::eConnect)
+            c->connected = true;
+        else if (event_type == asio_kcp::eConnectFailed || event_type == asio_kcp::eDisconnect)
+        {
+            c->connected = false;
+            c->failed = true;
+        }
+    }
+
+    static void client_msg(kcp_conv_t /*conv*/, const char* msg, size_t len, void* var)
+    {
+        bench_client* c = (bench_client*)var;
+        if (len < ECHO_BENCH_MSG_HEADER_SIZE)
+            return;
+        const uint64_t send_us = read_uint64_le(msg);
+        if (send_us < c->run->measure_begin_us_ || send_us >= c->run->measure_end_us_)
+            return;
+        c->run->latency_us_.record(iclock64_us() - send_us);
+        c->run->msgs_echoed_++;
+    }
+
+    echo_bench_config config_;
+    std::vector<bench_client*> clients_;
+    wire_counters counters_;
+    asio_kcp::hdr_histogram latency_us_;
+    uint64_t measure_begin_us_;
+    uint64_t measure_end_us_;
+    uint64_t msgs_sent_;
+    uint64_t msgs_echoed_;
+};
+
+} // namespace
+
+int run_echo_bench(const echo_bench_config& config, echo_bench_result* result)
+{
+    echo_bench_run run(config);
+    return run.run(result);
+}
+
+static std::string utc_time_str(void)
+{
+    char buf[32];
+    const time_t now = time(NULL);
+    struct tm tm_now;
+    gmtime_r(&now, &tm_now);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm_now);
+    return buf;
+}
+
+std::string echo_bench_json(const echo_bench_config& config, const echo_bench_result& r)
+{
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(4);
+    os << "{\n"
+        << "  \"label\": \"" << config.label << "\",\n"
+        << "  \"time\": \"" << utc_time_str() << "\",\n"
+        << "  \"server\": \"" << config.server_host << ":" << config.server_port << "\",\n"
+        << "  \"clients\": " << config.clients << ",\n"
+        << "  \"msgs_per_sec\": " << config.msgs_per_sec << ",\n"
+        << "  \"msg_size\": " << config.msg_size << ",\n"
+        << "  \"duration_sec\": " << config.duration_sec << ",\n"
+        << "  \"warmup_sec\": " << config.warmup_sec << ",\n"
+        << "  \"clients_connected\": " << r.clients_connected << ",\n"
+        << "  \"msgs_sent\": " << r.msgs_sent << ",\n"
+        << "  \"msgs_echoed\": " << r.msgs_echoed << ",\n"
+        << "  \"msgs_lost\": " << r.msgs_lost << ",\n"
+        << "  \"latency_min_us\": " << r.latency_us.min << ",\n"
+        << "  \"latency_mean_us\": " << r.latency_us.mean << ",\n"
+        << "  \"latency_p50_us\": " << r.latency_us.p50 << ",\n"
+        << "  \"latency_p90_us\": " << r.latency_us.p90 << ",\n"
+        << "  \"latency_p99_us\": " << r.latency_us.p99 << ",\n"
+        << "  \"latency_p999_us\": " << r.latency_us.p999 << ",\n"
+        << "  \"latency_max_us\": " << r.latency_us.max << ",\n"
+        << "  \"goodput_kbps\": " << r.goodput_kbps << ",\n"
+        << "  \"packets_out\": " << r.packets_out << ",\n"
+        << "  \"bytes_out\": " << r.bytes_out << ",\n"
+        << "  \"packets_in\": " << r.packets_in << ",\n"
+        << "  \"bytes_in\": " << r.bytes_in << ",\n"
+        << "  \"packets_out_per_msg\": " << r.packets_out_per_msg << ",\n"
+        << "  \"packets_in_per_msg\": " << r.packets_in_per_msg << ",\n"
+        << "  \"byte_overhead_out\": " << r.byte_overhead_out << ",\n"
+        << "  \"byte_overhead_in\": " << r.byte_overhead_in << ",\n"
+        << "  \"push_segments_out\": " << r.push_segments_out << ",\n"
+        << "  \"retransmits_out\": " << r.retransmits_out << ",\n"
+        << "  \"retransmit_share\": " << r.retransmit_share << "\n"
+        << "}\n";
+    return os.str();
+}
+
+bool load_echo_bench_json(const std::string& path, std::map<std::string, std::string>* fields, std::string* err)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+    {
+        *err = "can not open " + path;
+        return false;
+    }
+
+    fields->clear();
+    std::string line;
+    while (std::getline(in, line))
+    {
+        const size_t key_begin = line.find('"');
+        const size_t key_end = (key_begin == std::string::npos ? std::string::npos : line.find('"', key_begin + 1));
+        const size_t colon = (key_end == std::string::npos ? std::string::npos : line.find(':', key_end));
+        if (colon == std::string::npos)
+            continue;
+
+        std::string value = line.substr(colon + 1);
+        const size_t value_begin = value.find_first_not_of(" \t\"");
+        const size_t value_end = value.find_last_not_of(" \t\",\r");
+        value = (value_begin == std::string::npos ? "" : value.substr(value_begin, value_end - value_begin + 1));
+        (*fields)[line.substr(key_begin + 1, key_end - key_begin - 1)] = value;
+    }
+    if (fields->empty())
+    {
+        *err = "no field in " + path;
+        return false;
+    }
+    return true;
+}
+
+struct compared_metric
+{
+    const char* name;
+    int better; // -1: lower is better, 1: higher is better
+};
+
+static const compared_metric compared_metrics[] = {
+    {"latency_p50_us", -1},
+    {"latency_p90_us", -1},
+    {"latency_p99_us", -1},
+    {"latency_p999_us", -1},
+    {"latency_max_us", -1},
+    {"latency_mean_us", -1},
+    {"goodput_kbps", 1},
+    {"msgs_lost", -1},
+    {"packets_out_per_msg", -1},
+    {"packets_in_per_msg", -1},
+    {"byte_overhead_out", -1},
+    {"byte_overhead_in", -1},
+    {"retransmit_share", -1},
+};
+
+static const char* const compared_configs[] = {
+    "server", "clients", "msgs_per_sec", "msg_size", "duration_sec", "warmup_sec", "clients_connected"
+};
+
+static std::string field_of(const std::map<std::string, std::string>& fields, const std::string& name)
+{
+    std::map<std::string, std::string>::const_iterator iter = fields.find(name);
+    return (iter == fields.end() ? std::string("-") : iter->second);
+}
+
+std::string echo_bench_compare_report(const std::map<std::string, std::string>& before,
+        const std::map<std::string, std::string>& after)
+{
+    std::ostringstream os;
+    const char* const header_fields[] = {"label", "time"};
+    for (size_t i = 0; i < sizeof(header_fields) / sizeof(header_fields[0]); ++i)
+        os << std::left << std::setw(ECHO_BENCH_NAME_WIDTH) << header_fields[i] << std::right
+            << std::setw(ECHO_BENCH_VALUE_WIDTH) << field_of(before, header_fields[i])
+            << std::setw(ECHO_BENCH_VALUE_WIDTH) << field_of(after, header_fields[i]) << "\n";
+
+    bool config_differs = false;
+    for (size_t i = 0; i < sizeof(compared_configs) / sizeof(compared_configs[0]); ++i)
+    {
+        const std::string b = field_of(before, compared_configs[i]);
+        const std::string a = field_of(after, compared_configs[i]);
+        os << std::left << std::setw(ECHO_BENCH_NAME_WIDTH) << compared_configs[i] << std::right
+            << std::setw(ECHO_BENCH_VALUE_WIDTH) << b << std::setw(ECHO_BENCH_VALUE_WIDTH) << a
+            << (a != b ? "  differs" : "") << "\n";
+        config_differs = config_differs || (a != b);
+    }
+    os << "\n";
+
+    os << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < sizeof(compared_metrics) / sizeof(compared_metrics[0]); ++i)
+    {
+        const compared_metric& m = compared_metrics[i];
+        const std::string b_str = field_of(before, m.name);
+        const std::string a_str = field_of(after, m.name);
+        os << std::left << std::setw(ECHO_BENCH_NAME_WIDTH) << m.name << std::right
+            << std::setw(ECHO_BENCH_VALUE_WIDTH) << b_str << std::setw(ECHO_BENCH_VALUE_WIDTH) << a_str;
+        if (b_str == "-" || a_str == "-")
+        {
+            os << "\n";
+            continue;
+        }
+
+        const double b = atof(b_str.c_str());
+        const double a = atof(a_str.c_str());
+        if (b == 0)
+        {
+            os << std::setw(11) << (a == 0 ? "0%" : "new") << "\n";
+            continue;
+        }
+        const double change = (a - b) / b;
+        os << std::setw(10) << change * 100 << "%";
+        if (change * m.better > ECHO_BENCH_COMPARE_NOISE)
+            os << "  better";
+        else if (change * m.better < -ECHO_BENCH_COMPARE_NOISE)
+            os << "  worse";
+        os << "\n";
+    }
+
+    if (config_differs)
+        os << "\nwarning: the two runs have different settings.\n";
+    return os.str();
+}
@@ -0,0 +1,62 @@
+#ifndef _ECHO_BENCH_HPP_
+#define _ECHO_BENCH_HPP_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include "../util/hdr_histogram.hpp"
+
+struct echo_bench_config
+{
+    std::string server_host;
+    int server_port;
+    size_t clients;
+    double msgs_per_sec;    // of every client
+    size_t msg_size;        // bytes of a msg, at least 12: the send time and seq.
+    double duration_sec;    // measured, after warmup
+    double warmup_sec;      // msgs sent in warmup are not measured
+    std::string label;
+
+    echo_bench_config(void) :
+        server_port(0), clients(10), msgs_per_sec(10), msg_size(100), duration_sec(30), warmup_sec(2), label("-") {}
+};
+
+// The numbers of the msgs sent in the measured time. Bytes are udp payload: kcp headers, acks and
+// handshakes included, the ip and udp headers not.
+struct echo_bench_result
+{
+    size_t clients_connected;
+    uint64_t msgs_sent;
+    uint64_t msgs_echoed;
+    uint64_t msgs_lost;             // not echoed before the end of the drain time
+    asio_kcp::latency_summary latency_us; // send_msg to the echo recved
+
+    double goodput_kbps;            // payload echoed back, in kilobits per second
+
+    uint64_t packets_out;           // from the clients
+    uint64_t bytes_out;
+    uint64_t packets_in;            // to the clients
+    uint64_t bytes_in;
+    double packets_out_per_msg;
+    double packets_in_per_msg;
+    double byte_overhead_out;       // (bytes_out - payload) / payload
+    double byte_overhead_in;
+
+    uint64_t push_segments_out;     // data segments sent by the clients, including retransmits
+    uint64_t retransmits_out;
+    double retransmit_share;        // retransmits_out / push_segments_out
+};
+
+// Run the echo clients against server. Blocks for warmup + duration + drain.
+// return 0, or KCP_ERR_XXX of kcp_client.hpp if no client connected.
+int run_echo_bench(const echo_bench_config& config, echo_bench_result* result);
+
+// One "key": value a line, no nesting. load_echo_bench_json reads it back.
+std::string echo_bench_json(const echo_bench_config& config, const echo_bench_result& result);
+bool load_echo_bench_json(const std::string& path, std::map<std::string, std::string>* fields, std::string* err);
+
+// before, after and the change of every metric, with better or worse if the change is bigger than the noise.
+std::string echo_bench_compare_report(const std::map<std::string, std::string>& before,
+        const std::map<std::string, std::string>& after);
+
+#endif // _ECHO_BENCH_HPP_
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include "echo_bench.hpp"
+
+#define DEFAULT_JSON_PATH "echo_bench.json"
+#define MIN_MSG_SIZE 12
+
+static void usage(void)
+{
+    std::cerr << "Usage: echo_bench run <server_host> <server_port> [-c clients] [-r msgs_per_sec] [-s msg_size]\n"
+                 "                  [-d duration_sec] [-w warmup_sec] [-o json_path] [-l label]\n";
+    std::cerr << "       echo_bench compare <before.json> <after.json>\n";
+    std::cerr << "  run: clients (10) send msgs of msg_size (100) bytes at msgs_per_sec (10) each to an echo server,\n";
+    std::cerr << "    for warmup_sec (2) + duration_sec (30). The result is written to json_path (" DEFAULT_JSON_PATH ").\n";
+    std::cerr << "  ./server/server 0.0.0.0 12345\n";
+    std::cerr << "  ./echo_bench/echo_bench run 127.0.0.1 12345 -c 50 -r 30 -l $(git rev-parse --short HEAD)\n";
+}
+
+static int run_mode(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        usage();
+        return 1;
+    }
+
+    echo_bench_config config;
+    config.server_host = argv[2];
+    config.server_port = atoi(argv[3]);
+    std::string json_path = DEFAULT_JSON_PATH;
+
+    optind = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:s:d:w:o:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': config.clients = strtoul(optarg, NULL, 10); break;
+            case 'r': config.msgs_per_sec = atof(optarg); break;
+            case 's': config.msg_size = strtoul(optarg, NULL, 10); break;
+            case 'd': config.duration_sec = atof(optarg); break;
+            case 'w': config.warmup_sec = atof(optarg); break;
+            case 'o': json_path = optarg; break;
+            case 'l': config.label = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+    if (config.clients == 0 || config.msgs_per_sec <= 0 || config.duration_sec <= 0 || config.warmup_sec < 0)
+    {
+        std::cerr << "clients, msgs_per_sec and duration_sec should be > 0" << std::endl;
+        return 1;
+    }
+    if (config.msg_size < MIN_MSG_SIZE)
+    {
+        std::cerr << "msg_size should be >= " << MIN_MSG_SIZE << ": the send time and seq" << std::endl;
+        return 1;
+    }
+
+    echo_bench_result result;
+    const int ret = run_echo_bench(config, &result);
+    if (ret < 0)
+    {
+        std::cerr << "run failed: " << ret << std::endl;
+        return 1;
+    }
+
+    const std::string json = echo_bench_json(config, result);
+    std::cout << json;
+    std::ofstream out(json_path.c_str());
+    out << json;
+    if (!out)
+    {
+        std::cerr << "write failed: " << json_path << std::endl;
+        return 1;
+    }
+    std::cerr << "written to " << json_path << std::endl;
+    return 0;
+}
+
+static int compare_mode(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        usage();
+        return 1;
+    }
+
+    std::map<std::string, std::string> before;
+    std::map<std::string, std::string> after;
+    std::string err;
+    if (!load_echo_bench_json(argv[2], &before, &err) || !load_echo_bench_json(argv[3], &after, &err))
+    {
+        std::cerr << "load failed: " << err << std::endl;
+        return 1;
+    }
+    std::cout << echo_bench_compare_report(before, after);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string mode = (argc > 1 ? argv[1] : "");
+    if (mode == "run")
+        return run_mode(argc, argv);
+    if (mode == "compare")
+        return compare_mode(argc, argv);
+    usage();
+    return 1;
+}
@@ -0,0 +1,41 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../util/kcp_trace.hpp"
+
+// convert the files written by write_kcp_trace_file (server::dump_kcp_trace, kcp_client::dump_kcp_trace)
+// to one Chrome trace json. Open it by chrome://tracing or https://ui.perfetto.dev
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: kcp_trace_to_chrome <out.json> <trace_file> [trace_file ...]\n";
+        std::cerr << "  Put the traces of client and server together to see both ends of a msg:\n";
+        std::cerr << "    kcp_trace_to_chrome trace.json client.kcptrace server.kcptrace\n";
+        return 1;
+    }
+
+    std::vector<std::vector<asio_kcp::kcp_trace_record> > record_sets;
+    std::vector<std::string> names;
+    for (int i = 2; i < argc; ++i)
+    {
+        record_sets.push_back(std::vector<asio_kcp::kcp_trace_record>());
+        if (!asio_kcp::read_kcp_trace_file(argv[i], &record_sets.back()))
+        {
+            std::cerr << "read kcp trace file failed: " << argv[i] << std::endl;
+            return 1;
+        }
+        names.push_back(argv[i]);
+        std::cout << argv[i] << ": " << record_sets.back().size() << " records" << std::endl;
+    }
+
+    std::ofstream out(argv[1], std::ios::out | std::ios::trunc);
+    out << asio_kcp::kcp_trace_to_chrome_json(record_sets, names);
+    if (!out.good())
+    {
+        std::cerr << "write failed: " << argv[1] << std::endl;
+        return 1;
+    }
+    return 0;
+}
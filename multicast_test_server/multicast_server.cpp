@@ -64,7 +64,7 @@ void event_callback(kcp_conv_t conv, kcp_svr::eEventType event_type, std::shared
                 
                 // 将新客户端添加到组播组
                 if (g_multicast_group_id != 0) {
-                    g_server->add_to_multicast_group(g_multicast_group_id, conv);
+                    g_server->add_to_kcp_group(g_multicast_group_id, conv);
                     std::cout << "Added client " << conv << " to multicast group " << g_multicast_group_id << std::endl;
                 }
             }
@@ -79,7 +79,7 @@ void event_callback(kcp_conv_t conv, kcp_svr::eEventType event_type, std::shared
                 
                 // 从组播组移除客户端
                 if (g_multicast_group_id != 0) {
-                    g_server->remove_from_multicast_group(g_multicast_group_id, conv);
+                    g_server->remove_from_kcp_group(g_multicast_group_id, conv);
                     std::cout << "Removed client " << conv << " from multicast group " << g_multicast_group_id << std::endl;
                 }
             }
@@ -95,7 +95,7 @@ void event_callback(kcp_conv_t conv, kcp_svr::eEventType event_type, std::shared
                 if (g_multicast_group_id != 0 && msg->find("echo:") == 0) {
                     std::string echo_msg = msg->substr(5); // 去掉"echo:"前缀
                     auto reply = std::make_shared<std::string>(echo_msg);
-                    g_server->send_msg_to_group(g_multicast_group_id, reply);
+                    g_server->send_msg_to_kcp_group(g_multicast_group_id, reply);
                 }
             }
             break;
@@ -123,7 +123,7 @@ int main(int argc, char* argv[]) {
         g_server->set_callback(event_callback);
         
         // 创建组播组
-        g_multicast_group_id = g_server->create_multicast_group();
+        g_multicast_group_id = g_server->create_kcp_group();
         std::cout << "Created multicast group: " << g_multicast_group_id << std::endl;
         
         // 重置性能统计
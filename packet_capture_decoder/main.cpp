@@ -0,0 +1,27 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "packet_capture.hpp"
+
+// print the packets dumped by kcp_svr::server::dump_packet_capture, one line for one packet.
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: packet_capture_decoder <file.pcapng>\n";
+        std::cerr << "  The file is written by server::dump_packet_capture or the packet capture dump dir.\n";
+        return 1;
+    }
+
+    std::vector<kcp_svr::packet_capture_record> records;
+    if (!kcp_svr::read_pcapng_file(argv[1], &records))
+    {
+        std::cerr << "read packet capture file failed: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < records.size(); ++i)
+        std::cout << kcp_svr::packet_capture_record_str(records[i]) << "\n";
+    std::cout << records.size() << " packets" << std::endl;
+    return 0;
+}
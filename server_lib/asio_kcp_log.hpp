@@ -59,12 +59,11 @@ public:
 
 
 #define AK_INFO_LOG     AK_LOG(INFO)
-#define AK_WARNING_LOG  AK_LOG(WORNING)
+#define AK_WARNING_LOG  AK_LOG(WARNING)
 #define AK_FATAL_LOG    AK_LOG(FATAL)
 
 #define AK_MUDUO_LOG_INFO LOG_INFO  // log structure from muduo
 
-#define AK_UDP_PACKET_LOG AK_MUDUO_LOG_INFO
 #define AK_ASK_PACKET_LOG AK_MUDUO_LOG_INFO
 
 #endif // _ASIO_KCP_LOG_HPP__
@@ -17,11 +17,31 @@ namespace kcp_svr {
 
 //using namespace boost::asio::ip;
 
+shared_kcp_msg* shared_kcp_msg::create(std::shared_ptr<std::string> msg)
+{
+    return new shared_kcp_msg(msg);
+}
+
+void shared_kcp_msg::retain(void* ref)
+{
+    static_cast<shared_kcp_msg*>(ref)->refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void shared_kcp_msg::release(void* ref)
+{
+    shared_kcp_msg* msg = static_cast<shared_kcp_msg*>(ref);
+    if (msg->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete msg;
+}
+
 connection::connection(const std::weak_ptr<connection_manager>& manager_ptr) :
     connection_manager_weak_ptr_(manager_ptr),
     conv_(0),
     p_kcp_(NULL),
-    last_packet_recv_time_(0)
+    last_packet_recv_time_(0),
+    kcp_packet_recved_(false),
+    last_msg_recv_time_(0),
+    resume_token_(0)
 {
 }
 
@@ -48,6 +68,9 @@ connection::shared_ptr connection::create(const std::weak_ptr<connection_manager
     {
         ptr->init_kcp(conv);
         ptr->set_udp_remote_endpoint(udp_remote_endpoint);
+
+        // a client that never answer the connect back packet (lost it, or chose another server in race) should timeout too.
+        ptr->last_packet_recv_time_ = ptr->get_cur_clock();
         AK_INFO_LOG << "new connection from: " << udp_remote_endpoint;
     }
     return ptr;
@@ -63,6 +86,8 @@ void connection::init_kcp(const kcp_conv_t& conv)
     conv_ = conv;
     p_kcp_ = ikcp_create(conv, (void*)this);
     p_kcp_->output = &connection::udp_output;
+    ikcp_setref(p_kcp_, &shared_kcp_msg::retain, &shared_kcp_msg::release);
+    stats_ = std::make_shared<connection_stats_counters>(conv, get_cur_clock());
 
     // 启动快速模式
     // 第二个参数 nodelay-启用以后若干常规加速将启动
@@ -73,9 +98,26 @@ void connection::init_kcp(const kcp_conv_t& conv)
     ikcp_nodelay(p_kcp_, 1, 5, 1, 1); // 设置成1次ACK跨越直接重传, 这样反应速度会更快. 内部时钟5毫秒.
 }
 
+void connection::enable_kcp_trace(void)
+{
+    if (kcp_trace_ring_)
+        return;
+    kcp_trace_ring_.reset(new asio_kcp::kcp_trace_ring());
+    kcp_trace_ring_->attach(p_kcp_);
+}
+
+bool connection::get_kcp_trace(std::vector<asio_kcp::kcp_trace_record>* records) const
+{
+    if (!kcp_trace_ring_)
+        return false;
+    kcp_trace_ring_->snapshot(records);
+    return true;
+}
+
 // 发送一个 udp包
 int connection::udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
+    ((connection*)user)->stats_->on_output(buf, len);
     ((connection*)user)->send_udp_package(buf, len);
 	return 0;
 }
@@ -85,13 +127,6 @@ void connection::send_udp_package(const char *buf, int len)
     if (auto ptr = connection_manager_weak_ptr_.lock())
     {
         ptr->send_udp_packet(std::string(buf, len), udp_remote_endpoint_);
-
-    #if AK_ENABLE_UDP_PACKET_LOG
-        std::cout << "udp_send:" << udp_remote_endpoint_.address().to_string() << ":" << udp_remote_endpoint_.port()
-            << " conv:" << conv_
-            << " size:" << len << "\n"
-            << Essential::ToHexDumpText(std::string(buf, len), 32);
-    #endif
     }
 }
 
@@ -104,56 +139,66 @@ void connection::send_kcp_msg(const std::string& msg)
     }
 }
 
-void connection::input(char* udp_data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint)
+void connection::send_kcp_msg(shared_kcp_msg* msg)
+{
+    int send_ret = ikcp_send_ref(p_kcp_, msg->msg().data(), msg->msg().size(), msg);
+    if (send_ret < 0)
+    {
+        std::cout << "send_ret<0: " << send_ret << std::endl;
+    }
+}
+
+void connection::input(const char* udp_data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint)
 {
     last_packet_recv_time_ = get_cur_clock();
+    kcp_packet_recved_ = true;
     udp_remote_endpoint_ = udp_remote_endpoint;
 
+    auto manager_ptr = connection_manager_weak_ptr_.lock();
+
+    // ikcp_input and the rtt histogram take rtt samples against kcp->current, which only moves on the 5ms timer.
+    // Or the samples are up to one tick too low, and 0 on a lan.
+    const uint32_t now = (manager_ptr ? manager_ptr->clock_ms() : last_packet_recv_time_);
+    p_kcp_->current = now;
+
+    stats_->on_input(bytes_recvd, last_packet_recv_time_);
+    if (manager_ptr)
+        connection_stats_counters::record_ack_rtts(udp_data, bytes_recvd, now, &manager_ptr->get_rtt_histogram());
     ikcp_input(p_kcp_, udp_data, bytes_recvd);
+    stats_->publish_kcp(p_kcp_);
+
+    if (!manager_ptr)
+        return;
 
-    /* todo need re recv or not?
+    // one udp packet may finish more than one msg. recv them all.
+    std::vector<char>& kcp_buf = manager_ptr->get_kcp_recv_buf();
     while (true)
     {
-        char kcp_buf[1024 * 1000] = "";
-        int kcp_recvd_bytes = ikcp_recv(p_kcp_, kcp_buf, sizeof(kcp_buf));
-        if (kcp_recvd_bytes <= 0)
-        {
-            std::cout << "\nkcp_recvd_bytes<=0: " << kcp_recvd_bytes << std::endl;
+        const int peek_size = ikcp_peeksize(p_kcp_);
+        if (peek_size < 0)
             break;
-        }
-        const std::string package(kcp_buf, kcp_recvd_bytes);
-        std::cout << "\nkcp recv: " << kcp_recvd_bytes << std::endl << Essential::ToHexDumpText(package, 32) << std::endl;
+        if (kcp_buf.size() < static_cast<size_t>(peek_size))
+            kcp_buf.resize(peek_size);
 
-        ikcp_input(p_kcp_, "", 0);
-    }
-    */
+        const int kcp_recvd_bytes = ikcp_recv(p_kcp_, kcp_buf.data(), kcp_buf.size());
+        if (kcp_recvd_bytes < 0)
+            break;
+        if (kcp_recvd_bytes == 0)
+            continue;
 
-    {
-        char kcp_buf[1024 * 1000] = "";
-        int kcp_recvd_bytes = ikcp_recv(p_kcp_, kcp_buf, sizeof(kcp_buf));
-        if (kcp_recvd_bytes <= 0)
-        {
-            std::cout << "\nkcp_recvd_bytes<=0: " << kcp_recvd_bytes << std::endl;
-        }
-        else
-        {
-            const std::string package(kcp_buf, kcp_recvd_bytes);
-            std::cout << "\n" << last_packet_recv_time_
-                << " conv:" << conv_
-                << " lag_time:" << get_cur_clock() - last_packet_recv_time_
-                << " kcp recv: " << kcp_recvd_bytes << std::endl <<
-                Essential::ToHexDumpText(package, 32) << std::endl;
-            if (auto ptr = connection_manager_weak_ptr_.lock())
-            {
-                ptr->call_event_callback_func(conv_, eRcvMsg, std::make_shared<std::string>(package));
-            }
-        }
+        // the lag between two msgs. Bursting after a lag means the msgs were waiting for a lost one.
+        if (last_msg_recv_time_ != 0)
+            manager_ptr->get_msg_lag_histogram().record((uint64_t)(now - last_msg_recv_time_) * 1000);
+        last_msg_recv_time_ = now;
+
+        manager_ptr->call_msg_callback_func(conv_, kcp_buf.data(), kcp_recvd_bytes);
     }
 }
 
 void connection::update_kcp(uint32_t clock)
 {
     ikcp_update(p_kcp_, clock);
+    stats_->publish_kcp(p_kcp_);
 }
 
 
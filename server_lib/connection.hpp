@@ -4,15 +4,38 @@
 #include <set>
 #include <unordered_map>
 #include <memory>
+#include <atomic>
 #include <boost/noncopyable.hpp>
 #include <boost/asio.hpp>
 #include "kcp_typedef.hpp"
+#include "connection_stats.hpp"
+#include "../util/kcp_trace.hpp"
 
 namespace kcp_svr {
 
 using namespace boost::asio::ip;
 class connection_manager;
 
+// A msg queued in the kcp of many connections without a copy for each one (ikcp_send_ref).
+// Every kcp segment of it holds a ref until the segment is acked or the connection is cleaned.
+class shared_kcp_msg
+  : private boost::noncopyable
+{
+public:
+    // the ref count is 1, held by the caller. msg must not change until the last release.
+    static shared_kcp_msg* create(std::shared_ptr<std::string> msg);
+    static void retain(void* ref);
+    static void release(void* ref);
+
+    const std::string& msg(void) const {return *msg_;}
+
+private:
+    explicit shared_kcp_msg(std::shared_ptr<std::string> msg) : msg_(msg), refs_(1) {}
+
+    std::shared_ptr<std::string> msg_;
+    std::atomic<size_t> refs_;
+};
+
 class connection
   : private boost::noncopyable
 {
@@ -29,15 +52,32 @@ public:
     void set_udp_remote_endpoint(const udp::endpoint& udp_remote_endpoint);
 
     // changing udp_remote_endpoint at every packet. Because we allow connection change ip or port. we using conv to indicate a connection.
-    void input(char* udp_data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint);
+    void input(const char* udp_data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint);
 
     void update_kcp(uint32_t clock);
 
+    // token for 0-RTT resume. client must give back this token when it resume the connection from another endpoint.
+    void set_resume_token(uint64_t resume_token) {resume_token_ = resume_token;}
+    uint64_t get_resume_token(void) const {return resume_token_;}
+
+    // false means client has not sent any kcp packet after the connect packet.
+    bool kcp_packet_recved(void) const {return kcp_packet_recved_;}
+
     bool is_timeout(void) const;
     void do_timeout(void);
 
     // user level send msg.
     void send_kcp_msg(const std::string& msg);
+    void send_kcp_msg(shared_kcp_msg* msg);
+
+    // updated in the loop of io_service. Other threads can take snapshot from it.
+    std::shared_ptr<const connection_stats_counters> get_stats_counters(void) const {return stats_;}
+
+    // record the lifecycle of the kcp segments into a ring. See util/kcp_trace.hpp.
+    void enable_kcp_trace(void);
+
+    // false if the trace is not enabled.
+    bool get_kcp_trace(std::vector<asio_kcp::kcp_trace_record>* records) const;
 
     // todo need close if connection bind some asio callback.
     //void close();
@@ -57,6 +97,11 @@ private:
     ikcpcb* p_kcp_; // --own
     udp::endpoint udp_remote_endpoint_;
     uint32_t last_packet_recv_time_;
+    bool kcp_packet_recved_;
+    uint32_t last_msg_recv_time_; // 0 before the first msg
+    uint64_t resume_token_;
+    std::shared_ptr<connection_stats_counters> stats_;
+    std::unique_ptr<asio_kcp::kcp_trace_ring> kcp_trace_ring_; // null if not traced
 };
 
 } // namespace kcp_svr
@@ -12,7 +12,8 @@
 
 namespace kcp_svr {
 
-connection_container::connection_container(void)
+connection_container::connection_container(void) :
+    resume_token_rand_(std::random_device()())
 {
 }
 
@@ -25,8 +26,9 @@ connection::shared_ptr connection_container::find_by_conv(const kcp_conv_t& conv
         return iter->second;
 }
 
-void connection_container::update_all_kcp(uint32_t clock)
+size_t connection_container::update_all_kcp(uint32_t clock, std::vector<kcp_conv_t>* timeout_convs)
 {
+    size_t timeout_count = 0;
     for (auto iter = connections_.begin(); iter != connections_.end();)
     {
         connection::shared_ptr& ptr = iter->second;
@@ -37,12 +39,17 @@ void connection_container::update_all_kcp(uint32_t clock)
         if (ptr->is_timeout())
         {
             ptr->do_timeout();
+            erase_stats(iter->first);
+            if (timeout_convs)
+                timeout_convs->push_back(iter->first);
             connections_.erase(iter++);
+            timeout_count++;
             continue;
         }
 
         iter++;
     }
+    return timeout_count;
 }
 
 void connection_container::stop_all()
@@ -50,19 +57,56 @@ void connection_container::stop_all()
     // todo need more code if connection bind some asio callback.
 
     connections_.clear();
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.clear();
 }
 
 connection::shared_ptr connection_container::add_new_connection(std::weak_ptr<connection_manager> manager_ptr,
         const kcp_conv_t& conv, const udp::endpoint& udp_sender_endpoint)
 {
     connection::shared_ptr ptr = connection::create(manager_ptr, conv, udp_sender_endpoint);
+    ptr->set_resume_token(get_new_resume_token());
     connections_[conv] = ptr;
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_[conv] = ptr->get_stats_counters();
     return ptr;
 }
 
 void connection_container::remove_connection(const kcp_conv_t& conv)
 {
     connections_.erase(conv);
+    erase_stats(conv);
+}
+
+void connection_container::erase_stats(const kcp_conv_t& conv)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.erase(conv);
+}
+
+bool connection_container::get_stats(const kcp_conv_t& conv, uint32_t now, connection_stats* stats) const
+{
+    std::shared_ptr<const connection_stats_counters> counters;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        auto iter = stats_.find(conv);
+        if (iter == stats_.end())
+            return false;
+        counters = iter->second;
+    }
+    counters->snapshot(now, stats);
+    return true;
+}
+
+void connection_container::get_all_stats(uint32_t now, std::vector<connection_stats>* stats) const
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats->resize(stats_.size());
+    size_t i = 0;
+    for (auto iter = stats_.begin(); iter != stats_.end(); ++iter, ++i)
+        iter->second->snapshot(now, &(*stats)[i]);
 }
 
 kcp_conv_t connection_container::get_new_conv(void) const
@@ -76,4 +120,12 @@ kcp_conv_t connection_container::get_new_conv(void) const
     return static_cur_conv;
 }
 
+uint64_t connection_container::get_new_resume_token(void)
+{
+    uint64_t token = 0;
+    while (token == 0) // 0 means no token.
+        token = resume_token_rand_();
+    return token;
+}
+
 } // namespace kcp_svr
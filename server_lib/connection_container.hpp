@@ -3,6 +3,9 @@
 
 #include <set>
 #include <unordered_map>
+#include <random>
+#include <mutex>
+#include <vector>
 #include <boost/noncopyable.hpp>
 
 #include "connection.hpp"
@@ -20,7 +23,8 @@ class connection_container
 public:
     connection_container(void);
     connection::shared_ptr find_by_conv(const kcp_conv_t& conv);
-    void update_all_kcp(uint32_t clock);
+    // return the count of connections removed by timeout. Their convs are appended to timeout_convs if given.
+    size_t update_all_kcp(uint32_t clock, std::vector<kcp_conv_t>* timeout_convs = NULL);
 
     void stop_all();
 
@@ -29,11 +33,26 @@ public:
 
     void remove_connection(const kcp_conv_t& conv);
 
+    size_t size(void) const {return connections_.size();}
+
     kcp_conv_t get_new_conv(void) const;
+
+    // random token for 0-RTT resume.
+    uint64_t get_new_resume_token(void);
+
+    // thread safe. return false if conv is not connected.
+    bool get_stats(const kcp_conv_t& conv, uint32_t now, connection_stats* stats) const;
+    void get_all_stats(uint32_t now, std::vector<connection_stats>* stats) const;
 private:
+    void erase_stats(const kcp_conv_t& conv);
 
 private:
     std::unordered_map<kcp_conv_t, connection::shared_ptr> connections_;
+    std::mt19937_64 resume_token_rand_;
+
+    // the counters of connections_ for other threads. Locked only when a connection is added or removed, and by the readers.
+    mutable std::mutex stats_mutex_;
+    std::unordered_map<kcp_conv_t, std::shared_ptr<const connection_stats_counters> > stats_;
 };
 
 } // namespace kcp_svr
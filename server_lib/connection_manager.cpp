@@ -4,32 +4,24 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "../essential/utility/strutil.h"
 #include "../essential/check_function.h"
 #include "../util/ikcp.h"
 #include "../util/connect_packet.hpp"
+#include "../util/kcp_clock.hpp"
 #include "asio_kcp_log.hpp"
 
-/* get system time */
-static inline void itimeofday(long *sec, long *usec)
-{
-	struct timeval time;
-	gettimeofday(&time, NULL);
-	if (sec) *sec = time.tv_sec;
-	if (usec) *usec = time.tv_usec;
-}
-
-/* get clock in millisecond 64 */
+/* get clock in millisecond 64. monotonic: timeout and rto will not be broken by changing system time. */
 static inline uint64_t iclock64(void)
 {
-    long s, u;
-    uint64_t value;
-    itimeofday(&s, &u);
-    value = ((uint64_t)s) * 1000 + (u / 1000);
-    return value;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000 + (ts.tv_nsec / (1000 * 1000));
 }
 
 
@@ -41,6 +33,8 @@ static inline uint32_t iclock()
 
 namespace kcp_svr {
 
+static const uint64_t udp_packet_size_bounds[] = {32, 64, 128, 256, 512, 1024, 1400, 2048, 8192};
+
 uint64_t endpoint_to_i(const udp::endpoint& ep)
 {
     uint64_t addr_i = ep.address().to_v4().to_ulong();
@@ -51,23 +45,59 @@ uint64_t endpoint_to_i(const udp::endpoint& ep)
 
 connection_manager::connection_manager(boost::asio::io_service& io_service, const std::string& address, int udp_port) :
     stopped_(false),
-    udp_socket_(io_service, udp::endpoint(boost::asio::ip::address::from_string(address), udp_port)),
+    transport_(std::make_shared<asio_udp_transport>(io_service, address, udp_port)),
+    clock_(NULL),
+    kcp_recv_buf_(1024 * 32),
     kcp_timer_(io_service),
-    cur_clock_(0)
+    cur_clock_(0),
+    last_prune_handshaking_clock_(0),
+    udp_packet_size_in_(std::vector<uint64_t>(udp_packet_size_bounds,
+                udp_packet_size_bounds + sizeof(udp_packet_size_bounds) / sizeof(udp_packet_size_bounds[0]))),
+    kcp_trace_new_connections_(false)
 {
-    //udp_socket_.set_option(udp::socket::non_blocking_io(false)); // why this make compile fail
+    start();
+}
 
-    hook_udp_async_receive();
-    hook_kcp_timer();
+connection_manager::connection_manager(boost::asio::io_service& io_service, std::shared_ptr<server_transport> transport,
+        const asio_kcp::kcp_clock* clock) :
+    stopped_(false),
+    transport_(transport),
+    clock_(clock),
+    kcp_recv_buf_(1024 * 32),
+    kcp_timer_(io_service),
+    cur_clock_(0),
+    last_prune_handshaking_clock_(0),
+    udp_packet_size_in_(std::vector<uint64_t>(udp_packet_size_bounds,
+                udp_packet_size_bounds + sizeof(udp_packet_size_bounds) / sizeof(udp_packet_size_bounds[0]))),
+    kcp_trace_new_connections_(false)
+{
+    start();
+}
+
+void connection_manager::start(void)
+{
+    local_endpoint_ = transport_->local_endpoint();
+    cur_clock_ = clock_ms();
+    last_prune_handshaking_clock_ = cur_clock_;
+
+    transport_->start_recv(std::bind(&connection_manager::handle_udp_receive_from, this,
+                std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    if (!clock_)
+        hook_kcp_timer();
+}
+
+uint32_t connection_manager::clock_ms(void) const
+{
+    return (clock_ ? (uint32_t)(clock_->now_ms() & 0xfffffffful) : iclock());
 }
 
 void connection_manager::stop_all()
 {
   stopped_ = true;
   connections_.stop_all();
+  live_connections_.set(0);
 
-  udp_socket_.cancel();
-  udp_socket_.close();
+  transport_->close();
 }
 
 void connection_manager::force_disconnect(const kcp_conv_t& conv)
@@ -79,6 +109,8 @@ void connection_manager::force_disconnect(const kcp_conv_t& conv)
     std::shared_ptr<std::string> msg(new std::string("server force disconnect"));
     call_event_callback_func(conv, eEventType::eDisconnect, msg);
     connections_.remove_connection(conv);
+    live_connections_.set(connections_.size());
+    dump_packet_capture_on_disconnect(conv);
 }
 
 void connection_manager::set_callback(const std::function<event_callback_t>& func)
@@ -86,23 +118,85 @@ void connection_manager::set_callback(const std::function<event_callback_t>& fun
     event_callback_ = func;
 }
 
+void connection_manager::set_msg_callback(const std::function<msg_callback_t>& func)
+{
+    msg_callback_ = func;
+}
+
 void connection_manager::call_event_callback_func(kcp_conv_t conv, eEventType event_type, std::shared_ptr<std::string> msg)
 {
     event_callback_(conv, event_type, msg);
 }
 
-void connection_manager::handle_connect_packet()
+void connection_manager::call_msg_callback_func(kcp_conv_t conv, const char* msg, size_t len)
 {
+    if (msg_callback_)
+        msg_callback_(conv, msg, len);
+    else
+        event_callback_(conv, eRcvMsg, std::make_shared<std::string>(msg, len));
+}
+
+void connection_manager::handle_connect_packet(const udp::endpoint& udp_remote_endpoint)
+{
+    const uint64_t endpoint_i = endpoint_to_i(udp_remote_endpoint);
+
+    // the connect packet resent by client. answer the same conv.
+    auto iter = handshaking_convs_.find(endpoint_i);
+    if (iter != handshaking_convs_.end())
+    {
+        connection::shared_ptr conn_ptr = connections_.find_by_conv(iter->second);
+        if (conn_ptr && !conn_ptr->kcp_packet_recved())
+        {
+            std::string send_back_msg = asio_kcp::making_send_back_conv_packet(iter->second, conn_ptr->get_resume_token());
+            send_udp_packet(send_back_msg, udp_remote_endpoint);
+            return;
+        }
+    }
+
     kcp_conv_t conv = connections_.get_new_conv();
-    std::string send_back_msg = asio_kcp::making_send_back_conv_packet(conv);
-    udp_socket_.send_to(boost::asio::buffer(send_back_msg), udp_remote_endpoint_);
-    connections_.add_new_connection(shared_from_this(), conv, udp_remote_endpoint_);
+    connection::shared_ptr conn_ptr = connections_.add_new_connection(shared_from_this(), conv, udp_remote_endpoint);
+    if (kcp_trace_new_connections_)
+        conn_ptr->enable_kcp_trace();
+    std::string send_back_msg = asio_kcp::making_send_back_conv_packet(conv, conn_ptr->get_resume_token());
+    send_udp_packet(send_back_msg, udp_remote_endpoint);
+    handshaking_convs_[endpoint_i] = conv;
+    handshakes_.inc();
+    live_connections_.set(connections_.size());
+}
+
+void connection_manager::handle_resume_packet(const char* data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint)
+{
+    kcp_conv_t conv = 0;
+    uint64_t resume_token = 0;
+    if (!asio_kcp::grab_conv_and_token_from_resume_packet(data, bytes_recvd, &conv, &resume_token))
+        return;
+
+    connection::shared_ptr conn_ptr = connections_.find_by_conv(conv);
+    if (!conn_ptr || conn_ptr->get_resume_token() != resume_token)
+    {
+        AK_INFO_LOG << "resume failed with conv: " << conv << " from " << udp_remote_endpoint;
+        std::string disconnect_msg = asio_kcp::making_disconnect_packet(conv);
+        send_udp_packet(disconnect_msg, udp_remote_endpoint);
+        resume_failures_.inc();
+        return;
+    }
+
+    std::string resume_back_msg = asio_kcp::making_resume_back_packet(conv);
+    send_udp_packet(resume_back_msg, udp_remote_endpoint);
+    resumes_.inc();
+
+    // 0-RTT: the kcp packet following the header.
+    const size_t header_size = ASIO_KCP_RESUME_PACKET_HEADER_SIZE;
+    if (bytes_recvd > header_size)
+        conn_ptr->input(data + header_size, bytes_recvd - header_size, udp_remote_endpoint);
+    else
+        conn_ptr->set_udp_remote_endpoint(udp_remote_endpoint);
 }
 
-void connection_manager::handle_kcp_packet(size_t bytes_recvd)
+void connection_manager::handle_kcp_packet(const char* data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint)
 {
     IUINT32 conv;
-    int ret = ikcp_get_conv(udp_data_, bytes_recvd, &conv);
+    int ret = ikcp_get_conv(data, bytes_recvd, &conv);
     if (ret == 0)
     {
         assert_check(false, "ikcp_get_conv return 0");
@@ -113,60 +207,58 @@ void connection_manager::handle_kcp_packet(size_t bytes_recvd)
     if (!conn_ptr)
     {
         std::cout << "connection not exist with conv: " << conv << std::endl;
+        unknown_conv_drops_.inc();
         return;
     }
 
+    if (!conn_ptr->kcp_packet_recved())
+        handshaking_convs_.erase(endpoint_to_i(udp_remote_endpoint));
+
     if (conn_ptr)
-        conn_ptr->input(udp_data_, bytes_recvd, udp_remote_endpoint_);
+        conn_ptr->input(data, bytes_recvd, udp_remote_endpoint);
     else
         std::cout << "add_new_connection failed! can not connect!" << std::endl;
 }
 
-void connection_manager::handle_udp_receive_from(const boost::system::error_code& error, size_t bytes_recvd)
+void connection_manager::handle_udp_receive_from(const boost::system::error_code& error, const char* data, size_t bytes_recvd,
+        const udp::endpoint& udp_remote_endpoint)
 {
     if (!error && bytes_recvd > 0)
     {
+        udp_packets_in_.inc();
+        udp_bytes_in_.inc(bytes_recvd);
+        udp_packet_size_in_.observe(bytes_recvd);
+
         /*
-        std::cout << "\nudp_sender_endpoint: " << udp_remote_endpoint_ << std::endl;
-        unsigned long addr_i = udp_remote_endpoint_.address().to_v4().to_ulong();
-        std::cout << addr_i << " " << udp_remote_endpoint_.port() << std::endl;
+        std::cout << "\nudp_sender_endpoint: " << udp_remote_endpoint << std::endl;
+        unsigned long addr_i = udp_remote_endpoint.address().to_v4().to_ulong();
+        std::cout << addr_i << " " << udp_remote_endpoint.port() << std::endl;
         std::cout << "udp recv: " << bytes_recvd << std::endl <<
-            Essential::ToHexDumpText(std::string(udp_data_, bytes_recvd), 32) << std::endl;
+            Essential::ToHexDumpText(std::string(data, bytes_recvd), 32) << std::endl;
         */
 
-        #if AK_ENABLE_UDP_PACKET_LOG
-            AK_UDP_PACKET_LOG << "udp_recv:" << udp_remote_endpoint_.address().to_string() << ":" << udp_remote_endpoint_.port()
-                << " conv:" << 0
-                << " size:" << bytes_recvd << "\n"
-                << Essential::ToHexDumpText(std::string(udp_data_, bytes_recvd), 32);
-        #endif
+        packet_capture_.record(ePacketIn, udp_remote_endpoint, data, bytes_recvd);
+
+        if (asio_kcp::is_connect_packet(data, bytes_recvd))
+        {
+            handle_connect_packet(udp_remote_endpoint);
+            return;
+        }
 
-        if (asio_kcp::is_connect_packet(udp_data_, bytes_recvd))
+        if (asio_kcp::is_resume_packet(data, bytes_recvd))
         {
-            handle_connect_packet();
-            goto END;
+            handle_resume_packet(data, bytes_recvd, udp_remote_endpoint);
+            return;
         }
 
-        handle_kcp_packet(bytes_recvd);
+        handle_kcp_packet(data, bytes_recvd, udp_remote_endpoint);
     }
     else
     {
+        if (error != boost::asio::error::operation_aborted)
+            socket_errors_.inc();
         printf("\nhandle_udp_receive_from error end! error: %s, bytes_recvd: %ld\n", error.message().c_str(), bytes_recvd);
     }
-
-END:
-    hook_udp_async_receive();
-}
-
-void connection_manager::hook_udp_async_receive(void)
-{
-    if (stopped_)
-        return;
-    udp_socket_.async_receive_from(
-          boost::asio::buffer(udp_data_, sizeof(udp_data_)), udp_remote_endpoint_,
-          boost::bind(&connection_manager::handle_udp_receive_from, this,
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred));
 }
 
 void connection_manager::hook_kcp_timer(void)
@@ -181,13 +273,49 @@ void connection_manager::handle_kcp_time(void)
 {
     //std::cout << "."; std::cout.flush();
     hook_kcp_timer();
-    cur_clock_ = iclock();
-    connections_.update_all_kcp(cur_clock_);
+    update();
+}
+
+void connection_manager::update(void)
+{
+    cur_clock_ = clock_ms();
+    timeout_convs_.clear();
+    const size_t timeout_count = connections_.update_all_kcp(cur_clock_, &timeout_convs_);
+    if (timeout_count > 0)
+    {
+        timeouts_.inc(timeout_count);
+        live_connections_.set(connections_.size());
+        for (size_t i = 0; i < timeout_convs_.size(); ++i)
+            dump_packet_capture_on_disconnect(timeout_convs_[i]);
+    }
+
+    if (cur_clock_ - last_prune_handshaking_clock_ > 1000)
+    {
+        last_prune_handshaking_clock_ = cur_clock_;
+        prune_handshaking_convs();
+    }
+}
+
+void connection_manager::prune_handshaking_convs(void)
+{
+    for (auto iter = handshaking_convs_.begin(); iter != handshaking_convs_.end();)
+    {
+        connection::shared_ptr conn_ptr = connections_.find_by_conv(iter->second);
+        if (!conn_ptr || conn_ptr->kcp_packet_recved())
+        {
+            iter = handshaking_convs_.erase(iter);
+            continue;
+        }
+        iter++;
+    }
 }
 
 void connection_manager::send_udp_packet(const std::string& msg, const boost::asio::ip::udp::endpoint& endpoint)
 {
-    udp_socket_.send_to(boost::asio::buffer(msg), endpoint);
+    transport_->send_to(msg.data(), msg.size(), endpoint);
+    packet_capture_.record(ePacketOut, endpoint, msg.data(), msg.size());
+    udp_packets_out_.inc();
+    udp_bytes_out_.inc(msg.size());
 }
 
 int connection_manager::send_msg(const kcp_conv_t& conv, std::shared_ptr<std::string> msg)
@@ -200,4 +328,96 @@ int connection_manager::send_msg(const kcp_conv_t& conv, std::shared_ptr<std::st
     return 0;
 }
 
+int connection_manager::send_msg(const kcp_conv_t& conv, shared_kcp_msg* msg)
+{
+    connection::shared_ptr connection_ptr = connections_.find_by_conv(conv);
+    if (!connection_ptr)
+        return -1;
+
+    connection_ptr->send_kcp_msg(msg);
+    return 0;
+}
+
+bool connection_manager::get_connection_stats(const kcp_conv_t& conv, connection_stats* stats) const
+{
+    return connections_.get_stats(conv, clock_ms(), stats);
+}
+
+void connection_manager::get_all_connection_stats(std::vector<connection_stats>* stats) const
+{
+    connections_.get_all_stats(clock_ms(), stats);
+}
+
+bool connection_manager::dump_packet_capture(const std::string& path) const
+{
+    std::vector<packet_capture_record> records;
+    packet_capture_.snapshot(&records);
+    return write_pcapng_file(path, records, local_endpoint_);
+}
+
+void connection_manager::set_packet_capture_dump_dir(const std::string& dir)
+{
+    packet_capture_dump_dir_ = dir;
+}
+
+void connection_manager::dump_packet_capture_on_disconnect(const kcp_conv_t& conv)
+{
+    if (packet_capture_dump_dir_.empty())
+        return;
+
+    std::vector<packet_capture_record> records;
+    packet_capture_.snapshot(&records);
+    records.erase(std::remove_if(records.begin(), records.end(),
+                [conv](const packet_capture_record& r) { return r.conv != conv; }), records.end());
+
+    std::ostringstream path;
+    path << packet_capture_dump_dir_ << "/asio_kcp_conv_" << conv << "_" << time(NULL) << ".pcapng";
+    if (write_pcapng_file(path.str(), records, local_endpoint_))
+        AK_INFO_LOG << "packet capture of conv " << conv << " dumped to " << path.str();
+    else
+        AK_WARNING_LOG << "packet capture of conv " << conv << " dump failed: " << path.str();
+}
+
+bool connection_manager::enable_kcp_trace(const kcp_conv_t& conv)
+{
+    connection::shared_ptr conn_ptr = connections_.find_by_conv(conv);
+    if (!conn_ptr)
+        return false;
+    conn_ptr->enable_kcp_trace();
+    return true;
+}
+
+bool connection_manager::dump_kcp_trace(const kcp_conv_t& conv, const std::string& path)
+{
+    connection::shared_ptr conn_ptr = connections_.find_by_conv(conv);
+    std::vector<asio_kcp::kcp_trace_record> records;
+    if (!conn_ptr || !conn_ptr->get_kcp_trace(&records))
+        return false;
+    return asio_kcp::write_kcp_trace_file(path, records);
+}
+
+void connection_manager::get_latency_stats(latency_stats* stats) const
+{
+    rtt_us_.summarize(&stats->rtt_us);
+    msg_lag_us_.summarize(&stats->msg_lag_us);
+}
+
+void connection_manager::register_metrics(metrics_registry& registry)
+{
+    registry.add("asio_kcp_udp_packets_in_total", "UDP packets received.", &udp_packets_in_);
+    registry.add("asio_kcp_udp_bytes_in_total", "UDP bytes received.", &udp_bytes_in_);
+    registry.add("asio_kcp_udp_packets_out_total", "UDP packets sent, kcp and handshake.", &udp_packets_out_);
+    registry.add("asio_kcp_udp_bytes_out_total", "UDP bytes sent, kcp and handshake.", &udp_bytes_out_);
+    registry.add("asio_kcp_udp_packet_size_in_bytes", "Size of the UDP packets received.", &udp_packet_size_in_);
+    registry.add("asio_kcp_handshakes_total", "Connections created by connect packets.", &handshakes_);
+    registry.add("asio_kcp_resumes_total", "Connections resumed by 0-RTT resume packets.", &resumes_);
+    registry.add("asio_kcp_resume_failures_total", "Resume packets with unknown conv or wrong token.", &resume_failures_);
+    registry.add("asio_kcp_timeouts_total", "Connections removed by timeout.", &timeouts_);
+    registry.add("asio_kcp_unknown_conv_drops_total", "KCP packets dropped because the conv is not connected.", &unknown_conv_drops_);
+    registry.add("asio_kcp_socket_errors_total", "Errors of receiving from the UDP socket.", &socket_errors_);
+    registry.add("asio_kcp_live_connections", "Connections alive.", &live_connections_);
+    registry.add("asio_kcp_rtt_us", "RTT measured by the acks of clients, in microseconds.", &rtt_us_);
+    registry.add("asio_kcp_msg_lag_us", "Time between two msgs recved from the same client, in microseconds.", &msg_lag_us_);
+}
+
 } // namespace kcp_svr
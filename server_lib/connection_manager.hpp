@@ -3,13 +3,21 @@
 
 #include <set>
 #include <unordered_map>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/asio.hpp>
 
 #include "connection_container.hpp"
+#include "metrics.hpp"
+#include "packet_capture.hpp"
+#include "server_transport.hpp"
 
 
 
+namespace asio_kcp {
+class kcp_clock;
+}
+
 namespace kcp_svr {
 
 class connection_manager
@@ -21,6 +29,15 @@ public:
 
     connection_manager(boost::asio::io_service& io_service, const std::string& address, int udp_port);
 
+    // run on a transport other than the udp socket, e.g. memory_server_transport for simulation.
+    // clock NULL: the monotonic clock, kcp updated by a 5ms timer of io_service.
+    // clock set: the timer not hooked. The simulator calls update() after moving the clock.
+    connection_manager(boost::asio::io_service& io_service, std::shared_ptr<server_transport> transport,
+            const asio_kcp::kcp_clock* clock = NULL);
+
+    // update kcp of all connections, check timeout. Called by the kcp timer, or by the simulator.
+    void update(void);
+
     /// Stop all connections.
     void stop_all();
 
@@ -28,49 +45,125 @@ public:
 
     void set_callback(const std::function<event_callback_t>& func);
 
+    void set_msg_callback(const std::function<msg_callback_t>& func);
+
     int send_msg(const kcp_conv_t& conv, std::shared_ptr<std::string> msg);
 
+    // the kcp segments reference msg instead of copying it. For sending one msg to many connections.
+    int send_msg(const kcp_conv_t& conv, shared_kcp_msg* msg);
+
+    // thread safe.
+    bool get_connection_stats(const kcp_conv_t& conv, connection_stats* stats) const;
+    void get_all_connection_stats(std::vector<connection_stats>* stats) const;
+    void get_latency_stats(latency_stats* stats) const;
+
+    // write the recent udp packets to a pcapng file. thread safe.
+    bool dump_packet_capture(const std::string& path) const;
+
+    // dump the packets of a connection when it timeout or force disconnected. Empty dir (default) means no dump.
+    // call it before io_service.run().
+    void set_packet_capture_dump_dir(const std::string& dir);
+
+    // trace the kcp segments of the connection. false if conv not found.
+    bool enable_kcp_trace(const kcp_conv_t& conv);
+
+    // trace every new connection. call it before io_service.run().
+    void set_kcp_trace_new_connections(bool enable) {kcp_trace_new_connections_ = enable;}
+
+    // write the kcp trace of the connection to a file for kcp_trace_to_chrome. false if not traced.
+    bool dump_kcp_trace(const kcp_conv_t& conv, const std::string& path);
+
+    // register the counters of udp packets, handshakes, timeouts, etc. Do not render the registry after this is destroyed.
+    void register_metrics(metrics_registry& registry);
 
 
 
     // this func should be multithread safe if running UdpPacketHandler in work thread pool.  can implement by io_service.dispatch
     void call_event_callback_func(kcp_conv_t conv, eEventType event_type, std::shared_ptr<std::string> msg);
 
+    // call msg_callback if setted, or call event_callback with eRcvMsg.
+    void call_msg_callback_func(kcp_conv_t conv, const char* msg, size_t len);
+
+    // the recv buffer shared by all connections. All connections running in the loop of io_service.
+    std::vector<char>& get_kcp_recv_buf(void) {return kcp_recv_buf_;}
+
     // this func should be multithread safe if running UdpPacketHandler in work thread pool.  can implement by io_service.dispatch
     void send_udp_packet(const std::string& msg, const udp::endpoint& endpoint);
 
 
     uint32_t get_cur_clock(void) const {return cur_clock_;}
+
+    // the clock now. get_cur_clock() only moves on the 5ms kcp timer.
+    uint32_t clock_ms(void) const;
+
+    // recorded by connections in the loop of io_service.
+    asio_kcp::hdr_histogram& get_rtt_histogram(void) {return rtt_us_;}
+    asio_kcp::hdr_histogram& get_msg_lag_histogram(void) {return msg_lag_us_;}
 private:
 
+    void start(void);
+
     /// The UDP
-    void handle_udp_receive_from(const boost::system::error_code& error, size_t bytes_recvd);
-    void hook_udp_async_receive(void);
+    void handle_udp_receive_from(const boost::system::error_code& error, const char* data, size_t bytes_recvd,
+            const udp::endpoint& udp_remote_endpoint);
     void handle_kcp_time(void);
     void hook_kcp_timer(void);
 
-    void handle_connect_packet();
-    void handle_kcp_packet(size_t bytes_recvd);
+    void handle_connect_packet(const udp::endpoint& udp_remote_endpoint);
+    void handle_resume_packet(const char* data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint);
+    void handle_kcp_packet(const char* data, size_t bytes_recvd, const udp::endpoint& udp_remote_endpoint);
+    void prune_handshaking_convs(void);
+    void dump_packet_capture_on_disconnect(const kcp_conv_t& conv);
 
 private:
     bool stopped_;
 
     std::function<event_callback_t> event_callback_;
+    std::function<msg_callback_t> msg_callback_;
 
     /// The listen socket.
-    udp::socket udp_socket_;
+    std::shared_ptr<server_transport> transport_;
+    const asio_kcp::kcp_clock* clock_;
 
-    udp::endpoint udp_remote_endpoint_;
+    udp::endpoint local_endpoint_;
 
     //enum { udp_packet_max_length = 548 }; // maybe 1472 will be ok.
     enum { udp_packet_max_length = 1080 }; // (576-8-20 - 8) * 2
-    char udp_data_[1024 * 32];
+    std::vector<char> kcp_recv_buf_;
 
     boost::asio::deadline_timer kcp_timer_;
     uint32_t cur_clock_;
     u_int32_t timeout_time_; // after x millisecond
 
     connection_container connections_;
+
+    // endpoint -> conv of the connection which has not recved any kcp packet.
+    // client resend the connect packet quickly. Answer the same conv instead of creating a new connection.
+    std::unordered_map<uint64_t, kcp_conv_t> handshaking_convs_;
+    uint32_t last_prune_handshaking_clock_;
+
+    // process-wide metrics. Only updated in the loop of io_service.
+    metrics_counter udp_packets_in_;
+    metrics_counter udp_bytes_in_;
+    metrics_counter udp_packets_out_;
+    metrics_counter udp_bytes_out_;
+    metrics_histogram udp_packet_size_in_;
+    metrics_counter handshakes_;
+    metrics_counter resumes_;
+    metrics_counter resume_failures_;
+    metrics_counter timeouts_;
+    metrics_counter unknown_conv_drops_;
+    metrics_counter socket_errors_;
+    metrics_gauge live_connections_;
+    asio_kcp::hdr_histogram rtt_us_;
+    asio_kcp::hdr_histogram msg_lag_us_;
+
+    // the recent udp packets, always on.
+    packet_capture_ring packet_capture_;
+    std::string packet_capture_dump_dir_;
+    std::vector<kcp_conv_t> timeout_convs_;
+
+    bool kcp_trace_new_connections_;
 };
 
 } // namespace kcp_svr
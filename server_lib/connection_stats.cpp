@@ -0,0 +1,122 @@
+#include "connection_stats.hpp"
+#include "../util/ikcp.h"
+#include "../util/kcp_segment.hpp"
+
+namespace kcp_svr {
+
+connection_stats_counters::connection_stats_counters(const kcp_conv_t& conv, uint32_t clock) :
+    conv_(conv),
+    bytes_in_(0),
+    packets_in_(0),
+    bytes_out_(0),
+    packets_out_(0),
+    segments_sent_(0),
+    new_segments_sent_(0),
+    last_recv_clock_(clock),
+    srtt_us_(0),
+    rttvar_us_(0),
+    rto_us_(0),
+    cwnd_(0),
+    remote_wnd_(0),
+    in_flight_(0),
+    send_queue_(0),
+    recv_buf_(0),
+    recv_queue_(0),
+    timeout_retransmit_count_(0),
+    last_snd_nxt_(0)
+{
+}
+
+void connection_stats_counters::on_input(size_t bytes, uint32_t clock)
+{
+    add(bytes_in_, bytes);
+    add(packets_in_, 1);
+    last_recv_clock_.store(clock, std::memory_order_relaxed);
+}
+
+void connection_stats_counters::on_output(const char* buf, size_t len)
+{
+    add(bytes_out_, len);
+    add(packets_out_, 1);
+    add(segments_sent_, count_push_segments(buf, len));
+}
+
+uint32_t connection_stats_counters::count_push_segments(const char* buf, size_t len)
+{
+    uint32_t count = 0;
+    size_t offset = 0;
+    asio_kcp::kcp_segment_header seg;
+    while (asio_kcp::next_kcp_segment(buf, len, &offset, &seg))
+    {
+        if (seg.cmd == KCP_CMD_PUSH)
+            count++;
+    }
+    return count;
+}
+
+void connection_stats_counters::record_ack_rtts(const char* buf, size_t len, uint32_t current, asio_kcp::hdr_histogram* rtt_us)
+{
+    size_t offset = 0;
+    asio_kcp::kcp_segment_header seg;
+    while (asio_kcp::next_kcp_segment(buf, len, &offset, &seg))
+    {
+        if (seg.cmd == KCP_CMD_ACK)
+        {
+            // the ts of ack is the ts of the segment acked. ikcp_input skips the negative ones too.
+            const int32_t rtt = (int32_t)(current - seg.ts);
+            if (rtt >= 0)
+                rtt_us->record((uint64_t)rtt * 1000);
+        }
+    }
+}
+
+void connection_stats_counters::publish_kcp(const ikcpcb* kcp)
+{
+    // every segment moved into snd_buf is sent in the same flush. So the others are retransmits.
+    add(new_segments_sent_, kcp->snd_nxt - last_snd_nxt_);
+    last_snd_nxt_ = kcp->snd_nxt;
+
+    const uint32_t unit = (kcp->clock_unit > 0 ? kcp->clock_unit : 1);
+    srtt_us_.store((uint32_t)kcp->rx_srtt * 1000 / unit, std::memory_order_relaxed);
+    rttvar_us_.store((uint32_t)kcp->rx_rttval * 1000 / unit, std::memory_order_relaxed);
+    rto_us_.store((uint32_t)kcp->rx_rto * 1000 / unit, std::memory_order_relaxed);
+    cwnd_.store(kcp->cwnd, std::memory_order_relaxed);
+    remote_wnd_.store(kcp->rmt_wnd, std::memory_order_relaxed);
+    in_flight_.store(kcp->nsnd_buf, std::memory_order_relaxed);
+    send_queue_.store(kcp->nsnd_que, std::memory_order_relaxed);
+    recv_buf_.store(kcp->nrcv_buf, std::memory_order_relaxed);
+    recv_queue_.store(kcp->nrcv_que, std::memory_order_relaxed);
+    timeout_retransmit_count_.store(kcp->xmit, std::memory_order_relaxed);
+}
+
+void connection_stats_counters::snapshot(uint32_t now, connection_stats* stats) const
+{
+    stats->conv = conv_;
+    stats->srtt_us = srtt_us_.load(std::memory_order_relaxed);
+    stats->rttvar_us = rttvar_us_.load(std::memory_order_relaxed);
+    stats->rto_us = rto_us_.load(std::memory_order_relaxed);
+    stats->cwnd = cwnd_.load(std::memory_order_relaxed);
+    stats->remote_wnd = remote_wnd_.load(std::memory_order_relaxed);
+    stats->in_flight = in_flight_.load(std::memory_order_relaxed);
+    stats->send_queue = send_queue_.load(std::memory_order_relaxed);
+    stats->recv_buf = recv_buf_.load(std::memory_order_relaxed);
+    stats->recv_queue = recv_queue_.load(std::memory_order_relaxed);
+
+    // the segments of the flush running now may be counted but not published yet.
+    const uint64_t segments_sent = segments_sent_.load(std::memory_order_relaxed);
+    const uint64_t new_segments_sent = new_segments_sent_.load(std::memory_order_relaxed);
+    stats->segments_sent = segments_sent;
+    stats->retransmit_count = (segments_sent > new_segments_sent ? segments_sent - new_segments_sent : 0);
+    stats->timeout_retransmit_count = timeout_retransmit_count_.load(std::memory_order_relaxed);
+    stats->retransmit_ratio = (segments_sent > 0 ? (double)stats->retransmit_count / segments_sent : 0.0);
+
+    stats->bytes_in = bytes_in_.load(std::memory_order_relaxed);
+    stats->packets_in = packets_in_.load(std::memory_order_relaxed);
+    stats->bytes_out = bytes_out_.load(std::memory_order_relaxed);
+    stats->packets_out = packets_out_.load(std::memory_order_relaxed);
+
+    const uint32_t last_recv_clock = last_recv_clock_.load(std::memory_order_relaxed);
+    stats->last_recv_age_ms = ((int32_t)(now - last_recv_clock) > 0 ? now - last_recv_clock : 0);
+}
+
+} // namespace kcp_svr
@@ -0,0 +1,73 @@
+#ifndef _KCP_CONNECTION_STATS_HPP_
+#define _KCP_CONNECTION_STATS_HPP_
+
+#include <atomic>
+#include <stddef.h>
+#include <boost/noncopyable.hpp>
+#include "kcp_typedef.hpp"
+#include "../util/hdr_histogram.hpp"
+
+namespace kcp_svr {
+
+// The counters of one connection.
+// Only the thread running the connection (the loop of io_service) writes them, without lock.
+// Any thread can take a snapshot at any time. The fields of a snapshot may be taken at slightly different moments.
+class connection_stats_counters
+  : private boost::noncopyable
+{
+public:
+    // clock: when the connection is created. last_recv_age counts from it before any packet recved.
+    connection_stats_counters(const kcp_conv_t& conv, uint32_t clock);
+
+    // a udp packet from the client.
+    void on_input(size_t bytes, uint32_t clock);
+
+    // a udp packet made by kcp.
+    void on_output(const char* buf, size_t len);
+
+    // copy the state of kcp. Call it after ikcp_input and ikcp_update.
+    void publish_kcp(const ikcpcb* kcp);
+
+    void snapshot(uint32_t now, connection_stats* stats) const;
+
+    // the count of data segments in a udp packet made by kcp.
+    static uint32_t count_push_segments(const char* buf, size_t len);
+
+    // record the rtt of every ack in a udp packet from the client, in microseconds.
+    // current: the clock of kcp (ikcpcb::current), the same as ikcp_input using.
+    static void record_ack_rtts(const char* buf, size_t len, uint32_t current, asio_kcp::hdr_histogram* rtt_us);
+
+private:
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+private:
+    const kcp_conv_t conv_;
+
+    std::atomic<uint64_t> bytes_in_;
+    std::atomic<uint64_t> packets_in_;
+    std::atomic<uint64_t> bytes_out_;
+    std::atomic<uint64_t> packets_out_;
+    std::atomic<uint64_t> segments_sent_;
+    std::atomic<uint64_t> new_segments_sent_; // segments sent for the first time
+    std::atomic<uint32_t> last_recv_clock_;
+
+    std::atomic<uint32_t> srtt_us_;
+    std::atomic<uint32_t> rttvar_us_;
+    std::atomic<uint32_t> rto_us_;
+    std::atomic<uint32_t> cwnd_;
+    std::atomic<uint32_t> remote_wnd_;
+    std::atomic<uint32_t> in_flight_;
+    std::atomic<uint32_t> send_queue_;
+    std::atomic<uint32_t> recv_buf_;
+    std::atomic<uint32_t> recv_queue_;
+    std::atomic<uint32_t> timeout_retransmit_count_;
+
+    uint32_t last_snd_nxt_; // only used by the writer
+};
+
+} // namespace kcp_svr
+
+#endif // _KCP_CONNECTION_STATS_HPP_
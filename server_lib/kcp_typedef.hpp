@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include "../util/hdr_histogram.hpp"
 
 struct IKCPCB;
 typedef struct IKCPCB ikcpcb;
@@ -27,4 +28,39 @@ namespace kcp_svr
     const char* eventTypeStr(eEventType eventType);
 
     typedef void(event_callback_t)(kcp_conv_t /*conv*/, eEventType /*event_type*/, std::shared_ptr<std::string> /*msg*/);
+
+    // msg points into the recv buffer of kcp_svr. It is valid only before the callback return.
+    // Using asio_kcp::make_msg_buffer(msg, len) in util/msg_buffer.hpp if you want to keep it.
+    typedef void(msg_callback_t)(kcp_conv_t /*conv*/, const char* /*msg*/, size_t /*len*/);
+
+    // A snapshot of one connection. Given by server::get_connection_stats.
+    struct connection_stats
+    {
+        kcp_conv_t conv;
+        uint32_t srtt_us;           // smoothed rtt
+        uint32_t rttvar_us;
+        uint32_t rto_us;
+        uint32_t cwnd;              // congestion window in segments
+        uint32_t remote_wnd;        // receive window of the client in segments
+        uint32_t in_flight;         // segments sent but not acked yet
+        uint32_t send_queue;        // segments waiting for the window
+        uint32_t recv_buf;          // segments waiting for a lost one before them
+        uint32_t recv_queue;        // segments of msgs not taken yet
+        uint64_t segments_sent;     // data segments sent, including retransmits
+        uint64_t retransmit_count;
+        uint64_t timeout_retransmit_count; // retransmits by rto. The others are fast retransmits.
+        double retransmit_ratio;    // retransmit_count / segments_sent
+        uint64_t bytes_in;          // udp payload from the client
+        uint64_t packets_in;
+        uint64_t bytes_out;         // udp payload to the client
+        uint64_t packets_out;
+        uint32_t last_recv_age_ms;  // how long since the last packet from the client
+    };
+
+    // Latency percentiles of all connections since the server started. Given by server::get_latency_stats.
+    struct latency_stats
+    {
+        asio_kcp::latency_summary rtt_us;     // from the acks of clients. The resolution is the kcp clock: 1 millisecond.
+        asio_kcp::latency_summary msg_lag_us; // between two msgs recved from the same client. The resolution is the kcp clock: 1 millisecond.
+    };
 }
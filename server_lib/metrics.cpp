@@ -0,0 +1,153 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <sstream>
+
+namespace kcp_svr {
+
+metrics_histogram::metrics_histogram(const std::vector<uint64_t>& upper_bounds) :
+    upper_bounds_(upper_bounds),
+    buckets_(new std::atomic<uint64_t>[upper_bounds.size() + 1]),
+    sum_(0)
+{
+    for (size_t i = 0; i <= upper_bounds_.size(); ++i)
+        buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+void metrics_histogram::observe(uint64_t value)
+{
+    const size_t index = std::lower_bound(upper_bounds_.begin(), upper_bounds_.end(), value) - upper_bounds_.begin();
+    buckets_[index].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void metrics_registry::add(const std::string& name, const std::string& help, const metrics_counter* counter)
+{
+    metrics_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = eMetricsCounter;
+    entry.counter = counter;
+    add_entry(entry);
+}
+
+void metrics_registry::add(const std::string& name, const std::string& help, const metrics_gauge* gauge)
+{
+    metrics_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = eMetricsGauge;
+    entry.gauge = gauge;
+    add_entry(entry);
+}
+
+void metrics_registry::add(const std::string& name, const std::string& help, const metrics_histogram* histogram)
+{
+    metrics_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = eMetricsHistogram;
+    entry.histogram = histogram;
+    add_entry(entry);
+}
+
+void metrics_registry::add(const std::string& name, const std::string& help, const asio_kcp::hdr_histogram* hdr_histogram)
+{
+    metrics_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = eMetricsSummary;
+    entry.hdr_histogram = hdr_histogram;
+    add_entry(entry);
+}
+
+void metrics_registry::add_callback(const std::string& name, const std::string& help, eMetricsType type,
+        const std::function<double(void)>& func)
+{
+    metrics_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = (type == eMetricsCounter ? eMetricsCounter : eMetricsGauge);
+    entry.callback = func;
+    add_entry(entry);
+}
+
+void metrics_registry::add_entry(const metrics_entry& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(entry);
+}
+
+static const char* metrics_type_str(eMetricsType type)
+{
+    switch (type)
+    {
+        case eMetricsCounter: return "counter";
+        case eMetricsGauge: return "gauge";
+        case eMetricsHistogram: return "histogram";
+        case eMetricsSummary: return "summary";
+        default: return "untyped";
+    }
+}
+
+std::string metrics_registry::render(void) const
+{
+    // copy the entries. The callbacks may take other locks.
+    std::vector<metrics_entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = entries_;
+    }
+
+    std::ostringstream oss;
+    // the callbacks return double. Print whole counters above 1e6 in full, not as 1.23457e+06.
+    oss.precision(17);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const metrics_entry& entry = entries[i];
+        oss << "# HELP " << entry.name << " " << entry.help << "\n"
+            << "# TYPE " << entry.name << " " << metrics_type_str(entry.type) << "\n";
+
+        if (entry.callback)
+        {
+            oss << entry.name << " " << entry.callback() << "\n";
+        }
+        else if (entry.counter)
+        {
+            oss << entry.name << " " << entry.counter->value() << "\n";
+        }
+        else if (entry.gauge)
+        {
+            oss << entry.name << " " << entry.gauge->value() << "\n";
+        }
+        else if (entry.histogram)
+        {
+            const metrics_histogram& histogram = *entry.histogram;
+            const std::vector<uint64_t>& bounds = histogram.upper_bounds();
+            uint64_t count = 0;
+            for (size_t k = 0; k < bounds.size(); ++k)
+            {
+                count += histogram.bucket_count(k);
+                oss << entry.name << "_bucket{le=\"" << bounds[k] << "\"} " << count << "\n";
+            }
+            count += histogram.bucket_count(bounds.size());
+            oss << entry.name << "_bucket{le=\"+Inf\"} " << count << "\n"
+                << entry.name << "_sum " << histogram.sum() << "\n"
+                << entry.name << "_count " << count << "\n";
+        }
+        else if (entry.hdr_histogram)
+        {
+            const asio_kcp::hdr_histogram& hdr_histogram = *entry.hdr_histogram;
+            asio_kcp::latency_summary summary;
+            hdr_histogram.summarize(&summary);
+            oss << entry.name << "{quantile=\"0.5\"} " << summary.p50 << "\n"
+                << entry.name << "{quantile=\"0.9\"} " << summary.p90 << "\n"
+                << entry.name << "{quantile=\"0.99\"} " << summary.p99 << "\n"
+                << entry.name << "{quantile=\"0.999\"} " << summary.p999 << "\n"
+                << entry.name << "_sum " << hdr_histogram.sum() << "\n"
+                << entry.name << "_count " << summary.count << "\n";
+        }
+    }
+    return oss.str();
+}
+
+} // namespace kcp_svr
@@ -0,0 +1,119 @@
+#ifndef _KCP_METRICS_HPP_
+#define _KCP_METRICS_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include "../util/hdr_histogram.hpp"
+
+namespace kcp_svr {
+
+// The metrics are owned by the components which update them, and registered to a metrics_registry by pointer.
+// Updating is one or two relaxed atomic operations, so they can be used in the packet hot path.
+// Reading (rendering) can be done by any thread.
+
+class metrics_counter
+  : private boost::noncopyable
+{
+public:
+    metrics_counter(void) : value_(0) {}
+    void inc(uint64_t n = 1) {value_.fetch_add(n, std::memory_order_relaxed);}
+    uint64_t value(void) const {return value_.load(std::memory_order_relaxed);}
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+class metrics_gauge
+  : private boost::noncopyable
+{
+public:
+    metrics_gauge(void) : value_(0) {}
+    void set(int64_t value) {value_.store(value, std::memory_order_relaxed);}
+    void inc(int64_t n = 1) {value_.fetch_add(n, std::memory_order_relaxed);}
+    void dec(int64_t n = 1) {value_.fetch_sub(n, std::memory_order_relaxed);}
+    int64_t value(void) const {return value_.load(std::memory_order_relaxed);}
+
+private:
+    std::atomic<int64_t> value_;
+};
+
+// fixed buckets of integer values, like bytes or microseconds.
+class metrics_histogram
+  : private boost::noncopyable
+{
+public:
+    // upper_bounds must be ascending. A +Inf bucket is added.
+    explicit metrics_histogram(const std::vector<uint64_t>& upper_bounds);
+
+    void observe(uint64_t value);
+
+    const std::vector<uint64_t>& upper_bounds(void) const {return upper_bounds_;}
+
+    // not cumulative. The last one is the +Inf bucket.
+    uint64_t bucket_count(size_t index) const {return buckets_[index].load(std::memory_order_relaxed);}
+    uint64_t sum(void) const {return sum_.load(std::memory_order_relaxed);}
+
+private:
+    std::vector<uint64_t> upper_bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+    std::atomic<uint64_t> sum_;
+};
+
+enum eMetricsType
+{
+    eMetricsCounter,
+    eMetricsGauge,
+    eMetricsHistogram,
+    eMetricsSummary,
+};
+
+class metrics_registry
+  : private boost::noncopyable
+{
+public:
+    // name should follow the prometheus naming: [a-zA-Z_:][a-zA-Z0-9_:]*, and counters end with _total.
+    // The metrics must live longer than the registry, or than the last render.
+    void add(const std::string& name, const std::string& help, const metrics_counter* counter);
+    void add(const std::string& name, const std::string& help, const metrics_gauge* gauge);
+    void add(const std::string& name, const std::string& help, const metrics_histogram* histogram);
+
+    // rendered as a summary with the quantiles 0.5, 0.9, 0.99 and 0.999.
+    void add(const std::string& name, const std::string& help, const asio_kcp::hdr_histogram* hdr_histogram);
+
+    // func is called in every render, by the thread rendering. For the values already counted somewhere else.
+    void add_callback(const std::string& name, const std::string& help, eMetricsType type, const std::function<double(void)>& func);
+
+    // prometheus text exposition format 0.0.4
+    std::string render(void) const;
+
+private:
+    struct metrics_entry
+    {
+        std::string name;
+        std::string help;
+        eMetricsType type;
+        const metrics_counter* counter;
+        const metrics_gauge* gauge;
+        const metrics_histogram* histogram;
+        const asio_kcp::hdr_histogram* hdr_histogram;
+        std::function<double(void)> callback;
+
+        metrics_entry(void) : type(eMetricsCounter), counter(NULL), gauge(NULL), histogram(NULL), hdr_histogram(NULL) {}
+    };
+
+    void add_entry(const metrics_entry& entry);
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<metrics_entry> entries_;
+};
+
+} // namespace kcp_svr
+
+#endif // _KCP_METRICS_HPP_
@@ -0,0 +1,191 @@
+#include "metrics_http_endpoint.hpp"
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include "asio_kcp_log.hpp"
+
+// the request is dropped if the head is longer than this.
+#define METRICS_HTTP_MAX_REQUEST_SIZE 4096
+
+// the connection is closed if the request is not answered in this time.
+#define METRICS_HTTP_REQUEST_TIMEOUT_MS 5000
+
+namespace kcp_svr {
+
+using boost::asio::ip::tcp;
+
+class metrics_http_endpoint::session
+  : public std::enable_shared_from_this<metrics_http_endpoint::session>
+{
+public:
+    session(boost::asio::io_service& io_service, std::shared_ptr<metrics_http_endpoint> endpoint_ptr) :
+        socket_(io_service),
+        deadline_(io_service),
+        request_buf_(METRICS_HTTP_MAX_REQUEST_SIZE), // async_read_until fails with not_found beyond this
+        endpoint_ptr_(endpoint_ptr)
+    {
+    }
+
+    tcp::socket& socket(void) {return socket_;}
+
+    void start(void)
+    {
+        deadline_.expires_from_now(boost::posix_time::milliseconds(METRICS_HTTP_REQUEST_TIMEOUT_MS));
+        deadline_.async_wait(boost::bind(&session::handle_timeout, shared_from_this(), boost::asio::placeholders::error));
+        boost::asio::async_read_until(socket_, request_buf_, "\r\n\r\n",
+                boost::bind(&session::handle_read, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+private:
+    void handle_read(const boost::system::error_code& error)
+    {
+        if (error || endpoint_ptr_->stopped_)
+        {
+            close();
+            return;
+        }
+
+        std::string request_head(boost::asio::buffers_begin(request_buf_.data()), boost::asio::buffers_end(request_buf_.data()));
+        response_ = endpoint_ptr_->make_response(request_head);
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+                boost::bind(&session::handle_write, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code& /*error*/)
+    {
+        close();
+    }
+
+    // a client sending nothing or a endless head would hold the connection forever.
+    void handle_timeout(const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        close();
+    }
+
+    void close(void)
+    {
+        boost::system::error_code ignored_ec;
+        deadline_.cancel(ignored_ec);
+        socket_.shutdown(tcp::socket::shutdown_both, ignored_ec);
+        socket_.close(ignored_ec);
+    }
+
+private:
+    tcp::socket socket_;
+    boost::asio::deadline_timer deadline_;
+    boost::asio::streambuf request_buf_;
+    std::string response_;
+    std::shared_ptr<metrics_http_endpoint> endpoint_ptr_;
+};
+
+metrics_http_endpoint::metrics_http_endpoint(boost::asio::io_service& io_service, std::shared_ptr<const metrics_registry> registry) :
+    stopped_(false),
+    io_service_(io_service),
+    acceptor_(io_service),
+    registry_(registry)
+{
+}
+
+bool metrics_http_endpoint::start(const std::string& address, int tcp_port)
+{
+    boost::system::error_code ec;
+    const tcp::endpoint endpoint(boost::asio::ip::address::from_string(address, ec), tcp_port);
+    if (ec)
+    {
+        AK_WARNING_LOG << "metrics endpoint bad address: " << address;
+        return false;
+    }
+
+    acceptor_.open(endpoint.protocol(), ec);
+    if (!ec)
+        acceptor_.set_option(tcp::acceptor::reuse_address(true), ec);
+    if (!ec)
+        acceptor_.bind(endpoint, ec);
+    if (!ec)
+        acceptor_.listen(boost::asio::socket_base::max_connections, ec);
+    if (ec)
+    {
+        AK_WARNING_LOG << "metrics endpoint listen " << address << ":" << tcp_port << " failed: " << ec.message();
+        acceptor_.close(ec);
+        return false;
+    }
+
+    AK_INFO_LOG << "metrics endpoint listening on " << address << ":" << get_port();
+    hook_accept();
+    return true;
+}
+
+void metrics_http_endpoint::stop(void)
+{
+    stopped_ = true;
+    boost::system::error_code ignored_ec;
+    acceptor_.close(ignored_ec);
+}
+
+int metrics_http_endpoint::get_port(void) const
+{
+    boost::system::error_code ec;
+    const tcp::endpoint endpoint = acceptor_.local_endpoint(ec);
+    return ec ? 0 : endpoint.port();
+}
+
+void metrics_http_endpoint::hook_accept(void)
+{
+    if (stopped_)
+        return;
+    std::shared_ptr<session> session_ptr(new session(io_service_, shared_from_this()));
+    acceptor_.async_accept(session_ptr->socket(),
+            boost::bind(&metrics_http_endpoint::handle_accept, shared_from_this(), session_ptr,
+                boost::asio::placeholders::error));
+}
+
+void metrics_http_endpoint::handle_accept(std::shared_ptr<session> session_ptr, const boost::system::error_code& error)
+{
+    if (stopped_ || error == boost::asio::error::operation_aborted)
+        return;
+
+    if (!error)
+        session_ptr->start();
+    hook_accept();
+}
+
+std::string metrics_http_endpoint::make_response(const std::string& request_head) const
+{
+    // request line: GET /metrics HTTP/1.1
+    std::istringstream iss(request_head);
+    std::string method, target;
+    iss >> method >> target;
+
+    std::string status = "200 OK";
+    std::string content_type = "text/plain; version=0.0.4; charset=utf-8";
+    std::string body;
+    if (method != "GET")
+    {
+        status = "405 Method Not Allowed";
+        content_type = "text/plain";
+        body = "method not allowed\n";
+    }
+    else if (target == "/metrics" || target.compare(0, 9, "/metrics?") == 0)
+    {
+        body = registry_->render();
+    }
+    else
+    {
+        status = "404 Not Found";
+        content_type = "text/plain";
+        body = "not found\n";
+    }
+
+    std::ostringstream oss;
+    oss << "HTTP/1.0 " << status << "\r\n"
+        << "Content-Type: " << content_type << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n"
+        << "\r\n"
+        << body;
+    return oss.str();
+}
+
+} // namespace kcp_svr
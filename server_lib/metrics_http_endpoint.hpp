@@ -0,0 +1,50 @@
+#ifndef _KCP_METRICS_HTTP_ENDPOINT_HPP_
+#define _KCP_METRICS_HTTP_ENDPOINT_HPP_
+
+#include <memory>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+
+#include "metrics.hpp"
+
+namespace kcp_svr {
+
+// A tiny HTTP/1.0 server for prometheus scraping. GET /metrics returns metrics_registry::render().
+// Runs in the loop of io_service. One request per tcp connection.
+class metrics_http_endpoint
+  : private boost::noncopyable, public std::enable_shared_from_this<metrics_http_endpoint>
+{
+public:
+    typedef std::shared_ptr<metrics_http_endpoint> shared_ptr;
+
+    metrics_http_endpoint(boost::asio::io_service& io_service, std::shared_ptr<const metrics_registry> registry);
+
+    // return false if listening failed.
+    bool start(const std::string& address, int tcp_port);
+
+    // close the listening socket. The requests being read are answered with nothing.
+    void stop(void);
+
+    // the port listened. Useful when start with port 0.
+    int get_port(void) const;
+
+private:
+    class session;
+
+    void hook_accept(void);
+    void handle_accept(std::shared_ptr<session> session_ptr, const boost::system::error_code& error);
+
+    // the whole http response for the request head.
+    std::string make_response(const std::string& request_head) const;
+
+private:
+    bool stopped_;
+    boost::asio::io_service& io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::shared_ptr<const metrics_registry> registry_;
+};
+
+} // namespace kcp_svr
+
+#endif // _KCP_METRICS_HTTP_ENDPOINT_HPP_
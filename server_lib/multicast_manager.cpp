@@ -1,10 +1,12 @@
 #include "multicast_manager.hpp"
 #include "connection_manager.hpp"
 #include "asio_kcp_log.hpp"
+#include <algorithm>
 
 namespace kcp_svr
 {
-    MulticastManager::MulticastManager() : next_group_id_(1)
+    MulticastManager::MulticastManager(const std::weak_ptr<connection_manager>& conn_mgr)
+        : groups_(std::make_shared<group_map_t>()), next_group_id_(1), connection_manager_(conn_mgr)
     {
     }
 
@@ -12,108 +14,132 @@ namespace kcp_svr
     {
     }
 
+    std::shared_ptr<const MulticastManager::group_map_t> MulticastManager::load_groups(void) const
+    {
+        return std::atomic_load(&groups_);
+    }
+
     uint32_t MulticastManager::create_group()
     {
         std::lock_guard<std::mutex> lock(mutex_);
         uint32_t group_id = next_group_id_++;
-        group_members_[group_id] = std::set<kcp_conv_t>();
+
+        auto groups = std::make_shared<group_map_t>(*groups_);
+        (*groups)[group_id] = std::make_shared<member_list_t>();
+        std::atomic_store(&groups_, std::shared_ptr<const group_map_t>(groups));
         return group_id;
     }
 
     bool MulticastManager::add_member_to_group(uint32_t group_id, kcp_conv_t conv)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto it = group_members_.find(group_id);
-        if (it == group_members_.end())
+        auto it = groups_->find(group_id);
+        if (it == groups_->end())
         {
-            KCP_LOG_INFO("Group " << group_id << " not found when adding member " << conv);
+            AK_INFO_LOG << "Group " << group_id << " not found when adding member " << conv;
             return false;
         }
-        
-        it->second.insert(conv);
-        KCP_LOG_INFO("Added member " << conv << " to group " << group_id);
+
+        // 成员按conv排序
+        const member_list_t& old_members = *it->second;
+        auto pos = std::lower_bound(old_members.begin(), old_members.end(), conv);
+        if (pos != old_members.end() && *pos == conv)
+            return true;
+
+        auto members = std::make_shared<member_list_t>();
+        members->reserve(old_members.size() + 1);
+        members->insert(members->end(), old_members.begin(), pos);
+        members->push_back(conv);
+        members->insert(members->end(), pos, old_members.end());
+
+        auto groups = std::make_shared<group_map_t>(*groups_);
+        (*groups)[group_id] = members;
+        std::atomic_store(&groups_, std::shared_ptr<const group_map_t>(groups));
+
+        AK_INFO_LOG << "Added member " << conv << " to group " << group_id;
         return true;
     }
 
     bool MulticastManager::remove_member_from_group(uint32_t group_id, kcp_conv_t conv)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto it = group_members_.find(group_id);
-        if (it == group_members_.end())
+        auto it = groups_->find(group_id);
+        if (it == groups_->end())
         {
-            KCP_LOG_INFO("Group " << group_id << " not found when removing member " << conv);
+            AK_INFO_LOG << "Group " << group_id << " not found when removing member " << conv;
             return false;
         }
-        
-        size_t erased = it->second.erase(conv);
-        if (erased > 0)
+
+        const member_list_t& old_members = *it->second;
+        auto pos = std::lower_bound(old_members.begin(), old_members.end(), conv);
+        if (pos == old_members.end() || *pos != conv)
         {
-            KCP_LOG_INFO("Removed member " << conv << " from group " << group_id);
-            return true;
+            AK_INFO_LOG << "Member " << conv << " not found in group " << group_id;
+            return false;
         }
-        
-        KCP_LOG_INFO("Member " << conv << " not found in group " << group_id);
-        return false;
+
+        auto members = std::make_shared<member_list_t>();
+        members->reserve(old_members.size() - 1);
+        members->insert(members->end(), old_members.begin(), pos);
+        members->insert(members->end(), pos + 1, old_members.end());
+
+        auto groups = std::make_shared<group_map_t>(*groups_);
+        (*groups)[group_id] = members;
+        std::atomic_store(&groups_, std::shared_ptr<const group_map_t>(groups));
+
+        AK_INFO_LOG << "Removed member " << conv << " from group " << group_id;
+        return true;
     }
 
     bool MulticastManager::delete_group(uint32_t group_id)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        size_t erased = group_members_.erase(group_id);
-        if (erased > 0)
+        if (groups_->find(group_id) == groups_->end())
         {
-            KCP_LOG_INFO("Deleted group " << group_id);
-            return true;
+            AK_INFO_LOG << "Group " << group_id << " not found when deleting";
+            return false;
         }
-        
-        KCP_LOG_INFO("Group " << group_id << " not found when deleting");
-        return false;
+
+        auto groups = std::make_shared<group_map_t>(*groups_);
+        groups->erase(group_id);
+        std::atomic_store(&groups_, std::shared_ptr<const group_map_t>(groups));
+
+        AK_INFO_LOG << "Deleted group " << group_id;
+        return true;
+    }
+
+    std::shared_ptr<const MulticastManager::member_list_t> MulticastManager::get_group_members(uint32_t group_id) const
+    {
+        std::shared_ptr<const group_map_t> groups = load_groups();
+        auto it = groups->find(group_id);
+        if (it == groups->end())
+            return std::shared_ptr<const member_list_t>();
+        return it->second;
     }
 
-    void MulticastManager::send_to_group(uint32_t group_id, const std::string& msg)
+    int MulticastManager::send_to_group(uint32_t group_id, std::shared_ptr<std::string> msg)
     {
-        // First, get the list of members
-        std::set<kcp_conv_t> members;
+        // 不复制成员列表, 持有快照期间成员变动发布的是新列表
+        std::shared_ptr<const member_list_t> members = get_group_members(group_id);
+        if (!members)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            auto it = group_members_.find(group_id);
-            if (it == group_members_.end())
-            {
-                KCP_LOG_INFO("Group " << group_id << " not found when sending message");
-                return;
-            }
-            members = it->second; // Copy to avoid locking during send
+            AK_INFO_LOG << "Group " << group_id << " not found when sending message";
+            return -1;
         }
-        
-        // Then get the connection manager
+
         auto conn_mgr = connection_manager_.lock();
         if (!conn_mgr)
+            return 0;
+
+        // 所有成员的kcp段引用同一个msg, 每个段持有一个引用, 确认之后释放
+        shared_kcp_msg* shared_msg = shared_kcp_msg::create(msg);
+        int sent_count = 0;
+        for (kcp_conv_t conv : *members)
         {
-            KCP_LOG_INFO("Connection manager unavailable when sending to group " << group_id);
-            return;
-        }
-        
-        // Send to each member
-        size_t sent_count = 0;
-        for (auto conv : members)
-        {
-            auto conn = conn_mgr->get_connection_by_conv(conv);
-            if (conn)
-            {
-                conn->send_msg(msg);
+            if (conn_mgr->send_msg(conv, shared_msg) == 0)
                 sent_count++;
-            }
-            else
-            {
-                KCP_LOG_INFO("Failed to find connection for conv " << conv << " in group " << group_id);
-            }
         }
-        
-        KCP_LOG_INFO("Sent message to " << sent_count << "/" << members.size() << " members in group " << group_id);
-    }
-
-    void MulticastManager::set_connection_manager(std::weak_ptr<ConnectionManager> conn_mgr)
-    {
-        connection_manager_ = conn_mgr;
+        shared_kcp_msg::release(shared_msg);
+        return sent_count;
     }
-} 
\ No newline at end of file
+}
@@ -1,42 +1,56 @@
 #pragma once
 
 #include <map>
-#include <set>
+#include <vector>
 #include <memory>
 #include <mutex>
+#include <string>
 #include "kcp_typedef.hpp"
-#include "connection.hpp"
 
 namespace kcp_svr
 {
+    class connection_manager;
+
+    // 通过每个成员自己的kcp连接转发的组. 与UdpMulticastManager不同, 不需要网络支持组播, 每个成员可靠有序地收到消息.
     class MulticastManager
     {
     public:
-        MulticastManager();
+        // 组成员快照. 创建之后不再修改, 发送者拿到之后不用加锁遍历.
+        typedef std::vector<kcp_conv_t> member_list_t;
+
+        MulticastManager(const std::weak_ptr<connection_manager>& conn_mgr);
         ~MulticastManager();
 
-        // 创建一个组播组，返回组ID
+        // 创建一个组，返回组ID
         uint32_t create_group();
-        
+
         // 向组添加成员
         bool add_member_to_group(uint32_t group_id, kcp_conv_t conv);
-        
-        // 从组移除成员
+
+        // 从组移除成员. 成员断开连接时请调用, 否则它会一直留在组里.
         bool remove_member_from_group(uint32_t group_id, kcp_conv_t conv);
-        
+
         // 删除一个组
         bool delete_group(uint32_t group_id);
-        
-        // 向组内所有成员发送消息
-        void send_to_group(uint32_t group_id, const std::string& msg);
-        
-        // 设置连接管理器用于查找连接对象
-        void set_connection_manager(std::weak_ptr<class ConnectionManager> conn_mgr);
-        
+
+        // 向组内所有成员发送消息. 所有成员的kcp发送队列引用同一个msg, 不复制. 所有成员确认收到之前不能修改msg.
+        // 与server::send_msg一样需要在io_service的线程中调用. 成员变动可以在任何线程, 不会阻塞发送.
+        // 返回发给了几个成员, 组不存在时返回-1.
+        int send_to_group(uint32_t group_id, std::shared_ptr<std::string> msg);
+
+        // 当前的成员快照, 组不存在时返回NULL
+        std::shared_ptr<const member_list_t> get_group_members(uint32_t group_id) const;
+
+    private:
+        typedef std::map<uint32_t, std::shared_ptr<const member_list_t>> group_map_t;
+
+        // 读者用std::atomic_load拿到当前的组表. 写者持有mutex_, 复制出新表修改后用std::atomic_store发布 (RCU).
+        std::shared_ptr<const group_map_t> load_groups(void) const;
+
     private:
-        std::map<uint32_t, std::set<kcp_conv_t>> group_members_; // 组ID -> 成员列表
+        std::shared_ptr<const group_map_t> groups_;
         uint32_t next_group_id_;
-        std::mutex mutex_;
-        std::weak_ptr<class ConnectionManager> connection_manager_;
+        std::mutex mutex_; // 只在写者之间互斥
+        std::weak_ptr<connection_manager> connection_manager_;
     };
-} 
\ No newline at end of file
+}
@@ -0,0 +1,347 @@
+#include "network_impairment.hpp"
+#include <math.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+namespace kcp_svr {
+
+impairment_profile::impairment_profile(void) :
+    delay_ms(0),
+    jitter_ms(0),
+    delay_distribution(eDelayConstant),
+    loss(0),
+    burst_enter(0),
+    burst_exit(1),
+    burst_loss(0),
+    reorder(0),
+    reorder_ms(0),
+    duplicate(0),
+    rate_kbps(0),
+    queue_ms(0)
+{
+}
+
+static const char* delay_distribution_str(eDelayDistribution distribution)
+{
+    switch (distribution)
+    {
+        case eDelayConstant: return "constant";
+        case eDelayUniform: return "uniform";
+        case eDelayNormal: return "normal";
+        case eDelayPareto: return "pareto";
+    }
+    return "constant";
+}
+
+static bool parse_delay_distribution(const std::string& value, eDelayDistribution* distribution)
+{
+    for (int i = eDelayConstant; i <= eDelayPareto; ++i)
+    {
+        if (value == delay_distribution_str((eDelayDistribution)i))
+        {
+            *distribution = (eDelayDistribution)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string trim(const std::string& str)
+{
+    const size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return std::string();
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static bool parse_uint32(const std::string& value, uint32_t* out)
+{
+    char* end = NULL;
+    const unsigned long ret = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || value[0] == '-')
+        return false;
+    *out = (uint32_t)ret;
+    return true;
+}
+
+static bool parse_ratio(const std::string& value, double* out)
+{
+    char* end = NULL;
+    const double ret = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || ret < 0 || ret > 1)
+        return false;
+    *out = ret;
+    return true;
+}
+
+bool parse_impairment_profile(const std::string& text, impairment_profile* profile, std::string* err)
+{
+    impairment_profile ret;
+    std::istringstream istr(text);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(istr, line))
+    {
+        line_number++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        const size_t pos = line.find('=');
+        const std::string key = trim(line.substr(0, pos));
+        const std::string value = (pos == std::string::npos ? std::string() : trim(line.substr(pos + 1)));
+        bool ok = false;
+        if (key == "name") {ret.name = value; ok = !value.empty();}
+        else if (key == "delay_ms") ok = parse_uint32(value, &ret.delay_ms);
+        else if (key == "jitter_ms") ok = parse_uint32(value, &ret.jitter_ms);
+        else if (key == "delay_distribution") ok = parse_delay_distribution(value, &ret.delay_distribution);
+        else if (key == "loss") ok = parse_ratio(value, &ret.loss);
+        else if (key == "burst_enter") ok = parse_ratio(value, &ret.burst_enter);
+        else if (key == "burst_exit") ok = parse_ratio(value, &ret.burst_exit);
+        else if (key == "burst_loss") ok = parse_ratio(value, &ret.burst_loss);
+        else if (key == "reorder") ok = parse_ratio(value, &ret.reorder);
+        else if (key == "reorder_ms") ok = parse_uint32(value, &ret.reorder_ms);
+        else if (key == "duplicate") ok = parse_ratio(value, &ret.duplicate);
+        else if (key == "rate_kbps") ok = parse_uint32(value, &ret.rate_kbps);
+        else if (key == "queue_ms") ok = parse_uint32(value, &ret.queue_ms);
+
+        if (!ok)
+        {
+            if (err)
+            {
+                std::ostringstream ostr;
+                ostr << "line " << line_number << ": bad " << (pos == std::string::npos ? "line" : "key or value") << ": " << line;
+                *err = ostr.str();
+            }
+            return false;
+        }
+    }
+    *profile = ret;
+    return true;
+}
+
+std::string impairment_profile_str(const impairment_profile& profile)
+{
+    std::ostringstream ostr;
+    if (!profile.name.empty())
+        ostr << "name = " << profile.name << "\n";
+    ostr << "delay_ms = " << profile.delay_ms << "\n"
+        << "jitter_ms = " << profile.jitter_ms << "\n"
+        << "delay_distribution = " << delay_distribution_str(profile.delay_distribution) << "\n"
+        << "loss = " << profile.loss << "\n"
+        << "burst_enter = " << profile.burst_enter << "\n"
+        << "burst_exit = " << profile.burst_exit << "\n"
+        << "burst_loss = " << profile.burst_loss << "\n"
+        << "reorder = " << profile.reorder << "\n"
+        << "reorder_ms = " << profile.reorder_ms << "\n"
+        << "duplicate = " << profile.duplicate << "\n"
+        << "rate_kbps = " << profile.rate_kbps << "\n"
+        << "queue_ms = " << profile.queue_ms << "\n";
+    return ostr.str();
+}
+
+// One way values fitted to the asio_kcp logs in the bench_mark folder: delay and jitter by the rtt of the msgs sent
+// once, loss and bursts by the ratio of the msgs resent and the length of the stalls. Fitted by running two ikcp
+// through impaired_link in simulated time, with the settings of kcp_client and connection.
+// The rate caps of 3g are typical values, not fitted. The logs sent too few bytes to show them.
+static const char* builtin_profiles[] = {
+    "name = perfect\n",
+
+    // rtt 72ms, 18% msgs resent, a few stalls of seconds.
+    "name = network_lag\n"
+    "delay_ms = 35\n"
+    "jitter_ms = 3\n"
+    "delay_distribution = normal\n"
+    "loss = 0.04\n"
+    "burst_enter = 0.002\n"
+    "burst_exit = 0.04\n"
+    "burst_loss = 0.6\n",
+
+    // the same link at its worst. rtt p90 244ms, long tail of delay, more and longer stalls.
+    "name = network_very_lag\n"
+    "delay_ms = 30\n"
+    "jitter_ms = 14\n"
+    "delay_distribution = pareto\n"
+    "loss = 0.04\n"
+    "burst_enter = 0.006\n"
+    "burst_exit = 0.05\n"
+    "burst_loss = 0.6\n",
+
+    // rtt 84ms, almost no stall. The resent msgs are mostly spurious resends by jitter.
+    "name = china_mobile_3g\n"
+    "delay_ms = 38\n"
+    "jitter_ms = 7\n"
+    "delay_distribution = normal\n"
+    "loss = 0.01\n"
+    "rate_kbps = 2000\n"
+    "queue_ms = 200\n",
+
+    // rtt 116ms, short stalls.
+    "name = china_union_3g\n"
+    "delay_ms = 54\n"
+    "jitter_ms = 10\n"
+    "delay_distribution = normal\n"
+    "loss = 0.02\n"
+    "burst_enter = 0.002\n"
+    "burst_exit = 0.1\n"
+    "burst_loss = 0.6\n"
+    "rate_kbps = 2000\n"
+    "queue_ms = 200\n",
+};
+
+bool get_builtin_impairment_profile(const std::string& name, impairment_profile* profile)
+{
+    for (size_t i = 0; i < sizeof(builtin_profiles) / sizeof(builtin_profiles[0]); ++i)
+    {
+        impairment_profile builtin;
+        parse_impairment_profile(builtin_profiles[i], &builtin, NULL);
+        if (builtin.name == name)
+        {
+            *profile = builtin;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> builtin_impairment_profile_names(void)
+{
+    std::vector<std::string> names;
+    for (size_t i = 0; i < sizeof(builtin_profiles) / sizeof(builtin_profiles[0]); ++i)
+    {
+        impairment_profile builtin;
+        parse_impairment_profile(builtin_profiles[i], &builtin, NULL);
+        names.push_back(builtin.name);
+    }
+    return names;
+}
+
+bool load_impairment_profile(const std::string& name_or_path, impairment_profile* profile, std::string* err)
+{
+    if (get_builtin_impairment_profile(name_or_path, profile))
+        return true;
+
+    std::ifstream file(name_or_path.c_str());
+    if (!file)
+    {
+        if (err)
+            *err = "no builtin profile or file named " + name_or_path;
+        return false;
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    if (!parse_impairment_profile(text.str(), profile, err))
+    {
+        if (err)
+            *err = name_or_path + " " + *err;
+        return false;
+    }
+    if (profile->name.empty())
+        profile->name = name_or_path;
+    return true;
+}
+
+impaired_link::impaired_link(const impairment_profile& profile, uint32_t seed) :
+    profile_(profile),
+    rand_(seed),
+    in_burst_(false),
+    link_free_us_(0),
+    last_deliver_us_(0)
+{
+}
+
+double impaired_link::next_uniform(void)
+{
+    // [0, 1). Not std::uniform_real_distribution, whose output differs between standard libraries.
+    return (double)rand_() / 4294967296.0;
+}
+
+uint64_t impaired_link::sample_delay_us(double u1, double u2)
+{
+    const double delay = profile_.delay_ms * 1000.0;
+    const double jitter = profile_.jitter_ms * 1000.0;
+    double ret = delay;
+    switch (profile_.delay_distribution)
+    {
+        case eDelayConstant:
+            break;
+        case eDelayUniform:
+            ret = delay + jitter * (2 * u1 - 1);
+            break;
+        case eDelayNormal:
+            // Box-Muller
+            ret = delay + jitter * sqrt(-2 * log(1 - u1)) * cos(2 * M_PI * u2);
+            break;
+        case eDelayPareto:
+            {
+                // shape 3: most packets near delay, a few ones late by many times of jitter.
+                const double shape = 3;
+                ret = delay + jitter * (pow(1 - u1, -1 / shape) - 1);
+            }
+            break;
+    }
+    return ret < 0 ? 0 : (uint64_t)ret;
+}
+
+void impaired_link::send(uint64_t now_us, size_t size, std::vector<uint64_t>* deliver_times_us)
+{
+    deliver_times_us->clear();
+    stats_.packets++;
+
+    const double u_burst = next_uniform();
+    const double u_loss = next_uniform();
+    const double u_delay1 = next_uniform();
+    const double u_delay2 = next_uniform();
+    const double u_reorder = next_uniform();
+    const double u_duplicate = next_uniform();
+    const double u_duplicate_delay1 = next_uniform();
+    const double u_duplicate_delay2 = next_uniform();
+
+    // waiting for the link
+    uint64_t depart_us = now_us;
+    if (profile_.rate_kbps > 0)
+    {
+        const uint64_t start_us = (link_free_us_ > now_us ? link_free_us_ : now_us);
+        if (profile_.queue_ms > 0 && start_us - now_us > (uint64_t)profile_.queue_ms * 1000)
+        {
+            stats_.queue_dropped++;
+            return;
+        }
+        link_free_us_ = start_us + (uint64_t)size * 8 * 1000 / profile_.rate_kbps;
+        depart_us = link_free_us_;
+    }
+
+    if (in_burst_)
+        in_burst_ = !(u_burst < profile_.burst_exit);
+    else
+        in_burst_ = (u_burst < profile_.burst_enter);
+    if (u_loss < (in_burst_ ? profile_.burst_loss : profile_.loss))
+    {
+        stats_.lost++;
+        return;
+    }
+
+    uint64_t deliver_us = depart_us + sample_delay_us(u_delay1, u_delay2);
+    if (u_reorder < profile_.reorder)
+    {
+        stats_.reordered++;
+        deliver_us += (uint64_t)profile_.reorder_ms * 1000;
+    }
+    else
+    {
+        if (deliver_us < last_deliver_us_)
+            deliver_us = last_deliver_us_;
+        last_deliver_us_ = deliver_us;
+    }
+    deliver_times_us->push_back(deliver_us);
+
+    if (u_duplicate < profile_.duplicate)
+    {
+        stats_.duplicated++;
+        const uint64_t copy_deliver_us = depart_us + sample_delay_us(u_duplicate_delay1, u_duplicate_delay2);
+        deliver_times_us->push_back(copy_deliver_us < deliver_us ? deliver_us : copy_deliver_us);
+    }
+}
+
+} // namespace kcp_svr
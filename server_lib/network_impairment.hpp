@@ -0,0 +1,110 @@
+#ifndef _KCP_NETWORK_IMPAIRMENT_HPP_
+#define _KCP_NETWORK_IMPAIRMENT_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace kcp_svr {
+
+enum eDelayDistribution
+{
+    eDelayConstant = 0,
+    eDelayUniform = 1,  // delay +- jitter
+    eDelayNormal = 2,   // mean delay, standard deviation jitter
+    eDelayPareto = 3,   // delay plus a long tail, jitter is the scale of the tail. Like a link with bufferbloat.
+};
+
+// The conditions of one direction of a link. Both directions of udp_impair_proxy use the same profile.
+// Text form, one "key = value" a line, '#' for comments:
+//   delay_ms = 36
+//   jitter_ms = 3
+//   delay_distribution = normal
+//   loss = 0.05
+//   ...
+// All keys are optional, the default is a perfect link.
+struct impairment_profile
+{
+    impairment_profile(void);
+
+    std::string name;
+
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+    eDelayDistribution delay_distribution;
+
+    // Gilbert-Elliott loss. The link is in the good or the bad state, changing state before every packet.
+    // Set burst_enter to 0 for the simple bernoulli loss.
+    double loss;         // loss ratio in the good state
+    double burst_enter;  // probability of good -> bad
+    double burst_exit;   // probability of bad -> good. The mean burst is 1 / burst_exit packets.
+    double burst_loss;   // loss ratio in the bad state
+
+    // A reordered packet is held back reorder_ms more, and the packets after it overtake it.
+    // Other packets keep their order even with jitter, as on most real links.
+    double reorder;
+    uint32_t reorder_ms;
+
+    double duplicate;
+
+    // bandwidth cap. The packets wait in a queue for the link, and are dropped if they would wait more than queue_ms.
+    uint32_t rate_kbps;  // 0 for no cap
+    uint32_t queue_ms;
+};
+
+// parse the text form. Unknown keys and bad values are errors.
+bool parse_impairment_profile(const std::string& text, impairment_profile* profile, std::string* err);
+
+// the text form, readable by parse_impairment_profile.
+std::string impairment_profile_str(const impairment_profile& profile);
+
+// Profiles fitted to the logs in the bench_mark folder:
+//   network_lag, network_very_lag, china_mobile_3g, china_union_3g
+// and "perfect" for no impairment.
+bool get_builtin_impairment_profile(const std::string& name, impairment_profile* profile);
+std::vector<std::string> builtin_impairment_profile_names(void);
+
+// a builtin name or the path of a profile file.
+bool load_impairment_profile(const std::string& name_or_path, impairment_profile* profile, std::string* err);
+
+struct impaired_link_stats
+{
+    impaired_link_stats(void) : packets(0), lost(0), queue_dropped(0), reordered(0), duplicated(0) {}
+
+    uint64_t packets;
+    uint64_t lost;
+    uint64_t queue_dropped;
+    uint64_t reordered;
+    uint64_t duplicated;
+};
+
+// One direction of an impaired link. No socket, no clock: the caller tells the send time, and gets the deliver times.
+// With the same seed, the same packets get the same fate. Every packet takes the same count of random numbers
+// whatever happens to it, so changing the loss of a profile does not change the delays of the packets.
+class impaired_link
+{
+public:
+    impaired_link(const impairment_profile& profile, uint32_t seed);
+
+    // the deliver times of the copies of a packet of size bytes sent at now_us. Empty if the packet is dropped.
+    void send(uint64_t now_us, size_t size, std::vector<uint64_t>* deliver_times_us);
+
+    const impaired_link_stats& stats(void) const {return stats_;}
+
+private:
+    double next_uniform(void);
+    uint64_t sample_delay_us(double u1, double u2);
+
+    impairment_profile profile_;
+    std::mt19937 rand_;
+    bool in_burst_;
+    uint64_t link_free_us_;     // when the rate cap queue is empty
+    uint64_t last_deliver_us_;  // of the packets not reordered. Keeping the order.
+    impaired_link_stats stats_;
+};
+
+} // namespace kcp_svr
+
+#endif // _KCP_NETWORK_IMPAIRMENT_HPP_
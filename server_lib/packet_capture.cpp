@@ -0,0 +1,407 @@
+#include "packet_capture.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fstream>
+#include <sstream>
+#include "../util/kcp_segment.hpp"
+
+namespace kcp_svr {
+
+// all the handshake packets of asio_kcp are text starting with this. See util/connect_packet.cpp.
+#define ASIO_KCP_TEXT_PACKET_PREFIX "asio_kcp_"
+
+#define IPV4_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_RAW 101
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_FLAGS_INBOUND 1
+#define PCAPNG_EPB_FLAGS_OUTBOUND 2
+
+static uint64_t capture_clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+packet_capture_ring::packet_capture_ring(void) :
+    slots_(new slot[ASIO_KCP_PACKET_CAPTURE_SIZE]),
+    next_index_(0)
+{
+    for (size_t i = 0; i < ASIO_KCP_PACKET_CAPTURE_SIZE; ++i)
+        slots_[i].seq.store(0, std::memory_order_relaxed);
+}
+
+void packet_capture_ring::record(ePacketDirection direction, const boost::asio::ip::udp::endpoint& remote_endpoint,
+        const char* data, size_t len)
+{
+    const uint64_t index = next_index_.load(std::memory_order_relaxed);
+    slot& s = slots_[index & (ASIO_KCP_PACKET_CAPTURE_SIZE - 1)];
+
+    s.seq.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    packet_capture_record& r = s.record;
+    r.time_us = capture_clock_us();
+    r.remote_addr = (remote_endpoint.address().is_v4() ? remote_endpoint.address().to_v4().to_ulong() : 0);
+    r.remote_port = remote_endpoint.port();
+    r.direction = (uint8_t)direction;
+    r.captured_len = (uint8_t)(len < ASIO_KCP_PACKET_CAPTURE_SNAP_LEN ? len : ASIO_KCP_PACKET_CAPTURE_SNAP_LEN);
+    r.conv = grab_conv(data, len);
+    r.size = (uint32_t)len;
+    memcpy(r.data, data, r.captured_len);
+
+    s.seq.store(index * 2 + 2, std::memory_order_release);
+    next_index_.store(index + 1, std::memory_order_release);
+}
+
+void packet_capture_ring::snapshot(std::vector<packet_capture_record>* records) const
+{
+    const uint64_t end = next_index_.load(std::memory_order_acquire);
+    const uint64_t begin = (end > ASIO_KCP_PACKET_CAPTURE_SIZE ? end - ASIO_KCP_PACKET_CAPTURE_SIZE : 0);
+
+    records->clear();
+    records->reserve(end - begin);
+    for (uint64_t index = begin; index < end; ++index)
+    {
+        const slot& s = slots_[index & (ASIO_KCP_PACKET_CAPTURE_SIZE - 1)];
+        const uint64_t seq = s.seq.load(std::memory_order_acquire);
+        if (seq != index * 2 + 2)
+            continue; // overwritten by a newer one
+
+        packet_capture_record r = s.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq)
+            continue;
+        records->push_back(r);
+    }
+}
+
+uint32_t packet_capture_ring::grab_conv(const char* data, size_t len)
+{
+    const size_t prefix_len = sizeof(ASIO_KCP_TEXT_PACKET_PREFIX) - 1;
+    if (len >= prefix_len && memcmp(data, ASIO_KCP_TEXT_PACKET_PREFIX, prefix_len) == 0)
+    {
+        // the first number in the text. The connect packet has none.
+        const std::string text(data, len < ASIO_KCP_PACKET_CAPTURE_SNAP_LEN ? len : ASIO_KCP_PACKET_CAPTURE_SNAP_LEN);
+        const size_t pos = text.find_first_of("0123456789");
+        return (pos == std::string::npos ? 0 : (uint32_t)strtoul(text.c_str() + pos, NULL, 10));
+    }
+
+    size_t offset = 0;
+    asio_kcp::kcp_segment_header seg;
+    if (asio_kcp::next_kcp_segment(data, len, &offset, &seg))
+        return seg.conv;
+    return 0;
+}
+
+static void append_uint16(std::string& buf, uint16_t value)
+{
+    buf.append((const char*)&value, sizeof(value)); // pcapng is written in the byte order of the host
+}
+
+static void append_uint32(std::string& buf, uint32_t value)
+{
+    buf.append((const char*)&value, sizeof(value));
+}
+
+static void append_uint16_be(std::string& buf, uint16_t value)
+{
+    buf.push_back((char)(value >> 8));
+    buf.push_back((char)(value & 0xff));
+}
+
+static void append_uint32_be(std::string& buf, uint32_t value)
+{
+    append_uint16_be(buf, (uint16_t)(value >> 16));
+    append_uint16_be(buf, (uint16_t)(value & 0xffff));
+}
+
+// body of a block: the block type and the two block lengths are added here.
+static void append_pcapng_block(std::string& out, uint32_t type, const std::string& body)
+{
+    const uint32_t block_len = (uint32_t)(12 + body.size());
+    append_uint32(out, type);
+    append_uint32(out, block_len);
+    out += body;
+    append_uint32(out, block_len);
+}
+
+static void append_ipv4_udp_header(std::string& buf, uint32_t src_addr, uint16_t src_port,
+        uint32_t dst_addr, uint16_t dst_port, uint32_t payload_size)
+{
+    const size_t start = buf.size();
+    buf.push_back(0x45); // version 4, header 20 bytes
+    buf.push_back(0);
+    append_uint16_be(buf, (uint16_t)(IPV4_HEADER_SIZE + UDP_HEADER_SIZE + payload_size));
+    append_uint16_be(buf, 0);      // id
+    append_uint16_be(buf, 0x4000); // don't fragment
+    buf.push_back(64);             // ttl
+    buf.push_back(17);             // udp
+    append_uint16_be(buf, 0);      // checksum
+    append_uint32_be(buf, src_addr);
+    append_uint32_be(buf, dst_addr);
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < IPV4_HEADER_SIZE; i += 2)
+        sum += ((unsigned char)buf[start + i] << 8) | (unsigned char)buf[start + i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    const uint16_t checksum = (uint16_t)~sum;
+    buf[start + 10] = (char)(checksum >> 8);
+    buf[start + 11] = (char)(checksum & 0xff);
+
+    append_uint16_be(buf, src_port);
+    append_uint16_be(buf, dst_port);
+    append_uint16_be(buf, (uint16_t)(UDP_HEADER_SIZE + payload_size));
+    append_uint16_be(buf, 0); // no checksum. The payload is truncated.
+}
+
+bool write_pcapng_file(const std::string& path, const std::vector<packet_capture_record>& records,
+        const boost::asio::ip::udp::endpoint& local_endpoint)
+{
+    std::ofstream ofs(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!ofs)
+        return false;
+
+    const uint32_t local_addr = (local_endpoint.address().is_v4() ? local_endpoint.address().to_v4().to_ulong() : 0);
+    const uint16_t local_port = local_endpoint.port();
+
+    std::string out;
+    std::string body;
+
+    // section header: version 1.0, unknown section length
+    append_uint32(body, PCAPNG_BYTE_ORDER_MAGIC);
+    append_uint16(body, 1);
+    append_uint16(body, 0);
+    append_uint32(body, 0xffffffff);
+    append_uint32(body, 0xffffffff);
+    append_pcapng_block(out, PCAPNG_BLOCK_SHB, body);
+
+    // interface: raw ip, microsecond timestamps (the default resolution)
+    body.clear();
+    append_uint16(body, PCAPNG_LINKTYPE_RAW);
+    append_uint16(body, 0);
+    append_uint32(body, 0); // no snap length limit
+    append_pcapng_block(out, PCAPNG_BLOCK_IDB, body);
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const packet_capture_record& r = records[i];
+        std::string packet;
+        if (r.direction == ePacketIn)
+            append_ipv4_udp_header(packet, r.remote_addr, r.remote_port, local_addr, local_port, r.size);
+        else
+            append_ipv4_udp_header(packet, local_addr, local_port, r.remote_addr, r.remote_port, r.size);
+        packet.append(r.data, r.captured_len);
+
+        body.clear();
+        append_uint32(body, 0); // interface id
+        append_uint32(body, (uint32_t)(r.time_us >> 32));
+        append_uint32(body, (uint32_t)(r.time_us & 0xffffffff));
+        append_uint32(body, (uint32_t)packet.size());
+        append_uint32(body, IPV4_HEADER_SIZE + UDP_HEADER_SIZE + r.size);
+        body += packet;
+        body.append((4 - packet.size() % 4) % 4, '\0');
+
+        append_uint16(body, PCAPNG_OPT_EPB_FLAGS);
+        append_uint16(body, 4);
+        append_uint32(body, (r.direction == ePacketIn ? PCAPNG_EPB_FLAGS_INBOUND : PCAPNG_EPB_FLAGS_OUTBOUND));
+        append_uint16(body, PCAPNG_OPT_ENDOFOPT);
+        append_uint16(body, 0);
+        append_pcapng_block(out, PCAPNG_BLOCK_EPB, body);
+    }
+
+    ofs.write(out.data(), out.size());
+    return ofs.good();
+}
+
+static uint32_t read_uint32_be(const char* data)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint16_t read_uint16_be(const char* data)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// parse an enhanced packet block written by write_pcapng_file. body is the block without type and lengths.
+static bool parse_pcapng_epb(const std::string& body, packet_capture_record* r)
+{
+    if (body.size() < 20)
+        return false;
+    const char* p = body.data();
+    uint32_t value = 0;
+    memcpy(&value, p + 4, 4);
+    r->time_us = (uint64_t)value << 32;
+    memcpy(&value, p + 8, 4);
+    r->time_us |= value;
+    uint32_t captured_len = 0;
+    uint32_t original_len = 0;
+    memcpy(&captured_len, p + 12, 4);
+    memcpy(&original_len, p + 16, 4);
+    if (body.size() < 20 + captured_len || captured_len < IPV4_HEADER_SIZE + UDP_HEADER_SIZE ||
+            original_len < IPV4_HEADER_SIZE + UDP_HEADER_SIZE)
+        return false;
+
+    const char* packet = p + 20;
+    const uint32_t src_addr = read_uint32_be(packet + 12);
+    const uint32_t dst_addr = read_uint32_be(packet + 16);
+    const uint16_t src_port = read_uint16_be(packet + IPV4_HEADER_SIZE);
+    const uint16_t dst_port = read_uint16_be(packet + IPV4_HEADER_SIZE + 2);
+
+    // options: only epb_flags is used
+    r->direction = ePacketIn;
+    size_t offset = 20 + ((captured_len + 3) & ~3u);
+    while (offset + 4 <= body.size())
+    {
+        uint16_t code = 0;
+        uint16_t len = 0;
+        memcpy(&code, p + offset, 2);
+        memcpy(&len, p + offset + 2, 2);
+        if (code == PCAPNG_OPT_ENDOFOPT || offset + 4 + len > body.size())
+            break;
+        if (code == PCAPNG_OPT_EPB_FLAGS && len == 4)
+        {
+            uint32_t flags = 0;
+            memcpy(&flags, p + offset + 4, 4);
+            r->direction = ((flags & 3) == PCAPNG_EPB_FLAGS_OUTBOUND ? ePacketOut : ePacketIn);
+        }
+        offset += 4 + ((len + 3) & ~3u);
+    }
+
+    r->remote_addr = (r->direction == ePacketIn ? src_addr : dst_addr);
+    r->remote_port = (r->direction == ePacketIn ? src_port : dst_port);
+    r->size = original_len - IPV4_HEADER_SIZE - UDP_HEADER_SIZE;
+    const uint32_t payload_len = captured_len - IPV4_HEADER_SIZE - UDP_HEADER_SIZE;
+    r->captured_len = (uint8_t)(payload_len < ASIO_KCP_PACKET_CAPTURE_SNAP_LEN ? payload_len : ASIO_KCP_PACKET_CAPTURE_SNAP_LEN);
+    memcpy(r->data, packet + IPV4_HEADER_SIZE + UDP_HEADER_SIZE, r->captured_len);
+    r->conv = packet_capture_ring::grab_conv(r->data, r->captured_len);
+    return true;
+}
+
+bool read_pcapng_file(const std::string& path, std::vector<packet_capture_record>* records)
+{
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    if (!ifs)
+        return false;
+    const std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    records->clear();
+    size_t offset = 0;
+    bool section_found = false;
+    while (offset + 12 <= content.size())
+    {
+        uint32_t type = 0;
+        uint32_t block_len = 0;
+        memcpy(&type, content.data() + offset, 4);
+        memcpy(&block_len, content.data() + offset + 4, 4);
+        if (block_len < 12 || block_len % 4 != 0 || offset + block_len > content.size())
+            return false;
+        const std::string body = content.substr(offset + 8, block_len - 12);
+
+        if (type == PCAPNG_BLOCK_SHB)
+        {
+            uint32_t magic = 0;
+            if (body.size() >= 4)
+                memcpy(&magic, body.data(), 4);
+            if (magic != PCAPNG_BYTE_ORDER_MAGIC)
+                return false; // another byte order
+            section_found = true;
+        }
+        else if (type == PCAPNG_BLOCK_EPB && section_found)
+        {
+            packet_capture_record r;
+            if (parse_pcapng_epb(body, &r))
+                records->push_back(r);
+        }
+        offset += block_len;
+    }
+    return section_found;
+}
+
+static const char* kcp_cmd_str(uint8_t cmd)
+{
+    switch (cmd)
+    {
+        case KCP_CMD_PUSH: return "push";
+        case KCP_CMD_ACK: return "ack";
+        case KCP_CMD_WASK: return "wask";
+        case KCP_CMD_WINS: return "wins";
+        default: return "unknown";
+    }
+}
+
+static const char* text_packet_str(const std::string& text)
+{
+    // the longer prefixes first
+    static const char* const names[][2] = {
+        {"asio_kcp_connect_back_package", "connect_back"},
+        {"asio_kcp_connect_package", "connect"},
+        {"asio_kcp_resume_back_package", "resume_back"},
+        {"asio_kcp_resume_package", "resume"},
+        {"asio_kcp_disconnect_package", "disconnect"},
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (text.compare(0, strlen(names[i][0]), names[i][0]) == 0)
+            return names[i][1];
+    }
+    return "text";
+}
+
+std::string packet_capture_record_str(const packet_capture_record& r)
+{
+    const time_t sec = (time_t)(r.time_us / 1000000);
+    struct tm tm_time;
+    localtime_r(&sec, &tm_time);
+    char time_str[64] = "";
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_time);
+    char usec_str[16] = "";
+    snprintf(usec_str, sizeof(usec_str), ".%06u", (unsigned)(r.time_us % 1000000));
+
+    std::ostringstream oss;
+    oss << time_str << usec_str
+        << (r.direction == ePacketIn ? " in  " : " out ")
+        << boost::asio::ip::address_v4(r.remote_addr).to_string() << ":" << r.remote_port
+        << " conv:" << r.conv
+        << " size:" << r.size;
+
+    const std::string data(r.data, r.captured_len);
+    const std::string prefix(ASIO_KCP_TEXT_PACKET_PREFIX);
+    if (data.compare(0, prefix.size(), prefix) == 0)
+    {
+        oss << " | " << text_packet_str(data);
+        return oss.str();
+    }
+
+    // the segment headers in the captured bytes
+    size_t offset = 0;
+    asio_kcp::kcp_segment_header seg;
+    while (asio_kcp::next_kcp_segment(data.data(), data.size(), &offset, &seg))
+    {
+        oss << " | " << kcp_cmd_str(seg.cmd)
+            << " sn:" << seg.sn
+            << " una:" << seg.una
+            << " wnd:" << seg.wnd
+            << " frg:" << (unsigned)seg.frg
+            << " ts:" << seg.ts
+            << " len:" << seg.len;
+    }
+    if (offset < r.size)
+        oss << " | ..."; // truncated
+    return oss.str();
+}
+
+} // namespace kcp_svr
@@ -0,0 +1,82 @@
+#ifndef _KCP_PACKET_CAPTURE_HPP_
+#define _KCP_PACKET_CAPTURE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+
+// records kept by a packet_capture_ring. Must be a power of 2.
+#define ASIO_KCP_PACKET_CAPTURE_SIZE 4096
+
+// bytes kept from the head of every udp payload. Enough for two kcp segment headers, or the conv in handshake packets.
+#define ASIO_KCP_PACKET_CAPTURE_SNAP_LEN 64
+
+namespace kcp_svr {
+
+enum ePacketDirection
+{
+    ePacketIn = 0,  // recved by server
+    ePacketOut = 1, // sent by server
+};
+
+struct packet_capture_record
+{
+    uint64_t time_us;      // microseconds since epoch
+    uint32_t remote_addr;  // ipv4 of the client, host order
+    uint16_t remote_port;
+    uint8_t direction;     // ePacketDirection
+    uint8_t captured_len;  // bytes in data
+    uint32_t conv;         // 0 for the connect packet
+    uint32_t size;         // the whole udp payload
+    char data[ASIO_KCP_PACKET_CAPTURE_SNAP_LEN];
+};
+
+// The recent udp packets of one thread (one connection_manager).
+// Recording is lock-free and cheap enough to be always on: a clock read and a copy of the packet head.
+// Only one thread records. Any thread can take a snapshot at any time, without blocking the recording thread.
+class packet_capture_ring
+  : private boost::noncopyable
+{
+public:
+    packet_capture_ring(void);
+
+    void record(ePacketDirection direction, const boost::asio::ip::udp::endpoint& remote_endpoint, const char* data, size_t len);
+
+    // the records in the ring, oldest first. The records being overwritten while copying are skipped.
+    void snapshot(std::vector<packet_capture_record>* records) const;
+
+    // conv of a udp packet of asio_kcp: the kcp header, or the conv in the handshake packets. 0 if unknown.
+    static uint32_t grab_conv(const char* data, size_t len);
+
+private:
+    // seqlock: seq is odd while writing, and 2 * (index + 1) after the record of index written.
+    struct slot
+    {
+        std::atomic<uint64_t> seq;
+        packet_capture_record record;
+    };
+
+    std::unique_ptr<slot[]> slots_;
+    std::atomic<uint64_t> next_index_;
+};
+
+// pcapng file (wireshark, tcpdump -r). Every packet is given an IPv4 and UDP header between local_endpoint and
+// the client, with the payload truncated to captured_len. The direction is saved as the epb_flags of the packet.
+bool write_pcapng_file(const std::string& path, const std::vector<packet_capture_record>& records,
+        const boost::asio::ip::udp::endpoint& local_endpoint);
+
+// read the file written by write_pcapng_file.
+bool read_pcapng_file(const std::string& path, std::vector<packet_capture_record>* records);
+
+// one line for the packet. Like:
+//   2026-10-18 08:00:00.123456 in  127.0.0.1:39836 conv:1001 size:524 | push sn:3 una:2 wnd:128 frg:0 ts:1000 len:500
+std::string packet_capture_record_str(const packet_capture_record& record);
+
+} // namespace kcp_svr
+
+#endif // _KCP_PACKET_CAPTURE_HPP_
@@ -6,19 +6,31 @@
 #include "../essential/utility/strutil.h"
 #include "connection_manager.hpp"
 #include "udp_multicast_manager.hpp"
+#include "multicast_manager.hpp"
+#include "metrics.hpp"
+#include "metrics_http_endpoint.hpp"
 
 
 namespace kcp_svr {
 
 server::server(boost::asio::io_service& io_service, const std::string& address, const std::string& port)
   : io_service_(io_service),
+    metrics_registry_ptr_(new metrics_registry()),
     connection_manager_ptr_(new connection_manager(io_service_, address, std::atoi(port.c_str()))),
-    multicast_manager_ptr_(new UdpMulticastManager(io_service_))
+    multicast_manager_ptr_(new UdpMulticastManager(io_service_)),
+    kcp_group_manager_ptr_(new MulticastManager(connection_manager_ptr_))
 {
+    connection_manager_ptr_->register_metrics(*metrics_registry_ptr_);
+    multicast_manager_ptr_->register_metrics(*metrics_registry_ptr_);
 }
 
 void server::stop()
 {
+    if (metrics_endpoint_ptr_)
+    {
+        metrics_endpoint_ptr_->stop();
+    }
+
     // 停止组播管理器
     if (multicast_manager_ptr_)
     {
@@ -42,6 +54,11 @@ void server::set_callback(const std::function<event_callback_t>& func)
     connection_manager_ptr_->set_callback(func);
 }
 
+void server::set_msg_callback(const std::function<msg_callback_t>& func)
+{
+    connection_manager_ptr_->set_msg_callback(func);
+}
+
 void server::force_disconnect(const kcp_conv_t& conv)
 {
     connection_manager_ptr_->force_disconnect(conv);
@@ -53,6 +70,67 @@ int server::send_msg(const kcp_conv_t& conv, std::shared_ptr<std::string> msg)
     return connection_manager_ptr_->send_msg(conv, msg);
 }
 
+bool server::get_connection_stats(const kcp_conv_t& conv, connection_stats* stats) const
+{
+    return connection_manager_ptr_->get_connection_stats(conv, stats);
+}
+
+void server::get_all_connection_stats(std::vector<connection_stats>* stats) const
+{
+    connection_manager_ptr_->get_all_connection_stats(stats);
+}
+
+void server::get_latency_stats(latency_stats* stats) const
+{
+    connection_manager_ptr_->get_latency_stats(stats);
+}
+
+int server::start_metrics_endpoint(const std::string& address, int port)
+{
+    if (metrics_endpoint_ptr_)
+    {
+        return metrics_endpoint_ptr_->get_port(); // 已经启动
+    }
+
+    metrics_http_endpoint::shared_ptr endpoint_ptr(new metrics_http_endpoint(io_service_, metrics_registry_ptr_));
+    if (!endpoint_ptr->start(address, port))
+    {
+        return 0;
+    }
+    metrics_endpoint_ptr_ = endpoint_ptr;
+    return metrics_endpoint_ptr_->get_port();
+}
+
+std::string server::get_metrics_text() const
+{
+    return metrics_registry_ptr_->render();
+}
+
+bool server::dump_packet_capture(const std::string& path) const
+{
+    return connection_manager_ptr_->dump_packet_capture(path);
+}
+
+void server::set_packet_capture_dump_dir(const std::string& dir)
+{
+    connection_manager_ptr_->set_packet_capture_dump_dir(dir);
+}
+
+bool server::enable_kcp_trace(const kcp_conv_t& conv)
+{
+    return connection_manager_ptr_->enable_kcp_trace(conv);
+}
+
+void server::set_kcp_trace_new_connections(bool enable)
+{
+    connection_manager_ptr_->set_kcp_trace_new_connections(enable);
+}
+
+bool server::dump_kcp_trace(const kcp_conv_t& conv, const std::string& path)
+{
+    return connection_manager_ptr_->dump_kcp_trace(conv, path);
+}
+
 // UDP组播功能实现
 uint32_t server::create_multicast_group(const std::string& multicast_addr, uint16_t port)
 {
@@ -68,16 +146,64 @@ void server::send_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std:
 {
     if (msg && !msg->empty())
     {
-        multicast_manager_ptr_->send_to_group(group_id, *msg);
+        multicast_manager_ptr_->send_to_group(group_id, msg);
     }
 }
 
-void server::send_reliable_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std::string> msg)
+int server::send_reliable_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std::string> msg)
 {
     if (msg && !msg->empty())
     {
-        multicast_manager_ptr_->send_reliable_to_group(group_id, *msg);
+        return multicast_manager_ptr_->send_reliable_to_group(group_id, msg);
     }
+    return 0;
+}
+
+bool server::set_multicast_group_pacing_rate(uint32_t group_id, uint64_t bytes_per_second)
+{
+    return multicast_manager_ptr_->set_pacing_rate(group_id, bytes_per_second);
+}
+
+bool server::set_multicast_group_batching(uint32_t group_id, uint32_t delay_ms)
+{
+    return multicast_manager_ptr_->set_batching(group_id, delay_ms);
+}
+
+void server::flush_multicast_group(uint32_t group_id)
+{
+    multicast_manager_ptr_->flush_group(group_id);
+}
+
+bool server::set_multicast_group_catch_up_history(uint32_t group_id, size_t max_msgs)
+{
+    return multicast_manager_ptr_->set_catch_up_history(group_id, max_msgs);
+}
+
+bool server::handle_multicast_catch_up_request(const kcp_conv_t& conv, const std::string& msg)
+{
+    if (asio_kcp::get_mc_packet_type(msg.data(), msg.size()) != asio_kcp::eMcPacketCatchUpRequest)
+    {
+        return false;
+    }
+
+    const uint32_t group_id = asio_kcp::grab_group_id_from_mc_packet(msg.data(), msg.size());
+    std::vector<std::string> packets;
+    if (multicast_manager_ptr_->get_catch_up_packets(group_id, &packets) != 0)
+    {
+        return true;
+    }
+
+    // kcp保证顺序, 客户端按序交付
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        std::shared_ptr<std::string> packet = std::make_shared<std::string>();
+        packet->swap(packets[i]);
+        if (connection_manager_ptr_->send_msg(conv, packet) != 0)
+        {
+            break; // 连接已经断开
+        }
+    }
+    return true;
 }
 
 std::string server::get_multicast_group_info(uint32_t group_id)
@@ -85,4 +211,33 @@ std::string server::get_multicast_group_info(uint32_t group_id)
     return multicast_manager_ptr_->get_group_info(group_id);
 }
 
+uint32_t server::create_kcp_group()
+{
+    return kcp_group_manager_ptr_->create_group();
+}
+
+bool server::delete_kcp_group(uint32_t group_id)
+{
+    return kcp_group_manager_ptr_->delete_group(group_id);
+}
+
+bool server::add_to_kcp_group(uint32_t group_id, const kcp_conv_t& conv)
+{
+    return kcp_group_manager_ptr_->add_member_to_group(group_id, conv);
+}
+
+bool server::remove_from_kcp_group(uint32_t group_id, const kcp_conv_t& conv)
+{
+    return kcp_group_manager_ptr_->remove_member_from_group(group_id, conv);
+}
+
+int server::send_msg_to_kcp_group(uint32_t group_id, std::shared_ptr<std::string> msg)
+{
+    if (msg && !msg->empty())
+    {
+        return kcp_group_manager_ptr_->send_to_group(group_id, msg);
+    }
+    return 0;
+}
+
 } // namespace kcp_svr
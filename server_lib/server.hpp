@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <string>
 #include <memory>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include "kcp_typedef.hpp"
 
@@ -11,6 +12,9 @@ namespace kcp_svr {
 
 class connection_manager;
 class UdpMulticastManager;
+class MulticastManager;
+class metrics_registry;
+class metrics_http_endpoint;
 
 
 // The way of using kcp_svr::server is Reactor mode.
@@ -44,6 +48,10 @@ public:
 
     void set_callback(const std::function<event_callback_t>& func);
 
+    // Zero copy recving. eRcvMsg will be given to msg_callback func instead of event_callback func if you set it.
+    //   msg_call(2342, "text12345678", 12) will be called in loop of io_service. No allocation for every msg.
+    void set_msg_callback(const std::function<msg_callback_t>& func);
+
     // eLagNotify return when none msg recved within mtime milliseconds.
     // eLagNotify will be not returned if you do not set this or set this 0.
     //  void set_lag_notify_time(uint32_t mtime);
@@ -53,6 +61,41 @@ public:
     //  int send_msg_to_all();
     void force_disconnect(const kcp_conv_t& conv);
 
+    // kcp状态: RTT, RTO, 重传, 队列长度, 收发流量等. 可以在任何线程调用, 不阻塞io_service的线程.
+    // 连接不存在时返回false.
+    bool get_connection_stats(const kcp_conv_t& conv, connection_stats* stats) const;
+
+    // 所有连接的状态, 适合定期采集.
+    void get_all_connection_stats(std::vector<connection_stats>* stats) const;
+
+    // 所有连接的RTT和消息间隔的p50/p90/p99/p999(微秒), 可以在任何线程调用.
+    void get_latency_stats(latency_stats* stats) const;
+
+    // 进程级指标: udp收发, 握手, 超时, 连接数, 组播的重传等. Prometheus文本格式.
+    // 在io_service的循环中监听address:port, GET /metrics 返回get_metrics_text(). port为0时随机选择端口.
+    // 成功返回监听的端口, 失败返回0.
+    int start_metrics_endpoint(const std::string& address, int port);
+
+    // 可以在任何线程调用.
+    std::string get_metrics_text() const;
+
+    // 最近收发的udp包(包头和元数据)一直记录在内存环中. 导出为pcapng文件, 可用packet_capture_decoder或wireshark查看.
+    // 可以在任何线程调用.
+    bool dump_packet_capture(const std::string& path) const;
+
+    // 连接超时或被断开时把该连接的包导出到dir目录. 空字符串(默认)表示不导出. 在io_service.run之前调用.
+    void set_packet_capture_dump_dir(const std::string& dir);
+
+    // 记录连接的kcp分片的生命周期: 进入snd_queue, 等待cwnd, 发送, 重传, 被ack, 在rcv_buf中等待, 被recv.
+    // 找不到conv返回false. 和send_msg一样在io_service的线程中调用.
+    bool enable_kcp_trace(const kcp_conv_t& conv);
+
+    // 所有新连接都开启kcp trace. 在io_service.run之前调用.
+    void set_kcp_trace_new_connections(bool enable);
+
+    // 把kcp trace写到文件, 用kcp_trace_to_chrome转换成Chrome trace json. 没有开启trace返回false. 在io_service的线程中调用.
+    bool dump_kcp_trace(const kcp_conv_t& conv, const std::string& path);
+
     // you must call stop before the destory of io_service or calling io_service.stop
     void stop();
 
@@ -64,23 +107,62 @@ public:
     bool delete_multicast_group(uint32_t group_id);
     
     // 发送消息到组播组（不可靠，无确认）
+    // 组播消息异步发送, 不复制msg. 调用之后不要再修改msg.
     void send_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std::string> msg);
     
     // 发送可靠消息到组播组（带序列号和确认）
-    void send_reliable_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std::string> msg);
+    // 最慢的接收者落后太多时返回ASIO_KCP_MULTICAST_ERR_WINDOW_FULL, 超过限速积压太多时返回ASIO_KCP_MULTICAST_ERR_QUEUE_FULL, 请稍后重发. 成功返回0.
+    int send_reliable_msg_to_multicast_group(uint32_t group_id, std::shared_ptr<std::string> msg);
+
+    // 限制组播组的发送速率(字节/秒), 0表示不限速
+    bool set_multicast_group_pacing_rate(uint32_t group_id, uint64_t bytes_per_second);
+
+    // 把组播组的小消息打包成一个数据报发送, 最多延迟delay_ms. 0表示不打包.
+    // 打包时请在每一帧结束时调用flush_multicast_group立即发出.
+    bool set_multicast_group_batching(uint32_t group_id, uint32_t delay_ms);
+    void flush_multicast_group(uint32_t group_id);
     
+    // 可靠组播组为中途加入的客户端保留最近max_msgs条消息, 默认ASIO_KCP_MULTICAST_CATCH_UP_HISTORY. 0表示不保留.
+    bool set_multicast_group_catch_up_history(uint32_t group_id, size_t max_msgs);
+
+    // 客户端加入组播组之后通过kcp请求补齐之前的可靠消息(kcp_multicast_client::begin_catch_up).
+    // 请在eRcvMsg中先调用它: msg是补齐请求时通过conv的kcp连接回复并返回true, 否则返回false, 照常处理msg.
+    bool handle_multicast_catch_up_request(const kcp_conv_t& conv, const std::string& msg);
+
     // 获取组播组信息，包括地址和端口
     std::string get_multicast_group_info(uint32_t group_id);
 
+    // kcp组: 通过每个成员自己的kcp连接转发消息, 不需要网络支持组播.
+    // 创建一个kcp组，返回组ID
+    uint32_t create_kcp_group();
+
+    bool delete_kcp_group(uint32_t group_id);
+
+    // 成员断开连接(eDisconnect)时请移除它
+    bool add_to_kcp_group(uint32_t group_id, const kcp_conv_t& conv);
+    bool remove_from_kcp_group(uint32_t group_id, const kcp_conv_t& conv);
+
+    // 所有成员共用同一个msg, 调用之后不要再修改msg. 返回发给了几个成员, 组不存在时返回-1.
+    int send_msg_to_kcp_group(uint32_t group_id, std::shared_ptr<std::string> msg);
+
 private:
     /// The io_service used to perform asynchronous operations.
     boost::asio::io_service& io_service_; // -known
 
+    /// 指标注册表, 引用下面各个管理器中的计数器
+    std::shared_ptr<metrics_registry> metrics_registry_ptr_;
+
     /// The connection manager which owns all live connections.
     std::shared_ptr<connection_manager> connection_manager_ptr_;
     
     /// UDP组播管理器
     std::shared_ptr<UdpMulticastManager> multicast_manager_ptr_;
+
+    /// kcp组管理器
+    std::shared_ptr<MulticastManager> kcp_group_manager_ptr_;
+
+    /// 指标的http端口, start_metrics_endpoint之前为空
+    std::shared_ptr<metrics_http_endpoint> metrics_endpoint_ptr_;
 };
 
 } // namespace kcp_svr
@@ -0,0 +1,74 @@
+#include "server_transport.hpp"
+#include <boost/bind.hpp>
+
+namespace kcp_svr {
+
+asio_udp_transport::asio_udp_transport(boost::asio::io_service& io_service, const std::string& address, int udp_port) :
+    closed_(false),
+    udp_socket_(io_service, udp::endpoint(boost::asio::ip::address::from_string(address), udp_port))
+{
+    //udp_socket_.set_option(udp::socket::non_blocking_io(false)); // why this make compile fail
+}
+
+void asio_udp_transport::start_recv(const std::function<transport_recv_handler_t>& handler)
+{
+    handler_ = handler;
+    hook_udp_async_receive();
+}
+
+void asio_udp_transport::send_to(const char* data, size_t len, const udp::endpoint& to)
+{
+    udp_socket_.send_to(boost::asio::buffer(data, len), to);
+}
+
+udp::endpoint asio_udp_transport::local_endpoint(void) const
+{
+    return udp_socket_.local_endpoint();
+}
+
+void asio_udp_transport::close(void)
+{
+    closed_ = true;
+    udp_socket_.cancel();
+    udp_socket_.close();
+}
+
+void asio_udp_transport::hook_udp_async_receive(void)
+{
+    if (closed_)
+        return;
+    udp_socket_.async_receive_from(
+          boost::asio::buffer(udp_data_, sizeof(udp_data_)), udp_remote_endpoint_,
+          boost::bind(&asio_udp_transport::handle_udp_receive_from, this,
+              boost::asio::placeholders::error,
+              boost::asio::placeholders::bytes_transferred));
+}
+
+void asio_udp_transport::handle_udp_receive_from(const boost::system::error_code& error, size_t bytes_recvd)
+{
+    handler_(error, udp_data_, bytes_recvd, udp_remote_endpoint_);
+    hook_udp_async_receive();
+}
+
+
+memory_server_transport::memory_server_transport(const udp::endpoint& local_endpoint, const std::function<output_t>& output) :
+    local_endpoint_(local_endpoint),
+    output_(output),
+    closed_(false)
+{
+}
+
+void memory_server_transport::send_to(const char* data, size_t len, const udp::endpoint& to)
+{
+    if (!closed_)
+        output_(data, len, local_endpoint_, to);
+}
+
+void memory_server_transport::deliver(const char* data, size_t len, const udp::endpoint& from)
+{
+    if (closed_ || !handler_)
+        return;
+    handler_(boost::system::error_code(), data, len, from);
+}
+
+} // namespace kcp_svr
@@ -0,0 +1,82 @@
+#ifndef _KCP_SERVER_TRANSPORT_HPP_
+#define _KCP_SERVER_TRANSPORT_HPP_
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace kcp_svr {
+
+using boost::asio::ip::udp;
+
+// a packet recved, or ec on error. data is valid only in the call.
+typedef void(transport_recv_handler_t)(const boost::system::error_code& ec, const char* data, size_t len, const udp::endpoint& from);
+
+// The udp socket under connection_manager. Replace it by memory_server_transport to run servers and clients
+// in one process in simulated time. All calls are made in the loop of connection_manager.
+class server_transport
+  : private boost::noncopyable
+{
+public:
+    virtual ~server_transport(void) {}
+
+    // deliver the packets to handler until close.
+    virtual void start_recv(const std::function<transport_recv_handler_t>& handler) = 0;
+
+    virtual void send_to(const char* data, size_t len, const udp::endpoint& to) = 0;
+
+    virtual udp::endpoint local_endpoint(void) const = 0;
+
+    virtual void close(void) = 0;
+};
+
+// the default one. An asio udp socket recving in the loop of io_service.
+class asio_udp_transport : public server_transport
+{
+public:
+    asio_udp_transport(boost::asio::io_service& io_service, const std::string& address, int udp_port);
+
+    virtual void start_recv(const std::function<transport_recv_handler_t>& handler);
+    virtual void send_to(const char* data, size_t len, const udp::endpoint& to);
+    virtual udp::endpoint local_endpoint(void) const;
+    virtual void close(void);
+
+private:
+    void hook_udp_async_receive(void);
+    void handle_udp_receive_from(const boost::system::error_code& error, size_t bytes_recvd);
+
+    bool closed_;
+    udp::socket udp_socket_;
+    udp::endpoint udp_remote_endpoint_;
+    char udp_data_[1024 * 32];
+    std::function<transport_recv_handler_t> handler_;
+};
+
+// No socket. The packets sent go to output, and the simulator delivers the packets to the server by deliver().
+class memory_server_transport : public server_transport
+{
+public:
+    typedef void(output_t)(const char* data, size_t len, const udp::endpoint& from, const udp::endpoint& to);
+
+    memory_server_transport(const udp::endpoint& local_endpoint, const std::function<output_t>& output);
+
+    virtual void start_recv(const std::function<transport_recv_handler_t>& handler) {handler_ = handler;}
+    virtual void send_to(const char* data, size_t len, const udp::endpoint& to);
+    virtual udp::endpoint local_endpoint(void) const {return local_endpoint_;}
+    virtual void close(void) {closed_ = true;}
+
+    // a packet arrived. Handled at once in the calling thread. Dropped if closed or not started.
+    void deliver(const char* data, size_t len, const udp::endpoint& from);
+
+private:
+    udp::endpoint local_endpoint_;
+    std::function<output_t> output_;
+    std::function<transport_recv_handler_t> handler_;
+    bool closed_;
+};
+
+} // namespace kcp_svr
+
+#endif // _KCP_SERVER_TRANSPORT_HPP_
@@ -2,6 +2,12 @@
 #include "asio_kcp_log.hpp"
 #include <random>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <boost/bind.hpp>
 
 namespace kcp_svr
@@ -11,10 +17,101 @@ namespace kcp_svr
     const uint16_t UdpMulticastManager::MULTICAST_PORT_MIN = 30000;
     const uint16_t UdpMulticastManager::MULTICAST_PORT_MAX = 40000;
 
+    static uint64_t multicast_clock_ms(void)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t multicast_clock_us(void)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t UdpMulticastManager::MulticastGroup::window_base_seq(void) const
+    {
+        if (reliable_sent_count < ASIO_KCP_MULTICAST_WINDOW_SIZE)
+            return next_seq - (uint32_t)reliable_sent_count;
+        return next_seq - ASIO_KCP_MULTICAST_WINDOW_SIZE;
+    }
+
+    uint32_t UdpMulticastManager::MulticastGroup::slowest_ack_seq(uint64_t now, size_t* live_receiver_count) const
+    {
+        uint32_t slowest = next_seq;
+        *live_receiver_count = 0;
+        for (const auto& kv : receivers)
+        {
+            if (now - kv.second.last_feedback_clock > ASIO_KCP_MULTICAST_RECEIVER_TIMEOUT)
+                continue;
+            (*live_receiver_count)++;
+            if (asio_kcp::mc_seq_diff(kv.second.ack_seq, slowest) < 0)
+                slowest = kv.second.ack_seq;
+        }
+        return slowest;
+    }
+
+    uint16_t UdpMulticastManager::MulticastGroup::worst_loss_permille(uint64_t now) const
+    {
+        uint16_t worst = 0;
+        for (const auto& kv : receivers)
+        {
+            if (now - kv.second.last_feedback_clock <= ASIO_KCP_MULTICAST_RECEIVER_TIMEOUT)
+                worst = std::max(worst, kv.second.loss_permille);
+        }
+        return worst;
+    }
+
+    void UdpMulticastManager::MulticastGroup::prune_receivers(uint64_t now)
+    {
+        for (auto it = receivers.begin(); it != receivers.end(); )
+        {
+            if (now - it->second.last_feedback_clock > ASIO_KCP_MULTICAST_RECEIVER_TIMEOUT)
+                it = receivers.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void UdpMulticastManager::MulticastGroup::refill_pacing_tokens(uint64_t now_us)
+    {
+        // 至少能突发一个最大的数据报, 否则低速率的组的令牌永远不会大于0
+        const int64_t burst = std::max<int64_t>((int64_t)(pacing_rate * ASIO_KCP_MULTICAST_PACING_BURST_TIME / 1000),
+                ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM);
+        if (pacing_tokens >= burst)
+        {
+            pacing_clock_us = now_us;
+            return;
+        }
+
+        const uint64_t elapsed_us = now_us - pacing_clock_us;
+        const uint64_t fill_us = (uint64_t)(burst - pacing_tokens) * 1000000 / pacing_rate;
+        if (elapsed_us >= fill_us)
+        {
+            pacing_tokens = burst;
+            pacing_clock_us = now_us;
+            return;
+        }
+
+        // 不足一个字节的时间留到下次, 否则低速率时每次都被舍掉
+        const uint64_t tokens = elapsed_us * pacing_rate / 1000000;
+        pacing_tokens += (int64_t)tokens;
+        pacing_clock_us += tokens * 1000000 / pacing_rate;
+    }
+
+    std::string UdpMulticastManager::MulticastGroup::flush_fec_block(void)
+    {
+        std::string packet = asio_kcp::making_mc_fec_packet(fec_block);
+        fec_block = asio_kcp::mc_fec_block();
+        fec_sent_count++;
+        return packet;
+    }
+
     UdpMulticastManager::UdpMulticastManager(boost::asio::io_service& io_service)
-        : io_service_(io_service), next_group_id_(1)
+        : io_service_(io_service), next_group_id_(1), flush_posted_(false), pacing_timer_(io_service), pacing_timer_armed_(false),
+        retired_stats_(group_stat_metric_count, 0)
     {
-        KCP_LOG_INFO("UDP Multicast Manager initialized");
+        AK_INFO_LOG << "UDP Multicast Manager initialized";
     }
 
     UdpMulticastManager::~UdpMulticastManager()
@@ -25,265 +122,920 @@ namespace kcp_svr
     uint32_t UdpMulticastManager::create_group(const std::string& multicast_addr, uint16_t port)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        
+
         // 生成组ID
         uint32_t group_id = next_group_id_++;
-        
+
         // 创建组播组
         auto group = std::make_shared<MulticastGroup>(io_service_);
-        
+        group->group_id = group_id;
+
         // 如果没有指定组播地址和端口，则生成一个
         std::string mc_addr = multicast_addr;
         uint16_t mc_port = port;
-        
+
         if (mc_addr.empty() || mc_port == 0)
         {
             auto addr_port = generate_multicast_address();
             mc_addr = addr_port.first;
             mc_port = addr_port.second;
         }
-        
+
         // 初始化组播socket
         if (!init_group_socket(*group, mc_addr, mc_port))
         {
-            KCP_LOG_ERROR("Failed to initialize multicast socket for group " << group_id);
+            AK_WARNING_LOG << "Failed to initialize multicast socket for group " << group_id;
             return 0; // 返回0表示失败
         }
-        
+
         // 保存组
         groups_[group_id] = group;
-        
-        KCP_LOG_INFO("Created multicast group " << group_id << " with address " << mc_addr << ":" << mc_port);
+
+        // 开始接收NACK
+        hook_group_receive(group);
+
+        AK_INFO_LOG << "Created multicast group " << group_id << " with address " << mc_addr << ":" << mc_port;
         return group_id;
     }
 
     bool UdpMulticastManager::delete_group(uint32_t group_id)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        
+
         auto it = groups_.find(group_id);
         if (it == groups_.end())
         {
-            KCP_LOG_INFO("Group " << group_id << " not found when deleting");
+            AK_INFO_LOG << "Group " << group_id << " not found when deleting";
             return false;
         }
-        
-        // 停止重传定时器
+
+        // 停止重传和心跳定时器, 关闭socket
+        close_group(*it->second);
+
+        // 删除组
+        retire_group_stats(*it->second);
+        groups_.erase(it);
+
+        AK_INFO_LOG << "Deleted multicast group " << group_id;
+        return true;
+    }
+
+    void UdpMulticastManager::close_group(MulticastGroup& group)
+    {
+        group.closed = true;
         try
         {
-            it->second->retransmit_timer.cancel();
+            group.retransmit_timer.cancel();
+            group.heartbeat_timer.cancel();
+            group.batch_timer.cancel();
         }
         catch (const std::exception& e)
         {
-            KCP_LOG_ERROR("Error canceling retransmit timer: " << e.what());
+            AK_WARNING_LOG << "Error stopping multicast group " << group.group_id << ": " << e.what();
         }
-        
-        // 关闭socket
-        try
+        if (group.receiving)
         {
-            it->second->socket.close();
+            // 接收的回调还没开始时取消它. 已经开始的回调由handle_group_receive关闭.
+            boost::system::error_code ec;
+            group.socket.cancel(ec);
         }
-        catch (const std::exception& e)
+        else if (group.sending_count == 0)
         {
-            KCP_LOG_ERROR("Error closing socket: " << e.what());
+            close_group_socket(group);
         }
-        
-        // 删除组
-        groups_.erase(it);
-        
-        KCP_LOG_INFO("Deleted multicast group " << group_id);
-        return true;
+    }
+
+    void UdpMulticastManager::close_group_socket(MulticastGroup& group)
+    {
+        boost::system::error_code ec;
+        group.socket.close(ec);
+        if (ec)
+            AK_WARNING_LOG << "Error closing multicast group " << group.group_id << ": " << ec.message();
     }
 
     void UdpMulticastManager::send_to_group(uint32_t group_id, const std::string& msg)
     {
-        std::shared_ptr<MulticastGroup> group;
-        
+        send_to_group(group_id, std::make_shared<const std::string>(msg));
+    }
+
+    void UdpMulticastManager::send_to_group(uint32_t group_id, std::shared_ptr<const std::string> msg)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it == groups_.end())
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            auto it = groups_.find(group_id);
-            if (it == groups_.end())
-            {
-                KCP_LOG_INFO("Group " << group_id << " not found when sending message");
-                return;
-            }
-            group = it->second;
+            AK_INFO_LOG << "Group " << group_id << " not found when sending message";
+            return;
         }
-        
-        try
+        MulticastGroup& group = *it->second;
+
+        if (group.send_queue.size() >= ASIO_KCP_MULTICAST_SEND_QUEUE_SIZE)
         {
-            // 直接发送消息到组播地址
-            group->socket.send_to(boost::asio::buffer(msg), group->endpoint);
-            KCP_LOG_INFO("Sent " << msg.size() << " bytes to multicast group " << group_id);
+            group.queue_full_count++;
+            return;
         }
-        catch (const std::exception& e)
+
+        OutPacket packet;
+        packet.endpoint = group.endpoint;
+        packet.head_len = (uint8_t)asio_kcp::making_mc_raw_header(packet.head);
+        packet.body = msg;
+        queue_packet(group, packet);
+    }
+
+    int UdpMulticastManager::send_reliable_to_group(uint32_t group_id, const std::string& msg)
+    {
+        return send_reliable_to_group(group_id, std::make_shared<const std::string>(msg));
+    }
+
+    int UdpMulticastManager::send_reliable_to_group(uint32_t group_id, std::shared_ptr<const std::string> msg)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it == groups_.end())
         {
-            KCP_LOG_ERROR("Error sending to multicast group " << group_id << ": " << e.what());
+            AK_INFO_LOG << "Group " << group_id << " not found when sending reliable message";
+            return ASIO_KCP_MULTICAST_ERR_GROUP_NOT_FOUND;
         }
+        std::shared_ptr<MulticastGroup> group = it->second;
+
+        // 组级流控: 不能覆盖最慢的接收者还没收到的消息
+        const uint64_t now = multicast_clock_ms();
+        size_t live_receiver_count = 0;
+        const uint32_t slowest_ack_seq = group->slowest_ack_seq(now, &live_receiver_count);
+        if (live_receiver_count > 0 && asio_kcp::mc_seq_diff(group->next_seq, slowest_ack_seq) >= ASIO_KCP_MULTICAST_WINDOW_SIZE)
+        {
+            group->window_full_count++;
+            return ASIO_KCP_MULTICAST_ERR_WINDOW_FULL;
+        }
+
+        // 发送速度超过了限速
+        if (group->send_queue.size() >= ASIO_KCP_MULTICAST_SEND_QUEUE_SIZE)
+        {
+            group->queue_full_count++;
+            return ASIO_KCP_MULTICAST_ERR_QUEUE_FULL;
+        }
+
+        // 获取并增加序列号
+        const uint32_t seq = group->next_seq++;
+
+        // 保存到重传窗口. 覆盖掉最老的一条消息.
+        WindowSlot& slot = group->window[seq % ASIO_KCP_MULTICAST_WINDOW_SIZE];
+        slot.seq = seq;
+        slot.msg = msg;
+        slot.last_send_clock = now;
+        slot.retransmit_pending = false;
+
+        // 保存到补发历史
+        if (group->history_size > 0)
+        {
+            group->history.push_back(msg);
+            if (group->history.size() > group->history_size)
+                group->history.pop_front();
+        }
+
+        OutPacket packet;
+        packet.endpoint = group->endpoint;
+        packet.head_len = (uint8_t)asio_kcp::making_mc_reliable_header(seq, packet.head);
+        packet.body = msg;
+        queue_packet(*group, packet);
+
+        // 块满了就在这条消息之后发校验包
+        if (group->fec_block_size > 0)
+        {
+            if (group->fec_block.count == 0)
+                group->fec_block.first_seq = seq;
+            group->fec_block.add(msg->data(), msg->size());
+            if (group->fec_block.count >= group->fec_block_size)
+                queue_packet(*group, group->flush_fec_block(), group->endpoint);
+        }
+
+        group->reliable_sent_count++;
+        group->last_reliable_send_clock = now;
+        hook_heartbeat_timer(group);
+        return 0;
+    }
+
+    bool UdpMulticastManager::set_pacing_rate(uint32_t group_id, uint64_t bytes_per_second)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it == groups_.end())
+            return false;
+
+        MulticastGroup& group = *it->second;
+        group.pacing_rate = bytes_per_second;
+        group.pacing_tokens = 0;
+        group.pacing_clock_us = multicast_clock_us();
+        hook_flush();
+        return true;
     }
 
-    void UdpMulticastManager::send_reliable_to_group(uint32_t group_id, const std::string& msg)
+    bool UdpMulticastManager::set_catch_up_history(uint32_t group_id, size_t max_msgs)
     {
-        std::shared_ptr<MulticastGroup> group;
-        uint32_t seq = 0;
-        
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it == groups_.end())
+            return false;
+
+        MulticastGroup& group = *it->second;
+        group.history_size = max_msgs;
+        while (group.history.size() > max_msgs)
+            group.history.pop_front();
+        return true;
+    }
+
+    int UdpMulticastManager::get_catch_up_packets(uint32_t group_id, std::vector<std::string>* packets)
+    {
+        // 持有锁时只复制shared_ptr, 生成包时不阻塞发送
+        std::vector<std::shared_ptr<const std::string> > msgs;
+        uint32_t live_seq = 0;
         {
             std::lock_guard<std::mutex> lock(mutex_);
             auto it = groups_.find(group_id);
             if (it == groups_.end())
             {
-                KCP_LOG_INFO("Group " << group_id << " not found when sending reliable message");
+                AK_INFO_LOG << "Group " << group_id << " not found when catching up";
+                return ASIO_KCP_MULTICAST_ERR_GROUP_NOT_FOUND;
+            }
+
+            MulticastGroup& group = *it->second;
+            msgs.assign(group.history.begin(), group.history.end());
+            live_seq = group.next_seq;
+            group.catch_up_count++;
+            group.catch_up_msg_count += msgs.size();
+        }
+
+        const uint32_t first_seq = live_seq - (uint32_t)msgs.size();
+        packets->clear();
+        packets->reserve(msgs.size() + 1);
+        packets->push_back(asio_kcp::making_mc_catch_up_begin_packet(group_id, first_seq, live_seq));
+        for (size_t i = 0; i < msgs.size(); ++i)
+            packets->push_back(asio_kcp::making_mc_catch_up_packet(group_id, first_seq + (uint32_t)i, msgs[i]->data(), msgs[i]->size()));
+        return 0;
+    }
+
+    void UdpMulticastManager::hook_group_receive(std::shared_ptr<MulticastGroup> group)
+    {
+        if (group->closed)
+            return;
+        group->receiving = true;
+        group->socket.async_receive_from(
+                boost::asio::buffer(group->recv_buf, sizeof(group->recv_buf)), group->recv_endpoint,
+                boost::bind(&UdpMulticastManager::handle_group_receive, this, group,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+    }
+
+    void UdpMulticastManager::handle_group_receive(std::shared_ptr<MulticastGroup> group,
+            const boost::system::error_code& error, size_t bytes_recvd)
+    {
+        // close_group取消了接收. 不再访问this, 最后一个持有group的回调结束时socket随group析构关闭.
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            group->receiving = false;
+            if (group->closed)
+            {
+                if (group->sending_count == 0)
+                    close_group_socket(*group);
                 return;
             }
-            group = it->second;
-            
-            // 获取并增加序列号
-            seq = group->next_seq++;
-            
-            // 保存消息以便重传
-            group->sent_msgs[seq] = msg;
-        }
-        
-        try
+        }
+
+        if (error)
         {
-            // 构建带序列号的消息
-            // 格式: [SEQ:4字节][MSG:余下字节]
-            std::string seq_msg;
-            seq_msg.resize(4 + msg.size());
-            
-            // 将序列号编码为网络字节序
-            uint32_t net_seq = htonl(seq);
-            std::memcpy(&seq_msg[0], &net_seq, 4);
-            
-            // 复制消息内容
-            std::memcpy(&seq_msg[4], msg.data(), msg.size());
-            
-            // 发送到组播地址
-            group->socket.send_to(boost::asio::buffer(seq_msg), group->endpoint);
-            
-            KCP_LOG_INFO("Sent reliable message (seq=" << seq << ") of " << msg.size() 
-                        << " bytes to multicast group " << group_id);
-            
-            // 设置重传定时器
-            group->retransmit_timer.expires_from_now(boost::posix_time::milliseconds(500)); // 500ms后重传
-            group->retransmit_timer.async_wait(boost::bind(&UdpMulticastManager::handle_retransmit, this, group_id));
+            AK_INFO_LOG << "multicast group " << group->group_id << " receive error: " << error.message();
         }
-        catch (const std::exception& e)
+        else
         {
-            KCP_LOG_ERROR("Error sending reliable message to multicast group " << group_id << ": " << e.what());
+            switch (asio_kcp::get_mc_packet_type(group->recv_buf, bytes_recvd))
+            {
+                case asio_kcp::eMcPacketNack:
+                    handle_nack(group, group->recv_buf, bytes_recvd);
+                    break;
+                case asio_kcp::eMcPacketFeedback:
+                    handle_feedback(group, group->recv_buf, bytes_recvd);
+                    break;
+                default:
+                    break;
+            }
         }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        hook_group_receive(group);
     }
 
-    void UdpMulticastManager::handle_retransmit(uint32_t group_id)
+    bool UdpMulticastManager::queue_retransmit(MulticastGroup& group, uint32_t seq, uint64_t now)
     {
-        std::shared_ptr<MulticastGroup> group;
-        std::map<uint32_t, std::string> msgs_to_retransmit;
-        
+        if (asio_kcp::mc_seq_diff(seq, group.window_base_seq()) < 0)
+            return false;
+
+        // 多个接收者NACK同一条消息时, 已在队列中或刚重传过的不再重传.
+        WindowSlot& slot = group.window[seq % ASIO_KCP_MULTICAST_WINDOW_SIZE];
+        if (slot.retransmit_pending || now - slot.last_send_clock < ASIO_KCP_MULTICAST_RETRANSMIT_HOLDOFF)
+            return true;
+        slot.retransmit_pending = true;
+        group.retransmit_queue.push_back(seq);
+        return true;
+    }
+
+    void UdpMulticastManager::hook_retransmit_timer(std::shared_ptr<MulticastGroup> group)
+    {
+        if (group->retransmit_queue.empty() || group->retransmit_timer_armed)
+            return;
+        group->retransmit_timer_armed = true;
+        group->retransmit_timer.expires_from_now(boost::posix_time::milliseconds(ASIO_KCP_MULTICAST_NACK_AGGREGATE_TIME));
+        group->retransmit_timer.async_wait(boost::bind(&UdpMulticastManager::handle_retransmit, this,
+                    group, boost::asio::placeholders::error));
+    }
+
+    void UdpMulticastManager::handle_nack(std::shared_ptr<MulticastGroup> group, const char* data, size_t len)
+    {
+        std::vector<asio_kcp::mc_nack_range> ranges;
+        if (!asio_kcp::grab_ranges_from_mc_nack_packet(data, len, &ranges))
+            return;
+
+        bool has_too_old = false;
         {
             std::lock_guard<std::mutex> lock(mutex_);
-            auto it = groups_.find(group_id);
-            if (it == groups_.end())
+            group->nack_recved_count++;
+
+            // 只响应反馈过的接收者. 否则伪造源地址的NACK可以让服务端把too_old发给任意地址, 或者不停地重传.
+            if (group->receivers.find(group->recv_endpoint) == group->receivers.end())
             {
-                return; // 组已被删除
+                group->nack_unknown_count++;
+                return;
             }
-            group = it->second;
-            
-            // 复制需要重传的消息
-            msgs_to_retransmit = group->sent_msgs;
-            
-            // 如果没有消息需要重传，直接返回
-            if (msgs_to_retransmit.empty())
+
+            const uint32_t window_base_seq = group->window_base_seq();
+            const uint64_t now = multicast_clock_ms();
+            for (const asio_kcp::mc_nack_range& range : ranges)
             {
-                return;
+                const uint32_t count = std::min<uint32_t>(range.count, ASIO_KCP_MULTICAST_WINDOW_SIZE);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    const uint32_t seq = range.first_seq + i;
+                    if (asio_kcp::mc_seq_diff(seq, group->next_seq) >= 0)
+                        break; // not sent yet.
+                    if (!queue_retransmit(*group, seq, now))
+                        has_too_old = true;
+                }
+            }
+
+            hook_retransmit_timer(group);
+
+            // 只告诉NACK的接收者, 其它接收者自己会NACK.
+            if (has_too_old)
+            {
+                group->too_old_count++;
+                queue_packet(*group, asio_kcp::making_mc_too_old_packet(window_base_seq), group->recv_endpoint);
             }
         }
-        
-        // 重传所有未确认的消息
-        for (const auto& kv : msgs_to_retransmit)
+    }
+
+    void UdpMulticastManager::handle_feedback(std::shared_ptr<MulticastGroup> group, const char* data, size_t len)
+    {
+        uint32_t ack_seq = 0;
+        std::vector<uint8_t> bitmap;
+        uint16_t loss_permille = 0;
+        if (!asio_kcp::grab_feedback_from_mc_packet(data, len, &ack_seq, &bitmap, &loss_permille))
+            return;
+
         {
-            uint32_t seq = kv.first;
-            const std::string& msg = kv.second;
-            
-            try
+            std::lock_guard<std::mutex> lock(mutex_);
+            group->feedback_recved_count++;
+
+            if (asio_kcp::mc_seq_diff(ack_seq, group->next_seq) > 0)
+                return; // broken feedback.
+
+            const uint64_t now = multicast_clock_ms();
+            auto it = group->receivers.find(group->recv_endpoint);
+            if (it == group->receivers.end())
             {
-                // 构建带序列号的消息
-                std::string seq_msg;
-                seq_msg.resize(4 + msg.size());
-                
-                uint32_t net_seq = htonl(seq);
-                std::memcpy(&seq_msg[0], &net_seq, 4);
-                std::memcpy(&seq_msg[4], msg.data(), msg.size());
-                
-                // 重传
-                group->socket.send_to(boost::asio::buffer(seq_msg), group->endpoint);
-                
-                KCP_LOG_INFO("Retransmitted message (seq=" << seq << ") to multicast group " << group_id);
+                if (group->receivers.size() >= ASIO_KCP_MULTICAST_MAX_RECEIVERS)
+                    group->prune_receivers(now);
+                if (group->receivers.size() < ASIO_KCP_MULTICAST_MAX_RECEIVERS)
+                    it = group->receivers.insert(std::make_pair(group->recv_endpoint, ReceiverState())).first;
+                else
+                    group->receivers_full_count++;
             }
-            catch (const std::exception& e)
+
+            // 满了的时候只重传, 不记录状态
+            if (it != group->receivers.end())
             {
-                KCP_LOG_ERROR("Error retransmitting to multicast group " << group_id << ": " << e.what());
+                it->second.ack_seq = ack_seq;
+                it->second.loss_permille = loss_permille;
+                it->second.last_feedback_clock = now;
+
+                // 按丢包最多的接收者调整FEC. 块变小时当前块在下一条消息时结束, 不再需要FEC时丢弃当前块.
+                group->fec_block_size = asio_kcp::mc_fec_block_size_for_loss(group->worst_loss_permille(now));
+                if (group->fec_block_size == 0)
+                    group->fec_block = asio_kcp::mc_fec_block();
             }
+
+            // 落后于重传窗口, 只能放弃. 没有记录的接收者不回复, 同handle_nack.
+            const uint32_t window_base_seq = group->window_base_seq();
+            if (it != group->receivers.end() && ack_seq != group->next_seq && asio_kcp::mc_seq_diff(ack_seq, window_base_seq) < 0)
+            {
+                group->too_old_count++;
+                queue_packet(*group, asio_kcp::making_mc_too_old_packet(window_base_seq), group->recv_endpoint);
+            }
+
+            // 最后一个收到的消息之前的空位都是丢失的. 之后的可能还在路上, 交给NACK和心跳.
+            int last_recved_bit = -1;
+            for (int i = (int)bitmap.size() * 8 - 1; i >= 0 && last_recved_bit < 0; --i)
+            {
+                if (bitmap[i / 8] & (1 << (i % 8)))
+                    last_recved_bit = i;
+            }
+            if (last_recved_bit >= 0)
+            {
+                queue_retransmit(*group, ack_seq, now);
+                for (int i = 0; i < last_recved_bit; ++i)
+                {
+                    if (!(bitmap[i / 8] & (1 << (i % 8))))
+                        queue_retransmit(*group, ack_seq + 1 + i, now);
+                }
+                hook_retransmit_timer(group);
+            }
+        }
+    }
+
+    void UdpMulticastManager::handle_retransmit(std::shared_ptr<MulticastGroup> group, const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        group->retransmit_timer_armed = false;
+        if (group->closed)
+            return;
+
+        // 重传也发到组播地址, 丢包往往不止一个接收者. 不受发送队列长度的限制.
+        const uint64_t now = multicast_clock_ms();
+        for (uint32_t seq : group->retransmit_queue)
+        {
+            WindowSlot& slot = group->window[seq % ASIO_KCP_MULTICAST_WINDOW_SIZE];
+            if (slot.seq != seq || !slot.retransmit_pending)
+                continue; // overwritten by new msg.
+            slot.retransmit_pending = false;
+            slot.last_send_clock = now;
+
+            OutPacket packet;
+            packet.endpoint = group->endpoint;
+            packet.head_len = (uint8_t)asio_kcp::making_mc_reliable_header(seq, packet.head);
+            packet.body = slot.msg;
+            queue_packet(*group, packet);
+            group->retransmit_count++;
         }
-        
-        // 重新设置定时器
-        group->retransmit_timer.expires_from_now(boost::posix_time::milliseconds(500));
-        group->retransmit_timer.async_wait(boost::bind(&UdpMulticastManager::handle_retransmit, this, group_id));
+        group->retransmit_queue.clear();
+    }
+
+    void UdpMulticastManager::hook_heartbeat_timer(std::shared_ptr<MulticastGroup> group)
+    {
+        if (group->heartbeat_timer_armed)
+            return;
+        group->heartbeat_timer_armed = true;
+        group->heartbeat_timer.expires_from_now(boost::posix_time::milliseconds(ASIO_KCP_MULTICAST_HEARTBEAT_INTERVAL));
+        group->heartbeat_timer.async_wait(boost::bind(&UdpMulticastManager::handle_heartbeat, this,
+                    group, boost::asio::placeholders::error));
     }
 
-    void UdpMulticastManager::handle_ack(uint32_t group_id, uint32_t seq)
+    void UdpMulticastManager::handle_heartbeat(std::shared_ptr<MulticastGroup> group, const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        group->heartbeat_timer_armed = false;
+        if (group->closed)
+            return;
+
+        const uint64_t now = multicast_clock_ms();
+        group->prune_receivers(now);
+
+        const uint64_t idle_time = now - group->last_reliable_send_clock;
+        if (idle_time > ASIO_KCP_MULTICAST_HEARTBEAT_DURATION)
+            return; // 接收者早就该发现丢包了. 下次发送可靠消息时再开始心跳.
+
+        if (idle_time >= ASIO_KCP_MULTICAST_HEARTBEAT_INTERVAL)
+        {
+            // 空闲时把没满的块也发出去, 末尾丢失的消息也能恢复
+            if (group->fec_block.count > 0)
+                queue_packet(*group, group->flush_fec_block(), group->endpoint);
+            queue_packet(*group, asio_kcp::making_mc_heartbeat_packet(group->next_seq), group->endpoint);
+        }
+        hook_heartbeat_timer(group);
+    }
+
+    void UdpMulticastManager::queue_packet(MulticastGroup& group, const OutPacket& packet)
+    {
+        const bool to_group = (packet.endpoint == group.endpoint);
+        const size_t frame_size = ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE + packet.size();
+        if (to_group && group.batch_delay > 0 && ASIO_KCP_MC_HEADER_SIZE + frame_size <= ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM)
+        {
+            if (group.batch_packet.size() + frame_size > ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM)
+                flush_batch(group);
+            if (group.batch_frame_count == 0)
+            {
+                group.batch_packet = asio_kcp::making_mc_batch_packet();
+                hook_batch_timer(group);
+            }
+            asio_kcp::append_frame_to_mc_batch_packet(&group.batch_packet, packet.head, packet.head_len,
+                    packet.body ? packet.body->data() : "", packet.body ? packet.body->size() : 0);
+            group.batch_frame_count++;
+            return;
+        }
+
+        // 保持组播包的顺序
+        if (to_group)
+            flush_batch(group);
+        group.send_queue.push_back(packet);
+        hook_flush();
+    }
+
+    void UdpMulticastManager::flush_batch(MulticastGroup& group)
+    {
+        if (group.batch_frame_count == 0)
+            return;
+
+        // 只有一个包时不用打包
+        OutPacket packet;
+        packet.endpoint = group.endpoint;
+        if (group.batch_frame_count == 1)
+            packet.body = std::make_shared<const std::string>(group.batch_packet, ASIO_KCP_MC_HEADER_SIZE + ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE);
+        else
+            packet.body = std::make_shared<const std::string>(std::move(group.batch_packet));
+        group.batched_packet_count += group.batch_frame_count;
+        group.batch_sent_count++;
+        group.batch_packet.clear();
+        group.batch_frame_count = 0;
+
+        group.send_queue.push_back(packet);
+        hook_flush();
+    }
+
+    void UdpMulticastManager::hook_batch_timer(MulticastGroup& group)
+    {
+        if (group.batch_timer_armed)
+            return;
+        group.batch_timer_armed = true;
+        group.batch_timer.expires_from_now(boost::posix_time::milliseconds(group.batch_delay));
+        group.batch_timer.async_wait(boost::bind(&UdpMulticastManager::handle_batch_timer, this,
+                    group.group_id, boost::asio::placeholders::error));
+    }
+
+    void UdpMulticastManager::handle_batch_timer(uint32_t group_id, const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it == groups_.end())
+            return;
+        it->second->batch_timer_armed = false;
+        flush_batch(*it->second);
+    }
+
+    bool UdpMulticastManager::set_batching(uint32_t group_id, uint32_t delay_ms)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        
         auto it = groups_.find(group_id);
         if (it == groups_.end())
+            return false;
+
+        it->second->batch_delay = delay_ms;
+        if (delay_ms == 0)
+            flush_batch(*it->second);
+        return true;
+    }
+
+    void UdpMulticastManager::flush_group(uint32_t group_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = groups_.find(group_id);
+        if (it != groups_.end())
+            flush_batch(*it->second);
+    }
+
+    void UdpMulticastManager::queue_packet(MulticastGroup& group, const std::string& packet,
+            const boost::asio::ip::udp::endpoint& endpoint)
+    {
+        OutPacket out_packet;
+        out_packet.endpoint = endpoint;
+        out_packet.body = std::make_shared<const std::string>(packet);
+        queue_packet(group, out_packet);
+    }
+
+    void UdpMulticastManager::hook_flush(void)
+    {
+        if (flush_posted_)
+            return;
+        flush_posted_ = true;
+        io_service_.post(boost::bind(&UdpMulticastManager::handle_flush, this));
+    }
+
+    void UdpMulticastManager::handle_flush(void)
+    {
         {
-            return; // 组已被删除
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_posted_ = false;
         }
-        
-        // 从sent_msgs中移除已确认的消息
-        it->second->sent_msgs.erase(seq);
-        
-        KCP_LOG_INFO("Acknowledged message (seq=" << seq << ") for multicast group " << group_id);
+        flush_send_queues();
+    }
+
+    void UdpMulticastManager::hook_pacing_timer(void)
+    {
+        if (pacing_timer_armed_)
+            return;
+        pacing_timer_armed_ = true;
+        pacing_timer_.expires_from_now(boost::posix_time::milliseconds(ASIO_KCP_MULTICAST_PACING_INTERVAL));
+        pacing_timer_.async_wait(boost::bind(&UdpMulticastManager::handle_pacing_timer, this,
+                    boost::asio::placeholders::error));
+    }
+
+    void UdpMulticastManager::handle_pacing_timer(const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pacing_timer_armed_ = false;
+        }
+        flush_send_queues();
+    }
+
+    void UdpMulticastManager::flush_send_queues(void)
+    {
+        // 不持有锁发送, 发送时可以继续排队
+        std::vector<std::pair<std::shared_ptr<MulticastGroup>, std::vector<OutPacket>>> batches;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const uint64_t now_us = multicast_clock_us();
+            for (auto& kv : groups_)
+            {
+                MulticastGroup& group = *kv.second;
+                if (group.send_queue.empty())
+                    continue;
+
+                if (group.pacing_rate > 0)
+                    group.refill_pacing_tokens(now_us);
+
+                std::vector<OutPacket> packets;
+                while (!group.send_queue.empty() && packets.size() < ASIO_KCP_MULTICAST_FLUSH_MAX_PACKETS
+                        && (group.pacing_rate == 0 || group.pacing_tokens > 0))
+                {
+                    if (group.pacing_rate > 0)
+                        group.pacing_tokens -= group.send_queue.front().size();
+                    packets.push_back(group.send_queue.front());
+                    group.send_queue.pop_front();
+                }
+                if (!packets.empty())
+                {
+                    group.sending_count++;
+                    batches.push_back(std::make_pair(kv.second, std::move(packets)));
+                }
+            }
+        }
+
+        std::vector<size_t> done_counts(batches.size());
+        std::vector<size_t> sendmmsg_counts(batches.size());
+        for (size_t i = 0; i < batches.size(); ++i)
+            done_counts[i] = send_packets(*batches[i].first, batches[i].second, &sendmmsg_counts[i]);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<const MulticastGroup*> blocked_groups;
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            MulticastGroup& group = *batches[i].first;
+            const std::vector<OutPacket>& packets = batches[i].second;
+            group.sent_packet_count += done_counts[i];
+            group.sendmmsg_count += sendmmsg_counts[i];
+
+            // 发送时被删除了
+            group.sending_count--;
+            if (group.closed)
+            {
+                if (group.sending_count == 0 && !group.receiving)
+                    close_group_socket(group);
+                continue;
+            }
+
+            // socket缓冲区满了, 没发出去的放回队列前面, 稍后再发
+            for (size_t j = packets.size(); j > done_counts[i]; --j)
+            {
+                if (group.pacing_rate > 0)
+                    group.pacing_tokens += packets[j - 1].size();
+                group.send_queue.push_front(packets[j - 1]);
+            }
+            if (done_counts[i] < packets.size())
+                blocked_groups.push_back(&group);
+        }
+
+        // 还没发完的: 限速的和socket缓冲区满的等下一个间隔, 其它的马上继续
+        for (auto& kv : groups_)
+        {
+            if (kv.second->send_queue.empty())
+                continue;
+            if (kv.second->pacing_rate > 0
+                    || std::find(blocked_groups.begin(), blocked_groups.end(), kv.second.get()) != blocked_groups.end())
+                hook_pacing_timer();
+            else
+                hook_flush();
+        }
+    }
+
+    size_t UdpMulticastManager::send_packets(MulticastGroup& group, const std::vector<OutPacket>& packets, size_t* sendmmsg_count)
+    {
+        const int fd = group.socket.native_handle();
+        *sendmmsg_count = 0;
+
+        struct mmsghdr msgs[ASIO_KCP_MULTICAST_SEND_BATCH];
+        struct iovec iovs[ASIO_KCP_MULTICAST_SEND_BATCH][2];
+        size_t done = 0;
+        while (done < packets.size())
+        {
+            const size_t count = std::min<size_t>(packets.size() - done, ASIO_KCP_MULTICAST_SEND_BATCH);
+            memset(msgs, 0, sizeof(msgs[0]) * count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const OutPacket& packet = packets[done + i];
+                size_t iov_count = 0;
+                if (packet.head_len > 0)
+                {
+                    iovs[i][iov_count].iov_base = (void*)packet.head;
+                    iovs[i][iov_count].iov_len = packet.head_len;
+                    iov_count++;
+                }
+                if (packet.body && !packet.body->empty())
+                {
+                    iovs[i][iov_count].iov_base = (void*)packet.body->data();
+                    iovs[i][iov_count].iov_len = packet.body->size();
+                    iov_count++;
+                }
+                msgs[i].msg_hdr.msg_name = (void*)packet.endpoint.data();
+                msgs[i].msg_hdr.msg_namelen = packet.endpoint.size();
+                msgs[i].msg_hdr.msg_iov = iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = iov_count;
+            }
+
+            const int sent = sendmmsg(fd, msgs, count, 0);
+            (*sendmmsg_count)++;
+            if (sent > 0)
+            {
+                done += sent;
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (sent < 0 && errno == EINTR)
+                continue;
+
+            // 第一个包发送失败, 丢弃它
+            AK_WARNING_LOG << "Error sending to multicast group " << group.group_id << ": " << strerror(errno);
+            done++;
+        }
+        return done;
     }
 
     std::string UdpMulticastManager::get_group_info(uint32_t group_id) const
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        
+
         auto it = groups_.find(group_id);
         if (it == groups_.end())
         {
             return "Group not found";
         }
-        
+
+        const MulticastGroup& group = *it->second;
         std::ostringstream oss;
         oss << "Group ID: " << group_id << "\n"
-            << "Multicast Address: " << it->second->endpoint.address().to_string() << "\n"
-            << "Port: " << it->second->endpoint.port() << "\n"
-            << "Pending Messages: " << it->second->sent_msgs.size();
-        
+            << "Multicast Address: " << group.endpoint.address().to_string() << "\n"
+            << "Port: " << group.endpoint.port() << "\n"
+            << "Next Seq: " << group.next_seq << "\n"
+            << "Window Base Seq: " << group.window_base_seq() << "\n"
+            << "Nack Recved: " << group.nack_recved_count << "\n"
+            << "Nack Unknown: " << group.nack_unknown_count << "\n"
+            << "Retransmitted: " << group.retransmit_count << "\n"
+            << "Too Old: " << group.too_old_count << "\n"
+            << "Feedback Recved: " << group.feedback_recved_count << "\n"
+            << "Window Full: " << group.window_full_count << "\n"
+            << "FEC Block Size: " << (int)group.fec_block_size << "\n"
+            << "FEC Sent: " << group.fec_sent_count << "\n"
+            << "Pacing Rate: " << group.pacing_rate << "\n"
+            << "Send Queue: " << group.send_queue.size() << "\n"
+            << "Queue Full: " << group.queue_full_count << "\n"
+            << "Sent Packets: " << group.sent_packet_count << "\n"
+            << "Sendmmsg Calls: " << group.sendmmsg_count << "\n"
+            << "Batch Delay: " << group.batch_delay << "\n"
+            << "Batched Packets: " << group.batched_packet_count << "\n"
+            << "Batches Sent: " << group.batch_sent_count << "\n"
+            << "Catch Up History: " << group.history.size() << "/" << group.history_size << "\n"
+            << "Catch Ups: " << group.catch_up_count << "\n"
+            << "Catch Up Msgs: " << group.catch_up_msg_count << "\n";
+
+        const uint64_t now = multicast_clock_ms();
+        size_t live_receiver_count = 0;
+        const uint32_t slowest_ack_seq = group.slowest_ack_seq(now, &live_receiver_count);
+        oss << "Receivers: " << group.receivers.size() << "\n"
+            << "Receivers Full: " << group.receivers_full_count << "\n"
+            << "Live Receivers: " << live_receiver_count << "\n"
+            << "Slowest Ack Seq: " << slowest_ack_seq << "\n"
+            << "Worst Loss Permille: " << group.worst_loss_permille(now);
+
         return oss.str();
     }
 
     void UdpMulticastManager::stop()
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        
+        pacing_timer_.cancel();
+
         for (auto& kv : groups_)
         {
-            try
-            {
-                kv.second->retransmit_timer.cancel();
-                kv.second->socket.close();
-            }
-            catch (const std::exception& e)
-            {
-                KCP_LOG_ERROR("Error stopping group " << kv.first << ": " << e.what());
-            }
+            close_group(*kv.second);
+            retire_group_stats(*kv.second);
         }
-        
+
         groups_.clear();
-        KCP_LOG_INFO("UDP Multicast Manager stopped");
+        AK_INFO_LOG << "UDP Multicast Manager stopped";
+    }
+
+    const UdpMulticastManager::GroupStatMetric UdpMulticastManager::group_stat_metrics[] = {
+        {"asio_kcp_multicast_reliable_msgs_sent_total", "Reliable multicast messages sent, not counting retransmits.", &MulticastGroup::reliable_sent_count},
+        {"asio_kcp_multicast_retransmits_total", "Reliable multicast messages retransmitted.", &MulticastGroup::retransmit_count},
+        {"asio_kcp_multicast_nacks_recved_total", "NACK packets received from multicast receivers.", &MulticastGroup::nack_recved_count},
+        {"asio_kcp_multicast_fec_sent_total", "FEC parity packets sent.", &MulticastGroup::fec_sent_count},
+        {"asio_kcp_multicast_queue_full_total", "Multicast messages rejected or dropped by a full send queue.", &MulticastGroup::queue_full_count},
+        {"asio_kcp_multicast_window_full_total", "Reliable multicast messages rejected by a full retransmit window.", &MulticastGroup::window_full_count},
+        {"asio_kcp_multicast_packets_sent_total", "UDP packets sent by the multicast groups.", &MulticastGroup::sent_packet_count},
+        {"asio_kcp_multicast_catch_ups_total", "Catch up requests answered.", &MulticastGroup::catch_up_count},
+    };
+    const size_t UdpMulticastManager::group_stat_metric_count = sizeof(group_stat_metrics) / sizeof(group_stat_metrics[0]);
+
+    uint64_t UdpMulticastManager::sum_group_stat(size_t index) const
+    {
+        uint64_t sum = retired_stats_[index];
+        for (const auto& kv : groups_)
+        {
+            sum += (*kv.second).*(group_stat_metrics[index].stat);
+        }
+        return sum;
+    }
+
+    void UdpMulticastManager::retire_group_stats(const MulticastGroup& group)
+    {
+        for (size_t i = 0; i < group_stat_metric_count; ++i)
+        {
+            retired_stats_[i] += group.*(group_stat_metrics[i].stat);
+        }
+    }
+
+    void UdpMulticastManager::register_metrics(metrics_registry& registry)
+    {
+        registry.add_callback("asio_kcp_multicast_groups", "Multicast groups alive.", eMetricsGauge,
+            [this]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return (double)groups_.size();
+            });
+
+        // 最慢的活跃接收者还没确认的可靠消息. 没有活跃接收者的组不计.
+        registry.add_callback("asio_kcp_multicast_pending_reliable_msgs", "Reliable multicast messages not acked by the slowest live receiver.", eMetricsGauge,
+            [this]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const uint64_t now = multicast_clock_ms();
+                uint64_t pending = 0;
+                for (const auto& kv : groups_)
+                {
+                    size_t live_receiver_count = 0;
+                    pending += kv.second->next_seq - kv.second->slowest_ack_seq(now, &live_receiver_count);
+                }
+                return (double)pending;
+            });
+
+        registry.add_callback("asio_kcp_multicast_send_queue_packets", "Packets waiting in the send queues of multicast groups.", eMetricsGauge,
+            [this]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                size_t queued = 0;
+                for (const auto& kv : groups_)
+                {
+                    queued += kv.second->send_queue.size();
+                }
+                return (double)queued;
+            });
+
+        for (size_t i = 0; i < group_stat_metric_count; ++i)
+        {
+            registry.add_callback(group_stat_metrics[i].name, group_stat_metrics[i].help, eMetricsCounter,
+                [this, i]() {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    return (double)sum_group_stat(i);
+                });
+        }
     }
 
     bool UdpMulticastManager::init_group_socket(MulticastGroup& group, const std::string& multicast_addr, uint16_t port)
@@ -292,27 +1044,33 @@ namespace kcp_svr
         {
             // 解析组播地址
             boost::asio::ip::address multicast_address = boost::asio::ip::address::from_string(multicast_addr);
-            
+
             // 创建组播endpoint
             group.endpoint = boost::asio::ip::udp::endpoint(multicast_address, port);
-            
+
             // 打开socket
             group.socket.open(group.endpoint.protocol());
-            
+
             // 设置socket选项
             group.socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
-            
+
+            // 绑定一个临时端口, 接收者把NACK单播到这个端口
+            group.socket.bind(boost::asio::ip::udp::endpoint(group.endpoint.protocol(), 0));
+
             // 设置TTL (存活时间)
             group.socket.set_option(boost::asio::ip::multicast::hops(1));
-            
+
             // 禁用本地回环
             group.socket.set_option(boost::asio::ip::multicast::enable_loopback(false));
-            
+
+            // 缓冲区满时不阻塞, 包留在发送队列里
+            group.socket.non_blocking(true);
+
             return true;
         }
         catch (const std::exception& e)
         {
-            KCP_LOG_ERROR("Error initializing multicast socket: " << e.what());
+            AK_WARNING_LOG << "Error initializing multicast socket: " << e.what();
             return false;
         }
     }
@@ -323,14 +1081,14 @@ namespace kcp_svr
         static std::mt19937 gen(rd());
         static std::uniform_int_distribution<> addr_dis(0, 255);
         static std::uniform_int_distribution<> port_dis(MULTICAST_PORT_MIN, MULTICAST_PORT_MAX);
-        
+
         // 生成组播地址 239.255.X.Y
         std::string addr = MULTICAST_PREFIX + std::to_string(addr_dis(gen)) + "." + std::to_string(addr_dis(gen));
-        
+
         // 生成端口
         uint16_t port = port_dis(gen);
-        
+
         return std::make_pair(addr, port);
     }
-    
-} 
\ No newline at end of file
+
+}
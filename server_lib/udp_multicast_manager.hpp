@@ -3,10 +3,60 @@
 #include <string>
 #include <memory>
 #include <map>
-#include <set>
+#include <vector>
+#include <deque>
 #include <mutex>
 #include <boost/asio.hpp>
 #include "kcp_typedef.hpp"
+#include "metrics.hpp"
+#include "../util/multicast_packet.hpp"
+
+// 可靠组播保留最近多少条消息用于重传. 更早的消息被NACK时回复too_old.
+#define ASIO_KCP_MULTICAST_WINDOW_SIZE 1024
+
+// 这段时间内收到的NACK合并成一次重传 (毫秒)
+#define ASIO_KCP_MULTICAST_NACK_AGGREGATE_TIME 5
+
+// 同一个序列号在这段时间内最多重传一次, 多个接收者NACK同一条消息时只重传一次 (毫秒)
+#define ASIO_KCP_MULTICAST_RETRANSMIT_HOLDOFF 20
+
+// 空闲时发送心跳的间隔, 接收者据此发现末尾丢失的消息 (毫秒)
+#define ASIO_KCP_MULTICAST_HEARTBEAT_INTERVAL 100
+
+// 最后一条可靠消息发出后, 继续发送心跳的时间 (毫秒)
+#define ASIO_KCP_MULTICAST_HEARTBEAT_DURATION 3000
+
+// 接收者这段时间没有反馈, 不再参与流控, 心跳时删除它的状态 (毫秒)
+#define ASIO_KCP_MULTICAST_RECEIVER_TIMEOUT 3000
+
+// 每个组最多记录多少个接收者. 满了之后新接收者的反馈不参与流控和FEC调整, NACK也被忽略, 直到超时的接收者被删除.
+#define ASIO_KCP_MULTICAST_MAX_RECEIVERS 4096
+
+// 每个组的发送队列最多排多少个包. 满了之后新消息被拒绝, 重传和控制包不受限制.
+#define ASIO_KCP_MULTICAST_SEND_QUEUE_SIZE 4096
+
+// 一次sendmmsg最多发多少个包
+#define ASIO_KCP_MULTICAST_SEND_BATCH 64
+
+// 一次发送最多处理一个组的多少个包, 剩下的下次再发, 避免一个组饿死其它组
+#define ASIO_KCP_MULTICAST_FLUSH_MAX_PACKETS 256
+
+// 限速的组每隔多久发送一次 (毫秒)
+#define ASIO_KCP_MULTICAST_PACING_INTERVAL 1
+
+// 限速的组空闲之后最多可以突发多长时间的流量, 至少一个ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM (毫秒)
+#define ASIO_KCP_MULTICAST_PACING_BURST_TIME 5
+
+// 打包小消息时一个数据报最大的UDP负载. 以太网MTU 1500减去IP和UDP头, 再给隧道留一些余量.
+#define ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM 1400
+
+// 可靠组播默认保留最近多少条消息, 中途加入的接收者通过自己的kcp连接补齐
+#define ASIO_KCP_MULTICAST_CATCH_UP_HISTORY 1024
+
+// send_reliable_to_group的返回值
+#define ASIO_KCP_MULTICAST_ERR_GROUP_NOT_FOUND -1
+#define ASIO_KCP_MULTICAST_ERR_WINDOW_FULL -2
+#define ASIO_KCP_MULTICAST_ERR_QUEUE_FULL -3
 
 namespace kcp_svr
 {
@@ -19,56 +69,253 @@ namespace kcp_svr
 
         // 创建一个组播组，返回组ID
         uint32_t create_group(const std::string& multicast_addr = "", uint16_t port = 0);
-        
+
         // 删除一个组播组
         bool delete_group(uint32_t group_id);
-        
-        // 发送消息到组播组
+
+        // 发送都是异步的: 包进入组的发送队列, 在io_service的线程中用sendmmsg批量发出, 调用者的线程不做系统调用.
+        // 包头和msg分开发送(scatter/gather), 不复制msg. 传入shared_ptr的版本在发出(可靠消息是移出重传窗口和补发历史)之前不能修改msg.
+
+        // 发送消息到组播组. 发送队列满时丢弃.
         void send_to_group(uint32_t group_id, const std::string& msg);
-        
-        // 发送消息到组播组，并维护可靠性（使用序列号、重传等机制）
-        void send_reliable_to_group(uint32_t group_id, const std::string& msg);
-        
+        void send_to_group(uint32_t group_id, std::shared_ptr<const std::string> msg);
+
+        // 发送消息到组播组，并维护可靠性
+        // 接收者发现序列号缺口后单播NACK给发送socket, 只重传被NACK的消息. 只响应已经反馈过的接收者的NACK.
+        // 接收者也定期单播反馈已收到的位置. 最慢的接收者落后一整个重传窗口时返回ASIO_KCP_MULTICAST_ERR_WINDOW_FULL, 消息不发送.
+        // 接收者反馈有丢包时, 每一块消息之后多发一个xor校验包, 块大小随丢包最多的接收者的丢包率调整. 块内丢一个消息时接收者自己恢复, 不用NACK.
+        // 发送队列满时返回ASIO_KCP_MULTICAST_ERR_QUEUE_FULL. 成功返回0.
+        int send_reliable_to_group(uint32_t group_id, const std::string& msg);
+        int send_reliable_to_group(uint32_t group_id, std::shared_ptr<const std::string> msg);
+
+        // 限制组的发送速率(字节/秒, 按UDP负载计算), 避免突发的消息冲垮接收者的缓冲区和交换机队列. 0表示不限速(默认).
+        bool set_pacing_rate(uint32_t group_id, uint64_t bytes_per_second);
+
+        // 把发往组播地址的小包打包成不超过ASIO_KCP_MULTICAST_BATCH_MAX_DATAGRAM的数据报, 减少包头和每个包的开销.
+        // 包最多延迟delay_ms发出. 0表示不打包(默认).
+        bool set_batching(uint32_t group_id, uint32_t delay_ms);
+
+        // 立即发出正在打包的数据报. 打包时请在每一帧的消息都发送完之后调用.
+        void flush_group(uint32_t group_id);
+
+        // 中途加入的接收者补齐加入之前的可靠消息:
+        //   接收者加入组播组之后通过kcp发来catch_up_request, 服务端用get_catch_up_packets生成回复, 按顺序通过同一个kcp连接发回.
+        //   回复是一个catch_up_begin和历史中的每一条消息. live_seq之前的消息走kcp, 从live_seq开始的消息走组播.
+        // 保留最近max_msgs条可靠消息用于补发, 默认ASIO_KCP_MULTICAST_CATCH_UP_HISTORY. 0表示不保留, 接收者只能从live_seq开始.
+        bool set_catch_up_history(uint32_t group_id, size_t max_msgs);
+
+        // 成功返回0, 组不存在时返回ASIO_KCP_MULTICAST_ERR_GROUP_NOT_FOUND.
+        int get_catch_up_packets(uint32_t group_id, std::vector<std::string>* packets);
+
         // 获取组播组信息
         std::string get_group_info(uint32_t group_id) const;
-        
+
         // 停止所有组播操作
         void stop();
-        
+
+        // 注册组数, 未确认的可靠消息, 重传等指标. 在采集时加锁计算, 不影响发送. this销毁之后不能再调用registry的render.
+        void register_metrics(metrics_registry& registry);
+
     private:
+        // 重传窗口中的一条消息
+        struct WindowSlot {
+            uint32_t seq;
+            std::shared_ptr<const std::string> msg;       // 重传时和包头一起发送
+            uint64_t last_send_clock;                     // 最后一次发送(或重传)的时间
+            bool retransmit_pending;                      // 已在重传队列中
+
+            WindowSlot() : seq(0), last_send_clock(0), retransmit_pending(false) {}
+        };
+
+        // 发送队列中的一个包: 包头 + body
+        struct OutPacket {
+            boost::asio::ip::udp::endpoint endpoint;
+            uint8_t head_len;
+            char head[ASIO_KCP_MC_RELIABLE_HEADER_SIZE];
+            std::shared_ptr<const std::string> body;
+
+            OutPacket() : head_len(0) {}
+            size_t size(void) const {return head_len + (body ? body->size() : 0);}
+        };
+
+        // 根据反馈记录的接收者状态
+        struct ReceiverState {
+            uint32_t ack_seq;                             // 之前的消息都已收到
+            uint16_t loss_permille;                       // 修复之前的丢包率
+            uint64_t last_feedback_clock;
+
+            ReceiverState() : ack_seq(0), loss_permille(0), last_feedback_clock(0) {}
+        };
+
         // 组播组结构
         struct MulticastGroup {
+            uint32_t group_id;
             boost::asio::ip::udp::endpoint endpoint;      // 组播地址和端口
-            boost::asio::ip::udp::socket socket;          // 用于发送的socket
+            boost::asio::ip::udp::socket socket;          // 用于发送的socket, 也接收接收者单播的NACK
             uint32_t next_seq;                            // 下一个序列号
-            std::map<uint32_t, std::string> sent_msgs;    // 已发送但未确认的消息
-            boost::asio::deadline_timer retransmit_timer; // 重传定时器
-            
-            MulticastGroup(boost::asio::io_service& io_service) 
-                : socket(io_service), next_seq(0), retransmit_timer(io_service) {}
+            uint64_t reliable_sent_count;                 // 已发送的可靠消息数量
+            std::vector<WindowSlot> window;               // 环形重传窗口, 按 seq % ASIO_KCP_MULTICAST_WINDOW_SIZE 索引
+            std::vector<uint32_t> retransmit_queue;       // 等待合并重传的序列号
+            boost::asio::deadline_timer retransmit_timer; // 重传合并定时器
+            bool retransmit_timer_armed;
+            boost::asio::deadline_timer heartbeat_timer;  // 心跳定时器
+            bool heartbeat_timer_armed;
+            uint64_t last_reliable_send_clock;
+
+            uint32_t batch_delay;                         // 打包的最长延迟(毫秒), 0表示不打包
+            std::string batch_packet;                     // 正在打包的数据报
+            size_t batch_frame_count;
+            boost::asio::deadline_timer batch_timer;
+            bool batch_timer_armed;
+
+            std::deque<OutPacket> send_queue;
+            uint64_t pacing_rate;                         // 字节/秒, 0表示不限速
+            int64_t pacing_tokens;                        // 还可以发送的字节数, 可以是负数
+            uint64_t pacing_clock_us;                     // 上次补充pacing_tokens的时间
+
+            boost::asio::ip::udp::endpoint recv_endpoint; // NACK或反馈的发送者
+            char recv_buf[1500];
+            std::map<boost::asio::ip::udp::endpoint, ReceiverState> receivers;
+
+            std::deque<std::shared_ptr<const std::string> > history; // 补发历史, 是[next_seq - history.size(), next_seq)的消息
+            size_t history_size;                          // history最多保留的消息数
+
+            uint8_t fec_block_size;                       // 每块的消息数, 0表示不发FEC
+            asio_kcp::mc_fec_block fec_block;             // 正在累积的块
+
+            // 统计
+            uint64_t nack_recved_count;
+            uint64_t nack_unknown_count;                  // 不在receivers中的接收者的NACK, 被忽略
+            uint64_t retransmit_count;
+            uint64_t too_old_count;
+            uint64_t feedback_recved_count;
+            uint64_t window_full_count;
+            uint64_t fec_sent_count;
+            uint64_t queue_full_count;
+            uint64_t sent_packet_count;
+            uint64_t sendmmsg_count;
+            uint64_t batched_packet_count;
+            uint64_t batch_sent_count;
+            uint64_t catch_up_count;
+            uint64_t catch_up_msg_count;
+            uint64_t receivers_full_count;
+
+            // 删除的组等正在进行的sendmmsg和接收结束后才关闭socket, 否则fd可能被复用, 包发到别的socket.
+            // 这三个和socket的成员函数都在持有mutex_时访问. 定时器和接收的回调用closed判断组是否已删除.
+            bool closed;
+            int sending_count;                            // 正在发送的flush_send_queues个数
+            bool receiving;                               // 有未完成的async_receive_from
+
+            MulticastGroup(boost::asio::io_service& io_service)
+                : group_id(0), socket(io_service), next_seq(0), reliable_sent_count(0),
+                window(ASIO_KCP_MULTICAST_WINDOW_SIZE), retransmit_timer(io_service), retransmit_timer_armed(false),
+                heartbeat_timer(io_service), heartbeat_timer_armed(false), last_reliable_send_clock(0),
+                batch_delay(0), batch_frame_count(0), batch_timer(io_service), batch_timer_armed(false),
+                pacing_rate(0), pacing_tokens(0), pacing_clock_us(0), history_size(ASIO_KCP_MULTICAST_CATCH_UP_HISTORY), fec_block_size(0),
+                nack_recved_count(0), nack_unknown_count(0), retransmit_count(0), too_old_count(0), feedback_recved_count(0), window_full_count(0), fec_sent_count(0),
+                queue_full_count(0), sent_packet_count(0), sendmmsg_count(0), batched_packet_count(0), batch_sent_count(0),
+                catch_up_count(0), catch_up_msg_count(0), receivers_full_count(0), closed(false), sending_count(0), receiving(false) {}
+
+            // 最早还能重传的序列号
+            uint32_t window_base_seq(void) const;
+
+            // 最慢的活跃接收者的ack_seq. 没有活跃接收者时返回next_seq.
+            uint32_t slowest_ack_seq(uint64_t now, size_t* live_receiver_count) const;
+
+            // 活跃接收者中最大的丢包率
+            uint16_t worst_loss_permille(uint64_t now) const;
+
+            // 删除超时的接收者. 接收者可能换端口重新加入, 也可能是伪造的反馈, 不删除的话receivers一直增长.
+            void prune_receivers(uint64_t now);
+
+            // 令牌桶: 按pacing_rate补充pacing_tokens, 最多积累ASIO_KCP_MULTICAST_PACING_BURST_TIME的流量. 需要持有mutex_.
+            void refill_pacing_tokens(uint64_t now_us);
+
+            // 把fec_block编码成校验包并开始新的块. 需要持有mutex_.
+            std::string flush_fec_block(void);
         };
-        
+
         // 初始化组播socket
         bool init_group_socket(MulticastGroup& group, const std::string& multicast_addr, uint16_t port);
-        
+
+        // 需要持有mutex_. 停止组的定时器并关闭socket. 正在发送或接收时由最后结束的flush_send_queues或handle_group_receive关闭, 被取消的接收由group析构关闭.
+        void close_group(MulticastGroup& group);
+        void close_group_socket(MulticastGroup& group);
+
+        // 接收NACK. hook_group_receive需要持有mutex_.
+        void hook_group_receive(std::shared_ptr<MulticastGroup> group);
+        void handle_group_receive(std::shared_ptr<MulticastGroup> group, const boost::system::error_code& error, size_t bytes_recvd);
+        void handle_nack(std::shared_ptr<MulticastGroup> group, const char* data, size_t len);
+        void handle_feedback(std::shared_ptr<MulticastGroup> group, const char* data, size_t len);
+
+        // 把seq加入重传队列, 需要持有mutex_. seq已经不在窗口中时返回false.
+        bool queue_retransmit(MulticastGroup& group, uint32_t seq, uint64_t now);
+        void hook_retransmit_timer(std::shared_ptr<MulticastGroup> group);
+
         // 处理重传
-        void handle_retransmit(uint32_t group_id);
-        
-        // 处理确认接收
-        void handle_ack(uint32_t group_id, uint32_t seq);
-        
+        void handle_retransmit(std::shared_ptr<MulticastGroup> group, const boost::system::error_code& error);
+
+        // 空闲时发送心跳
+        void hook_heartbeat_timer(std::shared_ptr<MulticastGroup> group);
+        void handle_heartbeat(std::shared_ptr<MulticastGroup> group, const boost::system::error_code& error);
+
+        // 以下函数需要持有mutex_. 把包放进组的发送队列. 打包时发往组播地址的小包先放进batch_packet.
+        void queue_packet(MulticastGroup& group, const OutPacket& packet);
+        void queue_packet(MulticastGroup& group, const std::string& packet, const boost::asio::ip::udp::endpoint& endpoint);
+
+        // 需要持有mutex_. 把batch_packet放进发送队列.
+        void flush_batch(MulticastGroup& group);
+        void hook_batch_timer(MulticastGroup& group);
+        void handle_batch_timer(uint32_t group_id, const boost::system::error_code& error);
+
+        // 需要持有mutex_. 尽快在io_service的线程中发送.
+        void hook_flush(void);
+        void handle_flush(void);
+
+        // 需要持有mutex_. 限速的组ASIO_KCP_MULTICAST_PACING_INTERVAL之后再发送.
+        void hook_pacing_timer(void);
+        void handle_pacing_timer(const boost::system::error_code& error);
+
+        // 一轮处理所有组: 按各组的限速从发送队列取包, 用sendmmsg发出
+        void flush_send_queues(void);
+
+        // 返回处理了几个包(发出的和出错丢弃的). 少于packets.size()时后面的包暂时发不出去(EAGAIN).
+        size_t send_packets(MulticastGroup& group, const std::vector<OutPacket>& packets, size_t* sendmmsg_count);
+
+        // 导出为指标的组统计, 见udp_multicast_manager.cpp中的group_stat_metrics
+        struct GroupStatMetric {
+            const char* name;
+            const char* help;
+            uint64_t MulticastGroup::* stat;
+        };
+        static const GroupStatMetric group_stat_metrics[];
+        static const size_t group_stat_metric_count;
+
+        // 需要持有mutex_. 所有组(包括已删除的组)的group_stat_metrics[index]之和
+        uint64_t sum_group_stat(size_t index) const;
+
+        // 需要持有mutex_. 删除组之前保存它的统计, 使计数器单调增加
+        void retire_group_stats(const MulticastGroup& group);
+
         // 生成一个随机未使用的组播地址和端口
         std::pair<std::string, uint16_t> generate_multicast_address();
-        
+
     private:
         boost::asio::io_service& io_service_;
         std::map<uint32_t, std::shared_ptr<MulticastGroup>> groups_;
         uint32_t next_group_id_;
-        std::mutex mutex_;
-        
+        mutable std::mutex mutex_;
+
+        bool flush_posted_;
+        boost::asio::deadline_timer pacing_timer_;
+        bool pacing_timer_armed_;
+
+        // 已删除的组的统计, 按group_stat_metrics索引
+        std::vector<uint64_t> retired_stats_;
+
         // 组播地址范围
         static const std::string MULTICAST_PREFIX;
         static const uint16_t MULTICAST_PORT_MIN;
         static const uint16_t MULTICAST_PORT_MAX;
     };
-} 
\ No newline at end of file
+}
@@ -0,0 +1,156 @@
+#include "impair_proxy.hpp"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+using boost::asio::ip::udp;
+using kcp_svr::impaired_link_stats;
+
+static uint64_t proxy_clock_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string link_stats_str(const impaired_link_stats& stats)
+{
+    std::ostringstream ostr;
+    ostr << "packets:" << stats.packets << " lost:" << stats.lost << " queue_dropped:" << stats.queue_dropped
+        << " reordered:" << stats.reordered << " duplicated:" << stats.duplicated;
+    return ostr.str();
+}
+
+impair_proxy::session::session(boost::asio::io_service& io_service, const kcp_svr::impairment_profile& profile, uint32_t seed) :
+    server_socket(io_service, udp::endpoint(udp::v4(), 0)),
+    to_server(profile, seed),
+    to_client(profile, seed + 1)
+{
+}
+
+impair_proxy::impair_proxy(boost::asio::io_service& io_service, int listen_port,
+        const std::string& server_host, int server_port, const kcp_svr::impairment_profile& profile, uint32_t seed) :
+    io_service_(io_service),
+    client_socket_(io_service, udp::endpoint(udp::v4(), listen_port)),
+    profile_(profile),
+    seed_(seed),
+    next_order_(0),
+    deliver_timer_(io_service),
+    deliver_timer_us_(0)
+{
+    udp::resolver resolver(io_service_);
+    udp::resolver::query query(udp::v4(), server_host, std::to_string(server_port));
+    server_endpoint_ = *resolver.resolve(query);
+    hook_client_recv();
+}
+
+std::string impair_proxy::stats_str(void) const
+{
+    std::ostringstream ostr;
+    for (size_t i = 0; i < sessions_in_order_.size(); ++i)
+    {
+        const session& s = *sessions_in_order_[i];
+        ostr << s.client_endpoint << " -> server " << link_stats_str(s.to_server.stats()) << "\n"
+            << s.client_endpoint << " <- server " << link_stats_str(s.to_client.stats()) << "\n";
+    }
+    return ostr.str();
+}
+
+void impair_proxy::hook_client_recv(void)
+{
+    client_socket_.async_receive_from(
+            boost::asio::buffer(client_recv_buf_, sizeof(client_recv_buf_)), client_endpoint_recving_,
+            boost::bind(&impair_proxy::handle_client_recv, this,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+}
+
+void impair_proxy::handle_client_recv(const boost::system::error_code& ec, std::size_t bytes_recvd)
+{
+    if (ec)
+    {
+        std::cerr << "client recv error: " << ec.message() << std::endl;
+        hook_client_recv();
+        return;
+    }
+
+    std::shared_ptr<session>& session_ptr = sessions_[client_endpoint_recving_];
+    if (!session_ptr)
+    {
+        session_ptr.reset(new session(io_service_, profile_, seed_ + 2 * (uint32_t)sessions_in_order_.size()));
+        session_ptr->client_endpoint = client_endpoint_recving_;
+        sessions_in_order_.push_back(session_ptr);
+        std::cout << "new client " << client_endpoint_recving_ << " from port " << session_ptr->server_socket.local_endpoint().port() << std::endl;
+        hook_server_recv(session_ptr);
+    }
+    impair_packet(session_ptr, true, client_recv_buf_, bytes_recvd);
+    hook_client_recv();
+}
+
+void impair_proxy::hook_server_recv(const std::shared_ptr<session>& session_ptr)
+{
+    session_ptr->server_socket.async_receive_from(
+            boost::asio::buffer(session_ptr->recv_buf, sizeof(session_ptr->recv_buf)), session_ptr->server_endpoint_recving,
+            boost::bind(&impair_proxy::handle_server_recv, this, session_ptr,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+}
+
+void impair_proxy::handle_server_recv(std::shared_ptr<session> session_ptr, const boost::system::error_code& ec, std::size_t bytes_recvd)
+{
+    if (ec)
+        std::cerr << "server recv error: " << ec.message() << std::endl;
+    else
+        impair_packet(session_ptr, false, session_ptr->recv_buf, bytes_recvd);
+    hook_server_recv(session_ptr);
+}
+
+void impair_proxy::impair_packet(const std::shared_ptr<session>& session_ptr, bool to_server, const char* data, size_t len)
+{
+    std::vector<uint64_t> deliver_times_us;
+    (to_server ? session_ptr->to_server : session_ptr->to_client).send(proxy_clock_us(), len, &deliver_times_us);
+    for (size_t i = 0; i < deliver_times_us.size(); ++i)
+    {
+        delayed_packet packet;
+        packet.deliver_us = deliver_times_us[i];
+        packet.order = next_order_++;
+        packet.session_ptr = session_ptr;
+        packet.to_server = to_server;
+        packet.data.assign(data, len);
+        delayed_packets_.push(packet);
+    }
+    if (!delayed_packets_.empty() && (deliver_timer_us_ == 0 || delayed_packets_.top().deliver_us < deliver_timer_us_))
+        hook_deliver_timer();
+}
+
+void impair_proxy::hook_deliver_timer(void)
+{
+    deliver_timer_us_ = delayed_packets_.top().deliver_us;
+    const uint64_t now_us = proxy_clock_us();
+    deliver_timer_.expires_from_now(boost::posix_time::microseconds(deliver_timer_us_ > now_us ? deliver_timer_us_ - now_us : 0));
+    deliver_timer_.async_wait(boost::bind(&impair_proxy::handle_deliver_timer, this, boost::asio::placeholders::error));
+}
+
+void impair_proxy::handle_deliver_timer(const boost::system::error_code& ec)
+{
+    if (ec == boost::asio::error::operation_aborted)
+        return; // hooked again for an earlier packet
+
+    const uint64_t now_us = proxy_clock_us();
+    while (!delayed_packets_.empty() && delayed_packets_.top().deliver_us <= now_us)
+    {
+        const delayed_packet& packet = delayed_packets_.top();
+        boost::system::error_code send_ec;
+        if (packet.to_server)
+            packet.session_ptr->server_socket.send_to(boost::asio::buffer(packet.data), server_endpoint_, 0, send_ec);
+        else
+            client_socket_.send_to(boost::asio::buffer(packet.data), packet.session_ptr->client_endpoint, 0, send_ec);
+        if (send_ec)
+            std::cerr << "send error: " << send_ec.message() << std::endl;
+        delayed_packets_.pop();
+    }
+
+    deliver_timer_us_ = 0;
+    if (!delayed_packets_.empty())
+        hook_deliver_timer();
+}
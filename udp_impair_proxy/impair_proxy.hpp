@@ -0,0 +1,82 @@
+#ifndef _UDP_IMPAIR_PROXY_HPP_
+#define _UDP_IMPAIR_PROXY_HPP_
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include "network_impairment.hpp"
+
+// Forward udp packets between the clients and a server, passing every packet through an impaired_link.
+// Every client gets its own udp socket to the server, so the server sees one address for every client.
+// The links of the n-th client are seeded by seed + 2n (client to server) and seed + 2n + 1 (server to client),
+// so the same run with the same seed drops and delays the same packets.
+class impair_proxy
+  : private boost::noncopyable
+{
+public:
+    impair_proxy(boost::asio::io_service& io_service, int listen_port,
+            const std::string& server_host, int server_port, const kcp_svr::impairment_profile& profile, uint32_t seed);
+
+    // the stats of all clients, one line a direction.
+    std::string stats_str(void) const;
+
+private:
+    struct session
+    {
+        session(boost::asio::io_service& io_service, const kcp_svr::impairment_profile& profile, uint32_t seed);
+
+        boost::asio::ip::udp::endpoint client_endpoint;
+        boost::asio::ip::udp::socket server_socket;
+        boost::asio::ip::udp::endpoint server_endpoint_recving;
+        kcp_svr::impaired_link to_server;
+        kcp_svr::impaired_link to_client;
+        char recv_buf[1024 * 64];
+    };
+
+    struct delayed_packet
+    {
+        uint64_t deliver_us;
+        uint64_t order;          // the packets with the same deliver_us keep their order
+        std::shared_ptr<session> session_ptr;
+        bool to_server;
+        std::string data;
+
+        bool operator<(const delayed_packet& other) const
+        {
+            return deliver_us != other.deliver_us ? deliver_us > other.deliver_us : order > other.order;
+        }
+    };
+
+    void hook_client_recv(void);
+    void handle_client_recv(const boost::system::error_code& ec, std::size_t bytes_recvd);
+
+    void hook_server_recv(const std::shared_ptr<session>& session_ptr);
+    void handle_server_recv(std::shared_ptr<session> session_ptr, const boost::system::error_code& ec, std::size_t bytes_recvd);
+
+    void impair_packet(const std::shared_ptr<session>& session_ptr, bool to_server, const char* data, size_t len);
+    void hook_deliver_timer(void);
+    void handle_deliver_timer(const boost::system::error_code& ec);
+
+    boost::asio::io_service& io_service_;
+    boost::asio::ip::udp::socket client_socket_;
+    boost::asio::ip::udp::endpoint client_endpoint_recving_;
+    char client_recv_buf_[1024 * 64];
+    boost::asio::ip::udp::endpoint server_endpoint_;
+
+    kcp_svr::impairment_profile profile_;
+    uint32_t seed_;
+    std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<session> > sessions_;
+    std::vector<std::shared_ptr<session> > sessions_in_order_; // for stats_str
+
+    std::priority_queue<delayed_packet> delayed_packets_;
+    uint64_t next_order_;
+    boost::asio::deadline_timer deliver_timer_;
+    uint64_t deliver_timer_us_; // 0 if the timer is not waiting
+};
+
+#endif // _UDP_IMPAIR_PROXY_HPP_
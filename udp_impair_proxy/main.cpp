@@ -0,0 +1,72 @@
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include "impair_proxy.hpp"
+
+#define PRINT_STATS_INTERVAL_SECONDS 10
+
+static void print_builtin_profiles(void)
+{
+    const std::vector<std::string>& names = kcp_svr::builtin_impairment_profile_names();
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        kcp_svr::impairment_profile profile;
+        kcp_svr::get_builtin_impairment_profile(names[i], &profile);
+        std::cout << kcp_svr::impairment_profile_str(profile) << std::endl;
+    }
+}
+
+static void handle_stats_timer(boost::asio::deadline_timer* timer, const impair_proxy* proxy)
+{
+    std::cout << proxy->stats_str() << std::flush;
+    timer->expires_from_now(boost::posix_time::seconds(PRINT_STATS_INTERVAL_SECONDS));
+    timer->async_wait(boost::bind(&handle_stats_timer, timer, proxy));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 2 && std::string(argv[1]) == "-l")
+    {
+        print_builtin_profiles();
+        return 0;
+    }
+    if (argc != 5 && argc != 6)
+    {
+        std::cerr << "Usage: udp_impair_proxy <listen_port> <server_host> <server_port> <profile> [seed]\n";
+        std::cerr << "       udp_impair_proxy -l    # print the builtin profiles\n";
+        std::cerr << "  profile is a builtin profile name or the path of a profile file. seed is 1 by default.\n";
+        std::cerr << "  ./server/server 0.0.0.0 12345\n";
+        std::cerr << "  ./udp_impair_proxy/udp_impair_proxy 12346 127.0.0.1 12345 network_lag\n";
+        std::cerr << "  ./client_with_asio/client_with_asio 23445 127.0.0.1 12346 500\n";
+        return 1;
+    }
+
+    kcp_svr::impairment_profile profile;
+    std::string err;
+    if (!kcp_svr::load_impairment_profile(argv[4], &profile, &err))
+    {
+        std::cerr << "load profile failed: " << err << std::endl;
+        return 1;
+    }
+    const uint32_t seed = (argc == 6 ? (uint32_t)strtoul(argv[5], NULL, 10) : 1);
+    std::cout << kcp_svr::impairment_profile_str(profile) << "seed = " << seed << std::endl;
+
+    try
+    {
+        boost::asio::io_service io_service;
+        impair_proxy proxy(io_service, atoi(argv[1]), argv[2], atoi(argv[3]), profile, seed);
+
+        boost::asio::deadline_timer stats_timer(io_service);
+        stats_timer.expires_from_now(boost::posix_time::seconds(PRINT_STATS_INTERVAL_SECONDS));
+        stats_timer.async_wait(boost::bind(&handle_stats_timer, &stats_timer, &proxy));
+
+        io_service.run();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "exception: " << e.what() << "\n";
+    }
+    return 0;
+}
@@ -142,6 +142,11 @@ void client_event_callback(kcp_conv_t conv, asio_kcp::eEventType event_type, con
             g_perf_stats.recv_msgs++;
             g_perf_stats.recv_bytes += msg.size();
             
+            // 加入之前的可靠组播消息, 由组播客户端交付
+            if (g_multicast_client && g_multicast_client->handle_catch_up_packet(msg.data(), msg.size())) {
+                break;
+            }
+            
             // 检查是否是组播信息通知
             if (msg.find("MULTICAST:") == 0) {
                 // 格式: MULTICAST:addr:port:group_id
@@ -165,6 +170,11 @@ void client_event_callback(kcp_conv_t conv, asio_kcp::eEventType event_type, con
                         g_multicast_client->set_message_callback(multicast_message_callback);
                         
                         if (g_multicast_client->join_group(g_multicast_addr, g_multicast_port, g_multicast_group_id) == 0) {
+                            // 通过kcp补齐加入之前的消息
+                            std::string catch_up_request;
+                            if (g_multicast_client->begin_catch_up(g_multicast_group_id, &catch_up_request) == 0) {
+                                client->send_msg(catch_up_request);
+                            }
                             g_multicast_client->start();
                             std::cout << "Joined multicast group " << g_multicast_group_id << std::endl;
                         } else {
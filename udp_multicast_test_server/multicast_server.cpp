@@ -87,6 +87,10 @@ void event_callback(kcp_conv_t conv, kcp_svr::eEventType event_type, std::shared
             break;
         }
         case kcp_svr::eRcvMsg: {
+            // 中途加入的客户端请求补齐组播消息
+            if (msg && g_server->handle_multicast_catch_up_request(conv, *msg)) {
+                break;
+            }
             if (msg) {
                 // 更新性能统计信息
                 g_perf_stats.total_msgs++;
@@ -8,6 +8,9 @@
 #define ASIO_KCP_CONNECT_PACKET "asio_kcp_connect_package get_conv"
 #define ASIO_KCP_SEND_BACK_CONV_PACKET "asio_kcp_connect_back_package get_conv:"
 #define ASIO_KCP_DISCONNECT_PACKET "asio_kcp_disconnect_package"
+#define ASIO_KCP_RESUME_PACKET "asio_kcp_resume_package"
+#define ASIO_KCP_RESUME_BACK_PACKET "asio_kcp_resume_back_package"
+#define ASIO_KCP_RESUME_TOKEN_TAG " token:"
 
 namespace asio_kcp {
 
@@ -28,10 +31,15 @@ bool is_send_back_conv_packet(const char* data, size_t len)
         memcmp(data, ASIO_KCP_SEND_BACK_CONV_PACKET, sizeof(ASIO_KCP_SEND_BACK_CONV_PACKET) - 1) == 0);
 }
 
-std::string making_send_back_conv_packet(uint32_t conv)
+std::string making_send_back_conv_packet(uint32_t conv, uint64_t resume_token)
 {
     char str_send_back_conv[256] = "";
-    size_t n = snprintf(str_send_back_conv, sizeof(str_send_back_conv), "%s %u", ASIO_KCP_SEND_BACK_CONV_PACKET, conv);
+    size_t n = 0;
+    if (resume_token == 0)
+        n = snprintf(str_send_back_conv, sizeof(str_send_back_conv), "%s %u", ASIO_KCP_SEND_BACK_CONV_PACKET, conv);
+    else
+        n = snprintf(str_send_back_conv, sizeof(str_send_back_conv), "%s %u%s%016llx",
+                ASIO_KCP_SEND_BACK_CONV_PACKET, conv, ASIO_KCP_RESUME_TOKEN_TAG, (unsigned long long)resume_token);
     return std::string(str_send_back_conv, n);
 }
 
@@ -41,6 +49,60 @@ uint32_t grab_conv_from_send_back_conv_packet(const char* data, size_t len)
     return conv;
 }
 
+uint64_t grab_resume_token_from_send_back_conv_packet(const char* data, size_t len)
+{
+    const std::string packet(data, len);
+    const size_t pos = packet.find(ASIO_KCP_RESUME_TOKEN_TAG);
+    if (pos == std::string::npos)
+        return 0;
+    return strtoull(packet.c_str() + pos + sizeof(ASIO_KCP_RESUME_TOKEN_TAG) - 1, NULL, 16);
+}
+
+
+
+std::string making_resume_packet(uint32_t conv, uint64_t resume_token)
+{
+    char str_resume_packet[256] = "";
+    size_t n = snprintf(str_resume_packet, sizeof(str_resume_packet), "%s %010u %016llx",
+            ASIO_KCP_RESUME_PACKET, conv, (unsigned long long)resume_token);
+    return std::string(str_resume_packet, n);
+}
+
+bool is_resume_packet(const char* data, size_t len)
+{
+    return (len >= ASIO_KCP_RESUME_PACKET_HEADER_SIZE &&
+        memcmp(data, ASIO_KCP_RESUME_PACKET " ", sizeof(ASIO_KCP_RESUME_PACKET)) == 0);
+}
+
+bool grab_conv_and_token_from_resume_packet(const char* data, size_t len, uint32_t* conv, uint64_t* resume_token)
+{
+    if (!is_resume_packet(data, len))
+        return false;
+
+    char str_conv[11] = "";
+    char str_token[17] = "";
+    memcpy(str_conv, data + sizeof(ASIO_KCP_RESUME_PACKET), 10);
+    memcpy(str_token, data + sizeof(ASIO_KCP_RESUME_PACKET) + 11, 16);
+    char* conv_end = NULL;
+    char* token_end = NULL;
+    *conv = strtoul(str_conv, &conv_end, 10);
+    *resume_token = strtoull(str_token, &token_end, 16);
+    return (conv_end == str_conv + 10 && token_end == str_token + 16);
+}
+
+std::string making_resume_back_packet(uint32_t conv)
+{
+    char str_resume_back_packet[256] = "";
+    size_t n = snprintf(str_resume_back_packet, sizeof(str_resume_back_packet), "%s %u", ASIO_KCP_RESUME_BACK_PACKET, conv);
+    return std::string(str_resume_back_packet, n);
+}
+
+bool is_resume_back_packet(const char* data, size_t len)
+{
+    return (len > sizeof(ASIO_KCP_RESUME_BACK_PACKET) &&
+        memcmp(data, ASIO_KCP_RESUME_BACK_PACKET, sizeof(ASIO_KCP_RESUME_BACK_PACKET) - 1) == 0);
+}
+
 
 
 
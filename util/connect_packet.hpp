@@ -13,9 +13,25 @@ namespace asio_kcp {
 std::string making_connect_packet(void);
 bool is_connect_packet(const char* data, size_t len);
 
-std::string making_send_back_conv_packet(uint32_t conv);
+// resume_token is optional. 0 means no token. Old client ignores the token.
+std::string making_send_back_conv_packet(uint32_t conv, uint64_t resume_token = 0);
 bool is_send_back_conv_packet(const char* data, size_t len);
 uint32_t grab_conv_from_send_back_conv_packet(const char* data, size_t len);
+// return 0 if the packet has no token.
+uint64_t grab_resume_token_from_send_back_conv_packet(const char* data, size_t len);
+
+
+// resume packet is a fixed size header. kcp data can be appended after the header in the same udp packet,
+// but kcp_client sends it alone: a kcp packet can already be a whole mtu.
+// server will send back a resume_back packet if succeed, or a disconnect packet if conv or token is wrong.
+#define ASIO_KCP_RESUME_PACKET_HEADER_SIZE (sizeof("asio_kcp_resume_package") + 10 + 1 + 16)
+std::string making_resume_packet(uint32_t conv, uint64_t resume_token);
+bool is_resume_packet(const char* data, size_t len);
+// return false if packet is broken.
+bool grab_conv_and_token_from_resume_packet(const char* data, size_t len, uint32_t* conv, uint64_t* resume_token);
+
+std::string making_resume_back_packet(uint32_t conv);
+bool is_resume_back_packet(const char* data, size_t len);
 
 
 std::string making_disconnect_packet(uint32_t conv);
@@ -0,0 +1,173 @@
+#include "hdr_histogram.hpp"
+#include <math.h>
+
+namespace asio_kcp {
+
+#define SUB_BUCKET_HALF_COUNT ((size_t)1 << HDR_HISTOGRAM_SUB_BUCKET_BITS)
+#define SUB_BUCKET_COUNT (SUB_BUCKET_HALF_COUNT * 2)
+#define NO_MIN (~(uint64_t)0)
+
+// values below SUB_BUCKET_COUNT: one bucket for every value.
+// bigger values: SUB_BUCKET_HALF_COUNT buckets for every power of 2, from SUB_BUCKET_COUNT to HDR_HISTOGRAM_HIGHEST_TRACKABLE.
+static size_t bucket_count(void)
+{
+    size_t power_count = 0;
+    for (uint64_t v = SUB_BUCKET_COUNT; v < HDR_HISTOGRAM_HIGHEST_TRACKABLE; v <<= 1)
+        power_count++;
+    return SUB_BUCKET_COUNT + power_count * SUB_BUCKET_HALF_COUNT;
+}
+
+static inline uint64_t load_relaxed(const uint64_t* p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void add_relaxed(uint64_t* p, uint64_t value)
+{
+    __atomic_fetch_add(p, value, __ATOMIC_RELAXED);
+}
+
+hdr_histogram::hdr_histogram(void) :
+    counts_(bucket_count(), 0),
+    total_count_(0),
+    total_sum_(0),
+    min_(NO_MIN),
+    max_(0)
+{
+}
+
+size_t hdr_histogram::bucket_index(uint64_t value)
+{
+    if (value >= HDR_HISTOGRAM_HIGHEST_TRACKABLE)
+        value = HDR_HISTOGRAM_HIGHEST_TRACKABLE - 1;
+    if (value < SUB_BUCKET_COUNT)
+        return (size_t)value;
+
+    const int msb = 63 - __builtin_clzll(value);
+    const int shift = msb - HDR_HISTOGRAM_SUB_BUCKET_BITS; // >= 1
+    return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF_COUNT + (size_t)(value >> shift) - SUB_BUCKET_HALF_COUNT;
+}
+
+uint64_t hdr_histogram::highest_equivalent_value(size_t index)
+{
+    if (index < SUB_BUCKET_COUNT)
+        return index;
+
+    const size_t k = index - SUB_BUCKET_COUNT;
+    const int shift = (int)(k / SUB_BUCKET_HALF_COUNT) + 1;
+    const uint64_t lowest = (uint64_t)(k % SUB_BUCKET_HALF_COUNT + SUB_BUCKET_HALF_COUNT) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+void hdr_histogram::record(uint64_t value)
+{
+    add_relaxed(&counts_[bucket_index(value)], 1);
+    add_relaxed(&total_count_, 1);
+    add_relaxed(&total_sum_, value);
+    update_min_max(value, value);
+}
+
+void hdr_histogram::update_min_max(uint64_t min_value, uint64_t max_value)
+{
+    uint64_t cur = load_relaxed(&min_);
+    while (min_value < cur && !__atomic_compare_exchange_n(&min_, &cur, min_value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    cur = load_relaxed(&max_);
+    while (max_value > cur && !__atomic_compare_exchange_n(&max_, &cur, max_value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void hdr_histogram::merge(const hdr_histogram& other)
+{
+    for (size_t i = 0; i < counts_.size(); ++i)
+    {
+        const uint64_t count = load_relaxed(&other.counts_[i]);
+        if (count > 0)
+            add_relaxed(&counts_[i], count);
+    }
+    add_relaxed(&total_count_, load_relaxed(&other.total_count_));
+    add_relaxed(&total_sum_, load_relaxed(&other.total_sum_));
+    update_min_max(load_relaxed(&other.min_), load_relaxed(&other.max_));
+}
+
+void hdr_histogram::reset(void)
+{
+    for (size_t i = 0; i < counts_.size(); ++i)
+        __atomic_store_n(&counts_[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&total_count_, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&total_sum_, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&min_, NO_MIN, __ATOMIC_RELAXED);
+    __atomic_store_n(&max_, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t hdr_histogram::count(void) const
+{
+    return load_relaxed(&total_count_);
+}
+
+uint64_t hdr_histogram::min(void) const
+{
+    const uint64_t value = load_relaxed(&min_);
+    return value == NO_MIN ? 0 : value;
+}
+
+uint64_t hdr_histogram::max(void) const
+{
+    return load_relaxed(&max_);
+}
+
+uint64_t hdr_histogram::sum(void) const
+{
+    return load_relaxed(&total_sum_);
+}
+
+double hdr_histogram::mean(void) const
+{
+    const uint64_t total_count = count();
+    return total_count > 0 ? (double)load_relaxed(&total_sum_) / total_count : 0.0;
+}
+
+uint64_t hdr_histogram::value_at_percentile(double percentile) const
+{
+    // count the buckets, not total_count_. They may be different while recording.
+    uint64_t total_count = 0;
+    for (size_t i = 0; i < counts_.size(); ++i)
+        total_count += load_relaxed(&counts_[i]);
+    if (total_count == 0)
+        return 0;
+
+    if (percentile < 0.0)
+        percentile = 0.0;
+    if (percentile > 100.0)
+        percentile = 100.0;
+    uint64_t count_to_index = (uint64_t)ceil(percentile / 100.0 * total_count - 1e-9);
+    if (count_to_index < 1)
+        count_to_index = 1;
+
+    const uint64_t max_value = max();
+    uint64_t count_so_far = 0;
+    for (size_t i = 0; i < counts_.size(); ++i)
+    {
+        count_so_far += load_relaxed(&counts_[i]);
+        if (count_so_far >= count_to_index)
+        {
+            const uint64_t value = highest_equivalent_value(i);
+            return value < max_value ? value : max_value;
+        }
+    }
+    return max_value;
+}
+
+void hdr_histogram::summarize(latency_summary* summary) const
+{
+    summary->count = count();
+    summary->min = min();
+    summary->p50 = value_at_percentile(50.0);
+    summary->p90 = value_at_percentile(90.0);
+    summary->p99 = value_at_percentile(99.0);
+    summary->p999 = value_at_percentile(99.9);
+    summary->max = max();
+    summary->mean = mean();
+}
+
+} // namespace asio_kcp
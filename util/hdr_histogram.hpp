@@ -0,0 +1,83 @@
+#ifndef _ASIO_KCP_HDR_HISTOGRAM_HPP_
+#define _ASIO_KCP_HDR_HISTOGRAM_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace asio_kcp {
+
+// percentiles of a histogram. Every value is the highest value equivalent to the bucket, but not more than max.
+struct latency_summary
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+    double mean;
+
+    latency_summary(void) : count(0), min(0), p50(0), p90(0), p99(0), p999(0), max(0), mean(0.0) {}
+};
+
+/*
+ * High dynamic range histogram of integer values, like latencies in microseconds.
+ *
+ * Buckets are log-linear: values below 256 are exact, bigger ones keep 8 significant bits (error < 1%).
+ *   Values from HDR_HISTOGRAM_HIGHEST_TRACKABLE are counted as HDR_HISTOGRAM_HIGHEST_TRACKABLE - 1.
+ * The memory is fixed (about 26KB) and allocated in constructor.
+ * record() is lock-free, a few relaxed atomic adds. Any thread can record and read at the same time.
+ *   The percentiles read while recording may miss the values being recorded.
+ * Shards (one histogram per thread) can be merged for reading.
+ * Keep this file c++03 because client_lib is c++03. Using the __atomic builtins of gcc instead of std::atomic.
+ */
+#define HDR_HISTOGRAM_SUB_BUCKET_BITS 7
+#define HDR_HISTOGRAM_HIGHEST_TRACKABLE ((uint64_t)1 << 32)
+
+class hdr_histogram
+{
+public:
+    hdr_histogram(void);
+
+    void record(uint64_t value);
+
+    // add the counts of other into this.
+    void merge(const hdr_histogram& other);
+
+    // clear. Values recorded at the same time may be lost.
+    void reset(void);
+
+    uint64_t count(void) const;
+    uint64_t min(void) const; // 0 if empty
+    uint64_t max(void) const;
+    uint64_t sum(void) const;
+    double mean(void) const;
+
+    // percentile in [0, 100]. 0 if empty.
+    uint64_t value_at_percentile(double percentile) const;
+
+    void summarize(latency_summary* summary) const;
+
+    // the bucket of value and the highest value in the bucket. For testing.
+    static size_t bucket_index(uint64_t value);
+    static uint64_t highest_equivalent_value(size_t index);
+
+private:
+    hdr_histogram(const hdr_histogram&);
+    hdr_histogram& operator=(const hdr_histogram&);
+
+    void update_min_max(uint64_t min_value, uint64_t max_value);
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_count_;
+    uint64_t total_sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_HDR_HISTOGRAM_HPP_
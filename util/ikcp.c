@@ -170,15 +170,26 @@ void ikcp_allocator(void* (*new_malloc)(size_t), void (*new_free)(void*))
 // allocate a new kcp segment
 static IKCPSEG* ikcp_segment_new(ikcpcb *kcp, int size)
 {
-	return (IKCPSEG*)ikcp_malloc(sizeof(IKCPSEG) + size);
+	IKCPSEG *seg = (IKCPSEG*)ikcp_malloc(sizeof(IKCPSEG) + size);
+	if (seg) {
+		seg->ref_data = NULL;
+		seg->ref = NULL;
+	}
+	return seg;
 }
 
 // delete a segment
 static void ikcp_segment_delete(ikcpcb *kcp, IKCPSEG *seg)
 {
+	if (seg->ref) {
+		kcp->ref_release(seg->ref);
+	}
 	ikcp_free(seg);
 }
 
+// the data of a segment, in the segment or referenced
+#define ikcp_segment_data(seg) ((seg)->ref ? (seg)->ref_data : (seg)->data)
+
 // write log
 void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...)
 {
@@ -191,6 +202,22 @@ void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...)
 	kcp->writelog(buffer, kcp, kcp->user);
 }
 
+// trace hook
+#define ikcp_trace(kcp, event, sn, arg) \
+	do { if ((kcp)->trace) (kcp)->trace((event), (sn), (IUINT32)(arg), (kcp), (kcp)->trace_user); } while (0)
+
+void ikcp_settrace(ikcpcb *kcp, void (*trace)(int event, IUINT32 sn, IUINT32 arg, ikcpcb *kcp, void *user), void *user)
+{
+	kcp->trace = trace;
+	kcp->trace_user = user;
+}
+
+void ikcp_setref(ikcpcb *kcp, void (*retain)(void *ref), void (*release)(void *ref))
+{
+	kcp->ref_retain = retain;
+	kcp->ref_release = release;
+}
+
 // check log mask
 static int ikcp_canlog(const ikcpcb *kcp, int mask)
 {
@@ -276,6 +303,7 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->current = 0;
 	kcp->interval = IKCP_INTERVAL;
 	kcp->ts_flush = IKCP_INTERVAL;
+	kcp->clock_unit = 1;
 	kcp->nodelay = 0;
 	kcp->updated = 0;
 	kcp->logmask = 0;
@@ -286,6 +314,10 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
     kcp->dead_link = IKCP_DEADLINK;
 	kcp->output = NULL;
 	kcp->writelog = NULL;
+	kcp->trace = NULL;
+	kcp->trace_user = NULL;
+	kcp->ref_retain = NULL;
+	kcp->ref_release = NULL;
 
 	return kcp;
 }
@@ -386,6 +418,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 		}
 
 		if (ispeek == 0) {
+			ikcp_trace(kcp, IKCP_TRACE_RECV, seg->sn, seg->len);
 			iqueue_del(&seg->node);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nrcv_que--;
@@ -406,6 +439,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 			iqueue_add_tail(&seg->node, &kcp->rcv_queue);
 			kcp->nrcv_que++;
 			kcp->rcv_nxt++;
+			ikcp_trace(kcp, IKCP_TRACE_RCVQUEUE, seg->sn, kcp->nrcv_que);
 		}	else {
 			break;
 		}
@@ -452,8 +486,9 @@ int ikcp_peeksize(const ikcpcb *kcp)
 
 //---------------------------------------------------------------------
 // user/upper level send, returns below zero for error
+// ref: NULL to copy buffer into the segments, or see ikcp_send_ref
 //---------------------------------------------------------------------
-int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
+static int ikcp_send_segments(ikcpcb *kcp, const char *buffer, int len, void *ref)
 {
 	IKCPSEG *seg;
 	int count, i;
@@ -471,16 +506,22 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 	// fragment
 	for (i = 0; i < count; i++) {
 		int size = len > (int)kcp->mss ? (int)kcp->mss : len;
-		seg = ikcp_segment_new(kcp, size);
+		seg = ikcp_segment_new(kcp, ref ? 0 : size);
 		assert(seg);
 		if (seg == NULL) {
 			return -2;
 		}
-		if (buffer && len > 0) {
+		if (ref) {
+			kcp->ref_retain(ref);
+			seg->ref_data = buffer;
+			seg->ref = ref;
+		}
+		else if (buffer && len > 0) {
 			memcpy(seg->data, buffer, size);
 		}
 		seg->len = size;
 		seg->frg = count - i - 1;
+		ikcp_trace(kcp, IKCP_TRACE_SEND, kcp->snd_nxt + kcp->nsnd_que, size);
 		iqueue_init(&seg->node);
 		iqueue_add_tail(&seg->node, &kcp->snd_queue);
 		kcp->nsnd_que++;
@@ -493,6 +534,18 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 	return 0;
 }
 
+int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
+{
+	return ikcp_send_segments(kcp, buffer, len, NULL);
+}
+
+int ikcp_send_ref(ikcpcb *kcp, const char *buffer, int len, void *ref)
+{
+	assert(ref);
+	if (kcp->ref_retain == NULL || kcp->ref_release == NULL) return -3;
+	return ikcp_send_segments(kcp, buffer, len, ref);
+}
+
 
 //---------------------------------------------------------------------
 // parse ack
@@ -511,7 +564,7 @@ static void ikcp_update_ack(ikcpcb *kcp, IINT32 rtt)
 		if (kcp->rx_srtt < 1) kcp->rx_srtt = 1;
 	}
 	rto = kcp->rx_srtt + _imax_(1, 4 * kcp->rx_rttval);
-	kcp->rx_rto = _ibound_(kcp->rx_minrto, rto, IKCP_RTO_MAX);
+	kcp->rx_rto = _ibound_(kcp->rx_minrto, rto, IKCP_RTO_MAX * kcp->clock_unit);
 }
 
 static void ikcp_shrink_buf(ikcpcb *kcp)
@@ -536,6 +589,7 @@ static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (sn == seg->sn) {
+			ikcp_trace(kcp, IKCP_TRACE_ACKED, seg->sn, seg->xmit);
 			iqueue_del(p);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
@@ -555,6 +609,7 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (_itimediff(una, seg->sn) > 0) {
+			ikcp_trace(kcp, IKCP_TRACE_ACKED, seg->sn, seg->xmit);
 			iqueue_del(p);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
@@ -623,6 +678,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 	
 	if (_itimediff(sn, kcp->rcv_nxt + kcp->rcv_wnd) >= 0 ||
 		_itimediff(sn, kcp->rcv_nxt) < 0) {
+		ikcp_trace(kcp, IKCP_TRACE_INPUT_DROP, sn, newseg->len);
 		ikcp_segment_delete(kcp, newseg);
 		return;
 	}
@@ -640,10 +696,12 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 	}
 
 	if (repeat == 0) {
+		ikcp_trace(kcp, IKCP_TRACE_INPUT, sn, newseg->len);
 		iqueue_init(&newseg->node);
 		iqueue_add(&newseg->node, p);
 		kcp->nrcv_buf++;
 	}	else {
+		ikcp_trace(kcp, IKCP_TRACE_INPUT_DROP, sn, newseg->len);
 		ikcp_segment_delete(kcp, newseg);
 	}
 
@@ -661,6 +719,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 			iqueue_add_tail(&seg->node, &kcp->rcv_queue);
 			kcp->nrcv_que++;
 			kcp->rcv_nxt++;
+			ikcp_trace(kcp, IKCP_TRACE_RCVQUEUE, seg->sn, kcp->nrcv_que);
 		}	else {
 			break;
 		}
@@ -754,7 +813,10 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 			}
 			if (_itimediff(sn, kcp->rcv_nxt + kcp->rcv_wnd) < 0) {
 				ikcp_ack_push(kcp, sn, ts);
-				if (_itimediff(sn, kcp->rcv_nxt) >= 0) {
+				if (_itimediff(sn, kcp->rcv_nxt) < 0) {
+					ikcp_trace(kcp, IKCP_TRACE_INPUT_DROP, sn, len);
+				}
+				else {
 					seg = ikcp_segment_new(kcp, len);
 					seg->conv = conv;
 					seg->cmd = cmd;
@@ -772,6 +834,9 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 					ikcp_parse_data(kcp, seg);
 				}
 			}
+			else {
+				ikcp_trace(kcp, IKCP_TRACE_INPUT_DROP, sn, len);
+			}
 		}
 		else if (cmd == IKCP_CMD_WASK) {
 			// ready to send back IKCP_CMD_WINS in ikcp_flush
@@ -890,16 +955,16 @@ void ikcp_flush(ikcpcb *kcp)
 	// probe window size (if remote window size equals zero)
 	if (kcp->rmt_wnd == 0) {
 		if (kcp->probe_wait == 0) {
-			kcp->probe_wait = IKCP_PROBE_INIT;
+			kcp->probe_wait = IKCP_PROBE_INIT * kcp->clock_unit;
 			kcp->ts_probe = kcp->current + kcp->probe_wait;
 		}	
 		else {
 			if (_itimediff(kcp->current, kcp->ts_probe) >= 0) {
-				if (kcp->probe_wait < IKCP_PROBE_INIT) 
-					kcp->probe_wait = IKCP_PROBE_INIT;
+				if (kcp->probe_wait < IKCP_PROBE_INIT * kcp->clock_unit) 
+					kcp->probe_wait = IKCP_PROBE_INIT * kcp->clock_unit;
 				kcp->probe_wait += kcp->probe_wait / 2;
-				if (kcp->probe_wait > IKCP_PROBE_LIMIT)
-					kcp->probe_wait = IKCP_PROBE_LIMIT;
+				if (kcp->probe_wait > IKCP_PROBE_LIMIT * kcp->clock_unit)
+					kcp->probe_wait = IKCP_PROBE_LIMIT * kcp->clock_unit;
 				kcp->ts_probe = kcp->current + kcp->probe_wait;
 				kcp->probe |= IKCP_ASK_SEND;
 			}
@@ -959,6 +1024,7 @@ void ikcp_flush(ikcpcb *kcp)
 		newseg->rto = kcp->rx_rto;
 		newseg->fastack = 0;
 		newseg->xmit = 0;
+		ikcp_trace(kcp, IKCP_TRACE_SNDBUF, newseg->sn, cwnd);
 	}
 
 	// calculate resent
@@ -974,6 +1040,7 @@ void ikcp_flush(ikcpcb *kcp)
 			segment->xmit++;
 			segment->rto = kcp->rx_rto;
 			segment->resendts = current + segment->rto + rtomin;
+			ikcp_trace(kcp, IKCP_TRACE_XMIT, segment->sn, segment->rto);
 		}
 		else if (_itimediff(current, segment->resendts) >= 0) {
 			needsend = 1;
@@ -986,6 +1053,7 @@ void ikcp_flush(ikcpcb *kcp)
 			}
 			segment->resendts = current + segment->rto;
 			lost = 1;
+			ikcp_trace(kcp, IKCP_TRACE_RTO_RESEND, segment->sn, segment->xmit);
 		}
 		else if (segment->fastack >= resent) {
 			needsend = 1;
@@ -993,6 +1061,7 @@ void ikcp_flush(ikcpcb *kcp)
 			segment->fastack = 0;
 			segment->resendts = current + segment->rto;
 			change++;
+			ikcp_trace(kcp, IKCP_TRACE_FAST_RESEND, segment->sn, segment->xmit);
 		}
 
 		if (needsend) {
@@ -1012,7 +1081,7 @@ void ikcp_flush(ikcpcb *kcp)
 			ptr = ikcp_encode_seg(ptr, segment);
 
 			if (segment->len > 0) {
-				memcpy(ptr, segment->data, segment->len);
+				memcpy(ptr, ikcp_segment_data(segment), segment->len);
 				ptr += segment->len;
 			}
 
@@ -1056,11 +1125,13 @@ void ikcp_flush(ikcpcb *kcp)
 //---------------------------------------------------------------------
 // update state (call it repeatedly, every 10ms-100ms), or you can ask 
 // ikcp_check when to call it again (without ikcp_input/_send calling).
-// 'current' - current timestamp in millisec. 
+// 'current' - current timestamp in millisec (in clock unit, see
+// ikcp_clockunit). 
 //---------------------------------------------------------------------
 void ikcp_update(ikcpcb *kcp, IUINT32 current)
 {
 	IINT32 slap;
+	const IINT32 slap_limit = 10000 * (IINT32)kcp->clock_unit;
 
 	kcp->current = current;
 
@@ -1071,7 +1142,7 @@ void ikcp_update(ikcpcb *kcp, IUINT32 current)
 
 	slap = _itimediff(kcp->current, kcp->ts_flush);
 
-	if (slap >= 10000 || slap < -10000) {
+	if (slap >= slap_limit || slap < -slap_limit) {
 		kcp->ts_flush = kcp->current;
 		slap = 0;
 	}
@@ -1101,14 +1172,15 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 	IINT32 tm_flush = 0x7fffffff;
 	IINT32 tm_packet = 0x7fffffff;
 	IUINT32 minimal = 0;
+	const IINT32 slap_limit = 10000 * (IINT32)kcp->clock_unit;
 	struct IQUEUEHEAD *p;
 
 	if (kcp->updated == 0) {
 		return current;
 	}
 
-	if (_itimediff(current, ts_flush) >= 10000 ||
-		_itimediff(current, ts_flush) < -10000) {
+	if (_itimediff(current, ts_flush) >= slap_limit ||
+		_itimediff(current, ts_flush) < -slap_limit) {
 		ts_flush = current;
 	}
 
@@ -1154,7 +1226,20 @@ int ikcp_interval(ikcpcb *kcp, int interval)
 {
 	if (interval > 5000) interval = 5000;
 	else if (interval < 2) interval = 2;
-	kcp->interval = interval;
+	kcp->interval = interval * kcp->clock_unit;
+	return 0;
+}
+
+int ikcp_clockunit(ikcpcb *kcp, int unit_per_ms)
+{
+	IUINT32 old_unit = kcp->clock_unit;
+	if (unit_per_ms < 1 || unit_per_ms > 1000 || kcp->updated)
+		return -1;
+	kcp->rx_rto = kcp->rx_rto / old_unit * unit_per_ms;
+	kcp->rx_minrto = kcp->rx_minrto / old_unit * unit_per_ms;
+	kcp->interval = kcp->interval / old_unit * unit_per_ms;
+	kcp->ts_flush = kcp->interval;
+	kcp->clock_unit = unit_per_ms;
 	return 0;
 }
 
@@ -1163,16 +1248,16 @@ int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc)
 	if (nodelay >= 0) {
 		kcp->nodelay = nodelay;
 		if (nodelay) {
-			kcp->rx_minrto = IKCP_RTO_NDL;	
+			kcp->rx_minrto = IKCP_RTO_NDL * kcp->clock_unit;	
 		}	
 		else {
-			kcp->rx_minrto = IKCP_RTO_MIN;
+			kcp->rx_minrto = IKCP_RTO_MIN * kcp->clock_unit;
 		}
 	}
 	if (interval >= 0) {
 		if (interval > 5000) interval = 5000;
 		else if (interval < 2) interval = 2;
-		kcp->interval = interval;
+		kcp->interval = interval * kcp->clock_unit;
 	}
 	if (resend >= 0) {
 		kcp->fastresend = resend;
@@ -264,6 +264,8 @@ struct IKCPSEG
 	IUINT32 rto;
 	IUINT32 fastack;
 	IUINT32 xmit;
+	const char *ref_data;	// data outside of the segment, sent by ikcp_send_ref
+	void *ref;				// NULL: the data is in data[]
 	char data[1];
 };
 
@@ -285,6 +287,7 @@ struct IKCPCB
 	IUINT32 nodelay, updated;
 	IUINT32 ts_probe, probe_wait;
 	IUINT32 dead_link, incr;
+	IUINT32 clock_unit;
 	struct IQUEUEHEAD snd_queue;
 	struct IQUEUEHEAD rcv_queue;
 	struct IQUEUEHEAD snd_buf;
@@ -299,6 +302,10 @@ struct IKCPCB
 	int logmask;
 	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
 	void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
+	void (*trace)(int event, IUINT32 sn, IUINT32 arg, struct IKCPCB *kcp, void *user);
+	void *trace_user;
+	void (*ref_retain)(void *ref);
+	void (*ref_release)(void *ref);
 };
 
 
@@ -317,6 +324,18 @@ typedef struct IKCPCB ikcpcb;
 #define IKCP_LOG_OUT_PROBE		1024
 #define IKCP_LOG_OUT_WINS		2048
 
+// segment lifecycle events passed to the trace hook, see ikcp_settrace.
+#define IKCP_TRACE_SEND			1	// ikcp_send: queued in snd_queue. sn: the sn it will get. arg: len
+#define IKCP_TRACE_SNDBUF		2	// ikcp_flush: moved to snd_buf. arg: cwnd
+#define IKCP_TRACE_XMIT			3	// ikcp_flush: first transmit. arg: rto
+#define IKCP_TRACE_RTO_RESEND	4	// ikcp_flush: resent by timeout. arg: xmit
+#define IKCP_TRACE_FAST_RESEND	5	// ikcp_flush: resent by fastack. arg: xmit
+#define IKCP_TRACE_ACKED		6	// ikcp_input: removed from snd_buf by ack or una. arg: xmit
+#define IKCP_TRACE_INPUT		7	// ikcp_input: push segment put into rcv_buf. arg: len
+#define IKCP_TRACE_INPUT_DROP	8	// ikcp_input: push segment repeated or out of window. arg: len
+#define IKCP_TRACE_RCVQUEUE		9	// moved from rcv_buf to rcv_queue. arg: nrcv_que
+#define IKCP_TRACE_RECV			10	// ikcp_recv: taken by user. arg: len
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -339,6 +358,13 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// like ikcp_send, but the segments point into 'buffer' instead of copying
+// it, so one buffer can be queued in many kcp objects. Every segment holds
+// 'ref': ref_retain(ref) when it is created and ref_release(ref) when it is
+// acked or the kcp is released. 'buffer' must not change until the last
+// release. Set the two hooks by ikcp_setref first, or it returns -3.
+int ikcp_send_ref(ikcpcb *kcp, const char *buffer, int len, void *ref);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask 
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec. 
@@ -371,6 +397,12 @@ int ikcp_peeksize(const ikcpcb *kcp);
 // change MTU size, default is 1400
 int ikcp_setmtu(ikcpcb *kcp, int mtu);
 
+// clock units in one millisecond: 1 by default (millisecond clock), 1000 for
+// microsecond clock. 'current' of ikcp_update and the ts of segments are in
+// this unit. The ts is echoed back by the peer, so two endpoints need not to
+// use the same unit. Call it before ikcp_nodelay and the first ikcp_update.
+int ikcp_clockunit(ikcpcb *kcp, int unit_per_ms);
+
 // set maximum window size: sndwnd=32, rcvwnd=32 by default
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd);
 
@@ -389,6 +421,14 @@ int ikcp_sndbuf_count(const ikcpcb *kcp);
 
 void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...);
 
+// call trace(event, sn, arg, kcp, user) at the IKCP_TRACE_XXX points of
+// every data segment. NULL (default) disables it, costing one compare.
+// The hook is called inside ikcp_send/_recv/_input/_flush, keep it fast.
+void ikcp_settrace(ikcpcb *kcp, void (*trace)(int event, IUINT32 sn, IUINT32 arg, ikcpcb *kcp, void *user), void *user);
+
+// the reference counting hooks of the buffers sent by ikcp_send_ref.
+void ikcp_setref(ikcpcb *kcp, void (*retain)(void *ref), void (*release)(void *ref));
+
 // setup allocator
 void ikcp_allocator(void* (*new_malloc)(size_t), void (*new_free)(void*));
 
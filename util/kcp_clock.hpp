@@ -0,0 +1,43 @@
+#ifndef _ASIO_KCP_KCP_CLOCK_HPP_
+#define _ASIO_KCP_KCP_CLOCK_HPP_
+
+#include <stdint.h>
+
+namespace asio_kcp {
+
+/*
+ * The clock of kcp_client and kcp_svr::connection_manager: kcp update, rto, connect timeout and connection timeout.
+ * Not set (NULL) means the monotonic clock of the system. Set a virtual_kcp_clock to run clients and servers in
+ * simulated time, faster than real time, with an in-memory transport (see client_transport and server_transport).
+ * Keep this file c++03 because client_lib is c++03.
+ */
+class kcp_clock
+{
+public:
+    virtual ~kcp_clock(void) {}
+
+    // microseconds from an unspecified start. Never goes back.
+    virtual uint64_t now_us(void) const = 0;
+
+    uint64_t now_ms(void) const {return now_us() / 1000;}
+};
+
+// the time moves only when told. Not thread safe: set it in the thread running the clients and servers.
+class virtual_kcp_clock : public kcp_clock
+{
+public:
+    explicit virtual_kcp_clock(uint64_t start_us = 0) : now_us_(start_us) {}
+
+    virtual uint64_t now_us(void) const {return now_us_;}
+
+    void set_us(uint64_t now_us) {if (now_us > now_us_) now_us_ = now_us;}
+    void advance_us(uint64_t us) {now_us_ += us;}
+    void advance_ms(uint64_t ms) {now_us_ += ms * 1000;}
+
+private:
+    uint64_t now_us_;
+};
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_KCP_CLOCK_HPP_
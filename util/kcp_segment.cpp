@@ -0,0 +1,35 @@
+#include "kcp_segment.hpp"
+
+namespace asio_kcp {
+
+uint32_t read_uint32_le(const char* data)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t read_uint16_le(const char* data)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+bool next_kcp_segment(const char* data, size_t len, size_t* offset, kcp_segment_header* header)
+{
+    if (*offset + KCP_SEGMENT_HEADER_SIZE > len)
+        return false;
+
+    const char* p = data + *offset;
+    header->conv = read_uint32_le(p);
+    header->cmd = (uint8_t)p[4];
+    header->frg = (uint8_t)p[5];
+    header->wnd = read_uint16_le(p + 6);
+    header->ts = read_uint32_le(p + 8);
+    header->sn = read_uint32_le(p + 12);
+    header->una = read_uint32_le(p + 16);
+    header->len = read_uint32_le(p + 20);
+    *offset += KCP_SEGMENT_HEADER_SIZE + header->len;
+    return true;
+}
+
+} // namespace asio_kcp
@@ -0,0 +1,48 @@
+#ifndef _ASIO_KCP_KCP_SEGMENT_HPP_
+#define _ASIO_KCP_KCP_SEGMENT_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Parser of the segment headers of kcp, for looking into the udp packets out of ikcp: stats, captures and benches.
+ *
+ * A udp packet of kcp is one or more segments. Every segment is a header written by ikcp_encode_seg and len bytes of data:
+ *   [conv:4][cmd:1][frg:1][wnd:2][ts:4][sn:4][una:4][len:4], little endian.
+ * Keep this file c++03 because client_lib is c++03.
+ */
+#define KCP_SEGMENT_HEADER_SIZE 24
+
+// the cmd of segment. Same as IKCP_CMD_XXX of ikcp.c.
+#define KCP_CMD_PUSH 81
+#define KCP_CMD_ACK 82
+#define KCP_CMD_WASK 83
+#define KCP_CMD_WINS 84
+
+namespace asio_kcp {
+
+struct kcp_segment_header
+{
+    uint32_t conv;
+    uint8_t cmd;
+    uint8_t frg;
+    uint16_t wnd;
+    uint32_t ts;    // the ts of the segment acked, if cmd is ack
+    uint32_t sn;
+    uint32_t una;
+    uint32_t len;   // bytes of data after the header
+};
+
+uint32_t read_uint32_le(const char* data);
+uint16_t read_uint16_le(const char* data);
+
+// read the header at *offset of the packet, and move *offset to the next segment.
+// false if there is not a whole header left. The data of the last segment may be truncated: *offset goes beyond len.
+//   size_t offset = 0;
+//   kcp_segment_header seg;
+//   while (next_kcp_segment(buf, len, &offset, &seg)) ...
+bool next_kcp_segment(const char* data, size_t len, size_t* offset, kcp_segment_header* header);
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_KCP_SEGMENT_HPP_
@@ -0,0 +1,334 @@
+#include "kcp_trace.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace asio_kcp {
+
+#define KCP_TRACE_FILE_MAGIC "akcptrc1"
+#define KCP_TRACE_FILE_MAGIC_SIZE 8
+#define KCP_TRACE_FILE_RECORD_SIZE 24
+
+#define CHROME_TID_SEND 1
+#define CHROME_TID_RECV 2
+
+static uint64_t trace_clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+kcp_trace_ring::kcp_trace_ring(void) :
+    slots_(ASIO_KCP_KCP_TRACE_RING_SIZE),
+    next_seq_(0)
+{
+    for (size_t i = 0; i < slots_.size(); ++i)
+        slots_[i].seq = 0;
+}
+
+void kcp_trace_ring::attach(ikcpcb* kcp)
+{
+    ikcp_settrace(kcp, &kcp_trace_ring::on_trace, this);
+}
+
+void kcp_trace_ring::detach(ikcpcb* kcp)
+{
+    ikcp_settrace(kcp, NULL, NULL);
+}
+
+void kcp_trace_ring::on_trace(int event, IUINT32 sn, IUINT32 arg, ikcpcb* kcp, void* user)
+{
+    ((kcp_trace_ring*)user)->record(kcp->conv, event, sn, arg);
+}
+
+void kcp_trace_ring::record(uint32_t conv, int event, uint32_t sn, uint32_t arg)
+{
+    const uint64_t seq = __atomic_add_fetch(&next_seq_, 1, __ATOMIC_RELAXED);
+    slot& s = slots_[(seq - 1) & (ASIO_KCP_KCP_TRACE_RING_SIZE - 1)];
+
+    // mark the slot is being written. reader will skip it.
+    __atomic_store_n(&s.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s.record.time_us = trace_clock_us();
+    s.record.conv = conv;
+    s.record.event = (uint32_t)event;
+    s.record.sn = sn;
+    s.record.arg = arg;
+    __atomic_store_n(&s.seq, seq, __ATOMIC_RELEASE);
+}
+
+void kcp_trace_ring::snapshot(std::vector<kcp_trace_record>* records) const
+{
+    records->clear();
+    const uint64_t last_seq = __atomic_load_n(&next_seq_, __ATOMIC_ACQUIRE);
+    const uint64_t first_seq = (last_seq > ASIO_KCP_KCP_TRACE_RING_SIZE ? last_seq - ASIO_KCP_KCP_TRACE_RING_SIZE + 1 : 1);
+    records->reserve(last_seq - first_seq + 1);
+
+    for (uint64_t seq = first_seq; seq <= last_seq; ++seq)
+    {
+        const slot& s = slots_[(seq - 1) & (ASIO_KCP_KCP_TRACE_RING_SIZE - 1)];
+        if (__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != seq)
+            continue; // being written, or overwritten by a newer one.
+        const kcp_trace_record record = s.record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s.seq, __ATOMIC_RELAXED) != seq)
+            continue; // overwritten when copying.
+        records->push_back(record);
+    }
+}
+
+const char* kcp_trace_event_str(uint32_t event)
+{
+    switch (event)
+    {
+        case IKCP_TRACE_SEND: return "send";
+        case IKCP_TRACE_SNDBUF: return "sndbuf";
+        case IKCP_TRACE_XMIT: return "xmit";
+        case IKCP_TRACE_RTO_RESEND: return "rto_resend";
+        case IKCP_TRACE_FAST_RESEND: return "fast_resend";
+        case IKCP_TRACE_ACKED: return "acked";
+        case IKCP_TRACE_INPUT: return "input";
+        case IKCP_TRACE_INPUT_DROP: return "input_drop";
+        case IKCP_TRACE_RCVQUEUE: return "rcvqueue";
+        case IKCP_TRACE_RECV: return "recv";
+        default: return "unknown";
+    }
+}
+
+static void append_uint32(std::string& buf, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        buf.push_back((char)((value >> (i * 8)) & 0xff));
+}
+
+static uint32_t read_uint32(const char* data)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// little endian, the same on every platform.
+bool write_kcp_trace_file(const std::string& path, const std::vector<kcp_trace_record>& records)
+{
+    std::string buf(KCP_TRACE_FILE_MAGIC, KCP_TRACE_FILE_MAGIC_SIZE);
+    buf.reserve(KCP_TRACE_FILE_MAGIC_SIZE + records.size() * KCP_TRACE_FILE_RECORD_SIZE);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const kcp_trace_record& r = records[i];
+        append_uint32(buf, (uint32_t)(r.time_us & 0xffffffff));
+        append_uint32(buf, (uint32_t)(r.time_us >> 32));
+        append_uint32(buf, r.conv);
+        append_uint32(buf, r.event);
+        append_uint32(buf, r.sn);
+        append_uint32(buf, r.arg);
+    }
+
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+    out.write(buf.data(), buf.size());
+    return out.good();
+}
+
+bool read_kcp_trace_file(const std::string& path, std::vector<kcp_trace_record>* records)
+{
+    records->clear();
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream content;
+    content << in.rdbuf();
+    const std::string buf = content.str();
+
+    if (buf.size() < KCP_TRACE_FILE_MAGIC_SIZE || memcmp(buf.data(), KCP_TRACE_FILE_MAGIC, KCP_TRACE_FILE_MAGIC_SIZE) != 0)
+        return false;
+    if ((buf.size() - KCP_TRACE_FILE_MAGIC_SIZE) % KCP_TRACE_FILE_RECORD_SIZE != 0)
+        return false;
+
+    for (size_t pos = KCP_TRACE_FILE_MAGIC_SIZE; pos < buf.size(); pos += KCP_TRACE_FILE_RECORD_SIZE)
+    {
+        const char* p = buf.data() + pos;
+        kcp_trace_record r;
+        r.time_us = (uint64_t)read_uint32(p) | ((uint64_t)read_uint32(p + 4) << 32);
+        r.conv = read_uint32(p + 8);
+        r.event = read_uint32(p + 12);
+        r.sn = read_uint32(p + 16);
+        r.arg = read_uint32(p + 20);
+        records->push_back(r);
+    }
+    return true;
+}
+
+static std::string json_escape(const std::string& str)
+{
+    std::string out;
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        const char c = str[i];
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", (unsigned int)(unsigned char)c);
+            out += buf;
+        }
+        else
+            out.push_back(c);
+    }
+    return out;
+}
+
+// the events of traceEvents, separated by ','.
+class chrome_trace_events
+{
+public:
+    chrome_trace_events(void) : empty_(true) {}
+
+    // start a new event and return the stream to write it.
+    std::ostringstream& next(void)
+    {
+        out_ << (empty_ ? "\n" : ",\n");
+        empty_ = false;
+        return out_;
+    }
+
+    // the stream of the current event.
+    std::ostringstream& cur(void) {return out_;}
+
+    std::string str(void) const {return out_.str();}
+
+private:
+    std::ostringstream out_;
+    bool empty_;
+};
+
+// builds the events of one record set. A segment (conv, sn) has at most one open span on each side.
+class chrome_trace_builder
+{
+public:
+    chrome_trace_builder(chrome_trace_events& events, int pid) : events_(events), pid_(pid) {}
+
+    void add(const kcp_trace_record& r)
+    {
+        const uint64_t key = ((uint64_t)r.conv << 32) | r.sn;
+        switch (r.event)
+        {
+            case IKCP_TRACE_SEND:
+                begin(send_open_, key, r, CHROME_TID_SEND, "snd_queue", "len", r.arg);
+                break;
+            case IKCP_TRACE_SNDBUF:
+                begin(send_open_, key, r, CHROME_TID_SEND, "in_flight", "cwnd", r.arg);
+                break;
+            case IKCP_TRACE_XMIT:
+                mark(send_open_, key, r, CHROME_TID_SEND, "rto", r.arg);
+                break;
+            case IKCP_TRACE_RTO_RESEND:
+            case IKCP_TRACE_FAST_RESEND:
+                mark(send_open_, key, r, CHROME_TID_SEND, "xmit", r.arg);
+                break;
+            case IKCP_TRACE_ACKED:
+                end(send_open_, key, r, CHROME_TID_SEND);
+                break;
+            case IKCP_TRACE_INPUT:
+                begin(recv_open_, key, r, CHROME_TID_RECV, "rcv_buf", "len", r.arg);
+                break;
+            case IKCP_TRACE_INPUT_DROP:
+                mark(recv_open_, key, r, CHROME_TID_RECV, "len", r.arg);
+                break;
+            case IKCP_TRACE_RCVQUEUE:
+                begin(recv_open_, key, r, CHROME_TID_RECV, "rcv_queue", "nrcv_que", r.arg);
+                break;
+            case IKCP_TRACE_RECV:
+                end(recv_open_, key, r, CHROME_TID_RECV);
+                break;
+            default:
+                break;
+        }
+    }
+
+private:
+    typedef std::map<uint64_t, const char*> open_map_t;
+
+    void event_head(const char* name, const char* cat, const char* ph, const kcp_trace_record& r, int tid)
+    {
+        events_.next() << "{\"name\":\"" << name << "\",\"cat\":\"" << cat << "\",\"ph\":\"" << ph << "\""
+            << ",\"pid\":" << pid_ << ",\"tid\":" << tid << ",\"ts\":" << r.time_us;
+    }
+
+    void async_event(const char* name, const char* ph, const kcp_trace_record& r, int tid)
+    {
+        event_head(name, tid == CHROME_TID_SEND ? "kcp_send" : "kcp_recv", ph, r, tid);
+        events_.cur() << ",\"id\":\"" << r.conv << "_" << r.sn << "\"";
+    }
+
+    void begin(open_map_t& open, uint64_t key, const kcp_trace_record& r, int tid,
+            const char* name, const char* arg_name, uint32_t arg)
+    {
+        end(open, key, r, tid); // the previous step ends here
+        async_event(name, "b", r, tid);
+        events_.cur() << ",\"args\":{\"conv\":" << r.conv << ",\"sn\":" << r.sn << ",\"" << arg_name << "\":" << arg << "}}";
+        open[key] = name;
+    }
+
+    void end(open_map_t& open, uint64_t key, const kcp_trace_record& r, int tid)
+    {
+        open_map_t::iterator iter = open.find(key);
+        if (iter == open.end())
+            return; // begin is overwritten in the ring, or not traced.
+        async_event(iter->second, "e", r, tid);
+        events_.cur() << "}";
+        open.erase(iter);
+    }
+
+    // a mark on the open span of the segment, or a thread instant if no span is open.
+    void mark(open_map_t& open, uint64_t key, const kcp_trace_record& r, int tid, const char* arg_name, uint32_t arg)
+    {
+        const char* name = kcp_trace_event_str(r.event);
+        if (open.find(key) != open.end())
+            async_event(name, "n", r, tid);
+        else
+        {
+            event_head(name, tid == CHROME_TID_SEND ? "kcp_send" : "kcp_recv", "i", r, tid);
+            events_.cur() << ",\"s\":\"t\"";
+        }
+        events_.cur() << ",\"args\":{\"conv\":" << r.conv << ",\"sn\":" << r.sn << ",\"" << arg_name << "\":" << arg << "}}";
+    }
+
+private:
+    chrome_trace_events& events_;
+    int pid_;
+    open_map_t send_open_;
+    open_map_t recv_open_;
+};
+
+std::string kcp_trace_to_chrome_json(const std::vector<std::vector<kcp_trace_record> >& record_sets,
+        const std::vector<std::string>& names)
+{
+    chrome_trace_events events;
+
+    for (size_t i = 0; i < record_sets.size(); ++i)
+    {
+        const int pid = (int)i + 1;
+        const std::string name = (i < names.size() ? names[i] : std::string("kcp"));
+        events.next() << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << json_escape(name) << "\"}}";
+        events.next() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << CHROME_TID_SEND << ",\"args\":{\"name\":\"send\"}}";
+        events.next() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << CHROME_TID_RECV << ",\"args\":{\"name\":\"recv\"}}";
+
+        chrome_trace_builder builder(events, pid);
+        const std::vector<kcp_trace_record>& records = record_sets[i];
+        for (size_t j = 0; j < records.size(); ++j)
+            builder.add(records[j]);
+    }
+
+    return "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" + events.str() + "\n]}\n";
+}
+
+} // namespace asio_kcp
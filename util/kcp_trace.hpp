@@ -0,0 +1,80 @@
+#ifndef _ASIO_KCP_KCP_TRACE_HPP_
+#define _ASIO_KCP_KCP_TRACE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "ikcp.h"
+
+/*
+ * Lifecycle trace of the kcp segments of a connection.
+ *
+ * kcp_trace_ring::attach(kcp) sets the trace hook of ikcp (ikcp_settrace). Every data segment then records its
+ *   steps into the ring: ikcp_send, snd_queue -> snd_buf (waiting for cwnd), transmit, resend by rto or fastack,
+ *   acked, and on the receiving side: input, rcv_buf -> rcv_queue (waiting for a lost one), ikcp_recv.
+ * Tracing is opt-in per connection. Without attach, ikcp pays one compare for every event.
+ * Recording is lock-free. The ring keeps the last records, any thread can take a snapshot at any time.
+ *
+ * Dump the records by write_kcp_trace_file, and convert the files to a Chrome trace by the kcp_trace_to_chrome tool.
+ * Keep this file c++03 because client_lib is c++03. Using the __atomic builtins of gcc instead of std::atomic.
+ */
+#define ASIO_KCP_KCP_TRACE_RING_SIZE 8192 // must be power of 2
+
+namespace asio_kcp {
+
+struct kcp_trace_record
+{
+    uint64_t time_us;   // microseconds since epoch. So traces of client and server can be put together.
+    uint32_t conv;
+    uint32_t event;     // IKCP_TRACE_XXX
+    uint32_t sn;
+    uint32_t arg;       // see IKCP_TRACE_XXX
+};
+
+class kcp_trace_ring
+{
+public:
+    kcp_trace_ring(void);
+
+    // trace kcp into this ring. The ring must outlive the kcp, or detach before destroyed.
+    void attach(ikcpcb* kcp);
+    static void detach(ikcpcb* kcp);
+
+    void record(uint32_t conv, int event, uint32_t sn, uint32_t arg);
+
+    // the records in the ring, oldest first. The records being overwritten while copying are skipped.
+    void snapshot(std::vector<kcp_trace_record>* records) const;
+
+private:
+    kcp_trace_ring(const kcp_trace_ring&);
+    kcp_trace_ring& operator=(const kcp_trace_ring&);
+
+    static void on_trace(int event, IUINT32 sn, IUINT32 arg, ikcpcb* kcp, void* user);
+
+    // seq is 0 while writing, and the seq of the record after written. seq start from 1.
+    struct slot
+    {
+        uint64_t seq;
+        kcp_trace_record record;
+    };
+
+    std::vector<slot> slots_;
+    uint64_t next_seq_;
+};
+
+const char* kcp_trace_event_str(uint32_t event);
+
+// binary file of the records, read by the kcp_trace_to_chrome tool.
+bool write_kcp_trace_file(const std::string& path, const std::vector<kcp_trace_record>& records);
+bool read_kcp_trace_file(const std::string& path, std::vector<kcp_trace_record>* records);
+
+// Chrome trace event format (chrome://tracing or ui.perfetto.dev). Every record set is a process named by names[i].
+//   Every segment is a row: snd_queue -> in_flight (with xmit/resend marks) -> acked on the send thread,
+//   rcv_buf -> rcv_queue -> recv on the recv thread.
+std::string kcp_trace_to_chrome_json(const std::vector<std::vector<kcp_trace_record> >& record_sets,
+        const std::vector<std::string>& names);
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_KCP_TRACE_HPP_
@@ -0,0 +1,101 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "msg_buffer.hpp"
+
+// the free buffers more than this will be deleted.
+#define ASIO_KCP_MSG_BUFFER_POOL_MAX_FREE 1024
+
+// the buffer bigger than this will not be kept in pool.
+#define ASIO_KCP_MSG_BUFFER_POOL_MAX_KEEP_SIZE (1024 * 64)
+
+namespace asio_kcp {
+
+static pthread_mutex_t s_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<msg_buffer*> s_pool_free_buffers;
+
+msg_buffer* alloc_msg_buffer(const char* msg, size_t len)
+{
+    msg_buffer* buf = NULL;
+    pthread_mutex_lock(&s_pool_mutex);
+    if (!s_pool_free_buffers.empty())
+    {
+        buf = s_pool_free_buffers.back();
+        s_pool_free_buffers.pop_back();
+    }
+    pthread_mutex_unlock(&s_pool_mutex);
+
+    if (buf == NULL)
+        buf = new msg_buffer();
+    if (buf->buf_.size() < len)
+        buf->buf_.resize(len);
+    if (len > 0)
+        memcpy(&buf->buf_[0], msg, len);
+    buf->size_ = len;
+    buf->refcount_ = 0;
+    return buf;
+}
+
+void recycle_msg_buffer(msg_buffer* buf)
+{
+    if (buf->buf_.size() <= ASIO_KCP_MSG_BUFFER_POOL_MAX_KEEP_SIZE)
+    {
+        pthread_mutex_lock(&s_pool_mutex);
+        if (s_pool_free_buffers.size() < ASIO_KCP_MSG_BUFFER_POOL_MAX_FREE)
+        {
+            s_pool_free_buffers.push_back(buf);
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&s_pool_mutex);
+    }
+    delete buf;
+}
+
+msg_buffer_ref::msg_buffer_ref(msg_buffer* p) : p_(p)
+{
+    if (p_)
+        __sync_add_and_fetch(&p_->refcount_, 1);
+}
+
+msg_buffer_ref::msg_buffer_ref(const msg_buffer_ref& other) : p_(other.p_)
+{
+    if (p_)
+        __sync_add_and_fetch(&p_->refcount_, 1);
+}
+
+msg_buffer_ref& msg_buffer_ref::operator=(const msg_buffer_ref& other)
+{
+    msg_buffer* p = other.p_; // other maybe *this.
+    if (p)
+        __sync_add_and_fetch(&p->refcount_, 1);
+    reset();
+    p_ = p;
+    return *this;
+}
+
+msg_buffer_ref::~msg_buffer_ref(void)
+{
+    reset();
+}
+
+void msg_buffer_ref::reset(void)
+{
+    if (p_ && __sync_sub_and_fetch(&p_->refcount_, 1) == 0)
+        recycle_msg_buffer(p_);
+    p_ = NULL;
+}
+
+msg_buffer_ref make_msg_buffer(const char* msg, size_t len)
+{
+    return msg_buffer_ref(alloc_msg_buffer(msg, len));
+}
+
+size_t msg_buffer_pool_free_count(void)
+{
+    pthread_mutex_lock(&s_pool_mutex);
+    size_t count = s_pool_free_buffers.size();
+    pthread_mutex_unlock(&s_pool_mutex);
+    return count;
+}
+
+} // namespace asio_kcp
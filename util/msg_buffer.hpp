@@ -0,0 +1,67 @@
+#ifndef _ASIO_KCP_MSG_BUFFER_HPP_
+#define _ASIO_KCP_MSG_BUFFER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace asio_kcp {
+
+/*
+ * Refcounted message buffer from a process wide pool.
+ *
+ * The msg callback (kcp_client::set_msg_callback, kcp_svr::server::set_msg_callback) gives you a pointer into the
+ *   receive buffer. It is valid only before the callback return.
+ * If you want to keep the msg, call make_msg_buffer(msg, len) in the callback.
+ *   The buffer goes back to the pool when the last msg_buffer_ref released. So there is no allocation in steady state.
+ *
+ * msg_buffer_ref is multithread safe as the std::shared_ptr: you can copy and release refs in different threads.
+ * Keep this file c++03 because client_lib is c++03.
+ */
+class msg_buffer
+{
+public:
+    const char* data(void) const {return buf_.empty() ? NULL : &buf_[0];}
+    size_t size(void) const {return size_;}
+
+private:
+    msg_buffer(void) : size_(0), refcount_(0) {}
+    msg_buffer(const msg_buffer&);
+    msg_buffer& operator=(const msg_buffer&);
+
+    friend class msg_buffer_ref;
+    friend msg_buffer* alloc_msg_buffer(const char* msg, size_t len);
+    friend void recycle_msg_buffer(msg_buffer* buf);
+
+    std::vector<char> buf_;
+    size_t size_;
+    volatile int refcount_;
+};
+
+class msg_buffer_ref
+{
+public:
+    msg_buffer_ref(void) : p_(NULL) {}
+    explicit msg_buffer_ref(msg_buffer* p);
+    msg_buffer_ref(const msg_buffer_ref& other);
+    msg_buffer_ref& operator=(const msg_buffer_ref& other);
+    ~msg_buffer_ref(void);
+
+    const char* data(void) const {return p_ ? p_->data() : NULL;}
+    size_t size(void) const {return p_ ? p_->size() : 0;}
+    bool empty(void) const {return size() == 0;}
+    void reset(void);
+
+private:
+    msg_buffer* p_;
+};
+
+// copy msg into a pooled buffer.
+msg_buffer_ref make_msg_buffer(const char* msg, size_t len);
+
+// count of the free buffers in pool. for testing.
+size_t msg_buffer_pool_free_count(void);
+
+} // namespace asio_kcp
+
+#endif // _ASIO_KCP_MSG_BUFFER_HPP_
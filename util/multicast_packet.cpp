@@ -0,0 +1,329 @@
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "multicast_packet.hpp"
+
+namespace asio_kcp {
+
+static void append_uint32(std::string& packet, uint32_t value)
+{
+    const uint32_t net_value = htonl(value);
+    packet.append((const char*)&net_value, 4);
+}
+
+static void append_uint16(std::string& packet, uint16_t value)
+{
+    const uint16_t net_value = htons(value);
+    packet.append((const char*)&net_value, 2);
+}
+
+static uint32_t read_uint32(const char* data)
+{
+    uint32_t net_value = 0;
+    memcpy(&net_value, data, 4);
+    return ntohl(net_value);
+}
+
+static uint16_t read_uint16(const char* data)
+{
+    uint16_t net_value = 0;
+    memcpy(&net_value, data, 2);
+    return ntohs(net_value);
+}
+
+static std::string making_mc_header(eMulticastPacketType type, size_t reserve_size)
+{
+    std::string packet;
+    packet.reserve(ASIO_KCP_MC_HEADER_SIZE + reserve_size);
+    packet.push_back((char)ASIO_KCP_MC_PACKET_MAGIC);
+    packet.push_back((char)type);
+    return packet;
+}
+
+eMulticastPacketType get_mc_packet_type(const char* data, size_t len)
+{
+    if (len < ASIO_KCP_MC_HEADER_SIZE || (unsigned char)data[0] != ASIO_KCP_MC_PACKET_MAGIC)
+        return eMcPacketUnknown;
+
+    const eMulticastPacketType type = (eMulticastPacketType)(unsigned char)data[1];
+    switch (type)
+    {
+        case eMcPacketRaw:
+            return type;
+        case eMcPacketReliable:
+        case eMcPacketHeartbeat:
+        case eMcPacketTooOld:
+            return (len >= ASIO_KCP_MC_HEADER_SIZE + 4 ? type : eMcPacketUnknown);
+        case eMcPacketNack:
+            return (len >= ASIO_KCP_MC_HEADER_SIZE + 2 ? type : eMcPacketUnknown);
+        case eMcPacketFeedback:
+            return (len >= ASIO_KCP_MC_HEADER_SIZE + 5 ? type : eMcPacketUnknown);
+        case eMcPacketFec:
+            return (len >= ASIO_KCP_MC_FEC_HEADER_SIZE ? type : eMcPacketUnknown);
+        case eMcPacketBatch:
+            return type;
+        case eMcPacketCatchUpRequest:
+            return (len >= ASIO_KCP_MC_HEADER_SIZE + 4 ? type : eMcPacketUnknown);
+        case eMcPacketCatchUpBegin:
+            return (len >= ASIO_KCP_MC_HEADER_SIZE + 12 ? type : eMcPacketUnknown);
+        case eMcPacketCatchUp:
+            return (len >= ASIO_KCP_MC_CATCH_UP_HEADER_SIZE ? type : eMcPacketUnknown);
+        default:
+            return eMcPacketUnknown;
+    }
+}
+
+std::string making_mc_raw_packet(const char* msg, size_t len)
+{
+    std::string packet = making_mc_header(eMcPacketRaw, len);
+    packet.append(msg, len);
+    return packet;
+}
+
+std::string making_mc_reliable_packet(uint32_t seq, const char* msg, size_t len)
+{
+    std::string packet = making_mc_header(eMcPacketReliable, 4 + len);
+    append_uint32(packet, seq);
+    packet.append(msg, len);
+    return packet;
+}
+
+size_t making_mc_raw_header(char* buf)
+{
+    buf[0] = (char)ASIO_KCP_MC_PACKET_MAGIC;
+    buf[1] = (char)eMcPacketRaw;
+    return ASIO_KCP_MC_HEADER_SIZE;
+}
+
+size_t making_mc_reliable_header(uint32_t seq, char* buf)
+{
+    buf[0] = (char)ASIO_KCP_MC_PACKET_MAGIC;
+    buf[1] = (char)eMcPacketReliable;
+    const uint32_t net_seq = htonl(seq);
+    memcpy(buf + ASIO_KCP_MC_HEADER_SIZE, &net_seq, 4);
+    return ASIO_KCP_MC_RELIABLE_HEADER_SIZE;
+}
+
+std::string making_mc_heartbeat_packet(uint32_t next_seq)
+{
+    std::string packet = making_mc_header(eMcPacketHeartbeat, 4);
+    append_uint32(packet, next_seq);
+    return packet;
+}
+
+std::string making_mc_nack_packet(const std::vector<mc_nack_range>& ranges)
+{
+    const size_t count = (ranges.size() < ASIO_KCP_MC_NACK_MAX_RANGES ? ranges.size() : ASIO_KCP_MC_NACK_MAX_RANGES);
+    std::string packet = making_mc_header(eMcPacketNack, 2 + count * 6);
+    append_uint16(packet, (uint16_t)count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        append_uint32(packet, ranges[i].first_seq);
+        append_uint16(packet, ranges[i].count);
+    }
+    return packet;
+}
+
+std::string making_mc_too_old_packet(uint32_t window_base_seq)
+{
+    std::string packet = making_mc_header(eMcPacketTooOld, 4);
+    append_uint32(packet, window_base_seq);
+    return packet;
+}
+
+std::string making_mc_feedback_packet(uint32_t ack_seq, const std::vector<uint8_t>& bitmap, uint16_t loss_permille)
+{
+    const size_t bitmap_len = (bitmap.size() < ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES ? bitmap.size() : ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES);
+    std::string packet = making_mc_header(eMcPacketFeedback, 7 + bitmap_len);
+    append_uint32(packet, ack_seq);
+    packet.push_back((char)bitmap_len);
+    if (bitmap_len > 0)
+        packet.append((const char*)&bitmap[0], bitmap_len);
+    append_uint16(packet, loss_permille);
+    return packet;
+}
+
+void mc_fec_block::add(const char* msg, size_t len)
+{
+    if (parity.size() < len)
+        parity.resize(len, 0);
+    for (size_t i = 0; i < len; ++i)
+        parity[i] ^= msg[i];
+    len_xor ^= (uint16_t)len;
+    count++;
+}
+
+uint8_t mc_fec_block_size_for_loss(uint16_t loss_permille)
+{
+    if (loss_permille < ASIO_KCP_MC_FEC_MIN_LOSS_PERMILLE)
+        return 0;
+
+    // one parity recovers one loss per block. keep about 0.3 losses per block,
+    // so most blocks lose at most one msg.
+    const uint32_t block_size = 300 / loss_permille;
+    if (block_size < ASIO_KCP_MC_FEC_MIN_BLOCK)
+        return ASIO_KCP_MC_FEC_MIN_BLOCK;
+    if (block_size > ASIO_KCP_MC_FEC_MAX_BLOCK)
+        return ASIO_KCP_MC_FEC_MAX_BLOCK;
+    return (uint8_t)block_size;
+}
+
+bool mc_fec_block::rebuild(std::string* msg) const
+{
+    if (len_xor > parity.size())
+        return false;
+    msg->assign(parity, 0, len_xor);
+    return true;
+}
+
+std::string making_mc_fec_packet(const mc_fec_block& block)
+{
+    std::string packet = making_mc_header(eMcPacketFec, 7 + block.parity.size());
+    append_uint32(packet, block.first_seq);
+    packet.push_back((char)block.count);
+    append_uint16(packet, block.len_xor);
+    packet.append(block.parity);
+    return packet;
+}
+
+uint32_t grab_seq_from_mc_packet(const char* data, size_t len)
+{
+    if (len < ASIO_KCP_MC_HEADER_SIZE + 4)
+        return 0;
+    return read_uint32(data + ASIO_KCP_MC_HEADER_SIZE);
+}
+
+uint32_t grab_seq_from_mc_catch_up_packet(const char* data, size_t len)
+{
+    if (len < ASIO_KCP_MC_CATCH_UP_HEADER_SIZE)
+        return 0;
+    return read_uint32(data + ASIO_KCP_MC_HEADER_SIZE + 4);
+}
+
+bool grab_ranges_from_mc_nack_packet(const char* data, size_t len, std::vector<mc_nack_range>* ranges)
+{
+    ranges->clear();
+    if (get_mc_packet_type(data, len) != eMcPacketNack)
+        return false;
+
+    const size_t count = read_uint16(data + ASIO_KCP_MC_HEADER_SIZE);
+    if (count > ASIO_KCP_MC_NACK_MAX_RANGES || len < ASIO_KCP_MC_HEADER_SIZE + 2 + count * 6)
+        return false;
+
+    const char* p = data + ASIO_KCP_MC_HEADER_SIZE + 2;
+    for (size_t i = 0; i < count; ++i, p += 6)
+    {
+        mc_nack_range range;
+        range.first_seq = read_uint32(p);
+        range.count = read_uint16(p + 4);
+        ranges->push_back(range);
+    }
+    return true;
+}
+
+bool grab_feedback_from_mc_packet(const char* data, size_t len, uint32_t* ack_seq, std::vector<uint8_t>* bitmap,
+        uint16_t* loss_permille)
+{
+    bitmap->clear();
+    if (get_mc_packet_type(data, len) != eMcPacketFeedback)
+        return false;
+
+    const size_t bitmap_len = (unsigned char)data[ASIO_KCP_MC_HEADER_SIZE + 4];
+    if (bitmap_len > ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES || len < ASIO_KCP_MC_HEADER_SIZE + 5 + bitmap_len)
+        return false;
+
+    *ack_seq = read_uint32(data + ASIO_KCP_MC_HEADER_SIZE);
+    const uint8_t* p = (const uint8_t*)(data + ASIO_KCP_MC_HEADER_SIZE + 5);
+    bitmap->assign(p, p + bitmap_len);
+
+    if (loss_permille != NULL)
+    {
+        const size_t loss_offset = ASIO_KCP_MC_HEADER_SIZE + 5 + bitmap_len;
+        *loss_permille = (len >= loss_offset + 2 ? read_uint16(data + loss_offset) : 0);
+    }
+    return true;
+}
+
+std::string making_mc_batch_packet(void)
+{
+    return making_mc_header(eMcPacketBatch, 0);
+}
+
+void append_frame_to_mc_batch_packet(std::string* batch, const char* head, size_t head_len, const char* body, size_t body_len)
+{
+    append_uint16(*batch, (uint16_t)(head_len + body_len));
+    batch->append(head, head_len);
+    batch->append(body, body_len);
+}
+
+bool grab_next_frame_from_mc_batch_packet(const char* data, size_t len, size_t* offset, const char** frame, size_t* frame_len)
+{
+    if (*offset + ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE > len)
+        return false;
+
+    const size_t packet_len = read_uint16(data + *offset);
+    if (*offset + ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE + packet_len > len)
+        return false;
+
+    *frame = data + *offset + ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE;
+    *frame_len = packet_len;
+    *offset += ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE + packet_len;
+    return true;
+}
+
+bool grab_fec_block_from_mc_packet(const char* data, size_t len, mc_fec_block* block)
+{
+    if (get_mc_packet_type(data, len) != eMcPacketFec)
+        return false;
+
+    block->first_seq = read_uint32(data + ASIO_KCP_MC_HEADER_SIZE);
+    block->count = (uint8_t)data[ASIO_KCP_MC_HEADER_SIZE + 4];
+    block->len_xor = read_uint16(data + ASIO_KCP_MC_HEADER_SIZE + 5);
+    block->parity.assign(data + ASIO_KCP_MC_FEC_HEADER_SIZE, len - ASIO_KCP_MC_FEC_HEADER_SIZE);
+    return block->count > 0;
+}
+
+std::string making_mc_catch_up_request_packet(uint32_t group_id)
+{
+    std::string packet = making_mc_header(eMcPacketCatchUpRequest, 4);
+    append_uint32(packet, group_id);
+    return packet;
+}
+
+std::string making_mc_catch_up_begin_packet(uint32_t group_id, uint32_t first_seq, uint32_t live_seq)
+{
+    std::string packet = making_mc_header(eMcPacketCatchUpBegin, 12);
+    append_uint32(packet, group_id);
+    append_uint32(packet, first_seq);
+    append_uint32(packet, live_seq);
+    return packet;
+}
+
+std::string making_mc_catch_up_packet(uint32_t group_id, uint32_t seq, const char* msg, size_t len)
+{
+    std::string packet = making_mc_header(eMcPacketCatchUp, 8 + len);
+    append_uint32(packet, group_id);
+    append_uint32(packet, seq);
+    packet.append(msg, len);
+    return packet;
+}
+
+uint32_t grab_group_id_from_mc_packet(const char* data, size_t len)
+{
+    if (len < ASIO_KCP_MC_HEADER_SIZE + 4)
+        return 0;
+    return read_uint32(data + ASIO_KCP_MC_HEADER_SIZE);
+}
+
+bool grab_catch_up_begin_from_mc_packet(const char* data, size_t len, uint32_t* group_id, uint32_t* first_seq, uint32_t* live_seq)
+{
+    if (get_mc_packet_type(data, len) != eMcPacketCatchUpBegin)
+        return false;
+
+    *group_id = read_uint32(data + ASIO_KCP_MC_HEADER_SIZE);
+    *first_seq = read_uint32(data + ASIO_KCP_MC_HEADER_SIZE + 4);
+    *live_seq = read_uint32(data + ASIO_KCP_MC_HEADER_SIZE + 8);
+    return mc_seq_diff(*live_seq, *first_seq) >= 0;
+}
+
+} // namespace asio_kcp
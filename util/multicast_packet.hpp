@@ -0,0 +1,166 @@
+#ifndef _KCP_MULTICAST_PACKET_HPP_
+#define _KCP_MULTICAST_PACKET_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace asio_kcp {
+
+// Every multicast packet begins with [magic:1][type:1]. Integers are in network byte order.
+//
+//   raw:       [magic][type]                         [msg]          multicast. unreliable.
+//   reliable:  [magic][type][seq:4]                  [msg]          multicast.
+//   heartbeat: [magic][type][next_seq:4]                            multicast. sent when idle. receivers detect tail loss by it.
+//   nack:      [magic][type][count:2][first_seq:4 seq_count:2]...   unicast, receiver -> sender.
+//   too_old:   [magic][type][window_base_seq:4]                     unicast, sender -> receiver. seqs before window_base_seq are dropped.
+//   feedback:  [magic][type][ack_seq:4][bitmap_len:1][bitmap][loss_permille:2]   unicast, receiver -> sender. periodic.
+//              all seqs before ack_seq are received. bit i (LSB first) of bitmap is set if ack_seq + 1 + i is received.
+//              loss_permille is the loss rate seen before any repair. It is optional for old receivers.
+//   fec:       [magic][type][first_seq:4][count:1][len_xor:2][parity]   multicast.
+//              parity is the xor of the msgs of reliable seqs [first_seq, first_seq + count), zero padded to the longest one.
+//              len_xor is the xor of their lengths. Any one lost msg of the block can be rebuilt from the others.
+//   batch:     [magic][type][len:2 packet]...                       multicast. several small packets of the types above in one datagram.
+//              packet is a whole multicast packet except batch.
+//
+// A late joiner pulls the reliable msgs sent before it joined over its kcp connection, not by multicast:
+//   catch_up_request: [magic][type][group_id:4]                     kcp, receiver -> sender.
+//   catch_up_begin:   [magic][type][group_id:4][first_seq:4][live_seq:4]   kcp, sender -> receiver.
+//              seqs [first_seq, live_seq) follow as catch_up packets. seqs from live_seq on come by multicast.
+//   catch_up:  [magic][type][group_id:4][seq:4][msg]                kcp, sender -> receiver. in seq order.
+#define ASIO_KCP_MC_PACKET_MAGIC 0xA5
+
+enum eMulticastPacketType
+{
+    eMcPacketUnknown = 0,
+    eMcPacketRaw,
+    eMcPacketReliable,
+    eMcPacketHeartbeat,
+    eMcPacketNack,
+    eMcPacketTooOld,
+    eMcPacketFeedback,
+    eMcPacketFec,
+    eMcPacketBatch,
+    eMcPacketCatchUpRequest,
+    eMcPacketCatchUpBegin,
+    eMcPacketCatchUp,
+
+    eCountOfMcPacketType
+};
+
+#define ASIO_KCP_MC_HEADER_SIZE 2
+#define ASIO_KCP_MC_RELIABLE_HEADER_SIZE (ASIO_KCP_MC_HEADER_SIZE + 4)
+
+// one nack packet carries at most this many ranges. It is 2 + 2 + 64 * 6 = 388 bytes.
+#define ASIO_KCP_MC_NACK_MAX_RANGES 64
+
+// feedback carries the receiving state of at most 32 * 8 = 256 seqs after ack_seq.
+#define ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES 32
+
+#define ASIO_KCP_MC_FEC_HEADER_SIZE (ASIO_KCP_MC_HEADER_SIZE + 7)
+
+#define ASIO_KCP_MC_BATCH_FRAME_HEADER_SIZE 2
+
+#define ASIO_KCP_MC_CATCH_UP_HEADER_SIZE (ASIO_KCP_MC_HEADER_SIZE + 8)
+
+// the sender stops sending fec when the worst receiver loses less than this (permille).
+#define ASIO_KCP_MC_FEC_MIN_LOSS_PERMILLE 5
+#define ASIO_KCP_MC_FEC_MIN_BLOCK 4
+#define ASIO_KCP_MC_FEC_MAX_BLOCK 64
+
+// xor parity of a block of reliable msgs.
+struct mc_fec_block
+{
+    uint32_t first_seq;
+    uint8_t count;
+    uint16_t len_xor;
+    std::string parity;
+
+    mc_fec_block(void) : first_seq(0), count(0), len_xor(0) {}
+
+    // add the msg of seq first_seq + count.
+    void add(const char* msg, size_t len);
+
+    // rebuild the only lost msg by the others. The others must be added already.
+    // return false if the result is broken.
+    bool rebuild(std::string* msg) const;
+};
+
+struct mc_nack_range
+{
+    uint32_t first_seq;
+    uint16_t count;
+};
+
+// seq wraps around at 2^32. > 0 means a is newer than b.
+inline int32_t mc_seq_diff(uint32_t a, uint32_t b) {return (int32_t)(a - b);}
+
+// return eMcPacketUnknown if it is not a multicast packet or it is broken.
+eMulticastPacketType get_mc_packet_type(const char* data, size_t len);
+
+std::string making_mc_raw_packet(const char* msg, size_t len);
+
+std::string making_mc_reliable_packet(uint32_t seq, const char* msg, size_t len);
+
+// write only the header, for sending header and msg by scatter/gather without copying msg.
+// buf must have ASIO_KCP_MC_RELIABLE_HEADER_SIZE bytes. return the header size.
+size_t making_mc_raw_header(char* buf);
+size_t making_mc_reliable_header(uint32_t seq, char* buf);
+
+std::string making_mc_heartbeat_packet(uint32_t next_seq);
+
+// the ranges more than ASIO_KCP_MC_NACK_MAX_RANGES are ignored.
+std::string making_mc_nack_packet(const std::vector<mc_nack_range>& ranges);
+
+std::string making_mc_too_old_packet(uint32_t window_base_seq);
+
+// the bytes more than ASIO_KCP_MC_FEEDBACK_MAX_BITMAP_BYTES are ignored.
+std::string making_mc_feedback_packet(uint32_t ack_seq, const std::vector<uint8_t>& bitmap, uint16_t loss_permille = 0);
+
+std::string making_mc_fec_packet(const mc_fec_block& block);
+
+// msgs per fec block for the loss rate. return 0 if fec is not needed.
+uint8_t mc_fec_block_size_for_loss(uint16_t loss_permille);
+
+// seq of reliable, next_seq of heartbeat, window_base_seq of too_old.
+// use grab_seq_from_mc_catch_up_packet for catch_up.
+uint32_t grab_seq_from_mc_packet(const char* data, size_t len);
+uint32_t grab_seq_from_mc_catch_up_packet(const char* data, size_t len);
+
+// return false if packet is broken.
+bool grab_ranges_from_mc_nack_packet(const char* data, size_t len, std::vector<mc_nack_range>* ranges);
+
+// return false if packet is broken.
+// loss_permille is 0 if the receiver does not send it.
+bool grab_feedback_from_mc_packet(const char* data, size_t len, uint32_t* ack_seq, std::vector<uint8_t>* bitmap,
+        uint16_t* loss_permille = NULL);
+
+// an empty batch packet
+std::string making_mc_batch_packet(void);
+
+// append packet = head + body to batch. The packet can not be longer than 0xFFFF.
+void append_frame_to_mc_batch_packet(std::string* batch, const char* head, size_t head_len, const char* body, size_t body_len);
+
+// get the packet at *offset and move *offset to the next one. *offset starts from ASIO_KCP_MC_HEADER_SIZE.
+// return false at the end or if batch is broken.
+bool grab_next_frame_from_mc_batch_packet(const char* data, size_t len, size_t* offset, const char** frame, size_t* frame_len);
+
+// return false if packet is broken.
+bool grab_fec_block_from_mc_packet(const char* data, size_t len, mc_fec_block* block);
+
+std::string making_mc_catch_up_request_packet(uint32_t group_id);
+
+std::string making_mc_catch_up_begin_packet(uint32_t group_id, uint32_t first_seq, uint32_t live_seq);
+
+std::string making_mc_catch_up_packet(uint32_t group_id, uint32_t seq, const char* msg, size_t len);
+
+// group_id of catch_up_request, catch_up_begin and catch_up.
+uint32_t grab_group_id_from_mc_packet(const char* data, size_t len);
+
+// return false if packet is broken.
+bool grab_catch_up_begin_from_mc_packet(const char* data, size_t len, uint32_t* group_id, uint32_t* first_seq, uint32_t* live_seq);
+
+} // namespace asio_kcp
+
+#endif // _KCP_MULTICAST_PACKET_HPP_